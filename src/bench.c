@@ -13,15 +13,21 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#define _GNU_SOURCE
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <dirent.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <errno.h>
 
 static void _errno_assert(const char *file, int line, int i) {
@@ -33,91 +39,24 @@ static void _errno_assert(const char *file, int line, int i) {
 
 #define errno_assert(i) _errno_assert(__FILE__, __LINE__, i)
 
-static void rm_rec(const char *dir) {
-  DIR *tmpd = opendir(dir);
-  if (tmpd != NULL) {
-    struct dirent *d;
-    while ((d = readdir(tmpd))) {
-      char subdir[100];
-      sprintf(subdir, "%s/%s", dir, d->d_name);
-      if(strcmp(d->d_name, ".") &&
-         strcmp(d->d_name, "..")) {
-        if (d->d_type == DT_DIR) {
-          rm_rec(subdir);
-        } else if (d->d_type == DT_REG) {
-          remove(subdir);
-        }
-      }
-    }
-    closedir(tmpd);
-  }
-  remove(dir);
-}
-
-static void rm_all_rec(const char** files) {
-  int i = 0;
-  while (1) {
-    const char *filename = files[i];
-    if (filename == NULL) {
-      return;
-    }
-    rm_rec(filename);
-    i++;
-  }
-}
-
-
-static size_t file_size_rec(const char *dir) {
+static size_t file_size(const char *filename) {
   struct stat buf;
-  errno_assert(stat(dir, &buf));
-  if (S_ISREG(buf.st_mode)) {
-    return buf.st_size;
-  } else if (S_ISDIR(buf.st_mode)) {
-    size_t sum = 0;
-    DIR *tmpd = opendir(dir);
-    if (tmpd != NULL) {
-      struct dirent *d;
-      while ((d = readdir(tmpd))) {
-        char subdir[100];
-        sprintf(subdir, "%s/%s", dir, d->d_name);
-        if(strcmp(d->d_name, ".") &&
-           strcmp(d->d_name, "..")) {
-          sum += file_size_rec(subdir);
-        }
-      }
-      closedir(tmpd);
-    }
-    return sum;
-  } else {
-    return 0;
-  }
-}
-
-static size_t total_file_size(const char** files) {
-  size_t sum = 0;
-  int i = 0;
-  while (1) {
-    const char *filename = files[i];
-    if (filename == NULL) {
-      return sum;
-    }
-    sum += file_size_rec(filename);
-    i++;
-  }
+  errno_assert(stat(filename, &buf));
+  return buf.st_size;
 }
 
 #ifdef __APPLE__
 #include <mach/mach_time.h>
-static float wall() {
+static double wall() {
   static double multiplier = 0;
   if (multiplier <= 0) {
     mach_timebase_info_data_t info;
     mach_timebase_info(&info);
     multiplier = (double) info.numer / (double) info.denom / 1000000000.0;
   }
-  return (float) (multiplier * mach_absolute_time());
+  return multiplier * mach_absolute_time();
 }
-static float cpu() {
+static double cpu() {
   return wall();
 }
 
@@ -129,25 +68,22 @@ static float cpu() {
 #else
 #define CLOCK_SUITABLE CLOCK_MONOTONIC
 #endif
-static float wall() {
+static double wall() {
   struct timespec tp;
   clock_gettime(CLOCK_SUITABLE, &tp);
   return tp.tv_sec + 1e-9 * tp.tv_nsec;
 }
 
-static float cpu() {
+static double cpu() {
   struct timespec tp;
   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tp);
   return tp.tv_sec + 1e-9 * tp.tv_nsec;
 }
 #endif
 
-typedef struct {
-  char *name;
-  void (*create)(int n);
-  void (*randomaccess)(int n, int lookups);
-  const char** (*files)();
-} candidate;
+static uint64_t wall_ns() {
+  return (uint64_t) (wall() * 1e9);
+}
 
 /* Sparkey stuff */
 
@@ -162,136 +98,934 @@ static void _sparkey_assert(const char *file, int line, sparkey_returncode i) {
 
 #define sparkey_assert(i) _sparkey_assert(__FILE__, __LINE__, i)
 
+#define INDEX_FILENAME "bench.spi"
+#define LOG_FILENAME "bench.spl"
+
+typedef enum {
+  ACCESS_UNIFORM,
+  ACCESS_ZIPF,
+  ACCESS_HOTSET
+} access_pattern;
+
+typedef struct {
+  uint64_t num_entries;
+  uint64_t num_lookups;
+  int key_min;
+  int key_max;
+  int value_min;
+  int value_max;
+  access_pattern pattern;
+  double zipf_exponent;
+  double hot_fraction;
+  double hot_probability;
+  double miss_ratio;
+  int threads;
+  int batch;
+  sparkey_compression_type compression_type;
+  int block_size;
+  int cold;
+  int scaling;
+  uint64_t seed;
+  const char *json_filename;
+} bench_config;
+
+/* Random numbers and generated data */
+
+static uint64_t mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t next_random(uint64_t *state) {
+  *state += 0x9e3779b97f4a7c15ULL;
+  return mix(*state);
+}
+
+static double next_double(uint64_t *state) {
+  return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#define KEY_SALT (0x6b6579)
+#define VALUE_SALT (0x76616c)
+
+static int size_for(uint64_t i, uint64_t salt, int min, int max) {
+  return min + mix(i ^ salt) % (max - min + 1);
+}
+
+/**
+ * Key i starts with the 8 bytes of i, which makes all keys distinct,
+ * followed by pseudorandom bytes up to its length.
+ */
+static int make_key(const bench_config *c, uint64_t i, uint8_t *buf) {
+  int len = size_for(i, KEY_SALT, c->key_min, c->key_max);
+  memcpy(buf, &i, 8);
+  for (int pos = 8; pos < len; pos += 8) {
+    uint64_t r = mix(i * 31 + pos);
+    memcpy(&buf[pos], &r, len - pos < 8 ? len - pos : 8);
+  }
+  return len;
+}
+
+/**
+ * Value i starts with the bytes of i, to verify lookups, and is padded with a fill byte.
+ */
+static int make_value(const bench_config *c, uint64_t i, uint8_t *buf) {
+  int len = size_for(i, VALUE_SALT, c->value_min, c->value_max);
+  memset(buf, 'v', len);
+  memcpy(buf, &i, len < 8 ? len : 8);
+  return len;
+}
+
+static void check_value(const bench_config *c, uint64_t i, const uint8_t *value, uint64_t valuelen) {
+  uint8_t expected[8];
+  int len = size_for(i, VALUE_SALT, c->value_min, c->value_max);
+  memcpy(expected, &i, 8);
+  if ((uint64_t) len != valuelen || memcmp(expected, value, len < 8 ? len : 8) != 0) {
+    printf("Did not get the expected value for key %"PRIu64"\n", i);
+    exit(1);
+  }
+}
+
+/*
+ * Zipf distributed ranks in [1, n] by rejection-inversion, which needs constant memory.
+ * W. Hörmann, G. Derflinger: "Rejection-Inversion to Generate Variates from
+ * Monotone Discrete Distributions", ACM TOMACS 6(3), 1996.
+ */
+typedef struct {
+  uint64_t n;
+  double s;
+  double h_integral_x1;
+  double h_integral_n;
+  double s_limit;
+} zipf_sampler;
+
+static double helper1(double x) {
+  return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x) {
+  return fabs(x) > 1e-8 ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
 
-static void sparkey_create(int n, sparkey_compression_type compression_type, int block_size) {
+static double zipf_h(const zipf_sampler *z, double x) {
+  return exp(-z->s * log(x));
+}
+
+static double zipf_h_integral(const zipf_sampler *z, double x) {
+  double log_x = log(x);
+  return helper2((1 - z->s) * log_x) * log_x;
+}
+
+static double zipf_h_integral_inverse(const zipf_sampler *z, double x) {
+  double t = x * (1 - z->s);
+  if (t < -1) {
+    t = -1;
+  }
+  return exp(helper1(t) * x);
+}
+
+static void zipf_init(zipf_sampler *z, uint64_t n, double s) {
+  z->n = n;
+  z->s = s;
+  z->h_integral_x1 = zipf_h_integral(z, 1.5) - 1;
+  z->h_integral_n = zipf_h_integral(z, n + 0.5);
+  z->s_limit = 2 - zipf_h_integral_inverse(z, zipf_h_integral(z, 2.5) - zipf_h(z, 2));
+}
+
+static uint64_t zipf_next(const zipf_sampler *z, uint64_t *state) {
+  while (1) {
+    double u = z->h_integral_n + next_double(state) * (z->h_integral_x1 - z->h_integral_n);
+    double x = zipf_h_integral_inverse(z, u);
+    double k = floor(x + 0.5);
+    if (k < 1) {
+      k = 1;
+    } else if (k > z->n) {
+      k = z->n;
+    }
+    if (k - x <= z->s_limit || u >= zipf_h_integral(z, k + 0.5) - zipf_h(z, k)) {
+      return (uint64_t) k;
+    }
+  }
+}
+
+/* Latency histograms, log-linear with 8 buckets per power of two */
+
+#define SUB_BUCKETS (8)
+#define NUM_BUCKETS (64 * SUB_BUCKETS)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[NUM_BUCKETS];
+} histogram;
+
+static void histogram_add(histogram *h, uint64_t ns) {
+  int i = ns;
+  if (ns >= SUB_BUCKETS) {
+    int exponent = 63 - __builtin_clzll(ns);
+    i = (exponent - 2) * SUB_BUCKETS + ((ns >> (exponent - 3)) & (SUB_BUCKETS - 1));
+  }
+  h->buckets[i]++;
+  h->count++;
+  h->sum += ns;
+  if (ns > h->max) {
+    h->max = ns;
+  }
+}
+
+static void histogram_merge(histogram *h, const histogram *other) {
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    h->buckets[i] += other->buckets[i];
+  }
+  h->count += other->count;
+  h->sum += other->sum;
+  if (other->max > h->max) {
+    h->max = other->max;
+  }
+}
+
+/**
+ * @returns the upper bound of the bucket containing the percentile, at most the maximum.
+ */
+static uint64_t histogram_percentile(const histogram *h, double percentile) {
+  uint64_t rank = (uint64_t) (percentile * h->count);
+  uint64_t seen = 0;
+  for (int i = 0; i < NUM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen > rank) {
+      if (i < SUB_BUCKETS) {
+        return i;
+      }
+      int exponent = i / SUB_BUCKETS + 2;
+      uint64_t width = 1ULL << (exponent - 3);
+      uint64_t upper = (SUB_BUCKETS + i % SUB_BUCKETS) * width + width - 1;
+      return upper < h->max ? upper : h->max;
+    }
+  }
+  return h->max;
+}
+
+/* Benchmark phases */
+
+typedef struct {
+  double wall;
+  double cpu;
+  uint64_t file_size;
+  // writing the log, including generating the entries
+  double log_wall;
+  uint64_t compress_ns;
+  uint64_t log_peak_rss;
+  sparkey_hash_build_profile build;
+  uint64_t peak_rss;
+} create_result;
+
+/**
+ * @returns the peak resident set size of the process so far, in bytes.
+ */
+static uint64_t peak_rss() {
+  struct rusage r;
+  errno_assert(getrusage(RUSAGE_SELF, &r));
+#ifdef __APPLE__
+  return r.ru_maxrss;
+#else
+  return (uint64_t) r.ru_maxrss * 1024;
+#endif
+}
+
+static void create(const bench_config *c, create_result *result) {
+  remove(INDEX_FILENAME);
+  remove(LOG_FILENAME);
+  double t1_wall = wall();
+  double t1_cpu = cpu();
+
+  uint8_t *key = malloc(c->key_max);
+  uint8_t *value = malloc(c->value_max);
   sparkey_logwriter *mywriter;
-  sparkey_assert(sparkey_logwriter_create(&mywriter, "test.spl", compression_type, block_size));
-  for (int i = 0; i < n; i++) {
-    char mykey[100];
-    char myvalue[100];
-    sprintf(mykey, "key_%d", i);
-    sprintf(myvalue, "value_%d", i);
-    sparkey_assert(sparkey_logwriter_put(mywriter, strlen(mykey), (uint8_t*)mykey, strlen(myvalue), (uint8_t*)myvalue));
+  sparkey_assert(sparkey_logwriter_create(&mywriter, LOG_FILENAME, c->compression_type, c->block_size));
+  for (uint64_t i = 0; i < c->num_entries; i++) {
+    int keylen = make_key(c, i, key);
+    int valuelen = make_value(c, i, value);
+    sparkey_assert(sparkey_logwriter_put(mywriter, keylen, key, valuelen, value));
   }
+  sparkey_assert(sparkey_logwriter_flush(mywriter));
+  result->compress_ns = sparkey_logwriter_compression_ns(mywriter);
   sparkey_assert(sparkey_logwriter_close(&mywriter));
-  sparkey_assert(sparkey_hash_write("test.spi", "test.spl", 0));
+  free(key);
+  free(value);
+  result->log_wall = wall() - t1_wall;
+  result->log_peak_rss = peak_rss();
+
+  const char *log_filename = LOG_FILENAME;
+  sparkey_assert(sparkey_hash_write_profiled(INDEX_FILENAME, 1, &log_filename, 0, &result->build));
+
+  result->wall = wall() - t1_wall;
+  result->cpu = cpu() - t1_cpu;
+  result->peak_rss = peak_rss();
+  result->file_size = file_size(INDEX_FILENAME) + file_size(LOG_FILENAME);
 }
 
-static void sparkey_randomaccess(int n, int lookups) {
-  sparkey_hashreader *myreader;
-  sparkey_logiter *myiter;
-  sparkey_assert(sparkey_hash_open(&myreader, "test.spi", "test.spl"));
+/**
+ * Flushes a file and evicts it from the page cache, or reads it all into the page cache.
+ */
+static void prepare_cache(const char *filename, int cold) {
+  int fd = open(filename, O_RDONLY);
+  errno_assert(fd < 0);
+  if (cold) {
+    errno_assert(fsync(fd));
+#ifdef HAVE_POSIX_FADVISE
+    errno_assert(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+#else
+    printf("Evicting files from the page cache is not supported on this platform\n");
+#endif
+  } else {
+    static uint8_t buf[1 << 16];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+  }
+  close(fd);
+}
 
-  printf("    Number of hash collisions: %"PRIu64"\n", sparkey_hash_numcollisions(myreader));
+/* Resource usage, from getrusage */
 
-  sparkey_logreader *logreader = sparkey_hash_getreader(myreader);
-  sparkey_assert(sparkey_logiter_create(&myiter, logreader));
+typedef struct {
+  uint64_t minor_faults;
+  uint64_t major_faults;
+  uint64_t voluntary_switches;
+  uint64_t involuntary_switches;
+} usage_counts;
 
-  uint8_t *valuebuf = malloc(sparkey_logreader_maxvaluelen(logreader));
+static void get_usage(int who, usage_counts *u) {
+  struct rusage r;
+  errno_assert(getrusage(who, &r));
+  u->minor_faults = r.ru_minflt;
+  u->major_faults = r.ru_majflt;
+  u->voluntary_switches = r.ru_nvcsw;
+  u->involuntary_switches = r.ru_nivcsw;
+}
 
-  for (int i = 0; i < lookups; i++) {
-    char mykey[100];
-    char myvalue[100];
-    int r = rand() % n;
-    sprintf(mykey, "key_%d", r);
-    sprintf(myvalue, "value_%d", r);
-    sparkey_assert(sparkey_hash_get(myreader, (uint8_t*)mykey, strlen(mykey), myiter));
-    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
-      printf("Failed to lookup key: %s\n", mykey);
-      exit(1);
+static void usage_since(usage_counts *u, const usage_counts *start) {
+  u->minor_faults -= start->minor_faults;
+  u->major_faults -= start->major_faults;
+  u->voluntary_switches -= start->voluntary_switches;
+  u->involuntary_switches -= start->involuntary_switches;
+}
+
+/* Per thread usage is only available on Linux */
+#ifdef RUSAGE_THREAD
+#define PER_THREAD_USAGE (1)
+#else
+#define PER_THREAD_USAGE (0)
+#define RUSAGE_THREAD RUSAGE_SELF
+#endif
+
+typedef struct {
+  const bench_config *config;
+  const zipf_sampler *zipf;
+  sparkey_hashreader *reader;
+  const int *start;
+  uint64_t num_lookups;
+  uint64_t random_state;
+  uint64_t hits;
+  double wall;
+  usage_counts usage;
+  histogram latency;
+} lookup_thread;
+
+static uint64_t next_index(lookup_thread *t) {
+  const bench_config *c = t->config;
+  uint64_t n = c->num_entries;
+  if (c->miss_ratio > 0 && next_double(&t->random_state) < c->miss_ratio) {
+    return n + next_random(&t->random_state) % n;
+  }
+  switch (c->pattern) {
+  case ACCESS_ZIPF:
+    // spread the popular keys over the log instead of putting them first
+    return mix(zipf_next(t->zipf, &t->random_state)) % n;
+  case ACCESS_HOTSET: {
+    uint64_t hot = (uint64_t) (c->hot_fraction * n);
+    if (hot == 0) {
+      hot = 1;
+    }
+    if (hot == n || next_double(&t->random_state) < c->hot_probability) {
+      return mix(next_random(&t->random_state) % hot) % n;
     }
+    return mix(hot + next_random(&t->random_state) % (n - hot)) % n;
+  }
+  default:
+    return next_random(&t->random_state) % n;
+  }
+}
 
-    uint64_t wanted_valuelen = sparkey_logiter_valuelen(myiter);
-    uint64_t actual_valuelen;
-    sparkey_assert(sparkey_logiter_fill_value(myiter, logreader, wanted_valuelen, valuebuf, &actual_valuelen));
-    if (actual_valuelen != strlen(myvalue) || memcmp(myvalue, valuebuf, actual_valuelen)) {
-      printf("Did not get the expected value for key: %s\n", mykey);
+static void lookup_one(lookup_thread *t, sparkey_logiter *myiter, uint8_t *key, uint8_t *valuebuf) {
+  const bench_config *c = t->config;
+  sparkey_logreader *logreader = sparkey_hash_getreader(t->reader);
+  uint64_t i = next_index(t);
+  int keylen = make_key(c, i, key);
+  uint64_t start = wall_ns();
+  sparkey_assert(sparkey_hash_get(t->reader, key, keylen, myiter));
+  if (sparkey_logiter_state(myiter) == SPARKEY_ITER_ACTIVE) {
+    uint64_t valuelen;
+    sparkey_assert(sparkey_logiter_fill_value(myiter, logreader, c->value_max, valuebuf, &valuelen));
+    histogram_add(&t->latency, wall_ns() - start);
+    check_value(c, i, valuebuf, valuelen);
+    t->hits++;
+  } else {
+    histogram_add(&t->latency, wall_ns() - start);
+    if (i < c->num_entries) {
+      printf("Failed to lookup key %"PRIu64"\n", i);
       exit(1);
     }
   }
-  sparkey_logiter_close(&myiter);
-  sparkey_hash_close(&myreader);
 }
 
-static void sparkey_create_uncompressed(int n) {
-  sparkey_create(n, SPARKEY_COMPRESSION_NONE, 0);
+/**
+ * Submits a batch of lookups through the async API and waits for all of them.
+ * The latency of a lookup is the time from submitting the batch until its result is polled.
+ */
+static void lookup_batch(lookup_thread *t, sparkey_hash_async *async, uint64_t *indices, sparkey_hash_async_result *results, uint8_t *key, int batch) {
+  const bench_config *c = t->config;
+  int n;
+  // release the results of the previous batch
+  sparkey_assert(sparkey_hash_async_poll(async, 0, 0, results, &n));
+  uint64_t start = wall_ns();
+  for (int j = 0; j < batch; j++) {
+    indices[j] = next_index(t);
+    int keylen = make_key(c, indices[j], key);
+    sparkey_assert(sparkey_hash_async_submit(async, key, keylen, &indices[j]));
+  }
+  int remaining = batch;
+  while (remaining > 0) {
+    sparkey_assert(sparkey_hash_async_poll(async, 1, batch, results, &n));
+    uint64_t now = wall_ns();
+    for (int j = 0; j < n; j++) {
+      sparkey_assert(results[j].returncode);
+      uint64_t i = *(uint64_t *) results[j].userdata;
+      histogram_add(&t->latency, now - start);
+      if (results[j].state == SPARKEY_ITER_ACTIVE) {
+        check_value(c, i, results[j].value, results[j].valuelen);
+        t->hits++;
+      } else if (i < c->num_entries) {
+        printf("Failed to lookup key %"PRIu64"\n", i);
+        exit(1);
+      }
+    }
+    remaining -= n;
+  }
 }
 
-static void sparkey_create_snappy(int n) {
-  sparkey_create(n, SPARKEY_COMPRESSION_SNAPPY, 4 * 1024);
+static void * run_lookups(void *arg) {
+  lookup_thread *t = arg;
+  const bench_config *c = t->config;
+  uint8_t *key = malloc(c->key_max);
+  // wait until all threads have been created
+  while (!__atomic_load_n(t->start, __ATOMIC_ACQUIRE)) {
+    sched_yield();
+  }
+  usage_counts start_usage;
+  if (PER_THREAD_USAGE) {
+    get_usage(RUSAGE_THREAD, &start_usage);
+  }
+  double start_wall = wall();
+  if (c->batch <= 1) {
+    uint8_t *valuebuf = malloc(c->value_max);
+    sparkey_logiter *myiter;
+    sparkey_assert(sparkey_logiter_create(&myiter, sparkey_hash_getreader(t->reader)));
+    for (uint64_t i = 0; i < t->num_lookups; i++) {
+      lookup_one(t, myiter, key, valuebuf);
+    }
+    sparkey_logiter_close(&myiter);
+    free(valuebuf);
+  } else {
+    sparkey_hash_async *async;
+    sparkey_assert(sparkey_hash_async_create(&async, t->reader, c->batch));
+    uint64_t *indices = malloc(c->batch * sizeof(uint64_t));
+    sparkey_hash_async_result *results = malloc(c->batch * sizeof(sparkey_hash_async_result));
+    for (uint64_t i = 0; i < t->num_lookups; i += c->batch) {
+      uint64_t left = t->num_lookups - i;
+      lookup_batch(t, async, indices, results, key, left < (uint64_t) c->batch ? (int) left : c->batch);
+    }
+    sparkey_hash_async_close(&async);
+    free(indices);
+    free(results);
+  }
+  t->wall = wall() - start_wall;
+  if (PER_THREAD_USAGE) {
+    get_usage(RUSAGE_THREAD, &t->usage);
+    usage_since(&t->usage, &start_usage);
+  }
+  free(key);
+  return NULL;
 }
 
-static void sparkey_create_zstd(int n) {
-  sparkey_create(n, SPARKEY_COMPRESSION_ZSTD, 4 * 1024);
-}
+typedef struct {
+  int threads;
+  double wall;
+  double cpu;
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t collisions;
+  usage_counts usage;
+  histogram latency;
+  // owned by the result
+  lookup_thread *per_thread;
+} lookup_result;
 
-static const char* sparkey_list[] = {"test.spi", "test.spl", NULL};
+/**
+ * Runs c->num_lookups lookups spread over num_threads threads sharing the reader.
+ */
+static void run_threads(const bench_config *c, sparkey_hashreader *myreader, const zipf_sampler *zipf, int num_threads, lookup_result *result) {
+  lookup_thread *threads = calloc(num_threads, sizeof(lookup_thread));
+  pthread_t *ids = malloc(num_threads * sizeof(pthread_t));
+  int start = 0;
+  for (int i = 0; i < num_threads; i++) {
+    threads[i].config = c;
+    threads[i].zipf = zipf;
+    threads[i].reader = myreader;
+    threads[i].start = &start;
+    threads[i].num_lookups = c->num_lookups / num_threads + ((uint64_t) i < c->num_lookups % num_threads);
+    threads[i].random_state = mix(c->seed + i);
+  }
 
-static const char** sparkey_files() {
-  return sparkey_list;
+  usage_counts start_usage;
+  double t1_wall;
+  double t1_cpu;
+  if (num_threads == 1) {
+    start = 1;
+    get_usage(RUSAGE_SELF, &start_usage);
+    t1_wall = wall();
+    t1_cpu = cpu();
+    run_lookups(&threads[0]);
+  } else {
+    for (int i = 0; i < num_threads; i++) {
+      errno_assert(pthread_create(&ids[i], NULL, run_lookups, &threads[i]));
+    }
+    get_usage(RUSAGE_SELF, &start_usage);
+    t1_wall = wall();
+    t1_cpu = cpu();
+    __atomic_store_n(&start, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < num_threads; i++) {
+      errno_assert(pthread_join(ids[i], NULL));
+    }
+  }
+  result->wall = wall() - t1_wall;
+  result->cpu = cpu() - t1_cpu;
+  get_usage(RUSAGE_SELF, &result->usage);
+  usage_since(&result->usage, &start_usage);
+
+  result->threads = num_threads;
+  memset(&result->latency, 0, sizeof(histogram));
+  result->lookups = c->num_lookups;
+  result->hits = 0;
+  for (int i = 0; i < num_threads; i++) {
+    result->hits += threads[i].hits;
+    histogram_merge(&result->latency, &threads[i].latency);
+  }
+  result->collisions = sparkey_hash_numcollisions(myreader);
+  result->per_thread = threads;
+  free(ids);
 }
 
-static candidate sparkey_candidate_uncompressed = {
-  "Sparkey uncompressed", &sparkey_create_uncompressed, &sparkey_randomaccess, &sparkey_files
-};
+static sparkey_hashreader * open_reader(const bench_config *c, zipf_sampler *zipf) {
+  prepare_cache(INDEX_FILENAME, c->cold);
+  prepare_cache(LOG_FILENAME, c->cold);
+  sparkey_hashreader *myreader;
+  sparkey_assert(sparkey_hash_open(&myreader, INDEX_FILENAME, LOG_FILENAME));
+  if (c->pattern == ACCESS_ZIPF) {
+    zipf_init(zipf, c->num_entries, c->zipf_exponent);
+  }
+  return myreader;
+}
 
-static candidate sparkey_candidate_snappy = {
-  "Sparkey snappy(4K)", &sparkey_create_snappy, &sparkey_randomaccess, &sparkey_files
-};
+/* Reporting */
 
-static candidate sparkey_candidate_zstd = {
-  "Sparkey zstd(4K)", &sparkey_create_zstd, &sparkey_randomaccess, &sparkey_files
-};
+static const char * compression_name(sparkey_compression_type t) {
+  switch (t) {
+  case SPARKEY_COMPRESSION_SNAPPY: return "snappy";
+  case SPARKEY_COMPRESSION_ZSTD: return "zstd";
+  default: return "none";
+  }
+}
 
-/* main */
+static const char * pattern_name(access_pattern p) {
+  switch (p) {
+  case ACCESS_ZIPF: return "zipf";
+  case ACCESS_HOTSET: return "hotset";
+  default: return "uniform";
+  }
+}
 
-void test(candidate *c, int n, int lookups) {
-  printf("Testing bulk insert of %d elements and %d random lookups\n", n, lookups);
+static void print_text_config(const bench_config *c, const create_result *cr) {
+  printf("Benchmark of %"PRIu64" entries and %"PRIu64" %s lookups\n", c->num_entries, c->num_lookups, pattern_name(c->pattern));
+  printf("  keys: %d-%d bytes, values: %d-%d bytes, compression: %s", c->key_min, c->key_max, c->value_min, c->value_max, compression_name(c->compression_type));
+  if (c->compression_type != SPARKEY_COMPRESSION_NONE) {
+    printf(" (%d byte blocks)", c->block_size);
+  }
+  printf("\n  threads: %d, batch size: %d, miss ratio: %.3f, cache: %s\n", c->threads, c->batch, c->miss_ratio, c->cold ? "cold" : "warm");
+  printf("  creation time (wall):         %2.2f\n", cr->wall);
+  printf("  creation time (cpu):          %2.2f\n", cr->cpu);
+  printf("  throughput (puts/cpusec):     %2.2f\n", c->num_entries / cr->cpu);
+  printf("  file size:                    %"PRIu64"\n", cr->file_size);
+  const sparkey_hash_build_profile *b = &cr->build;
+  printf("  log write time (wall):        %2.2f\n", cr->log_wall);
+  printf("    compression:                %2.2f\n", cr->compress_ns / 1e9);
+  printf("  hash write time (wall):       %2.2f\n", b->total_ns / 1e9);
+  printf("    log reading:                %2.2f\n", b->read_ns / 1e9);
+  printf("    decompression:              %2.2f\n", b->decompress_ns / 1e9);
+  printf("    key hashing:                %2.2f\n", b->hash_ns / 1e9);
+  printf("    robin hood insertion:       %2.2f\n", b->insert_ns / 1e9);
+  printf("    displacement statistics:    %2.2f\n", b->displacement_ns / 1e9);
+  printf("    file write:                 %2.2f\n", b->write_ns / 1e9);
+  printf("  hash table size:              %"PRIu64"\n", b->table_bytes);
+  printf("  peak RSS after log write:     %"PRIu64"\n", cr->log_peak_rss);
+  printf("  peak RSS:                     %"PRIu64"\n", cr->peak_rss);
+}
 
-  printf("  Candidate: %s\n", c->name);
-  rm_all_rec(c->files());
+static void print_text(const lookup_result *lr) {
+  printf("  hash collisions:              %"PRIu64"\n", lr->collisions);
+  printf("  lookup time (wall):           %2.2f\n", lr->wall);
+  printf("  lookup time (cpu):            %2.2f\n", lr->cpu);
+  printf("  throughput (lookups/sec):     %2.2f\n", lr->lookups / lr->wall);
+  printf("  throughput (lookups/cpusec):  %2.2f\n", lr->lookups / lr->cpu);
+  printf("  hits:                         %"PRIu64"\n", lr->hits);
+  const histogram *h = &lr->latency;
+  printf("  latency (ns): mean %"PRIu64", p50 %"PRIu64", p90 %"PRIu64", p99 %"PRIu64", p99.9 %"PRIu64", max %"PRIu64"\n",
+    h->count == 0 ? 0 : h->sum / h->count, histogram_percentile(h, 0.5), histogram_percentile(h, 0.9),
+    histogram_percentile(h, 0.99), histogram_percentile(h, 0.999), h->max);
+  printf("  page faults: %"PRIu64" minor, %"PRIu64" major, context switches: %"PRIu64" voluntary, %"PRIu64" involuntary\n",
+    lr->usage.minor_faults, lr->usage.major_faults, lr->usage.voluntary_switches, lr->usage.involuntary_switches);
+}
 
-  float t1_wall = wall();
-  float t1_cpu = cpu();
+static void print_scaling_header() {
+  printf("  %-10s %14s %7s %10s %9s %9s %10s %10s %10s %10s\n", "threads", "lookups/s", "speedup", "efficiency",
+    "p50 ns", "p99 ns", "minflt", "majflt", "vcsw", "ivcsw");
+}
 
-  c->create(n);
+static void print_scaling(const lookup_result *lr, double base_throughput) {
+  const histogram *h = &lr->latency;
+  double throughput = lr->lookups / lr->wall;
+  printf("  %-10d %14.1f %7.2f %9.1f%% %9"PRIu64" %9"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64"\n",
+    lr->threads, throughput, throughput / base_throughput, 100 * throughput / base_throughput / lr->threads,
+    histogram_percentile(h, 0.5), histogram_percentile(h, 0.99),
+    lr->usage.minor_faults, lr->usage.major_faults, lr->usage.voluntary_switches, lr->usage.involuntary_switches);
+  for (int i = 0; i < lr->threads && lr->threads > 1; i++) {
+    const lookup_thread *t = &lr->per_thread[i];
+    printf("    thread %-3d %13.1f %18s %9"PRIu64" %9"PRIu64, i, t->num_lookups / t->wall, "",
+      histogram_percentile(&t->latency, 0.5), histogram_percentile(&t->latency, 0.99));
+    if (PER_THREAD_USAGE) {
+      printf(" %10"PRIu64" %10"PRIu64" %10"PRIu64" %10"PRIu64, t->usage.minor_faults, t->usage.major_faults,
+        t->usage.voluntary_switches, t->usage.involuntary_switches);
+    }
+    printf("\n");
+  }
+}
 
-  float t2_wall = wall();
-  float t2_cpu = cpu();
-  printf("    creation time (wall):     %2.2f\n", t2_wall - t1_wall);
-  printf("    creation time (cpu):      %2.2f\n", t2_cpu - t1_cpu);
-  printf("    throughput (puts/cpusec): %2.2f\n", (float) n / (t2_cpu - t1_cpu));
-  printf("    file size:                %zu\n", total_file_size(c->files()));
+static void print_json_latency(FILE *out, const histogram *h) {
+  fprintf(out, "\"latency_ns\": {\"mean\": %"PRIu64", \"p50\": %"PRIu64", \"p90\": %"PRIu64", \"p99\": %"PRIu64", \"p999\": %"PRIu64", \"max\": %"PRIu64"}",
+    h->count == 0 ? 0 : h->sum / h->count, histogram_percentile(h, 0.5), histogram_percentile(h, 0.9),
+    histogram_percentile(h, 0.99), histogram_percentile(h, 0.999), h->max);
+}
 
-  c->randomaccess(n, lookups);
+static void print_json_usage(FILE *out, const usage_counts *u) {
+  fprintf(out, "\"minor_faults\": %"PRIu64", \"major_faults\": %"PRIu64", \"voluntary_switches\": %"PRIu64", \"involuntary_switches\": %"PRIu64,
+    u->minor_faults, u->major_faults, u->voluntary_switches, u->involuntary_switches);
+}
 
-  float t3_wall = wall();
-  float t3_cpu = cpu();
-  printf("    lookup time (wall):          %2.2f\n", t3_wall - t2_wall);
-  printf("    lookup time (cpu):           %2.2f\n", t3_cpu - t2_cpu);
-  printf("    throughput (lookups/cpusec): %2.2f\n", (float) lookups / (t3_cpu - t2_cpu));
-  rm_all_rec(c->files());
+static void print_json_start(FILE *out, const bench_config *c, const create_result *cr) {
+  fprintf(out, "{\"config\": {\"entries\": %"PRIu64", \"lookups\": %"PRIu64", "
+    "\"key_size\": [%d, %d], \"value_size\": [%d, %d], \"access\": \"%s\", "
+    "\"zipf_exponent\": %g, \"hot_fraction\": %g, \"hot_probability\": %g, \"miss_ratio\": %g, "
+    "\"threads\": %d, \"batch\": %d, \"compression\": \"%s\", \"block_size\": %d, \"cache\": \"%s\", \"seed\": %"PRIu64"}, ",
+    c->num_entries, c->num_lookups, c->key_min, c->key_max, c->value_min, c->value_max, pattern_name(c->pattern),
+    c->zipf_exponent, c->hot_fraction, c->hot_probability, c->miss_ratio,
+    c->threads, c->batch, compression_name(c->compression_type), c->block_size, c->cold ? "cold" : "warm", c->seed);
+  fprintf(out, "\"create\": {\"wall_s\": %.6f, \"cpu_s\": %.6f, \"puts_per_cpu_s\": %.1f, \"file_bytes\": %"PRIu64", ",
+    cr->wall, cr->cpu, c->num_entries / cr->cpu, cr->file_size);
+  const sparkey_hash_build_profile *b = &cr->build;
+  fprintf(out, "\"log_write\": {\"wall_s\": %.6f, \"compress_s\": %.6f, \"peak_rss_bytes\": %"PRIu64"}, ",
+    cr->log_wall, cr->compress_ns / 1e9, cr->log_peak_rss);
+  fprintf(out, "\"hash_write\": {\"wall_s\": %.6f, \"read_s\": %.6f, \"decompress_s\": %.6f, \"hash_s\": %.6f, "
+    "\"insert_s\": %.6f, \"displacement_s\": %.6f, \"write_s\": %.6f, \"table_bytes\": %"PRIu64"}, ",
+    b->total_ns / 1e9, b->read_ns / 1e9, b->decompress_ns / 1e9, b->hash_ns / 1e9,
+    b->insert_ns / 1e9, b->displacement_ns / 1e9, b->write_ns / 1e9, b->table_bytes);
+  fprintf(out, "\"peak_rss_bytes\": %"PRIu64"}", cr->peak_rss);
+}
 
-  printf("\n");
+static void print_json_lookups(FILE *out, const lookup_result *lr) {
+  fprintf(out, "{\"threads\": %d, \"wall_s\": %.6f, \"cpu_s\": %.6f, \"lookups_per_s\": %.1f, \"lookups_per_cpu_s\": %.1f, "
+    "\"hits\": %"PRIu64", \"misses\": %"PRIu64", \"hash_collisions\": %"PRIu64", ",
+    lr->threads, lr->wall, lr->cpu, lr->lookups / lr->wall, lr->lookups / lr->cpu,
+    lr->hits, lr->lookups - lr->hits, lr->collisions);
+  print_json_usage(out, &lr->usage);
+  fprintf(out, ", ");
+  print_json_latency(out, &lr->latency);
+  if (lr->threads > 1) {
+    fprintf(out, ", \"per_thread\": [");
+    for (int i = 0; i < lr->threads; i++) {
+      const lookup_thread *t = &lr->per_thread[i];
+      fprintf(out, "%s{\"lookups_per_s\": %.1f, ", i == 0 ? "" : ", ", t->num_lookups / t->wall);
+      if (PER_THREAD_USAGE) {
+        print_json_usage(out, &t->usage);
+        fprintf(out, ", ");
+      }
+      print_json_latency(out, &t->latency);
+      fprintf(out, "}");
+    }
+    fprintf(out, "]");
+  }
+  fprintf(out, "}");
 }
 
-int main() {
-  test(&sparkey_candidate_uncompressed, 1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 10*1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_uncompressed, 100*1000*1000, 1*1000*1000);
+/* main */
 
-  test(&sparkey_candidate_snappy, 1000, 1*1000*1000);
-  test(&sparkey_candidate_snappy, 1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_snappy, 10*1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_snappy, 100*1000*1000, 1*1000*1000);
+static void usage() {
+  fprintf(stderr, "Usage: bench [options]\n");
+  fprintf(stderr, "  Creates a log and index with generated data, then times random lookups.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -n <n>                    Number of entries, with an optional k, M or G suffix [default: 1M]\n");
+  fprintf(stderr, "  -l <n>                    Number of lookups, 0 to only benchmark building [default: 1M]\n");
+  fprintf(stderr, "  -k <min>[-<max>]          Key size range in bytes, at least 8 [default: 8-16]\n");
+  fprintf(stderr, "  -v <min>[-<max>]          Value size range in bytes [default: 8-64]\n");
+  fprintf(stderr, "  -a uniform                Access every key with equal probability [default]\n");
+  fprintf(stderr, "  -a zipf[:<s>]             Zipfian access with exponent s [default: 0.99]\n");
+  fprintf(stderr, "  -a hotset[:<f>[:<p>]]     Access a fraction f of the keys with probability p [default: 0.2:0.8]\n");
+  fprintf(stderr, "  -m <ratio>                Fraction of lookups for keys that do not exist [default: 0]\n");
+  fprintf(stderr, "  -t <n>                    Number of threads sharing the reader [default: 1]\n");
+  fprintf(stderr, "  -b <n>                    Look up n keys at a time with the async API [default: 1]\n");
+  fprintf(stderr, "  -c <none|snappy|zstd>     Compression algorithm [default: none]\n");
+  fprintf(stderr, "  -B <n>                    Compression block size [default: 4096]\n");
+  fprintf(stderr, "  -C                        Evict the files from the page cache before the lookups\n");
+  fprintf(stderr, "                            [default: read them into the page cache]\n");
+  fprintf(stderr, "  -S                        Repeat the lookups with 1, 2, 4, ... up to -t threads to measure scaling\n");
+  fprintf(stderr, "  -s <n>                    Random seed [default: 1]\n");
+  fprintf(stderr, "  -j <file>                 Also write the results as JSON to a file, or only JSON to stdout with -\n");
+}
 
-  test(&sparkey_candidate_zstd, 1000, 1*1000*1000);
-  test(&sparkey_candidate_zstd, 1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_zstd, 10*1000*1000, 1*1000*1000);
-  test(&sparkey_candidate_zstd, 100*1000*1000, 1*1000*1000);
+/**
+ * Parses a count with an optional k, M or G suffix.
+ */
+static int parse_count(const char *s, uint64_t *count) {
+  uint64_t n;
+  char suffix;
+  char end;
+  int matched = sscanf(s, "%"SCNu64"%c%c", &n, &suffix, &end);
+  if (matched == 1) {
+    *count = n;
+    return 1;
+  }
+  if (matched != 2) {
+    return 0;
+  }
+  switch (suffix) {
+  case 'k': *count = n * 1000; return 1;
+  case 'M': *count = n * 1000 * 1000; return 1;
+  case 'G': *count = n * 1000 * 1000 * 1000; return 1;
+  default: return 0;
+  }
+}
 
+static int parse_range(const char *s, int *min, int *max) {
+  char end;
+  if (sscanf(s, "%d-%d%c", min, max, &end) == 2) {
+    return *min >= 0 && *min <= *max;
+  }
+  if (sscanf(s, "%d%c", min, &end) == 1) {
+    *max = *min;
+    return *min >= 0;
+  }
+  return 0;
+}
+
+static int parse_access(const char *s, bench_config *c) {
+  if (strcmp(s, "uniform") == 0) {
+    c->pattern = ACCESS_UNIFORM;
+    return 1;
+  }
+  if (strncmp(s, "zipf", 4) == 0) {
+    c->pattern = ACCESS_ZIPF;
+    return s[4] == 0 || (sscanf(s, "zipf:%lf", &c->zipf_exponent) == 1 && c->zipf_exponent > 0);
+  }
+  if (strncmp(s, "hotset", 6) == 0) {
+    c->pattern = ACCESS_HOTSET;
+    if (s[6] == 0) {
+      return 1;
+    }
+    int n = sscanf(s, "hotset:%lf:%lf", &c->hot_fraction, &c->hot_probability);
+    return n >= 1 && c->hot_fraction > 0 && c->hot_fraction <= 1 && c->hot_probability >= 0 && c->hot_probability <= 1;
+  }
   return 0;
 }
 
+int main(int argc, char * const *argv) {
+  bench_config c;
+  c.num_entries = 1000 * 1000;
+  c.num_lookups = 1000 * 1000;
+  c.key_min = 8;
+  c.key_max = 16;
+  c.value_min = 8;
+  c.value_max = 64;
+  c.pattern = ACCESS_UNIFORM;
+  c.zipf_exponent = 0.99;
+  c.hot_fraction = 0.2;
+  c.hot_probability = 0.8;
+  c.miss_ratio = 0;
+  c.threads = 1;
+  c.batch = 1;
+  c.compression_type = SPARKEY_COMPRESSION_NONE;
+  c.block_size = 4 * 1024;
+  c.cold = 0;
+  c.scaling = 0;
+  c.seed = 1;
+  c.json_filename = NULL;
+
+  int opt_char;
+  while ((opt_char = getopt(argc, argv, "n:l:k:v:a:m:t:b:c:B:CSs:j:h")) != -1) {
+    int ok = 1;
+    switch (opt_char) {
+    case 'n':
+      ok = parse_count(optarg, &c.num_entries) && c.num_entries > 0;
+      break;
+    case 'l':
+      ok = parse_count(optarg, &c.num_lookups);
+      break;
+    case 'k':
+      ok = parse_range(optarg, &c.key_min, &c.key_max) && c.key_min >= 8;
+      break;
+    case 'v':
+      ok = parse_range(optarg, &c.value_min, &c.value_max);
+      break;
+    case 'a':
+      ok = parse_access(optarg, &c);
+      break;
+    case 'm':
+      ok = sscanf(optarg, "%lf", &c.miss_ratio) == 1 && c.miss_ratio >= 0 && c.miss_ratio <= 1;
+      break;
+    case 't':
+      ok = sscanf(optarg, "%d", &c.threads) == 1 && c.threads > 0;
+      break;
+    case 'b':
+      ok = sscanf(optarg, "%d", &c.batch) == 1 && c.batch > 0;
+      break;
+    case 'c':
+      if (strcmp(optarg, "none") == 0) {
+        c.compression_type = SPARKEY_COMPRESSION_NONE;
+      } else if (strcmp(optarg, "snappy") == 0) {
+        c.compression_type = SPARKEY_COMPRESSION_SNAPPY;
+      } else if (strcmp(optarg, "zstd") == 0) {
+        c.compression_type = SPARKEY_COMPRESSION_ZSTD;
+      } else {
+        ok = 0;
+      }
+      break;
+    case 'B':
+      ok = sscanf(optarg, "%d", &c.block_size) == 1 && c.block_size > 0;
+      break;
+    case 'C':
+      c.cold = 1;
+      break;
+    case 'S':
+      c.scaling = 1;
+      break;
+    case 's':
+      ok = sscanf(optarg, "%"SCNu64, &c.seed) == 1;
+      break;
+    case 'j':
+      c.json_filename = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+    if (!ok) {
+      fprintf(stderr, "Invalid argument for -%c: '%s'\n", opt_char, optarg);
+      return 1;
+    }
+  }
+  if (optind < argc) {
+    usage();
+    return 1;
+  }
+
+  FILE *json = NULL;
+  if (c.json_filename != NULL) {
+    json = strcmp(c.json_filename, "-") == 0 ? stdout : fopen(c.json_filename, "w");
+    errno_assert(json == NULL);
+  }
 
+  create_result cr;
+  create(&c, &cr);
+  // with JSON on stdout, only print the JSON
+  int text = json != stdout;
+  if (text) {
+    print_text_config(&c, &cr);
+  }
+  if (json != NULL) {
+    print_json_start(json, &c, &cr);
+  }
+
+  zipf_sampler zipf;
+  sparkey_hashreader *myreader = NULL;
+  if (c.num_lookups == 0) {
+    // only benchmark building
+  } else if (!c.scaling) {
+    myreader = open_reader(&c, &zipf);
+    lookup_result lr;
+    run_threads(&c, myreader, &zipf, c.threads, &lr);
+    if (text) {
+      print_text(&lr);
+    }
+    if (json != NULL) {
+      fprintf(json, ", \"lookup\": ");
+      print_json_lookups(json, &lr);
+    }
+    free(lr.per_thread);
+  } else {
+    // The same reader is shared by every step, so later steps run with a warmer cache
+    myreader = open_reader(&c, &zipf);
+    if (text) {
+      print_scaling_header();
+    }
+    if (json != NULL) {
+      fprintf(json, ", \"scaling\": [");
+    }
+    double base_throughput = 0;
+    for (int n = 1; ; n = n * 2 > c.threads && n < c.threads ? c.threads : n * 2) {
+      lookup_result lr;
+      run_threads(&c, myreader, &zipf, n, &lr);
+      if (n == 1) {
+        base_throughput = lr.lookups / lr.wall;
+      }
+      if (text) {
+        print_scaling(&lr, base_throughput);
+      }
+      if (json != NULL) {
+        fprintf(json, "%s", n == 1 ? "" : ", ");
+        print_json_lookups(json, &lr);
+      }
+      free(lr.per_thread);
+      if (n >= c.threads) {
+        break;
+      }
+    }
+    if (json != NULL) {
+      fprintf(json, "]");
+    }
+  }
+  if (myreader != NULL) {
+    sparkey_hash_close(&myreader);
+  }
+  if (json != NULL) {
+    fprintf(json, "}\n");
+    if (json != stdout) {
+      fclose(json);
+    }
+  }
+  remove(INDEX_FILENAME);
+  remove(LOG_FILENAME);
+  return 0;
+}
@@ -0,0 +1,644 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "hashheader.h"
+#include "util.h"
+#include "vlq.h"
+
+// How often to update the progress, check for cancellation and throttle, in input bytes
+#define PROGRESS_INTERVAL (64*1024)
+
+// Maximum amount of data to copy verbatim in one go
+#define COPY_CHUNK_SIZE (1024*1024)
+
+struct sparkey_compaction {
+  char *hash_filename;
+  char *log_filename;
+  char *new_hash_filename;
+  char *new_log_filename;
+  uint64_t max_bytes_per_second;
+  int set_compression;
+  sparkey_compression_type compression_type;
+  int compression_block_size;
+  int has_writer_options;
+  sparkey_logwriter_options writer_options;
+  // the hot keys, key i is hot_key_data[hot_key_offsets[i]..hot_key_offsets[i + 1]]
+  uint64_t num_hot_keys;
+  uint8_t *hot_key_data;
+  uint64_t *hot_key_offsets;
+  int liveness;
+  // when copying started, for throttling
+  double start;
+  // the size of the hot entries copied to the front, counted as processed on top of the input log position
+  uint64_t hot_bytes;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  // signalled on cancellation, to wake up a throttled compaction
+  pthread_cond_t cond;
+  // the fields below are protected by lock
+  uint64_t processed;
+  uint64_t total;
+  int cancelled;
+  sparkey_returncode result;
+};
+
+static double now_seconds() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec + tp.tv_nsec / 1e9;
+}
+
+/**
+ * Publishes the progress and sleeps as long as needed to stay below the configured rate.
+ * @param processed the position reached in the input log, relative to its first entry.
+ */
+static sparkey_returncode checkpoint(sparkey_compaction *job, uint64_t processed) {
+  processed += job->hot_bytes;
+  pthread_mutex_lock(&job->lock);
+  job->processed = processed;
+  if (job->max_bytes_per_second > 0 && !job->cancelled) {
+    double ahead = processed / (double) job->max_bytes_per_second - (now_seconds() - job->start);
+    if (ahead > 0) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      double nsec = deadline.tv_nsec + (ahead - (time_t) ahead) * 1e9;
+      deadline.tv_sec += (time_t) ahead + (nsec >= 1e9);
+      deadline.tv_nsec = (long) (nsec >= 1e9 ? nsec - 1e9 : nsec);
+      while (!job->cancelled && pthread_cond_timedwait(&job->cond, &job->lock, &deadline) != ETIMEDOUT) {
+      }
+    }
+  }
+  int cancelled = job->cancelled;
+  pthread_mutex_unlock(&job->lock);
+  return cancelled ? SPARKEY_CANCELLED : SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode copy_entry(sparkey_logiter *iter, sparkey_logreader *log, sparkey_logwriter *writer, uint8_t *keybuf, uint8_t *valuebuf) {
+  uint64_t keylen = iter->keylen;
+  uint64_t valuelen = iter->valuelen;
+  uint64_t actual;
+  RETHROW(sparkey_logiter_fill_key(iter, log, keylen, keybuf, &actual));
+  RETHROW(sparkey_logiter_fill_value(iter, log, valuelen, valuebuf, &actual));
+  return sparkey_logwriter_put(writer, keylen, keybuf, valuelen, valuebuf);
+}
+
+static int is_live(sparkey_logiter *iter, sparkey_hashreader *reader, sparkey_live_entry *live, uint64_t num_live, uint64_t i) {
+  if (iter->type != SPARKEY_ENTRY_PUT || i >= num_live) {
+    return 0;
+  }
+  uint64_t address = (iter->block_position << reader->header.entry_block_bits) | iter->entry_count;
+  return address == live[i].address;
+}
+
+/**
+ * Copies the live entries one by one, decoding and encoding each of them.
+ */
+static sparkey_returncode copy_entries(sparkey_compaction *job, sparkey_hashreader *reader, sparkey_logwriter *writer, sparkey_live_entry *live, uint64_t num_live) {
+  sparkey_logreader *log = &reader->log;
+  sparkey_logiter *iter;
+  RETHROW(sparkey_logiter_create(&iter, log));
+
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  uint8_t *keybuf = malloc(log->header.max_key_len + 1);
+  uint8_t *valuebuf = malloc(log->header.max_value_len + 1);
+  if (keybuf == NULL || valuebuf == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, done);
+  }
+
+  uint64_t next_checkpoint = PROGRESS_INTERVAL;
+  uint64_t i = 0;
+  while (i < num_live) {
+    TRY(sparkey_logiter_next(iter, log), done);
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      // The hash table refers to entries beyond the end of the log
+      TRY(SPARKEY_HASH_HEADER_CORRUPT, done);
+    }
+    uint64_t processed = iter->block_position - log->header.header_size;
+    if (processed >= next_checkpoint) {
+      TRY(checkpoint(job, processed), done);
+      next_checkpoint = processed + PROGRESS_INTERVAL;
+    }
+    if (is_live(iter, reader, live, num_live, i)) {
+      TRY(copy_entry(iter, log, writer, keybuf, valuebuf), done);
+      i++;
+    }
+  }
+
+done:
+  free(keybuf);
+  free(valuebuf);
+  sparkey_logiter_close(&iter);
+  return returncode;
+}
+
+static void add_entry_stats(sparkey_logheader *stats, sparkey_logiter *iter, int fixed) {
+  uint8_t buf[10];
+  stats->num_puts++;
+  stats->put_size += iter->keylen + iter->valuelen;
+  if (!fixed) {
+    stats->put_size += write_vlq(buf, iter->keylen + 1) + write_vlq(buf, iter->valuelen);
+  }
+  if (iter->keylen > stats->max_key_len) {
+    stats->max_key_len = iter->keylen;
+  }
+  if (iter->valuelen > stats->max_value_len) {
+    stats->max_value_len = iter->valuelen;
+  }
+}
+
+static void merge_stats(sparkey_logheader *stats, const sparkey_logheader *other) {
+  stats->num_puts += other->num_puts;
+  stats->put_size += other->put_size;
+  if (other->max_key_len > stats->max_key_len) {
+    stats->max_key_len = other->max_key_len;
+  }
+  if (other->max_value_len > stats->max_value_len) {
+    stats->max_value_len = other->max_value_len;
+  }
+  if (other->max_entries_per_block > stats->max_entries_per_block) {
+    stats->max_entries_per_block = other->max_entries_per_block;
+  }
+}
+
+/**
+ * Copies the live entries like copy_entries, but blocks where every entry is live are copied verbatim.
+ * Requires that the new log uses the same compression settings as the old one.
+ *
+ * Each block is only decompressed once to find out if all its entries are live. Blocks with garbage
+ * are decompressed once more to copy their live entries. Runs of adjacent live blocks are appended
+ * to the new log in one go.
+ */
+static sparkey_returncode copy_blocks(sparkey_compaction *job, sparkey_hashreader *reader, sparkey_logwriter *writer, sparkey_live_entry *live, uint64_t num_live) {
+  sparkey_logreader *log = &reader->log;
+  // Compaction always maps the log, and it has a single segment
+  uint8_t *data = log->segments[0].data;
+  int compressed = sparkey_uses_compressor(log->header.compression_type);
+  sparkey_logiter *iter = NULL;
+  sparkey_logiter *copier = NULL;
+  uint8_t *keybuf = NULL;
+  uint8_t *valuebuf = NULL;
+  uint8_t *block_live = NULL;
+
+  sparkey_returncode returncode;
+  TRY(sparkey_logiter_create(&iter, log), done);
+  TRY(sparkey_logiter_create(&copier, log), done);
+  keybuf = malloc(log->header.max_key_len + 1);
+  valuebuf = malloc(log->header.max_value_len + 1);
+  uint64_t max_block_entries = compressed ? log->header.max_entries_per_block : 1;
+  block_live = malloc(max_block_entries + 1);
+  if (keybuf == NULL || valuebuf == NULL || block_live == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, done);
+  }
+
+  uint64_t next_checkpoint = PROGRESS_INTERVAL;
+  uint64_t i = 0;
+
+  // the block being scanned, 0 if none
+  uint64_t block = 0;
+  uint64_t block_entries = 0;
+  int block_all_live = 1;
+  sparkey_logheader block_stats;
+
+  // data waiting to be copied verbatim
+  uint64_t raw_start = 0;
+  uint64_t raw_end = 0;
+  sparkey_logheader raw_stats;
+  memset(&raw_stats, 0, sizeof(raw_stats));
+
+  while (1) {
+    TRY(sparkey_logiter_next(iter, log), done);
+    int active = iter->state == SPARKEY_ITER_ACTIVE;
+    // A block ends where the next one with entries starts, which includes continuation blocks of large entries
+    uint64_t position = active ? iter->block_position : log->header.data_end;
+    if (block != 0 && position != block) {
+      if (block_all_live && raw_end == block && raw_end - raw_start < COPY_CHUNK_SIZE) {
+        raw_end = position;
+        merge_stats(&raw_stats, &block_stats);
+      } else {
+        if (raw_end > raw_start) {
+          TRY(sparkey_logwriter_append_raw(writer, &data[raw_start], raw_end - raw_start, &raw_stats), done);
+        }
+        memset(&raw_stats, 0, sizeof(raw_stats));
+        raw_start = raw_end = 0;
+        if (block_all_live) {
+          raw_start = block;
+          raw_end = position;
+          raw_stats = block_stats;
+        } else {
+          TRY(sparkey_logiter_seek(copier, log, block), done);
+          for (uint64_t k = 0; k < block_entries; k++) {
+            TRY(sparkey_logiter_next(copier, log), done);
+            if (block_live[k]) {
+              TRY(copy_entry(copier, log, writer, keybuf, valuebuf), done);
+            }
+          }
+        }
+      }
+    }
+    if (!active) {
+      break;
+    }
+
+    if (position != block) {
+      block = position;
+      block_entries = 0;
+      block_all_live = 1;
+      memset(&block_stats, 0, sizeof(block_stats));
+
+      uint64_t processed = position - log->header.header_size;
+      if (processed >= next_checkpoint) {
+        TRY(checkpoint(job, processed), done);
+        next_checkpoint = processed + PROGRESS_INTERVAL;
+      }
+    }
+    if (block_entries >= max_block_entries) {
+      TRY(SPARKEY_LOG_HEADER_CORRUPT, done);
+    }
+    int entry_live = is_live(iter, reader, live, num_live, i);
+    if (entry_live) {
+      i++;
+      add_entry_stats(&block_stats, iter, log_fixed_width(&log->header));
+    }
+    block_live[block_entries++] = entry_live;
+    block_all_live &= entry_live;
+    if (compressed) {
+      block_stats.max_entries_per_block = block_entries;
+    }
+  }
+  if (raw_end > raw_start) {
+    TRY(sparkey_logwriter_append_raw(writer, &data[raw_start], raw_end - raw_start, &raw_stats), done);
+  }
+  if (i != num_live) {
+    // The hash table refers to entries that are not in the log
+    TRY(SPARKEY_HASH_HEADER_CORRUPT, done);
+  }
+
+done:
+  free(keybuf);
+  free(valuebuf);
+  free(block_live);
+  sparkey_logiter_close(&iter);
+  sparkey_logiter_close(&copier);
+  return returncode;
+}
+
+static int cmp_live_address(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = ((const sparkey_live_entry *) b)->address;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Writes the entries of the hot keys first, in the given order, and removes them from live
+ * so that the rest of the compaction skips them. Keys that are missing or repeated are ignored.
+ * @param hashes will be filled with the hashes of the written entries.
+ * @param num_hot will be set to the number of written entries.
+ */
+static sparkey_returncode copy_hot_entries(sparkey_compaction *job, sparkey_hashreader *reader, sparkey_logwriter *writer, sparkey_live_entry *live, uint64_t *num_live, uint64_t *hashes, uint64_t *num_hot) {
+  sparkey_logreader *log = &reader->log;
+  sparkey_logiter *iter;
+  RETHROW(sparkey_logiter_create(&iter, log));
+
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  uint8_t *valuebuf = malloc(log->header.max_value_len + 1);
+  uint8_t *is_hot = calloc(*num_live + 1, 1);
+  if (valuebuf == NULL || is_hot == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, done);
+  }
+
+  uint64_t n = 0;
+  uint64_t next_checkpoint = PROGRESS_INTERVAL;
+  for (uint64_t i = 0; i < job->num_hot_keys; i++) {
+    if (i % 4096 == 4095 || job->hot_bytes >= next_checkpoint) {
+      TRY(checkpoint(job, 0), done);
+      next_checkpoint = job->hot_bytes + PROGRESS_INTERVAL;
+    }
+    const uint8_t *key = &job->hot_key_data[job->hot_key_offsets[i]];
+    uint64_t keylen = job->hot_key_offsets[i + 1] - job->hot_key_offsets[i];
+    uint64_t address;
+    TRY(sparkey_hash_get_address(reader, key, keylen, iter, &address), done);
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      continue;
+    }
+    sparkey_live_entry *entry = bsearch(&address, live, *num_live, sizeof(sparkey_live_entry), cmp_live_address);
+    if (entry == NULL || is_hot[entry - live]) {
+      continue;
+    }
+    is_hot[entry - live] = 1;
+    uint64_t valuelen = iter->valuelen;
+    uint64_t actual;
+    TRY(sparkey_logiter_fill_value(iter, log, valuelen, valuebuf, &actual), done);
+    TRY(sparkey_logwriter_put(writer, keylen, key, valuelen, valuebuf), done);
+    hashes[n++] = entry->hash;
+    job->hot_bytes += keylen + valuelen;
+  }
+
+  uint64_t m = 0;
+  for (uint64_t k = 0; k < *num_live; k++) {
+    if (!is_hot[k]) {
+      live[m++] = live[k];
+    }
+  }
+  *num_live = m;
+  *num_hot = n;
+
+done:
+  free(valuebuf);
+  free(is_hot);
+  sparkey_logiter_close(&iter);
+  return returncode;
+}
+
+/**
+ * Copies a whole file, in chunks so that the progress and throttling still apply.
+ */
+static sparkey_returncode copy_file(sparkey_compaction *job, const char *from, const char *to, int track_progress) {
+  int in_fd = open(from, O_RDONLY);
+  if (in_fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  int out_fd = creat(to, 00644);
+  if (out_fd < 0) {
+    TRY(sparkey_create_returncode(errno), close_in);
+  }
+  struct stat st;
+  if (fstat(in_fd, &st) < 0) {
+    TRY(SPARKEY_INTERNAL_ERROR, close_out);
+  }
+
+  uint64_t size = st.st_size;
+  for (uint64_t offset = 0; offset < size; offset += COPY_CHUNK_SIZE) {
+    uint64_t len = size - offset < COPY_CHUNK_SIZE ? size - offset : COPY_CHUNK_SIZE;
+    TRY(sparkey_copy_range(in_fd, out_fd, offset, len), close_out);
+    if (track_progress) {
+      TRY(checkpoint(job, offset + len), close_out);
+    }
+  }
+
+close_out:
+  close(out_fd);
+close_in:
+  close(in_fd);
+  return returncode;
+}
+
+static sparkey_returncode run_compaction(sparkey_compaction *job) {
+  sparkey_hashreader *reader;
+  RETHROW(sparkey_hash_open(&reader, job->hash_filename, job->log_filename));
+
+  sparkey_returncode returncode;
+  sparkey_logreader *log = &reader->log;
+  sparkey_logwriter *writer = NULL;
+  uint64_t *hashes = NULL;
+  sparkey_live_entry *live = NULL;
+  uint64_t num_live;
+
+  pthread_mutex_lock(&job->lock);
+  job->total = log->header.data_end - log->header.header_size;
+  pthread_mutex_unlock(&job->lock);
+  job->start = now_seconds();
+
+  sparkey_compression_type compression_type = log->header.compression_type;
+  int compression_block_size = log->header.compression_block_size;
+  if (job->set_compression) {
+    compression_type = job->compression_type;
+    compression_block_size = job->compression_block_size;
+  }
+  int same_settings = compression_type == log->header.compression_type &&
+    (!sparkey_uses_compressor(compression_type) || compression_block_size == (int) log->header.compression_block_size);
+
+  if (same_settings && job->num_hot_keys == 0 &&
+      reader->header.garbage_size == 0 && reader->header.num_entries == log->header.num_puts) {
+    // Nothing to drop, the files can be copied as they are
+    TRY(copy_file(job, job->log_filename, job->new_log_filename, 1), remove_files);
+    TRY(copy_file(job, job->hash_filename, job->new_hash_filename, 0), remove_files);
+    char *liveness_filename = sparkey_create_liveness_filename(job->new_hash_filename);
+    if (liveness_filename != NULL) {
+      if (job->liveness) {
+        // Every entry is live, so the bitmap needs no addresses
+        returncode = sparkey_liveness_write(liveness_filename, reader->header.file_identifier,
+            reader->header.data_end, log->header.num_puts, NULL, NULL, log->header.num_puts);
+      } else {
+        remove(liveness_filename);
+      }
+      free(liveness_filename);
+      TRY(returncode, remove_files);
+    }
+    goto done;
+  }
+
+  TRY(sparkey_hash_live_entries(reader, &live, &num_live), close_reader);
+  hashes = malloc(num_live * sizeof(uint64_t) + 1);
+  if (hashes == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, close_reader);
+  }
+
+  // The new log keeps the entry format of the old one
+  sparkey_logwriter_options writer_options;
+  memset(&writer_options, 0, sizeof(writer_options));
+  if (job->has_writer_options) {
+    writer_options = job->writer_options;
+  }
+  writer_options.fixed_width = log_fixed_width(&log->header);
+  writer_options.fixed_key_len = log->header.fixed_key_len;
+  writer_options.fixed_value_len = log->header.fixed_value_len;
+  TRY(sparkey_logwriter_create_opts(&writer, job->new_log_filename,
+        compression_type, compression_block_size, &writer_options), close_reader);
+  uint64_t num_hot = 0;
+  if (job->num_hot_keys > 0) {
+    returncode = copy_hot_entries(job, reader, writer, live, &num_live, hashes, &num_hot);
+    // The hot entries are copied on top of the scan of the whole log
+    pthread_mutex_lock(&job->lock);
+    job->total += job->hot_bytes;
+    pthread_mutex_unlock(&job->lock);
+  }
+  for (uint64_t i = 0; i < num_live; i++) {
+    hashes[num_hot + i] = live[i].hash;
+  }
+  if (returncode != SPARKEY_SUCCESS) {
+    // Keep the error from copying the hot entries
+  } else if (same_settings) {
+    returncode = copy_blocks(job, reader, writer, live, num_live);
+  } else {
+    returncode = copy_entries(job, reader, writer, live, num_live);
+  }
+  if (returncode == SPARKEY_SUCCESS) {
+    returncode = sparkey_logwriter_close(&writer);
+  } else {
+    sparkey_logwriter_close(&writer);
+  }
+  TRY(returncode, remove_files);
+
+  // The hashes were collected in the order of the new log, so they line up with its entries
+  sparkey_hash_options hash_options;
+  hash_options.hash_size = reader->header.hash_size;
+  hash_options.inline_size = reader->header.inline_size;
+  hash_options.fingerprint_size = reader->header.fingerprint_size;
+  hash_options.liveness = job->liveness;
+  TRY(sparkey_hash_write_known(job->new_hash_filename, job->new_log_filename,
+        reader->header.hash_seed, &hash_options, num_hot + num_live, hashes), remove_files);
+
+done:
+  pthread_mutex_lock(&job->lock);
+  job->processed = job->total;
+  pthread_mutex_unlock(&job->lock);
+  goto close_reader;
+
+remove_files:
+  remove(job->new_log_filename);
+  remove(job->new_hash_filename);
+
+close_reader:
+  free(live);
+  free(hashes);
+  sparkey_hash_close(&reader);
+  return returncode;
+}
+
+static void free_compaction(sparkey_compaction *job) {
+  pthread_cond_destroy(&job->cond);
+  pthread_mutex_destroy(&job->lock);
+  free(job->hash_filename);
+  free(job->log_filename);
+  free(job->new_hash_filename);
+  free(job->new_log_filename);
+  free(job->hot_key_data);
+  free(job->hot_key_offsets);
+  free(job);
+}
+
+static sparkey_returncode copy_hot_keys(sparkey_compaction *job, const sparkey_compaction_options *options) {
+  uint64_t total = 0;
+  for (uint64_t i = 0; i < options->num_hot_keys; i++) {
+    total += options->hot_keylens[i];
+  }
+  job->hot_key_data = malloc(total + 1);
+  job->hot_key_offsets = malloc((options->num_hot_keys + 1) * sizeof(uint64_t));
+  if (job->hot_key_data == NULL || job->hot_key_offsets == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < options->num_hot_keys; i++) {
+    job->hot_key_offsets[i] = offset;
+    memcpy(&job->hot_key_data[offset], options->hot_keys[i], options->hot_keylens[i]);
+    offset += options->hot_keylens[i];
+  }
+  job->hot_key_offsets[options->num_hot_keys] = offset;
+  job->num_hot_keys = options->num_hot_keys;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode create_compaction(sparkey_compaction **job_ref, const char *hash_filename, const char *log_filename, const char *new_hash_filename, const char *new_log_filename, const sparkey_compaction_options *options) {
+  sparkey_compaction *job = calloc(1, sizeof(sparkey_compaction));
+  if (job == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  pthread_mutex_init(&job->lock, NULL);
+  pthread_cond_init(&job->cond, NULL);
+  job->hash_filename = strdup(hash_filename);
+  job->log_filename = strdup(log_filename);
+  job->new_hash_filename = strdup(new_hash_filename);
+  job->new_log_filename = strdup(new_log_filename);
+  if (job->hash_filename == NULL || job->log_filename == NULL ||
+      job->new_hash_filename == NULL || job->new_log_filename == NULL) {
+    free_compaction(job);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (options != NULL) {
+    job->max_bytes_per_second = options->max_bytes_per_second;
+    job->set_compression = options->set_compression;
+    job->compression_type = options->compression_type;
+    job->compression_block_size = options->compression_block_size;
+    job->liveness = options->liveness;
+    if (options->writer_options != NULL) {
+      job->has_writer_options = 1;
+      job->writer_options = *options->writer_options;
+    }
+    if (options->num_hot_keys > 0 && copy_hot_keys(job, options) != SPARKEY_SUCCESS) {
+      free_compaction(job);
+      return SPARKEY_INTERNAL_ERROR;
+    }
+  }
+  *job_ref = job;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_compact(const char *hash_filename, const char *log_filename, const char *new_hash_filename, const char *new_log_filename, const sparkey_compaction_options *options) {
+  sparkey_compaction *job;
+  RETHROW(create_compaction(&job, hash_filename, log_filename, new_hash_filename, new_log_filename, options));
+  sparkey_returncode returncode = run_compaction(job);
+  free_compaction(job);
+  return returncode;
+}
+
+static void * compaction_main(void *arg) {
+  sparkey_compaction *job = arg;
+  sparkey_returncode result = run_compaction(job);
+  pthread_mutex_lock(&job->lock);
+  job->result = result;
+  pthread_mutex_unlock(&job->lock);
+  return NULL;
+}
+
+sparkey_returncode sparkey_compaction_start(sparkey_compaction **job_ref, const char *hash_filename, const char *log_filename, const char *new_hash_filename, const char *new_log_filename, const sparkey_compaction_options *options) {
+  sparkey_compaction *job;
+  RETHROW(create_compaction(&job, hash_filename, log_filename, new_hash_filename, new_log_filename, options));
+  if (pthread_create(&job->thread, NULL, compaction_main, job) != 0) {
+    free_compaction(job);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  *job_ref = job;
+  return SPARKEY_SUCCESS;
+}
+
+void sparkey_compaction_progress(sparkey_compaction *job, uint64_t *processed, uint64_t *total) {
+  pthread_mutex_lock(&job->lock);
+  *processed = job->processed;
+  *total = job->total;
+  pthread_mutex_unlock(&job->lock);
+}
+
+void sparkey_compaction_cancel(sparkey_compaction *job) {
+  pthread_mutex_lock(&job->lock);
+  job->cancelled = 1;
+  pthread_cond_broadcast(&job->cond);
+  pthread_mutex_unlock(&job->lock);
+}
+
+sparkey_returncode sparkey_compaction_wait(sparkey_compaction **job_ref) {
+  sparkey_compaction *job = *job_ref;
+  if (job == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  pthread_join(job->thread, NULL);
+  sparkey_returncode returncode = job->result;
+  free_compaction(job);
+  *job_ref = NULL;
+  return returncode;
+}
@@ -32,9 +32,9 @@
 #include "endiantools.h"
 #include "sparkey.h"
 
-static sparkey_returncode _write_full(int fd, uint8_t *buf, size_t count) {
+static sparkey_returncode _write_full(int fd, uint8_t *buf, size_t count, off_t offset) {
   while (count > 0) {
-    ssize_t actual = write(fd, buf, count);
+    ssize_t actual = offset < 0 ? write(fd, buf, count) : pwrite(fd, buf, count, offset);
     if (actual < 0) {
       switch (errno) {
       case EINTR:
@@ -49,19 +49,33 @@ static sparkey_returncode _write_full(int fd, uint8_t *buf, size_t count) {
     }
     count -= actual;
     buf += actual;
+    if (offset >= 0) {
+      offset += actual;
+    }
   }
   return SPARKEY_SUCCESS;
 }
 
-sparkey_returncode write_full(int fd, uint8_t *buf, size_t count) {
+static sparkey_returncode _write_blocks(int fd, uint8_t *buf, size_t count, off_t offset) {
   const size_t block_size = 256*1024*1024;
   size_t fullruns = count / block_size;
   while (fullruns > 0) {
-    RETHROW(_write_full(fd, buf, block_size));
+    RETHROW(_write_full(fd, buf, block_size, offset));
     buf += block_size;
+    if (offset >= 0) {
+      offset += block_size;
+    }
     fullruns--;
   }
-  return _write_full(fd, buf, count % block_size);
+  return _write_full(fd, buf, count % block_size, offset);
+}
+
+sparkey_returncode write_full(int fd, uint8_t *buf, size_t count) {
+  return _write_blocks(fd, buf, count, -1);
+}
+
+sparkey_returncode pwrite_full(int fd, uint8_t *buf, size_t count, off_t offset) {
+  return _write_blocks(fd, buf, count, offset);
 }
 
 void write_little_endian32(uint8_t *buf, uint32_t value) {
@@ -37,6 +37,18 @@ typedef union {
  */
 sparkey_returncode write_full(int fd, uint8_t *buf, size_t count);
 
+/**
+ * Writes count bytes of buf to a file with file descriptor fd at a given offset.
+ * The file position of fd is not changed.
+ * @param fd file descriptor of a file to write to.
+ * @param buf bytes to write to file.
+ * Must point to a block of memory at least count long.
+ * @param count number of bytes to write.
+ * @param offset the file offset to start writing at.
+ * @returns SPARKEY_SUCCESS if all goes well, otherwise a sparkey error code.
+ */
+sparkey_returncode pwrite_full(int fd, uint8_t *buf, size_t count, off_t offset);
+
 /**
  * Write a 32 bit value to buf in little endian.
  * @param buf buf to write to. Must be at least 4 bytes long.
@@ -0,0 +1,864 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "hashheader.h"
+#include "util.h"
+#include "vlq.h"
+
+#if defined(__linux) && defined(HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#ifdef IORING_FEAT_RW_CUR_POS
+/* IORING_OP_READ arrived in the same kernel release as IORING_FEAT_RW_CUR_POS */
+#define SPARKEY_USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+#define MAGIC_VALUE_HASHASYNC (0x3c5a91e7)
+
+/* First read of an uncompressed entry. For larger entries only the missing tail is read. */
+#define ASYNC_INITIAL_READ (4096)
+
+typedef enum {
+  SLOT_FREE,
+  SLOT_PENDING,
+  SLOT_DONE,
+  SLOT_DELIVERED
+} slot_state;
+
+typedef enum {
+  STEP_PROBE,
+  STEP_READ,
+  STEP_PARSE
+} slot_step;
+
+typedef enum {
+  PARSE_DONE,
+  PARSE_MISMATCH,
+  PARSE_REREAD
+} parse_result;
+
+typedef enum {
+  PROBE_MISS,
+  PROBE_CANDIDATE,
+  PROBE_INLINE
+} probe_result;
+
+typedef struct {
+  slot_state state;
+  void *userdata;
+
+  // the key being looked up
+  uint8_t *key;
+  uint64_t keylen;
+  uint64_t hash;
+  uint32_t fingerprint;
+
+  // probe position in the hash table
+  uint64_t slot;
+  uint64_t pos;
+  uint64_t displacement;
+
+  // current candidate in the log
+  uint64_t position;
+  int entry_index;
+
+  // raw bytes read from the log, and decompressed block
+  uint8_t *read_buf;
+  uint64_t read_buf_size;
+  // the first read at a position, read_buf may have grown beyond it for a large entry
+  uint64_t read_size;
+  // read_buf holds read_len bytes from position, and the pending read fills it up to read_end
+  uint64_t read_len;
+  uint64_t read_end;
+  uint8_t *block_buf;
+
+  // an entry that spans several compressed blocks is assembled here
+  uint8_t *value_buf;
+  uint64_t value_buf_size;
+  // the key and value length of the entry being assembled, or 0
+  uint64_t entry_len;
+  uint64_t assembled;
+
+  // what the lookup did, for the statistics and traces of the reader
+  sparkey_lookup_info info;
+
+  // result
+  sparkey_returncode returncode;
+  sparkey_iter_state result_state;
+  const uint8_t *value;
+  uint64_t valuelen;
+} async_slot;
+
+#ifdef SPARKEY_USE_IO_URING
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr;
+  size_t sq_len;
+  void *cq_ptr;
+  size_t cq_len;
+  size_t sqes_len;
+  unsigned to_submit;
+  // reads queued and not yet completed, which the kernel may still write into the slot buffers
+  unsigned in_flight;
+} uring;
+#endif
+
+struct sparkey_hash_async {
+  uint32_t open_status;
+  sparkey_hashreader *reader;
+
+  int queue_depth;
+  async_slot *slots;
+
+  // stack of free slot ids
+  int *free_slots;
+  int num_free;
+
+  // fifo of finished slot ids, not yet handed out by poll
+  int *done;
+  int done_head;
+  int num_done;
+
+  // slots handed out by the last poll, released on the next one
+  int *delivered;
+  int num_delivered;
+
+  int use_ring;
+#ifdef SPARKEY_USE_IO_URING
+  uring ring;
+#endif
+};
+
+#ifdef SPARKEY_USE_IO_URING
+static int uring_init(uring *r, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) {
+    return -1;
+  }
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_len > r->sq_len) {
+      r->sq_len = r->cq_len;
+    }
+    r->cq_len = r->sq_len;
+  }
+  r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) {
+    close(r->fd);
+    return -1;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) {
+      munmap(r->sq_ptr, r->sq_len);
+      close(r->fd);
+      return -1;
+    }
+  }
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    if (r->cq_ptr != r->sq_ptr) {
+      munmap(r->cq_ptr, r->cq_len);
+    }
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+    return -1;
+  }
+
+  uint8_t *sq = r->sq_ptr;
+  uint8_t *cq = r->cq_ptr;
+  r->sq_head = (unsigned *) (sq + p.sq_off.head);
+  r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *) (sq + p.sq_off.array);
+  r->cq_head = (unsigned *) (cq + p.cq_off.head);
+  r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+  r->to_submit = 0;
+  return 0;
+}
+
+static void uring_close(uring *r) {
+  munmap(r->sqes, r->sqes_len);
+  if (r->cq_ptr != r->sq_ptr) {
+    munmap(r->cq_ptr, r->cq_len);
+  }
+  munmap(r->sq_ptr, r->sq_len);
+  close(r->fd);
+}
+
+static void uring_queue_read(uring *r, int fd, uint8_t *buf, uint64_t len, uint64_t offset, uint64_t user_data) {
+  unsigned tail = *r->sq_tail;
+  unsigned index = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t) (uintptr_t) buf;
+  sqe->len = len;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  r->sq_array[index] = index;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->to_submit++;
+  r->in_flight++;
+}
+
+/**
+ * @returns 0 on success, otherwise the errno of io_uring_enter.
+ */
+static int uring_enter(uring *r, unsigned min_complete) {
+  while (1) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete, flags, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    r->to_submit -= ret;
+    return 0;
+  }
+}
+#endif
+
+static sparkey_returncode assert_async_open(sparkey_hash_async *async) {
+  if (async->open_status != MAGIC_VALUE_HASHASYNC) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static void finish(sparkey_hash_async *async, int id, sparkey_returncode returncode, sparkey_iter_state state) {
+  async_slot *s = &async->slots[id];
+  if (returncode == SPARKEY_SUCCESS) {
+    s->info.found = state == SPARKEY_ITER_ACTIVE;
+    if (async->reader->trace != NULL) {
+      sparkey_trace_lookup(async->reader->trace, &s->info);
+    }
+    if (async->reader->stats != NULL) {
+      sparkey_stats_lookup(async->reader->stats, &s->info);
+    }
+  }
+  s->returncode = returncode;
+  s->result_state = state;
+  if (state != SPARKEY_ITER_ACTIVE) {
+    s->value = NULL;
+    s->valuelen = 0;
+  }
+  s->state = SLOT_DONE;
+  async->done[(async->done_head + async->num_done) % async->queue_depth] = id;
+  async->num_done++;
+}
+
+/**
+ * Walks the hash table from the slot's current probe position until the next
+ * slot with a matching hash. Inlined entries are compared and returned right away.
+ * @returns PROBE_CANDIDATE if a candidate in the log was found, PROBE_INLINE if the value
+ * was found in the hash file, or PROBE_MISS if the key does not exist.
+ */
+static probe_result probe(sparkey_hashreader *reader, async_slot *s) {
+  sparkey_hashheader *header = &reader->header;
+  int slot_size = header->address_size + header->hash_size;
+  uint8_t *hashtable = reader->data + header->header_size;
+  while (1) {
+    s->info.probe_length++;
+    uint64_t hash2 = header->hash_algorithm.read_hash(hashtable, s->pos);
+    uint64_t position2 = read_addr(hashtable, s->pos + header->hash_size, header->address_size);
+    if (position2 == 0) {
+      return PROBE_MISS;
+    }
+    uint64_t other_displacement = get_displacement(header->hash_capacity, s->slot, hash2);
+    if (s->displacement > other_displacement) {
+      return PROBE_MISS;
+    }
+    probe_result found = PROBE_MISS;
+    int match = s->hash == hash2;
+    if (match && header->fingerprint_size > 0) {
+      // A different fingerprint means a different key, so the log is not needed
+      match = s->fingerprint == read_fingerprint(hash_fingerprint_slot(header, hashtable, s->slot), header->fingerprint_size);
+    }
+    if (match) {
+      uint8_t *record = header->inline_size > 0 ? hash_inline_record(header, hashtable, s->slot) : NULL;
+      if (record == NULL || record[0] == 0) {
+        s->entry_index = (int) (position2) & header->entry_block_bitmask;
+        s->position = position2 >> header->entry_block_bits;
+        found = PROBE_CANDIDATE;
+      } else if (record[0] - 1u == s->keylen && memcmp(&record[2], s->key, s->keylen) == 0) {
+        s->value = &record[2 + s->keylen];
+        s->valuelen = record[1];
+        found = PROBE_INLINE;
+      }
+    }
+    s->pos += slot_size;
+    s->displacement++;
+    s->slot++;
+    if (s->slot >= header->hash_capacity) {
+      s->pos = 0;
+      s->slot = 0;
+    }
+    if (found != PROBE_MISS) {
+      return found;
+    }
+  }
+}
+
+static uint64_t read_length(sparkey_log_segment *seg, async_slot *s) {
+  uint64_t available = seg->base + seg->header.data_end - s->position;
+  return available < s->read_size ? available : s->read_size;
+}
+
+static sparkey_returncode pread_full(int fd, uint8_t *buf, uint64_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t actual = pread(fd, buf, len, offset);
+    if (actual < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    if (actual == 0) {
+      return SPARKEY_UNEXPECTED_EOF;
+    }
+    buf += actual;
+    len -= actual;
+    offset += actual;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Moves the slot to the compressed block that follows the one in read_buf, for an entry that continues there.
+ */
+static sparkey_returncode next_block(sparkey_logreader *log, async_slot *s, uint64_t block_end) {
+  sparkey_log_segment *seg = sparkey_logreader_segment(log, s->position);
+  if (block_end >= seg->base + seg->header.data_end) {
+    return SPARKEY_LOG_TOO_SMALL;
+  }
+  s->position = block_end;
+  s->read_len = 0;
+  s->read_end = 0;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Starts assembling an entry that does not fit in its compressed block.
+ * Such entries are larger than the compression block size, so they are expected to be rare.
+ */
+static sparkey_returncode start_assembly(sparkey_logreader *log, async_slot *s, uint8_t *data, uint64_t len, uint64_t entry_len, uint64_t block_end, parse_result *result) {
+  // Compare what is there of the key before reading any more blocks
+  uint64_t n = len < s->keylen ? len : s->keylen;
+  if (memcmp(data, s->key, n) != 0) {
+    *result = PARSE_MISMATCH;
+    return SPARKEY_SUCCESS;
+  }
+  if (entry_len > s->value_buf_size) {
+    uint8_t *buf = realloc(s->value_buf, entry_len);
+    if (buf == NULL) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    s->value_buf = buf;
+    s->value_buf_size = entry_len;
+  }
+  memcpy(s->value_buf, data, len);
+  s->entry_len = entry_len;
+  s->assembled = len;
+  RETHROW(next_block(log, s, block_end));
+  *result = PARSE_REREAD;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Adds a decompressed block to the entry being assembled, and completes it once all of it is there.
+ */
+static sparkey_returncode continue_assembly(sparkey_logreader *log, async_slot *s, uint8_t *data, uint64_t len, uint64_t block_end, parse_result *result) {
+  uint64_t m = s->entry_len - s->assembled;
+  m = len < m ? len : m;
+  memcpy(&s->value_buf[s->assembled], data, m);
+  s->assembled += m;
+  if (s->assembled < s->entry_len) {
+    RETHROW(next_block(log, s, block_end));
+    *result = PARSE_REREAD;
+    return SPARKEY_SUCCESS;
+  }
+  uint64_t entry_len = s->entry_len;
+  s->entry_len = 0;
+  if (memcmp(s->value_buf, s->key, s->keylen) != 0) {
+    *result = PARSE_MISMATCH;
+    return SPARKEY_SUCCESS;
+  }
+  s->result_state = SPARKEY_ITER_ACTIVE;
+  s->value = &s->value_buf[s->keylen];
+  s->valuelen = entry_len - s->keylen;
+  *result = PARSE_DONE;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode parse_entry(sparkey_hash_async *async, async_slot *s, parse_result *result) {
+  sparkey_logreader *log = &async->reader->log;
+  uint8_t *entry;
+  uint64_t entry_len;
+  uint64_t off = 0;
+  uint64_t block_end = 0;
+
+  if (sparkey_uses_compressor(log->header.compression_type)) {
+    uint64_t p = 0;
+    uint32_t compressed_size = read_vlq(s->read_buf, &p);
+    if (p + compressed_size > s->read_len) {
+      return SPARKEY_LOG_TOO_SMALL;
+    }
+    uint32_t uncompressed_size = log->header.compression_block_size;
+    uint64_t start = async->reader->stats != NULL ? sparkey_cycles() : 0;
+    RETHROW(sparkey_compressors[log->header.compression_type].decompress(
+      &s->read_buf[p], compressed_size, s->block_buf, &uncompressed_size));
+    if (async->reader->stats != NULL) {
+      s->info.decompress_cycles += sparkey_cycles() - start;
+    }
+    s->info.decompressions++;
+    s->info.decompressed_bytes += uncompressed_size;
+    entry = s->block_buf;
+    entry_len = uncompressed_size;
+    block_end = s->position + p + compressed_size;
+    if (s->entry_len > 0) {
+      return continue_assembly(log, s, entry, entry_len, block_end, result);
+    }
+    if (log_fixed_width(&log->header)) {
+      off = s->entry_index * log_fixed_entry_size(&log->header);
+      if (off > entry_len) {
+        return SPARKEY_INTERNAL_ERROR;
+      }
+    } else {
+      for (int i = 0; i < s->entry_index; i++) {
+        uint64_t a = read_vlq_bounded(entry, &off, entry_len);
+        uint64_t b = read_vlq_bounded(entry, &off, entry_len);
+        off += a == 0 ? b : a - 1 + b;
+        if (off > entry_len) {
+          return SPARKEY_INTERNAL_ERROR;
+        }
+      }
+    }
+  } else {
+    entry = s->read_buf;
+    entry_len = s->read_len;
+  }
+
+  uint64_t a;
+  uint64_t b;
+  if (log_fixed_width(&log->header)) {
+    a = log->header.fixed_key_len + 1;
+    b = log->header.fixed_value_len;
+  } else {
+    a = read_vlq_bounded(entry, &off, entry_len);
+    b = read_vlq_bounded(entry, &off, entry_len);
+  }
+  if (a == 0) {
+    // The index only points to puts
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  uint64_t keylen2 = a - 1;
+  if (keylen2 != s->keylen) {
+    *result = PARSE_MISMATCH;
+    return SPARKEY_SUCCESS;
+  }
+  uint64_t end = off + keylen2 + b;
+  if (end > entry_len) {
+    if (sparkey_uses_compressor(log->header.compression_type)) {
+      return start_assembly(log, s, &entry[off], entry_len - off, keylen2 + b, block_end, result);
+    }
+    if (s->read_len < s->read_size) {
+      return SPARKEY_LOG_TOO_SMALL;
+    }
+    if (end > s->read_buf_size) {
+      uint8_t *buf = realloc(s->read_buf, end);
+      if (buf == NULL) {
+        return SPARKEY_INTERNAL_ERROR;
+      }
+      s->read_buf = buf;
+      s->read_buf_size = end;
+    }
+    // Keep what was read, and only read the rest of the entry
+    s->read_end = end;
+    *result = PARSE_REREAD;
+    return SPARKEY_SUCCESS;
+  }
+  if (memcmp(&entry[off], s->key, keylen2) != 0) {
+    *result = PARSE_MISMATCH;
+    return SPARKEY_SUCCESS;
+  }
+  s->result_state = SPARKEY_ITER_ACTIVE;
+  s->value = &entry[off + keylen2];
+  s->valuelen = b;
+  *result = PARSE_DONE;
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Advances a lookup as far as possible without blocking on io_uring.
+ * With the pread backend this always runs the lookup to completion.
+ */
+static void drive(sparkey_hash_async *async, int id, slot_step step) {
+  async_slot *s = &async->slots[id];
+  sparkey_logreader *log = &async->reader->log;
+  sparkey_returncode returncode;
+  while (1) {
+    switch (step) {
+    case STEP_PROBE:
+      switch (probe(async->reader, s)) {
+      case PROBE_MISS:
+        finish(async, id, SPARKEY_SUCCESS, SPARKEY_ITER_INVALID);
+        return;
+      case PROBE_INLINE:
+        finish(async, id, SPARKEY_SUCCESS, SPARKEY_ITER_ACTIVE);
+        return;
+      case PROBE_CANDIDATE:
+        break;
+      }
+      s->read_len = 0;
+      s->read_end = 0;
+      s->entry_len = 0;
+      step = STEP_READ;
+      break;
+    case STEP_READ: {
+      sparkey_log_segment *seg = sparkey_logreader_segment(log, s->position);
+      if (s->read_end == 0) {
+        s->read_end = read_length(seg, s);
+        s->info.block_position = s->position;
+      }
+      uint8_t *buf = &s->read_buf[s->read_len];
+      uint64_t len = s->read_end - s->read_len;
+      uint64_t offset = s->position - seg->base + s->read_len;
+#ifdef SPARKEY_USE_IO_URING
+      if (async->use_ring) {
+        uring_queue_read(&async->ring, seg->fd, buf, len, offset, id);
+        return;
+      }
+#endif
+      TRY(pread_full(seg->fd, buf, len, offset), error);
+      s->read_len = s->read_end;
+      step = STEP_PARSE;
+      break;
+    }
+    case STEP_PARSE: {
+      parse_result result;
+      TRY(parse_entry(async, s, &result), error);
+      switch (result) {
+      case PARSE_DONE:
+        finish(async, id, SPARKEY_SUCCESS, s->result_state);
+        return;
+      case PARSE_MISMATCH:
+        step = STEP_PROBE;
+        break;
+      case PARSE_REREAD:
+        step = STEP_READ;
+        break;
+      }
+      break;
+    }
+    }
+  }
+error:
+  finish(async, id, returncode, SPARKEY_ITER_INVALID);
+}
+
+#ifdef SPARKEY_USE_IO_URING
+static void reap(sparkey_hash_async *async) {
+  uring *r = &async->ring;
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    int id = (int) cqe->user_data;
+    int res = cqe->res;
+    head++;
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    r->in_flight--;
+
+    async_slot *s = &async->slots[id];
+    if (res < 0) {
+      finish(async, id, SPARKEY_INTERNAL_ERROR, SPARKEY_ITER_INVALID);
+    } else if ((uint64_t) res < s->read_end - s->read_len) {
+      finish(async, id, SPARKEY_UNEXPECTED_EOF, SPARKEY_ITER_INVALID);
+    } else {
+      s->read_len = s->read_end;
+      drive(async, id, STEP_PARSE);
+    }
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  }
+}
+
+/**
+ * Submits the queued reads and waits for min_complete completions.
+ * EAGAIN and EBUSY mean the kernel is short of resources or the completion queue is full,
+ * which reaping completions resolves, so they are retried. Completions reaped that way
+ * already count, so the retry does not wait; callers wait again if they still need results.
+ */
+static sparkey_returncode enter(sparkey_hash_async *async, unsigned min_complete) {
+  while (1) {
+    int err = uring_enter(&async->ring, min_complete);
+    if (err == 0) {
+      return SPARKEY_SUCCESS;
+    }
+    if (err != EAGAIN && err != EBUSY) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    reap(async);
+    min_complete = 0;
+  }
+}
+#endif
+
+static void free_slots(sparkey_hash_async *async) {
+  if (async->slots == NULL) {
+    return;
+  }
+  for (int i = 0; i < async->queue_depth; i++) {
+    async_slot *s = &async->slots[i];
+    free(s->key);
+    free(s->read_buf);
+    free(s->block_buf);
+    free(s->value_buf);
+  }
+  free(async->slots);
+}
+
+sparkey_returncode sparkey_hash_async_create(sparkey_hash_async **async_ref, sparkey_hashreader *reader, int queue_depth) {
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (queue_depth < 1) {
+    return SPARKEY_INVALID_QUEUE_DEPTH;
+  }
+  sparkey_logreader *log = &reader->log;
+
+  sparkey_hash_async *async = calloc(1, sizeof(sparkey_hash_async));
+  if (async == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_returncode returncode;
+  async->reader = reader;
+  async->queue_depth = queue_depth;
+  async->slots = calloc(queue_depth, sizeof(async_slot));
+  async->free_slots = malloc(queue_depth * sizeof(int));
+  async->done = malloc(queue_depth * sizeof(int));
+  async->delivered = malloc(queue_depth * sizeof(int));
+  if (async->slots == NULL || async->free_slots == NULL || async->done == NULL || async->delivered == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, cleanup);
+  }
+
+  uint64_t read_buf_size;
+  int compressed = sparkey_uses_compressor(log->header.compression_type);
+  if (compressed) {
+    read_buf_size = 10 + sparkey_compressors[log->header.compression_type].max_compressed_size(log->header.compression_block_size);
+  } else {
+    read_buf_size = 20 + log->header.max_key_len + log->header.max_value_len;
+    if (read_buf_size > ASYNC_INITIAL_READ) {
+      read_buf_size = ASYNC_INITIAL_READ;
+    }
+  }
+
+  for (int i = 0; i < queue_depth; i++) {
+    async_slot *s = &async->slots[i];
+    s->state = SLOT_FREE;
+    s->key = malloc(1 + reader->header.max_key_len);
+    s->read_size = read_buf_size;
+    s->read_buf_size = read_buf_size;
+    s->read_buf = malloc(read_buf_size);
+    if (s->key == NULL || s->read_buf == NULL) {
+      TRY(SPARKEY_INTERNAL_ERROR, cleanup);
+    }
+    if (compressed) {
+      s->block_buf = malloc(log->header.compression_block_size);
+      if (s->block_buf == NULL) {
+        TRY(SPARKEY_INTERNAL_ERROR, cleanup);
+      }
+    }
+    async->free_slots[i] = queue_depth - 1 - i;
+  }
+  async->num_free = queue_depth;
+
+  async->use_ring = 0;
+#ifdef SPARKEY_USE_IO_URING
+  // Fall back to pread if io_uring is unavailable, e.g. old kernel or seccomp.
+  if (uring_init(&async->ring, queue_depth) == 0) {
+    async->use_ring = 1;
+  }
+#endif
+
+  async->open_status = MAGIC_VALUE_HASHASYNC;
+  *async_ref = async;
+  return SPARKEY_SUCCESS;
+
+cleanup:
+  free_slots(async);
+  free(async->free_slots);
+  free(async->done);
+  free(async->delivered);
+  free(async);
+  return returncode;
+}
+
+void sparkey_hash_async_close(sparkey_hash_async **async_ref) {
+  if (async_ref == NULL) {
+    return;
+  }
+  sparkey_hash_async *async = *async_ref;
+  if (async == NULL) {
+    return;
+  }
+  if (async->open_status != MAGIC_VALUE_HASHASYNC) {
+    return;
+  }
+  async->open_status = 0;
+#ifdef SPARKEY_USE_IO_URING
+  if (async->use_ring) {
+    // Reads still in flight target our buffers, wait for them before freeing.
+    while (async->ring.in_flight > 0) {
+      if (enter(async, 1) != SPARKEY_SUCCESS) {
+        break;
+      }
+      reap(async);
+    }
+    if (async->ring.in_flight > 0) {
+      // The ring is unusable, so the kernel may still write into the buffers at any time. Leak them instead.
+      *async_ref = NULL;
+      return;
+    }
+    uring_close(&async->ring);
+  }
+#endif
+  free_slots(async);
+  free(async->free_slots);
+  free(async->done);
+  free(async->delivered);
+  free(async);
+  *async_ref = NULL;
+}
+
+sparkey_returncode sparkey_hash_async_submit(sparkey_hash_async *async, const uint8_t *key, uint64_t keylen, void *userdata) {
+  RETHROW(assert_async_open(async));
+  if (async->num_free == 0) {
+    return SPARKEY_ASYNC_QUEUE_FULL;
+  }
+  sparkey_hashreader *reader = async->reader;
+  int id = async->free_slots[--async->num_free];
+  async_slot *s = &async->slots[id];
+  s->state = SLOT_PENDING;
+  s->userdata = userdata;
+  s->keylen = keylen;
+  s->value = NULL;
+  s->valuelen = 0;
+  memset(&s->info, 0, sizeof(s->info));
+
+  if (keylen > reader->header.max_key_len || reader->header.num_entries == 0) {
+    finish(async, id, SPARKEY_SUCCESS, SPARKEY_ITER_INVALID);
+    return SPARKEY_SUCCESS;
+  }
+  memcpy(s->key, key, keylen);
+  s->hash = reader->header.hash_algorithm.hash(key, keylen, reader->header.hash_seed);
+  if (reader->header.fingerprint_size > 0) {
+    s->fingerprint = sparkey_hash_fingerprint(&reader->header, key, keylen);
+  }
+  s->slot = s->hash % reader->header.hash_capacity;
+  s->info.slot = s->slot;
+  s->pos = s->slot * (reader->header.address_size + reader->header.hash_size);
+  s->displacement = 0;
+  drive(async, id, STEP_PROBE);
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_hash_async_poll(sparkey_hash_async *async, int min_results, int max_results, sparkey_hash_async_result *results, int *num_results) {
+  RETHROW(assert_async_open(async));
+  *num_results = 0;
+
+  for (int i = 0; i < async->num_delivered; i++) {
+    int id = async->delivered[i];
+    async->slots[id].state = SLOT_FREE;
+    async->free_slots[async->num_free++] = id;
+  }
+  async->num_delivered = 0;
+
+  int outstanding = async->queue_depth - async->num_free;
+  if (min_results > outstanding) {
+    min_results = outstanding;
+  }
+  if (min_results > max_results) {
+    min_results = max_results;
+  }
+
+#ifdef SPARKEY_USE_IO_URING
+  if (async->use_ring) {
+    do {
+      unsigned wait = async->num_done < min_results ? 1 : 0;
+      if (async->ring.to_submit > 0 || wait > 0) {
+        RETHROW(enter(async, wait));
+      }
+      reap(async);
+    } while (async->num_done < min_results);
+    // Reads queued while handling completions should not wait for the next poll.
+    if (async->ring.to_submit > 0) {
+      RETHROW(enter(async, 0));
+    }
+  }
+#endif
+
+  while (async->num_done > 0 && *num_results < max_results) {
+    int id = async->done[async->done_head];
+    async->done_head = (async->done_head + 1) % async->queue_depth;
+    async->num_done--;
+
+    async_slot *s = &async->slots[id];
+    s->state = SLOT_DELIVERED;
+    async->delivered[async->num_delivered++] = id;
+
+    sparkey_hash_async_result *r = &results[(*num_results)++];
+    r->userdata = s->userdata;
+    r->returncode = s->returncode;
+    r->state = s->result_state;
+    r->value = s->value;
+    r->valuelen = s->valuelen;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+int sparkey_hash_async_pending(sparkey_hash_async *async) {
+  return async->queue_depth - async->num_free - async->num_delivered;
+}
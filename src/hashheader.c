@@ -21,6 +21,7 @@
 #include "hashheader.h"
 #include "endiantools.h"
 #include "util.h"
+#include "MurmurHash3.h"
 #include "sparkey.h"
 
 void print_hashheader(sparkey_hashheader *header) {
@@ -31,6 +32,15 @@ void print_hashheader(sparkey_hashheader *header) {
   printf("Num entries: %"PRIu64", Capacity: %"PRIu64"\n", header->num_entries, header->hash_capacity);
   printf("Num collisions: %"PRIu64", Max displacement: %"PRIu64", Average displacement: %.2f\n", header->hash_collisions, header->max_displacement, (double) header->total_displacement / (double) header->num_entries);
   printf("Data size: %"PRIu64", Garbage size: %"PRIu64"\n", header->data_end, header->garbage_size);
+  if (header->num_segments > 1) {
+    printf("Log segments: %d\n", header->num_segments);
+  }
+  if (header->inline_size > 0) {
+    printf("Inline size: %d\n", header->inline_size);
+  }
+  if (header->fingerprint_size > 0) {
+    printf("Fingerprint size: %d bit\n", 8 * header->fingerprint_size);
+  }
 }
 
 static sparkey_returncode hashheader_version0(sparkey_hashheader *header, FILE *fp) {
@@ -52,6 +62,9 @@ static sparkey_returncode hashheader_version0(sparkey_hashheader *header, FILE *
   RETHROW(fread_little_endian64(fp, &header->hash_collisions));
   RETHROW(fread_little_endian64(fp, &header->total_displacement));
   header->header_size = HASH_HEADER_SIZE;
+  header->num_segments = 1;
+  header->inline_size = 0;
+  header->fingerprint_size = 0;
 
   header->hash_algorithm = sparkey_get_hash_algorithm(header->hash_size);
   if (header->hash_algorithm.hash == NULL) {
@@ -72,9 +85,42 @@ static sparkey_returncode hashheader_version0(sparkey_hashheader *header, FILE *
 }
 
 
+static sparkey_returncode hashheader_version2(sparkey_hashheader *header, FILE *fp) {
+  RETHROW(hashheader_version0(header, fp));
+  RETHROW(fread_little_endian32(fp, &header->num_segments));
+  if (header->num_segments < 1 || header->num_segments > (1 << 20)) {
+    return SPARKEY_HASH_HEADER_CORRUPT;
+  }
+  header->header_size = HASH_HEADER_SIZE + 4 + header->num_segments * HASH_SEGMENT_ENTRY_SIZE;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode hashheader_version3(sparkey_hashheader *header, FILE *fp) {
+  RETHROW(hashheader_version2(header, fp));
+  if (fseek(fp, header->header_size, SEEK_SET) != 0) {
+    return SPARKEY_HASH_HEADER_CORRUPT;
+  }
+  RETHROW(fread_little_endian32(fp, &header->inline_size));
+  if (header->inline_size > HASH_MAX_INLINE_SIZE) {
+    return SPARKEY_HASH_HEADER_CORRUPT;
+  }
+  header->header_size += 4;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode hashheader_version4(sparkey_hashheader *header, FILE *fp) {
+  RETHROW(hashheader_version3(header, fp));
+  RETHROW(fread_little_endian32(fp, &header->fingerprint_size));
+  if (header->fingerprint_size > HASH_MAX_FINGERPRINT_SIZE) {
+    return SPARKEY_HASH_HEADER_CORRUPT;
+  }
+  header->header_size += 4;
+  return SPARKEY_SUCCESS;
+}
+
 typedef sparkey_returncode (*loader)(sparkey_hashheader *header, FILE *fp);
 
-static loader loaders[2] = { hashheader_version0, hashheader_version0 };
+static loader loaders[5] = { hashheader_version0, hashheader_version0, hashheader_version2, hashheader_version3, hashheader_version4 };
 
 sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const char *filename) {
 	FILE *fp = fopen(filename, "r");
@@ -109,10 +155,42 @@ sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const cha
 	return x;
 }
 
-sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header) {
+sparkey_returncode sparkey_load_hash_segments(sparkey_hashheader *header, const char *filename, sparkey_hash_segment *segments) {
+  if (header->minor_version < HASH_SEGMENTS_MINOR_VERSION) {
+    segments[0].file_identifier = header->file_identifier;
+    segments[0].data_end = header->data_end;
+    return SPARKEY_SUCCESS;
+  }
+  FILE *fp = fopen(filename, "r");
+  if (fp == NULL) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  if (fseek(fp, HASH_HEADER_SIZE + 4, SEEK_SET) != 0) {
+    TRY(SPARKEY_HASH_TOO_SMALL, close);
+  }
+  for (uint32_t i = 0; i < header->num_segments; i++) {
+    TRY(fread_little_endian32(fp, &segments[i].file_identifier), close);
+    TRY(fread_little_endian64(fp, &segments[i].data_end), close);
+  }
+close:
+  fclose(fp);
+  return returncode;
+}
+
+uint32_t sparkey_hash_fingerprint(const sparkey_hashheader *header, const uint8_t *key, uint64_t keylen) {
+  // Inverting the seed gives a hash that is independent of the one in the slot, even for 4 byte hashes
+  uint32_t fingerprint = murmurhash32_hash(key, keylen, ~header->hash_seed);
+  if (header->fingerprint_size < 4) {
+    fingerprint &= (1U << (8 * header->fingerprint_size)) - 1;
+  }
+  return fingerprint;
+}
+
+sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header, sparkey_hash_segment *segments) {
   RETHROW(fwrite_little_endian32(fd, HASH_MAGIC_NUMBER));
   RETHROW(fwrite_little_endian32(fd, HASH_MAJOR_VERSION));
-  RETHROW(fwrite_little_endian32(fd, HASH_MINOR_VERSION));
+  RETHROW(fwrite_little_endian32(fd, header->minor_version));
   RETHROW(fwrite_little_endian32(fd, header->file_identifier));
   RETHROW(fwrite_little_endian32(fd, header->hash_seed));
   RETHROW(fwrite_little_endian64(fd, header->data_end));
@@ -128,6 +206,19 @@ sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header) {
   RETHROW(fwrite_little_endian32(fd, header->entry_block_bits));
   RETHROW(fwrite_little_endian64(fd, header->hash_collisions));
   RETHROW(fwrite_little_endian64(fd, header->total_displacement));
+  if (header->minor_version >= HASH_SEGMENTS_MINOR_VERSION) {
+    RETHROW(fwrite_little_endian32(fd, header->num_segments));
+    for (uint32_t i = 0; i < header->num_segments; i++) {
+      RETHROW(fwrite_little_endian32(fd, segments[i].file_identifier));
+      RETHROW(fwrite_little_endian64(fd, segments[i].data_end));
+    }
+  }
+  if (header->minor_version >= HASH_INLINE_MINOR_VERSION) {
+    RETHROW(fwrite_little_endian32(fd, header->inline_size));
+  }
+  if (header->minor_version >= HASH_FINGERPRINT_MINOR_VERSION) {
+    RETHROW(fwrite_little_endian32(fd, header->fingerprint_size));
+  }
 
   return SPARKEY_SUCCESS;
 }
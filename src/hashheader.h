@@ -24,8 +24,17 @@
 
 #define HASH_MAGIC_NUMBER (0x9a11318f)
 #define HASH_MAJOR_VERSION (1)
-#define HASH_MINOR_VERSION (1)
+#define HASH_MINOR_VERSION (4)
 #define HASH_HEADER_SIZE (112)
+/* Minor version 2 appends a segment count and a segment table to the version 1 header */
+#define HASH_SEGMENTS_MINOR_VERSION (2)
+#define HASH_SEGMENT_ENTRY_SIZE (12)
+/* Minor version 3 appends the inline size after the segment table, and an inline record per slot after the table */
+#define HASH_INLINE_MINOR_VERSION (3)
+#define HASH_MAX_INLINE_SIZE (254)
+/* Minor version 4 appends the fingerprint size after the inline size, and a fingerprint per slot after the table */
+#define HASH_FINGERPRINT_MINOR_VERSION (4)
+#define HASH_MAX_FINGERPRINT_SIZE (4)
 
 typedef struct {
   uint32_t major_version;
@@ -50,8 +59,19 @@ typedef struct {
   uint64_t hash_collisions;
   uint64_t total_displacement;
   sparkey_hash_algorithm hash_algorithm;
+  uint32_t num_segments;
+  uint32_t inline_size;
+  uint32_t fingerprint_size;
 } sparkey_hashheader;
 
+/**
+ * A log segment as recorded in the hash file.
+ */
+typedef struct {
+  uint32_t file_identifier;
+  uint64_t data_end;
+} sparkey_hash_segment;
+
 /**
  * fills up a hashheader struct based on the contents at the beginning of the file.
  * @param header header struct to fill
@@ -60,6 +80,16 @@ typedef struct {
  */
 sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const char *filename);
 
+/**
+ * Reads the segment table of a hash file. Files older than minor version 2
+ * always have a single segment, described by the header itself.
+ * @param header the header of the hash file, as loaded by sparkey_load_hashheader.
+ * @param filename the hash file
+ * @param segments array of at least header->num_segments entries to fill.
+ * @returns an error code if it could not read the file.
+ */
+sparkey_returncode sparkey_load_hash_segments(sparkey_hashheader *header, const char *filename, sparkey_hash_segment *segments);
+
 /**
  * Dumps a human readable representation of the header to stdout
  * @param header an initialized header struct
@@ -67,12 +97,15 @@ sparkey_returncode sparkey_load_hashheader(sparkey_hashheader *header, const cha
 void print_hashheader(sparkey_hashheader *header);
 
 /**
- * Writes a header to the current position in the file
+ * Writes a header to the current position in the file.
+ * The segment table is only written if header->minor_version is at least 2,
+ * the inline size if it is at least 3 and the fingerprint size if it is at least 4.
  * @param fd a file descripter pointing to a file open for writing
  * @param header the header to write
+ * @param segments the segment table, with header->num_segments entries
  * @returns an error code if it could not write to file.
  */
-sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header);
+sparkey_returncode write_hashheader(int fd, sparkey_hashheader *header, sparkey_hash_segment *segments);
 
 static inline uint64_t get_displacement(uint64_t capacity, uint64_t slot, uint64_t hash) {
   uint64_t wanted_slot = hash % capacity;
@@ -87,6 +120,60 @@ static inline uint64_t read_addr(uint8_t *hashtable, uint64_t pos, int address_s
   return -1;
 }
 
+/**
+ * Computes the fingerprint of a key, which is independent of the hash stored in the slot.
+ * @returns the lowest 8 * header->fingerprint_size bits of the fingerprint.
+ */
+uint32_t sparkey_hash_fingerprint(const sparkey_hashheader *header, const uint8_t *key, uint64_t keylen);
+
+/**
+ * @returns the size of the hash table, including the fingerprints and inline records.
+ */
+static inline uint64_t hash_table_size(const sparkey_hashheader *header) {
+  uint64_t slot_size = header->address_size + header->hash_size + header->fingerprint_size;
+  if (header->inline_size > 0) {
+    slot_size += header->inline_size + 2;
+  }
+  return slot_size * header->hash_capacity;
+}
+
+/**
+ * The fingerprints follow the hash table, one per slot, each header->fingerprint_size bytes.
+ * @returns a pointer to the fingerprint of the slot.
+ */
+static inline uint8_t * hash_fingerprint_slot(const sparkey_hashheader *header, uint8_t *hashtable, uint64_t slot) {
+  uint64_t slot_size = header->address_size + header->hash_size;
+  return hashtable + header->hash_capacity * slot_size + slot * header->fingerprint_size;
+}
+
+static inline uint32_t read_fingerprint(const uint8_t *buf, uint32_t size) {
+  uint32_t fingerprint = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    fingerprint |= (uint32_t) buf[i] << (8 * i);
+  }
+  return fingerprint;
+}
+
+static inline void write_fingerprint(uint8_t *buf, uint32_t fingerprint, uint32_t size) {
+  for (uint32_t i = 0; i < size; i++) {
+    buf[i] = fingerprint >> (8 * i);
+  }
+}
+
+/**
+ * The inline records follow the fingerprints, one per slot, each header->inline_size + 2 bytes.
+ * A record starts with the key length plus one, or zero if the entry of the slot is not inlined,
+ * followed by the value length, the key and the value.
+ * @param header the header of the hash file
+ * @param hashtable the start of the hash table
+ * @param slot the slot of the entry
+ * @returns a pointer to the inline record of the slot.
+ */
+static inline uint8_t * hash_inline_record(const sparkey_hashheader *header, uint8_t *hashtable, uint64_t slot) {
+  uint64_t slot_size = header->address_size + header->hash_size + header->fingerprint_size;
+  return hashtable + header->hash_capacity * slot_size + slot * (header->inline_size + 2);
+}
+
 static inline void write_addr(uint8_t *buf, uint64_t value, int address_size) {
   switch (address_size) {
   case 4: write_little_endian32(buf, value); return;
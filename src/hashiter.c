@@ -20,27 +20,48 @@
 #include "sparkey-internal.h"
 #include "hashiter.h"
 
-uint64_t sparkey_iter_hash(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log) {
+static void key_hashes(sparkey_hashheader *hash_header, const uint8_t *key, uint64_t keylen, uint64_t *hash, uint32_t *fingerprint) {
+  if (hash != NULL) {
+    *hash = hash_header->hash_algorithm.hash(key, keylen, hash_header->hash_seed);
+  }
+  if (fingerprint != NULL) {
+    *fingerprint = sparkey_hash_fingerprint(hash_header, key, keylen);
+  }
+}
+
+static void iter_key_hashes(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log, uint64_t *hash, uint32_t *fingerprint) {
   uint8_t *buf;
   uint64_t len;
+  if (hash != NULL) {
+    *hash = 0;
+  }
+  if (fingerprint != NULL) {
+    *fingerprint = 0;
+  }
   sparkey_returncode returncode = sparkey_logiter_keychunk(iter, log, 1 << 31, &buf, &len);
   if (returncode != SPARKEY_SUCCESS) {
-    return 0;
+    return;
   }
   if (len == iter->keylen) {
-    return hash_header->hash_algorithm.hash(buf, len, hash_header->hash_seed);
+    key_hashes(hash_header, buf, len, hash, fingerprint);
   } else {
     uint8_t *keybuf = malloc(iter->keylen);
     memcpy(keybuf, buf, len);
     uint64_t len2;
     returncode = sparkey_logiter_fill_key(iter, log, 1 << 31, keybuf + len, &len2);
-    if (len + len2 != iter->keylen) {
-      free(keybuf);
-      return 0;
+    if (len + len2 == iter->keylen) {
+      key_hashes(hash_header, keybuf, iter->keylen, hash, fingerprint);
     }
-    uint64_t hash = hash_header->hash_algorithm.hash(keybuf, iter->keylen, hash_header->hash_seed);
     free(keybuf);
-    return hash;
   }
 }
 
+uint64_t sparkey_iter_hash(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log) {
+  uint64_t hash;
+  iter_key_hashes(hash_header, iter, log, &hash, NULL);
+  return hash;
+}
+
+void sparkey_iter_hash_fingerprint(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log, uint64_t *hash, uint32_t *fingerprint) {
+  iter_key_hashes(hash_header, iter, log, hash, fingerprint);
+}
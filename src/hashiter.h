@@ -22,5 +22,11 @@
 
 uint64_t sparkey_iter_hash(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log);
 
+/**
+ * Computes both the hash and the fingerprint of the key of the current entry, reading the key once.
+ * See \ref sparkey_hash_fingerprint. Consumes the key, like sparkey_iter_hash.
+ */
+void sparkey_iter_hash_fingerprint(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log, uint64_t *hash, uint32_t *fingerprint);
+
 #endif
 
@@ -28,8 +28,66 @@
 #include "sparkey-internal.h"
 
 #define MAGIC_VALUE_HASHREADER (0x75103df9)
+#define MAGIC_VALUE_LIVEITER (0x3e1b07a5)
+
+/* How far a liveiter steps through an uncompressed log to the next live entry, in bytes, before seeking instead */
+#define LIVEITER_MAX_STEP (1 << 16)
+
+/* Configure with --disable-latency to compile out the phase timing in sparkey_hash_get */
+#ifdef SPARKEY_NO_LATENCY
+#define LATENCY_ENABLED (0)
+#else
+#define LATENCY_ENABLED (1)
+#endif
+
+struct sparkey_liveiter {
+  uint32_t open_status;
+  uint32_t file_identifier;
+  // the live entries, or NULL if the liveness bitmap is used
+  sparkey_live_entry *entries;
+  uint64_t count;
+  sparkey_liveness liveness;
+  // the next live entry, or the next log entry when using the bitmap
+  uint64_t next;
+};
 
 sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader_ref, const char *hash_filename, const char *log_filename) {
+  return sparkey_hash_open_mode(reader_ref, hash_filename, log_filename, SPARKEY_READ_MMAP);
+}
+
+sparkey_returncode sparkey_hash_open_mode(sparkey_hashreader **reader_ref, const char *hash_filename, const char *log_filename, sparkey_read_mode mode) {
+  return sparkey_hash_open_segments(reader_ref, hash_filename, 1, &log_filename, mode);
+}
+
+/**
+ * Verifies that the log segments are the ones the hash file was built from.
+ * The last segment may have grown since, all others must be unchanged.
+ */
+static sparkey_returncode check_segments(sparkey_hashreader *reader, const char *hash_filename) {
+  if (reader->header.num_segments != (uint32_t) reader->log.num_segments) {
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
+  }
+  sparkey_hash_segment *segments = malloc(reader->header.num_segments * sizeof(sparkey_hash_segment));
+  if (segments == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_returncode returncode;
+  TRY(sparkey_load_hash_segments(&reader->header, hash_filename, segments), done);
+  for (int i = 0; i < reader->log.num_segments; i++) {
+    sparkey_logheader *h = &reader->log.segments[i].header;
+    if (segments[i].file_identifier != h->file_identifier) {
+      TRY(SPARKEY_FILE_IDENTIFIER_MISMATCH, done);
+    }
+    if (i + 1 < reader->log.num_segments && segments[i].data_end != h->data_end) {
+      TRY(SPARKEY_FILE_IDENTIFIER_MISMATCH, done);
+    }
+  }
+done:
+  free(segments);
+  return returncode;
+}
+
+sparkey_returncode sparkey_hash_open_segments(sparkey_hashreader **reader_ref, const char *hash_filename, int num_segments, const char * const *log_filenames, sparkey_read_mode mode) {
   RETHROW(correct_endian_platform());
 
   sparkey_returncode returncode;
@@ -40,13 +98,17 @@ sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader_ref, const char
   }
 
   reader->open_status = 0;
+  reader->trace = NULL;
+  reader->stats = NULL;
+  reader->latency = NULL;
 
   TRY(sparkey_load_hashheader(&reader->header, hash_filename), free_reader);
-  TRY(sparkey_logreader_open_noalloc(&reader->log, log_filename), free_reader);
+  TRY(sparkey_logreader_open_noalloc(&reader->log, num_segments, log_filenames, mode), free_reader);
   if (reader->header.file_identifier != reader->log.header.file_identifier) {
     returncode = SPARKEY_FILE_IDENTIFIER_MISMATCH;
     goto close_reader;
   }
+  TRY(check_segments(reader, hash_filename), close_reader);
   if (reader->header.data_end > reader->log.header.data_end) {
     returncode = SPARKEY_HASH_HEADER_CORRUPT;
     goto close_reader;
@@ -67,7 +129,7 @@ sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader_ref, const char
     goto close_reader;
   }
 
-  reader->data_len = reader->header.header_size + reader->header.hash_capacity * (reader->header.hash_size + reader->header.address_size);
+  reader->data_len = reader->header.header_size + hash_table_size(&reader->header);
 
   struct stat s;
   stat(hash_filename, &s);
@@ -116,6 +178,9 @@ void sparkey_hash_close(sparkey_hashreader **reader_ref) {
     reader->fd = -1;
   }
 
+  sparkey_trace_free(reader->trace);
+  sparkey_stats_free(reader->stats);
+  sparkey_latency_free(reader->latency);
   free(reader);
   *reader_ref = NULL;
 }
@@ -127,9 +192,41 @@ static sparkey_returncode assert_reader_open(sparkey_hashreader *reader) {
   return SPARKEY_SUCCESS;
 }
 
-sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter) {
-  RETHROW(assert_reader_open(reader));
+/**
+ * @returns the current time if the lookup is timed, otherwise 0.
+ */
+static inline uint64_t timestamp(const sparkey_lookup_info *info) {
+  return LATENCY_ENABLED && info->timed ? sparkey_cycles() : 0;
+}
+
+/**
+ * Seeks to the entry at address and reads its header.
+ * Adds the decompression work done on the way to info.
+ */
+static sparkey_returncode seek_entry(sparkey_hashreader *reader, sparkey_logiter *iter, uint64_t position, int entry_index, sparkey_lookup_info *info) {
+  uint64_t decompressions = iter->decompressions;
+  uint64_t decompressed_bytes = iter->decompressed_bytes;
+  uint64_t decompress_cycles = iter->decompress_cycles;
+  uint64_t block_reuses = iter->block_reuses;
+  uint64_t start = timestamp(info);
+  RETHROW(sparkey_logiter_seek(iter, &reader->log, position));
+  RETHROW(sparkey_logiter_skip(iter, &reader->log, entry_index));
+  RETHROW(sparkey_logiter_next(iter, &reader->log));
+  info->seek_cycles += timestamp(info) - start;
+  info->decompressions += iter->decompressions - decompressions;
+  info->decompressed_bytes += iter->decompressed_bytes - decompressed_bytes;
+  info->decompress_cycles += iter->decompress_cycles - decompress_cycles;
+  if (sparkey_uses_compressor(reader->log.header.compression_type)) {
+    info->block_reuses += iter->block_reuses - block_reuses;
+  }
+  info->block_position = position;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode hash_get(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter, sparkey_lookup_info *info) {
+  uint64_t start = timestamp(info);
   uint64_t hash = reader->header.hash_algorithm.hash(key, keylen, reader->header.hash_seed);
+  info->hash_cycles = timestamp(info) - start;
   uint64_t wanted_slot = hash % reader->header.hash_capacity;
 
   int slot_size = reader->header.address_size + reader->header.hash_size;
@@ -139,20 +236,41 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
   uint64_t slot = wanted_slot;
 
   uint8_t *hashtable = reader->data + reader->header.header_size;
+  // computed on the first hash match
+  int64_t fingerprint = -1;
 
+  info->slot = wanted_slot;
   while (1) {
+    info->probe_length++;
     uint64_t hash2 = reader->header.hash_algorithm.read_hash(hashtable, pos);
     uint64_t position2 = read_addr(hashtable, pos + reader->header.hash_size, reader->header.address_size);
     if (position2 == 0) {
       iter->state = SPARKEY_ITER_INVALID;
       return SPARKEY_SUCCESS;
     }
+    uint64_t address2 = position2;
     int entry_index2 = (int) (position2) & reader->header.entry_block_bitmask;
     position2 >>= reader->header.entry_block_bits;
-    if (hash == hash2) {
-      RETHROW(sparkey_logiter_seek(iter, &reader->log, position2));
-      RETHROW(sparkey_logiter_skip(iter, &reader->log, entry_index2));
-      RETHROW(sparkey_logiter_next(iter, &reader->log));
+    int match = hash == hash2;
+    if (match && reader->header.fingerprint_size > 0) {
+      // A different fingerprint means a different key, so the log is not needed
+      if (fingerprint < 0) {
+        fingerprint = sparkey_hash_fingerprint(&reader->header, key, keylen);
+      }
+      match = fingerprint == read_fingerprint(hash_fingerprint_slot(&reader->header, hashtable, slot), reader->header.fingerprint_size);
+    }
+    uint8_t *record = reader->header.inline_size > 0 ? hash_inline_record(&reader->header, hashtable, slot) : NULL;
+    if (match && record != NULL && record[0] != 0) {
+      // The entry is stored in the hash file, so the log is not needed
+      if (record[0] - 1u == keylen && memcmp(&record[2], key, keylen) == 0) {
+        // Consume the key, like a lookup in the log does
+        RETHROW(sparkey_logiter_set_entry(iter, &reader->log, &record[2], keylen, record[1], 1));
+        info->found = 1;
+        info->address = address2;
+        return SPARKEY_SUCCESS;
+      }
+    } else if (match) {
+      RETHROW(seek_entry(reader, iter, position2, entry_index2, info));
       uint64_t keylen2 = iter->keylen;
       if (iter->type != SPARKEY_ENTRY_PUT) {
         iter->state = SPARKEY_ITER_INVALID;
@@ -161,6 +279,7 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
       if (keylen == keylen2) {
         uint64_t pos2 = 0;
         int equals = 1;
+        start = timestamp(info);
         while (pos2 < keylen) {
           uint8_t *buf2;
           uint64_t len2;
@@ -171,7 +290,10 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
           }
           pos2 += len2;
         }
+        info->compare_cycles += timestamp(info) - start;
         if (equals) {
+          info->found = 1;
+          info->address = address2;
           return SPARKEY_SUCCESS;
         }
       }
@@ -193,6 +315,40 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
   return SPARKEY_INTERNAL_ERROR;
 }
 
+static sparkey_returncode lookup(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter, sparkey_lookup_info *info) {
+  RETHROW(assert_reader_open(reader));
+  memset(info, 0, sizeof(*info));
+  info->timed = LATENCY_ENABLED && reader->latency != NULL;
+  iter->time_decompression = reader->stats != NULL || info->timed;
+  uint64_t start = timestamp(info);
+  sparkey_returncode returncode = hash_get(reader, key, keylen, iter, info);
+  if (returncode == SPARKEY_SUCCESS) {
+    if (info->timed) {
+      info->total_cycles = timestamp(info) - start;
+      sparkey_latency_lookup(reader->latency, info);
+    }
+    if (reader->trace != NULL) {
+      sparkey_trace_lookup(reader->trace, info);
+    }
+    if (reader->stats != NULL) {
+      sparkey_stats_lookup(reader->stats, info);
+    }
+  }
+  return returncode;
+}
+
+sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter) {
+  sparkey_lookup_info info;
+  return lookup(reader, key, keylen, iter, &info);
+}
+
+sparkey_returncode sparkey_hash_get_address(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter, uint64_t *address) {
+  sparkey_lookup_info info;
+  RETHROW(lookup(reader, key, keylen, iter, &info));
+  *address = info.address;
+  return SPARKEY_SUCCESS;
+}
+
 sparkey_returncode sparkey_logiter_hashnext(sparkey_logiter *iter, sparkey_hashreader *reader) {
   RETHROW(assert_reader_open(reader));
 
@@ -255,3 +411,180 @@ uint64_t sparkey_hash_numcollisions(sparkey_hashreader *reader) {
   return reader->header.hash_collisions;
 }
 
+
+static int cmp_address(const void *a, const void *b) {
+  uint64_t x = ((const sparkey_live_entry *) a)->address;
+  uint64_t y = ((const sparkey_live_entry *) b)->address;
+  return x < y ? -1 : x > y;
+}
+
+sparkey_returncode sparkey_hash_live_entries(sparkey_hashreader *reader, sparkey_live_entry **entries, uint64_t *count) {
+  RETHROW(assert_reader_open(reader));
+  sparkey_hashheader *header = &reader->header;
+  sparkey_live_entry *live = malloc(header->num_entries * sizeof(sparkey_live_entry) + 1);
+  if (live == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  uint8_t *hashtable = reader->data + header->header_size;
+  int slot_size = header->address_size + header->hash_size;
+  uint64_t n = 0;
+  for (uint64_t slot = 0; slot < header->hash_capacity; slot++) {
+    uint64_t pos = slot * slot_size;
+    uint64_t address = read_addr(hashtable, pos + header->hash_size, header->address_size);
+    if (address == 0) {
+      continue;
+    }
+    if (n == header->num_entries) {
+      free(live);
+      return SPARKEY_HASH_HEADER_CORRUPT;
+    }
+    live[n].address = address;
+    live[n].hash = header->hash_algorithm.read_hash(hashtable, pos);
+    n++;
+  }
+  qsort(live, n, sizeof(sparkey_live_entry), cmp_address);
+  *entries = live;
+  *count = n;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_liveiter_create(sparkey_liveiter **live_ref, sparkey_hashreader *reader) {
+  RETHROW(assert_reader_open(reader));
+  sparkey_liveiter *live = malloc(sizeof(sparkey_liveiter));
+  if (live == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_returncode returncode;
+  live->liveness.data = NULL;
+  TRY(sparkey_hash_live_entries(reader, &live->entries, &live->count), free_live);
+  live->open_status = MAGIC_VALUE_LIVEITER;
+  live->file_identifier = reader->header.file_identifier;
+  live->next = 0;
+  *live_ref = live;
+  return SPARKEY_SUCCESS;
+
+free_live:
+  free(live);
+  return returncode;
+}
+
+sparkey_returncode sparkey_liveiter_create_bitmap(sparkey_liveiter **live_ref, sparkey_hashreader *reader, const char *liveness_filename) {
+  RETHROW(assert_reader_open(reader));
+  sparkey_liveiter *live = malloc(sizeof(sparkey_liveiter));
+  if (live == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_returncode returncode;
+  TRY(sparkey_liveness_open(&live->liveness, liveness_filename, reader->header.file_identifier, reader->header.data_end), free_live);
+  if (live->liveness.num_live != reader->header.num_entries) {
+    sparkey_liveness_close(&live->liveness);
+    TRY(SPARKEY_LIVENESS_CORRUPT, free_live);
+  }
+  live->open_status = MAGIC_VALUE_LIVEITER;
+  live->file_identifier = reader->header.file_identifier;
+  live->entries = NULL;
+  live->count = live->liveness.num_entries;
+  live->next = 0;
+  *live_ref = live;
+  return SPARKEY_SUCCESS;
+
+free_live:
+  free(live);
+  return returncode;
+}
+
+void sparkey_liveiter_close(sparkey_liveiter **live_ref) {
+  if (live_ref == NULL) {
+    return;
+  }
+  sparkey_liveiter *live = *live_ref;
+  if (live == NULL || live->open_status != MAGIC_VALUE_LIVEITER) {
+    return;
+  }
+  live->open_status = 0;
+  free(live->entries);
+  sparkey_liveness_close(&live->liveness);
+  free(live);
+  *live_ref = NULL;
+}
+
+/**
+ * Reads the log sequentially and stops at the entries marked as live in the bitmap.
+ */
+static sparkey_returncode bitmap_next(sparkey_liveiter *live, sparkey_hashreader *reader, sparkey_logiter *iter) {
+  if (live->next == 0) {
+    RETHROW(sparkey_logiter_seek(iter, &reader->log, 0));
+  }
+  const uint8_t *bits = live->liveness.bits;
+  while (live->next < live->count) {
+    RETHROW(sparkey_logiter_next(iter, &reader->log));
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      // The bitmap has more entries than the log
+      iter->state = SPARKEY_ITER_INVALID;
+      return SPARKEY_LIVENESS_CORRUPT;
+    }
+    uint64_t i = live->next++;
+    if (bits[i / 8] & (1 << (i % 8))) {
+      return SPARKEY_SUCCESS;
+    }
+  }
+  iter->state = SPARKEY_ITER_CLOSED;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_liveiter_next(sparkey_liveiter *live, sparkey_hashreader *reader, sparkey_logiter *iter) {
+  RETHROW(assert_reader_open(reader));
+  if (live->open_status != MAGIC_VALUE_LIVEITER) {
+    return SPARKEY_LOG_ITERATOR_CLOSED;
+  }
+  if (live->file_identifier != reader->header.file_identifier) {
+    return SPARKEY_FILE_IDENTIFIER_MISMATCH;
+  }
+  if (live->next == live->count) {
+    iter->state = SPARKEY_ITER_CLOSED;
+    return SPARKEY_SUCCESS;
+  }
+  if (live->entries == NULL) {
+    return bitmap_next(live, reader, iter);
+  }
+
+  uint64_t address = live->entries[live->next++].address;
+  uint64_t block = address >> reader->header.entry_block_bits;
+  int count = address & reader->header.entry_block_bitmask;
+
+  // In an uncompressed log every entry is its own block. Step over the dead entries up to a nearby
+  // live one, so that PREAD modes keep reading from the current window instead of seeking per entry.
+  // Block position 0 is never a log block, it means the iterator is not on a log entry.
+  if (reader->log.header.compression_type == SPARKEY_COMPRESSION_NONE && iter->state == SPARKEY_ITER_ACTIVE &&
+      iter->entry_block_position != 0 && iter->entry_block_position < block &&
+      block - iter->entry_block_position <= LIVEITER_MAX_STEP) {
+    while (iter->entry_block_position < block) {
+      RETHROW(sparkey_logiter_next(iter, &reader->log));
+      if (iter->state != SPARKEY_ITER_ACTIVE) {
+        break;
+      }
+    }
+    if (iter->state != SPARKEY_ITER_ACTIVE || iter->entry_block_position != block) {
+      // The hash table refers to an entry that does not exist
+      iter->state = SPARKEY_ITER_INVALID;
+      return SPARKEY_HASH_HEADER_CORRUPT;
+    }
+    return SPARKEY_SUCCESS;
+  }
+
+  // Entries later in the current block are reached by stepping, anything else by seeking
+  if (iter->state != SPARKEY_ITER_ACTIVE || iter->entry_block_position != block || iter->entry_count >= count) {
+    RETHROW(sparkey_logiter_seek(iter, &reader->log, block));
+  }
+  while (1) {
+    RETHROW(sparkey_logiter_next(iter, &reader->log));
+    if (iter->state != SPARKEY_ITER_ACTIVE || iter->entry_block_position != block || iter->entry_count > count) {
+      // The hash table refers to an entry that does not exist
+      iter->state = SPARKEY_ITER_INVALID;
+      return SPARKEY_HASH_HEADER_CORRUPT;
+    }
+    if (iter->entry_count == count) {
+      return SPARKEY_SUCCESS;
+    }
+  }
+}
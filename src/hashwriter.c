@@ -76,8 +76,11 @@ static void added_entry(sparkey_hashheader *hash_header) {
   hash_header->num_entries++;
 }
 
-static void replaced_entry(sparkey_hashheader *hash_header, uint64_t keylen, uint64_t valuelen) {
-  hash_header->garbage_size += keylen + valuelen + unsigned_vlq_size(keylen + 1) + unsigned_vlq_size(valuelen);
+static void replaced_entry(sparkey_hashheader *hash_header, sparkey_logreader *log, uint64_t keylen, uint64_t valuelen) {
+  hash_header->garbage_size += keylen + valuelen;
+  if (!log_fixed_width(&log->header)) {
+    hash_header->garbage_size += unsigned_vlq_size(keylen + 1) + unsigned_vlq_size(valuelen);
+  }
 }
 
 static void deleted_entry(sparkey_hashheader *hash_header, uint64_t keylen, uint64_t valuelen) {
@@ -85,6 +88,73 @@ static void deleted_entry(sparkey_hashheader *hash_header, uint64_t keylen, uint
   hash_header->num_entries--;
 }
 
+/**
+ * The fingerprint and inline record of an entry, which are stored next to the hash table
+ * and must move along with the entry whenever it changes slot.
+ */
+typedef struct {
+  uint32_t fingerprint;
+  uint8_t record[HASH_MAX_INLINE_SIZE + 2];
+} slot_extra;
+
+static int has_extra(const sparkey_hashheader *hash_header) {
+  return hash_header->fingerprint_size > 0 || hash_header->inline_size > 0;
+}
+
+static void read_extra(const sparkey_hashheader *hash_header, uint8_t *hashtable, uint64_t slot, slot_extra *extra) {
+  if (hash_header->fingerprint_size > 0) {
+    extra->fingerprint = read_fingerprint(hash_fingerprint_slot(hash_header, hashtable, slot), hash_header->fingerprint_size);
+  }
+  if (hash_header->inline_size > 0) {
+    memcpy(extra->record, hash_inline_record(hash_header, hashtable, slot), hash_header->inline_size + 2);
+  }
+}
+
+static void write_extra(const sparkey_hashheader *hash_header, uint8_t *hashtable, uint64_t slot, const slot_extra *extra) {
+  if (hash_header->fingerprint_size > 0) {
+    write_fingerprint(hash_fingerprint_slot(hash_header, hashtable, slot), extra->fingerprint, hash_header->fingerprint_size);
+  }
+  if (hash_header->inline_size > 0) {
+    memcpy(hash_inline_record(hash_header, hashtable, slot), extra->record, hash_header->inline_size + 2);
+  }
+}
+
+static void move_extra(const sparkey_hashheader *hash_header, uint8_t *hashtable, uint64_t from, uint64_t to) {
+  slot_extra extra;
+  read_extra(hash_header, hashtable, from, &extra);
+  write_extra(hash_header, hashtable, to, &extra);
+}
+
+static void clear_extra(const sparkey_hashheader *hash_header, uint8_t *hashtable, uint64_t slot) {
+  if (hash_header->fingerprint_size > 0) {
+    memset(hash_fingerprint_slot(hash_header, hashtable, slot), 0, hash_header->fingerprint_size);
+  }
+  if (hash_header->inline_size > 0) {
+    memset(hash_inline_record(hash_header, hashtable, slot), 0, hash_header->inline_size + 2);
+  }
+}
+
+/**
+ * Fills in the extra of the current put of iter, whose key has already been hashed into fingerprint.
+ * Puts that are small enough are copied into the inline record, which rereads the entry from its block.
+ */
+static sparkey_returncode iter_extra(sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logreader *log, uint32_t fingerprint, slot_extra *extra) {
+  extra->fingerprint = fingerprint;
+  if (hash_header->inline_size == 0) {
+    return SPARKEY_SUCCESS;
+  }
+  memset(extra->record, 0, hash_header->inline_size + 2);
+  if (iter->keylen + iter->valuelen <= hash_header->inline_size) {
+    uint64_t len;
+    RETHROW(sparkey_logiter_reset(iter, log));
+    extra->record[0] = iter->keylen + 1;
+    extra->record[1] = iter->valuelen;
+    RETHROW(sparkey_logiter_fill_key(iter, log, iter->keylen, &extra->record[2], &len));
+    RETHROW(sparkey_logiter_fill_value(iter, log, iter->valuelen, &extra->record[2 + iter->keylen], &len));
+  }
+  return SPARKEY_SUCCESS;
+}
+
 static sparkey_returncode hash_delete(uint64_t wanted_slot, uint64_t hash, uint8_t *hashtable, sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logiter *ra_iter, sparkey_logreader *log) {
   int slot_size = hash_header->address_size + hash_header->hash_size;
   uint64_t pos = wanted_slot * slot_size;
@@ -136,6 +206,7 @@ static sparkey_returncode hash_delete(uint64_t wanted_slot, uint64_t hash, uint8
             uint64_t pos3 = slot * slot_size;
             hash_header->hash_algorithm.write_hash(&hashtable[pos3], hash3);
             write_addr(&hashtable[pos3 + hash_header->hash_size], position3, hash_header->address_size);
+            move_extra(hash_header, hashtable, next_slot, slot);
 
             slot = next_slot;
           }
@@ -143,6 +214,7 @@ static sparkey_returncode hash_delete(uint64_t wanted_slot, uint64_t hash, uint8
           uint64_t pos3 = slot * slot_size;
           hash_header->hash_algorithm.write_hash(&hashtable[pos3], 0);
           write_addr(&hashtable[pos3 + hash_header->hash_size], 0, hash_header->address_size);
+          clear_extra(hash_header, hashtable, slot);
           deleted_entry(hash_header, keylen2, valuelen2);
 
           return SPARKEY_SUCCESS;
@@ -166,13 +238,20 @@ static sparkey_returncode hash_delete(uint64_t wanted_slot, uint64_t hash, uint8
   return SPARKEY_INTERNAL_ERROR;
 }
 
-static sparkey_returncode hash_put(uint64_t wanted_slot, uint64_t hash, uint8_t *hashtable, sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logiter *ra_iter, sparkey_logreader *log, uint64_t position) {
+/**
+ * Inserts an entry. extra is the fingerprint and inline record of the entry, and must be set if the table has them.
+ */
+static sparkey_returncode hash_put(uint64_t wanted_slot, uint64_t hash, uint8_t *hashtable, sparkey_hashheader *hash_header, sparkey_logiter *iter, sparkey_logiter *ra_iter, sparkey_logreader *log, uint64_t position, const slot_extra *extra) {
   int slot_size = hash_header->address_size + hash_header->hash_size;
   uint64_t pos = wanted_slot * slot_size;
 
   uint64_t displacement = 0;
   uint64_t slot = wanted_slot;
 
+  // The extras of stolen slots, alternating since the one being placed may be the previous one
+  slot_extra displaced[2];
+  int next_displaced = 0;
+
   int might_be_collision = iter != NULL && ra_iter != NULL && log != NULL;
   while (1) {
     uint64_t hash2 = hash_header->hash_algorithm.read_hash(hashtable, pos);
@@ -180,6 +259,9 @@ static sparkey_returncode hash_put(uint64_t wanted_slot, uint64_t hash, uint8_t
     if (position2 == 0) {
       hash_header->hash_algorithm.write_hash(&hashtable[pos], hash);
       write_addr(&hashtable[pos + hash_header->hash_size], position, hash_header->address_size);
+      if (extra != NULL) {
+        write_extra(hash_header, hashtable, slot, extra);
+      }
       added_entry(hash_header);
       return SPARKEY_SUCCESS;
     }
@@ -204,7 +286,10 @@ static sparkey_returncode hash_put(uint64_t wanted_slot, uint64_t hash, uint8_t
         if (cmp == 0) {
           hash_header->hash_algorithm.write_hash(&hashtable[pos], hash);
           write_addr(&hashtable[pos + hash_header->hash_size], position, hash_header->address_size);
-          replaced_entry(hash_header, keylen2, valuelen2);
+          if (extra != NULL) {
+            write_extra(hash_header, hashtable, slot, extra);
+          }
+          replaced_entry(hash_header, log, keylen2, valuelen2);
           return SPARKEY_SUCCESS;
         }
       }
@@ -215,6 +300,12 @@ static sparkey_returncode hash_put(uint64_t wanted_slot, uint64_t hash, uint8_t
       // Steal the slot, and move the other one
       hash_header->hash_algorithm.write_hash(&hashtable[pos], hash);
       write_addr(&hashtable[pos + hash_header->hash_size], position, hash_header->address_size);
+      if (extra != NULL) {
+        read_extra(hash_header, hashtable, slot, &displaced[next_displaced]);
+        write_extra(hash_header, hashtable, slot, extra);
+        extra = &displaced[next_displaced];
+        next_displaced ^= 1;
+      }
       position = position2;
       displacement = other_displacement;
       hash = hash2;
@@ -295,48 +386,77 @@ static sparkey_returncode read_fully(int fd, uint8_t *buf, size_t count) {
   return SPARKEY_SUCCESS;
 }
 
-static sparkey_returncode hash_copy(uint8_t *hashtable, uint8_t *buf, size_t buffer_size, sparkey_hashheader *old_header, sparkey_hashheader *new_header) {
+static sparkey_returncode read_at(int fd, uint8_t *buf, size_t count, uint64_t offset) {
+  if (lseek(fd, offset, SEEK_SET) < 0) {
+    fprintf(stderr, "read_at():%d bug: could not seek to %"PRIu64", errno = %d\n", __LINE__, offset, errno);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  return read_fully(fd, buf, count);
+}
+
+/**
+ * Inserts the entries of num_slots slots of the old hash table, with their fingerprints and inline records.
+ */
+static sparkey_returncode hash_copy(uint8_t *hashtable, uint8_t *buf, uint8_t *fingerprints, uint8_t *records, uint64_t num_slots, sparkey_hashheader *old_header, sparkey_hashheader *new_header) {
   int slot_size = old_header->address_size + old_header->hash_size;
-  for (unsigned int i = 0; i < buffer_size; i += slot_size) {
-    uint64_t hash = old_header->hash_algorithm.read_hash(buf, i);
-    uint64_t position = read_addr(buf, i + old_header->hash_size, old_header->address_size);
+  slot_extra extra;
+  for (uint64_t slot = 0; slot < num_slots; slot++) {
+    uint64_t hash = old_header->hash_algorithm.read_hash(buf, slot * slot_size);
+    uint64_t position = read_addr(buf, slot * slot_size + old_header->hash_size, old_header->address_size);
 
     int entry_index = (int) (position) & old_header->entry_block_bitmask;
     position >>= old_header->entry_block_bits;
 
     uint64_t wanted_slot = hash % new_header->hash_capacity;
     if (position != 0) {
-      RETHROW(hash_put(wanted_slot, hash, hashtable, new_header, NULL, NULL, NULL, (position << new_header->entry_block_bits) | entry_index));
+      if (old_header->fingerprint_size > 0) {
+        extra.fingerprint = read_fingerprint(&fingerprints[slot * old_header->fingerprint_size], old_header->fingerprint_size);
+      }
+      if (old_header->inline_size > 0) {
+        memcpy(extra.record, &records[slot * (old_header->inline_size + 2)], old_header->inline_size + 2);
+      }
+      RETHROW(hash_put(wanted_slot, hash, hashtable, new_header, NULL, NULL, NULL, (position << new_header->entry_block_bits) | entry_index,
+                       has_extra(new_header) ? &extra : NULL));
     }
   }
   return SPARKEY_SUCCESS;
 }
 
+/**
+ * Inserts all entries of the old hash file. The inline and fingerprint sizes of both headers must be the same.
+ */
 static sparkey_returncode fill_hash(uint8_t *hashtable, const char *hash_filename, sparkey_hashheader *old_header, sparkey_hashheader *new_header) {
   int fd = open(hash_filename, O_RDONLY);
   if (fd < 0) {
     return sparkey_open_returncode(errno);
   }
 
-  lseek(fd, old_header->header_size, SEEK_SET);
-
   int slot_size = old_header->address_size + old_header->hash_size;
-  uint64_t buffer_size = slot_size * 1024;
+  int fingerprint_size = old_header->fingerprint_size;
+  int record_size = old_header->inline_size > 0 ? old_header->inline_size + 2 : 0;
+  uint64_t chunk_slots = 1024;
+  uint64_t buffer_size = (slot_size + fingerprint_size + record_size) * chunk_slots;
   uint8_t *buf = malloc(buffer_size);
   if (buf == NULL) {
     fprintf(stderr, "fill_hash():%d bug: could not malloc %"PRIu64" bytes\n", __LINE__, buffer_size);
+    close(fd);
     return SPARKEY_INTERNAL_ERROR;
   }
+  uint8_t *fingerprints = buf + slot_size * chunk_slots;
+  uint8_t *records = fingerprints + fingerprint_size * chunk_slots;
+
+  uint64_t capacity = old_header->hash_capacity;
+  uint64_t fingerprints_start = old_header->header_size + capacity * slot_size;
+  uint64_t records_start = fingerprints_start + capacity * fingerprint_size;
 
   sparkey_returncode returncode = SPARKEY_SUCCESS;
-  uint64_t remaining = old_header->hash_capacity * slot_size;
-  while (buffer_size <= remaining) {
-    TRY(read_fully(fd, buf, buffer_size), free);
-    TRY(hash_copy(hashtable, buf, buffer_size, old_header, new_header), free);
-    remaining -= buffer_size;
+  for (uint64_t first = 0; first < capacity; first += chunk_slots) {
+    uint64_t n = capacity - first < chunk_slots ? capacity - first : chunk_slots;
+    TRY(read_at(fd, buf, n * slot_size, old_header->header_size + first * slot_size), free);
+    TRY(read_at(fd, fingerprints, n * fingerprint_size, fingerprints_start + first * fingerprint_size), free);
+    TRY(read_at(fd, records, n * record_size, records_start + first * record_size), free);
+    TRY(hash_copy(hashtable, buf, fingerprints, records, n, old_header, new_header), free);
   }
-  TRY(read_fully(fd, buf, remaining), free);
-  TRY(hash_copy(hashtable, buf, remaining, old_header, new_header), free);
 
 free:
   free(buf);
@@ -350,16 +470,196 @@ free:
   return returncode;
 }
 
+static void init_address_layout(sparkey_hashheader *hash_header, sparkey_logheader *log_header) {
+  hash_header->entry_block_bits = int_log2(log_header->max_entries_per_block);
+  hash_header->entry_block_bitmask = (1 << hash_header->entry_block_bits) - 1;
+
+  if (log_header->data_end < (1ULL << (32 - hash_header->entry_block_bits))) {
+    hash_header->address_size = 4;
+  } else {
+    hash_header->address_size = 8;
+  }
+}
+
+static sparkey_returncode write_hashfile(const char *hash_filename, sparkey_hashheader *hash_header, sparkey_hash_segment *segments, uint8_t *hashtable, uint64_t hashsize) {
+  // Try removing it first, to avoid overwriting existing files that readers may be using.
+  if (remove(hash_filename) < 0) {
+    int e = errno;
+    if (e != ENOENT) {
+      return sparkey_remove_returncode(e);
+    }
+  }
+
+  int fd = creat(hash_filename, 00644);
+  if (fd < 0) {
+    return sparkey_create_returncode(errno);
+  }
+  hash_header->major_version = HASH_MAJOR_VERSION;
+  // Only use the newer formats when needed, so single log files stay readable by older versions
+  if (hash_header->fingerprint_size > 0) {
+    hash_header->minor_version = HASH_FINGERPRINT_MINOR_VERSION;
+  } else if (hash_header->inline_size > 0) {
+    hash_header->minor_version = HASH_INLINE_MINOR_VERSION;
+  } else {
+    hash_header->minor_version = hash_header->num_segments > 1 ? HASH_SEGMENTS_MINOR_VERSION : 1;
+  }
+
+  sparkey_returncode returncode;
+  TRY(write_hashheader(fd, hash_header, segments), close_hash);
+  TRY(write_full(fd, hashtable, hashsize), close_hash);
+
+close_hash:
+  close(fd);
+  return returncode;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Writes the liveness bitmap for a finished hash table, given the addresses of all entries in the log.
+ */
+static sparkey_returncode write_liveness(const char *liveness_filename, sparkey_hashheader *hash_header, uint8_t *hashtable, sparkey_address_list *addresses) {
+  uint64_t *live = malloc(hash_header->num_entries * sizeof(uint64_t) + 1);
+  if (live == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  int slot_size = hash_header->address_size + hash_header->hash_size;
+  uint64_t n = 0;
+  for (uint64_t slot = 0; slot < hash_header->hash_capacity && n < hash_header->num_entries; slot++) {
+    uint64_t address = read_addr(hashtable, slot * slot_size + hash_header->hash_size, hash_header->address_size);
+    if (address != 0) {
+      live[n++] = address;
+    }
+  }
+  qsort(live, n, sizeof(uint64_t), cmp_u64);
+  sparkey_returncode returncode = sparkey_liveness_write(liveness_filename, hash_header->file_identifier,
+      hash_header->data_end, addresses->count, addresses, live, n);
+  free(live);
+  return returncode;
+}
+
+/**
+ * Records the addresses of the entries before end, which an incremental build does not visit otherwise.
+ * This reads the part of the log the old hash file covers, so it is only done when a liveness bitmap is wanted.
+ */
+static sparkey_returncode record_addresses(sparkey_logiter *iter, sparkey_logreader *log, sparkey_hashheader *hash_header, uint64_t end, sparkey_address_list *addresses) {
+  RETHROW(sparkey_logiter_seek(iter, log, 0));
+  while (1) {
+    RETHROW(sparkey_logiter_next(iter, log));
+    if (iter->state != SPARKEY_ITER_ACTIVE || iter->block_position >= end) {
+      return SPARKEY_SUCCESS;
+    }
+    RETHROW(sparkey_addresses_add(addresses, (iter->block_position << hash_header->entry_block_bits) | iter->entry_count));
+  }
+}
+
+/**
+ * Checks if the liveness bitmap next to a hash file was written together with it.
+ */
+static int liveness_current(const char *liveness_filename, sparkey_hashheader *hash_header) {
+  sparkey_liveness liveness;
+  if (sparkey_liveness_open(&liveness, liveness_filename, hash_header->file_identifier, hash_header->data_end) != SPARKEY_SUCCESS) {
+    return 0;
+  }
+  int res = liveness.num_live == hash_header->num_entries;
+  sparkey_liveness_close(&liveness);
+  return res;
+}
+
+/**
+ * Writes the liveness bitmap of a new hash file if it was asked for, and otherwise removes
+ * the bitmap of an earlier build, which no longer matches.
+ */
+static sparkey_returncode finish_liveness(const char *liveness_filename, int write_bitmap, sparkey_hashheader *hash_header, uint8_t *hashtable, sparkey_address_list *addresses) {
+  if (liveness_filename == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  if (!write_bitmap) {
+    remove(liveness_filename);
+    return SPARKEY_SUCCESS;
+  }
+  return write_liveness(liveness_filename, hash_header, hashtable, addresses);
+}
+
+/**
+ * Checks if an existing hash file covers a prefix of the log segments, so that it can be extended
+ * instead of rebuilt. All covered segments must be unchanged, except the last one which may have grown.
+ */
+static int covers_prefix(sparkey_hashheader *old_header, const char *hash_filename, sparkey_logreader *log) {
+  if (old_header->num_segments > (uint32_t) log->num_segments) {
+    return 0;
+  }
+  sparkey_hash_segment *old_segments = malloc(old_header->num_segments * sizeof(sparkey_hash_segment));
+  if (old_segments == NULL) {
+    return 0;
+  }
+  int res = sparkey_load_hash_segments(old_header, hash_filename, old_segments) == SPARKEY_SUCCESS;
+  for (uint32_t i = 0; res && i < old_header->num_segments; i++) {
+    sparkey_logheader *h = &log->segments[i].header;
+    if (old_segments[i].file_identifier != h->file_identifier) {
+      res = 0;
+    } else if (i + 1 < old_header->num_segments && old_segments[i].data_end != h->data_end) {
+      res = 0;
+    } else if (old_segments[i].data_end > h->data_end) {
+      res = 0;
+    }
+  }
+  free(old_segments);
+  return res;
+}
+
 sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log_filename, int hash_size) {
+  return sparkey_hash_write_segments(hash_filename, 1, &log_filename, hash_size);
+}
+
+sparkey_returncode sparkey_hash_write_segments(const char *hash_filename, int num_segments, const char * const *log_filenames, int hash_size) {
+  return sparkey_hash_write_profiled(hash_filename, num_segments, log_filenames, hash_size, NULL);
+}
+
+/**
+ * Adds the cycles since *clock to *phase and restarts the clock. Does nothing if clock is NULL.
+ */
+static inline void lap(uint64_t *clock, uint64_t *phase) {
+  if (clock != NULL) {
+    uint64_t now = sparkey_cycles();
+    *phase += now - *clock;
+    *clock = now;
+  }
+}
+
+/**
+ * Builds the hash file. If options is NULL, the inline and fingerprint sizes of the existing hash file are kept,
+ * and no liveness bitmap is written.
+ */
+static sparkey_returncode hash_build(const char *hash_filename, int num_segments, const char * const *log_filenames, int hash_size, const sparkey_hash_options *options, sparkey_hash_build_profile *profile) {
+  // Phase times in cycles, only measured when profiling
+  uint64_t start_cycles = sparkey_cycles();
+  uint64_t now = start_cycles;
+  uint64_t *clock = profile != NULL ? &now : NULL;
+  uint64_t setup_cycles = 0, copy_cycles = 0, read_cycles = 0, hash_cycles = 0;
+  uint64_t insert_cycles = 0, displacement_cycles = 0, write_cycles = 0;
+  uint64_t decompress_cycles = 0;
+  uint64_t entries = 0;
+  uint64_t hashsize = 0;
+
   sparkey_logheader log_header;
   sparkey_logreader *log;
   sparkey_logiter *iter = NULL;
   sparkey_logiter *ra_iter = NULL;
+  sparkey_hash_segment *segments = NULL;
 
-  RETHROW(sparkey_load_logheader(&log_header, log_filename));
-
-  RETHROW(sparkey_logreader_open(&log, log_filename));
+  RETHROW(sparkey_logreader_open_segments(&log, num_segments, log_filenames, SPARKEY_READ_MMAP));
+  log_header = log->header;
   sparkey_returncode returncode = SPARKEY_SUCCESS;
+  // Hash files with the standard extension can get a liveness bitmap next to them
+  char *liveness_filename = sparkey_create_liveness_filename(hash_filename);
+  int write_bitmap = liveness_filename != NULL && options != NULL && options->liveness;
+  sparkey_address_list addresses;
+  sparkey_addresses_init(&addresses);
   TRY(sparkey_logiter_create(&iter, log), close_reader);
   TRY(sparkey_logiter_create(&ra_iter, log), close_iter);
 
@@ -372,10 +672,20 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   int copy_old;
   uint32_t old_hash_size = 0;
   returncode = sparkey_load_hashheader(&old_header, hash_filename);
+  if (options != NULL) {
+    hash_header.inline_size = options->inline_size;
+    hash_header.fingerprint_size = options->fingerprint_size;
+  } else if (returncode == SPARKEY_SUCCESS) {
+    hash_header.inline_size = old_header.inline_size;
+    hash_header.fingerprint_size = old_header.fingerprint_size;
+  } else {
+    hash_header.inline_size = 0;
+    hash_header.fingerprint_size = 0;
+  }
   if (returncode == SPARKEY_SUCCESS &&
-      old_header.file_identifier == log_header.file_identifier &&
       old_header.major_version == HASH_MAJOR_VERSION &&
-      old_header.minor_version == HASH_MINOR_VERSION) {
+      old_header.minor_version >= 1 &&
+      covers_prefix(&old_header, hash_filename, log)) {
     // Prepare to copy stuff from old header
     cap = ((log_header.num_puts - old_header.num_puts) + old_header.num_entries) * 1.3;
     start = old_header.data_end;
@@ -401,14 +711,7 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   hash_header.data_end = log_header.data_end;
   hash_header.num_puts = log_header.num_puts;
 
-  hash_header.entry_block_bits = int_log2(log_header.max_entries_per_block);
-  hash_header.entry_block_bitmask = (1 << hash_header.entry_block_bits) - 1;
-
-  if (hash_header.data_end < (1ULL << (32 - hash_header.entry_block_bits))) {
-    hash_header.address_size = 4;
-  } else {
-    hash_header.address_size = 8;
-  }
+  init_address_layout(&hash_header, &log_header);
   if (old_hash_size == 8 || hash_header.hash_capacity >= (1 << 23)) {
     hash_header.hash_size = 8;
   } else {
@@ -425,10 +728,13 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   if (hash_header.hash_size != old_hash_size) {
     copy_old = 0;
   }
+  if (copy_old && (old_header.inline_size != hash_header.inline_size || old_header.fingerprint_size != hash_header.fingerprint_size)) {
+    // The old slots have no fingerprints or inline records of the new sizes, so every entry has to be read again
+    copy_old = 0;
+  }
   hash_header.hash_algorithm = sparkey_get_hash_algorithm(hash_header.hash_size);
 
-  int slot_size = hash_header.hash_size + hash_header.address_size;
-  uint64_t hashsize = slot_size * hash_header.hash_capacity;
+  hashsize = hash_table_size(&hash_header);
   uint8_t *hashtable = malloc(hashsize);
   if (hashtable == NULL) {
     fprintf(stderr, "sparkey_hash_write():%d bug: could not malloc %"PRIu64" bytes\n", __LINE__, hashsize);
@@ -441,16 +747,26 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
   hash_header.total_displacement = 0;
   hash_header.num_entries = 0;
   hash_header.hash_collisions = 0;
+  lap(clock, &setup_cycles);
 
   if (copy_old) {
-    if (old_header.data_end == log->header.data_end) {
+    if (old_header.data_end == log->header.data_end && old_header.num_segments == (uint32_t) num_segments &&
+        old_header.inline_size == hash_header.inline_size && old_header.fingerprint_size == hash_header.fingerprint_size &&
+        (!write_bitmap || liveness_current(liveness_filename, &old_header))) {
       // Nothing needs to be done - just exit
       goto close_iter;
     }
     TRY(fill_hash(hashtable, hash_filename, &old_header, &hash_header), free_hashtable);
+    if (write_bitmap) {
+      TRY(record_addresses(iter, log, &hash_header, start, &addresses), free_hashtable);
+    }
     TRY(sparkey_logiter_seek(iter, log, start), free_hashtable);
+    lap(clock, &copy_cycles);
   }
 
+  slot_extra entry_extra;
+  slot_extra *extra = has_extra(&hash_header) ? &entry_extra : NULL;
+  iter->time_decompression = profile != NULL;
   while (1) {
     TRY(sparkey_logiter_next(iter, log), free_hashtable);
     switch (iter->state) {
@@ -468,54 +784,187 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
 
     uint64_t iter_block_start = iter->block_position;
     uint64_t iter_entry_count = iter->entry_count;
+    if (write_bitmap) {
+      TRY(sparkey_addresses_add(&addresses, (iter_block_start << hash_header.entry_block_bits) | iter_entry_count), free_hashtable);
+    }
+    entries++;
+    lap(clock, &read_cycles);
 
-    uint64_t key_hash = sparkey_iter_hash(&hash_header, iter, log);
+    uint64_t key_hash;
+    uint32_t fingerprint = 0;
+    if (hash_header.fingerprint_size > 0 && iter->type == SPARKEY_ENTRY_PUT) {
+      sparkey_iter_hash_fingerprint(&hash_header, iter, log, &key_hash, &fingerprint);
+    } else {
+      key_hash = sparkey_iter_hash(&hash_header, iter, log);
+    }
     uint64_t wanted_slot = key_hash % hash_header.hash_capacity;
+    lap(clock, &hash_cycles);
 
     switch (iter->type) {
     case SPARKEY_ENTRY_PUT:
-      TRY(hash_put(wanted_slot, key_hash, hashtable, &hash_header, iter, ra_iter, log, (iter_block_start << hash_header.entry_block_bits) | iter_entry_count), free_hashtable);
+      if (extra != NULL) {
+        TRY(iter_extra(&hash_header, iter, log, fingerprint, extra), free_hashtable);
+      }
+      TRY(hash_put(wanted_slot, key_hash, hashtable, &hash_header, iter, ra_iter, log, (iter_block_start << hash_header.entry_block_bits) | iter_entry_count, extra), free_hashtable);
       break;
     case SPARKEY_ENTRY_DELETE:
       hash_header.garbage_size += 1 + unsigned_vlq_size(iter->keylen) + iter->keylen;
       TRY(hash_delete(wanted_slot, key_hash, hashtable, &hash_header, iter, ra_iter, log), free_hashtable);
       break;
     }
+    lap(clock, &insert_cycles);
   }
 normal_exit:
+  lap(clock, &read_cycles);
+  decompress_cycles = iter->decompress_cycles;
 
   calculate_max_displacement(&hash_header, hashtable);
+  lap(clock, &displacement_cycles);
 
-  // Try removing it first, to avoid overwriting existing files that readers may be using.
-  if (remove(hash_filename) < 0) {
-    int e = errno;
-    if (e != ENOENT) {
-      returncode = sparkey_remove_returncode(e);
-      goto free_hashtable;
-    }
+  segments = malloc(num_segments * sizeof(sparkey_hash_segment));
+  if (segments == NULL) {
+    returncode = SPARKEY_INTERNAL_ERROR;
+    goto free_hashtable;
   }
-  int fd = creat(hash_filename, 00644);
-  hash_header.major_version = HASH_MAJOR_VERSION;
-  hash_header.minor_version = HASH_MINOR_VERSION;
+  for (int i = 0; i < num_segments; i++) {
+    segments[i].file_identifier = log->segments[i].header.file_identifier;
+    segments[i].data_end = log->segments[i].header.data_end;
+  }
+
+  hash_header.num_segments = num_segments;
   hash_header.file_identifier = log_header.file_identifier;
   hash_header.data_end = log_header.data_end;
-
-  TRY(write_hashheader(fd, &hash_header), close_hash);
-  TRY(write_full(fd, hashtable, hashsize), close_hash);
-
-close_hash:
-  close(fd);
+  TRY(write_hashfile(hash_filename, &hash_header, segments, hashtable, hashsize), free_hashtable);
+  TRY(finish_liveness(liveness_filename, write_bitmap, &hash_header, hashtable, &addresses), free_hashtable);
+  lap(clock, &write_cycles);
 
 free_hashtable:
   free(hashtable);
+  free(segments);
 
 close_iter:
   sparkey_logiter_close(&iter);
   sparkey_logiter_close(&ra_iter);
 
 close_reader:
+  if (profile != NULL) {
+    sparkey_calibrate_cycles();
+    profile->entries = entries;
+    profile->table_bytes = hashsize;
+    profile->total_ns = sparkey_cycles_to_ns(sparkey_cycles() - start_cycles);
+    profile->copy_ns = sparkey_cycles_to_ns(copy_cycles);
+    profile->read_ns = sparkey_cycles_to_ns(read_cycles > decompress_cycles ? read_cycles - decompress_cycles : 0);
+    profile->decompress_ns = sparkey_cycles_to_ns(decompress_cycles);
+    profile->hash_ns = sparkey_cycles_to_ns(hash_cycles);
+    profile->insert_ns = sparkey_cycles_to_ns(insert_cycles);
+    profile->displacement_ns = sparkey_cycles_to_ns(displacement_cycles);
+    profile->write_ns = sparkey_cycles_to_ns(write_cycles);
+  }
+  sparkey_addresses_free(&addresses);
+  free(liveness_filename);
   sparkey_logreader_close(&log);
 
   return returncode;
 }
 
+sparkey_returncode sparkey_hash_write_profiled(const char *hash_filename, int num_segments, const char * const *log_filenames, int hash_size, sparkey_hash_build_profile *profile) {
+  return hash_build(hash_filename, num_segments, log_filenames, hash_size, NULL, profile);
+}
+
+sparkey_returncode sparkey_hash_write_opts(const char *hash_filename, int num_segments, const char * const *log_filenames, const sparkey_hash_options *options) {
+  if (options->inline_size > HASH_MAX_INLINE_SIZE) {
+    return SPARKEY_INLINE_SIZE_INVALID;
+  }
+  if (options->fingerprint_size > HASH_MAX_FINGERPRINT_SIZE) {
+    return SPARKEY_FINGERPRINT_SIZE_INVALID;
+  }
+  return hash_build(hash_filename, num_segments, log_filenames, options->hash_size, options, NULL);
+}
+
+sparkey_returncode sparkey_hash_write_known(const char *hash_filename, const char *log_filename, uint32_t hash_seed, const sparkey_hash_options *options, uint64_t num_hashes, const uint64_t *hashes) {
+  sparkey_logreader *log;
+  sparkey_logiter *iter = NULL;
+  uint8_t *hashtable = NULL;
+
+  RETHROW(sparkey_logreader_open(&log, log_filename));
+  sparkey_returncode returncode;
+  TRY(sparkey_logiter_create(&iter, log), close_reader);
+
+  sparkey_hashheader hash_header;
+  memset(&hash_header, 0, sizeof(hash_header));
+  hash_header.hash_capacity = 1 | (uint64_t) (num_hashes * 1.3);
+  hash_header.hash_seed = hash_seed;
+  hash_header.hash_size = options->hash_size;
+  hash_header.hash_algorithm = sparkey_get_hash_algorithm(options->hash_size);
+  hash_header.inline_size = options->inline_size;
+  hash_header.fingerprint_size = options->fingerprint_size;
+  hash_header.max_key_len = log->header.max_key_len;
+  hash_header.max_value_len = log->header.max_value_len;
+  hash_header.num_puts = log->header.num_puts;
+  hash_header.num_segments = 1;
+  hash_header.file_identifier = log->header.file_identifier;
+  hash_header.data_end = log->header.data_end;
+  init_address_layout(&hash_header, &log->header);
+
+  uint64_t hashsize = hash_table_size(&hash_header);
+  hashtable = calloc(1, hashsize);
+  if (hashtable == NULL) {
+    fprintf(stderr, "sparkey_hash_write_known():%d bug: could not malloc %"PRIu64" bytes\n", __LINE__, hashsize);
+    TRY(SPARKEY_INTERNAL_ERROR, close_iter);
+  }
+
+  // The keys are known to be distinct, so the slots can be filled without comparing any keys.
+  // The keys are only read for the fingerprints and inline records.
+  slot_extra entry_extra;
+  slot_extra *extra = has_extra(&hash_header) ? &entry_extra : NULL;
+  uint64_t i = 0;
+  while (1) {
+    TRY(sparkey_logiter_next(iter, log), close_iter);
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    if (iter->type != SPARKEY_ENTRY_PUT || i >= num_hashes) {
+      fprintf(stderr, "sparkey_hash_write_known():%d bug: log does not match the %"PRIu64" known hashes\n", __LINE__, num_hashes);
+      TRY(SPARKEY_INTERNAL_ERROR, close_iter);
+    }
+    uint64_t hash = hashes[i++];
+    uint64_t position = (iter->block_position << hash_header.entry_block_bits) | iter->entry_count;
+    if (extra != NULL) {
+      uint32_t fingerprint = 0;
+      if (hash_header.fingerprint_size > 0) {
+        sparkey_iter_hash_fingerprint(&hash_header, iter, log, NULL, &fingerprint);
+      }
+      TRY(iter_extra(&hash_header, iter, log, fingerprint, extra), close_iter);
+    }
+    TRY(hash_put(hash % hash_header.hash_capacity, hash, hashtable, &hash_header, NULL, NULL, NULL, position, extra), close_iter);
+  }
+  if (i != num_hashes) {
+    fprintf(stderr, "sparkey_hash_write_known():%d bug: log does not match the %"PRIu64" known hashes\n", __LINE__, num_hashes);
+    TRY(SPARKEY_INTERNAL_ERROR, close_iter);
+  }
+
+  calculate_max_displacement(&hash_header, hashtable);
+  sparkey_hash_segment segment;
+  segment.file_identifier = hash_header.file_identifier;
+  segment.data_end = hash_header.data_end;
+  TRY(write_hashfile(hash_filename, &hash_header, &segment, hashtable, hashsize), close_iter);
+
+  char *liveness_filename = sparkey_create_liveness_filename(hash_filename);
+  if (liveness_filename != NULL) {
+    if (options->liveness) {
+      // Every entry is live, so the bitmap needs no addresses
+      returncode = sparkey_liveness_write(liveness_filename, hash_header.file_identifier, hash_header.data_end, num_hashes, NULL, NULL, num_hashes);
+    } else {
+      remove(liveness_filename);
+    }
+    free(liveness_filename);
+  }
+
+close_iter:
+  free(hashtable);
+  sparkey_logiter_close(&iter);
+
+close_reader:
+  sparkey_logreader_close(&log);
+  return returncode;
+}
@@ -0,0 +1,228 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+
+/*
+ * Log-linear histograms, like HdrHistogram with one significant digit in base 8:
+ * values below 8 have a bucket each, and every power of two above that is split
+ * into 8 buckets, which bounds the relative error to 12.5%.
+ * Values of 2^MAX_EXPONENT cycles or more end up in the last bucket.
+ */
+#define SUB_BUCKET_BITS (3)
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define MAX_EXPONENT (47)
+#define NUM_BUCKETS ((MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS)
+
+/* Histograms are big, so use fewer shards than the counters in stats.c */
+#define LATENCY_SHARDS (16)
+#define CACHE_LINE_SIZE (64)
+
+typedef struct {
+  uint64_t count[SPARKEY_NUM_PHASES];
+  uint64_t sum[SPARKEY_NUM_PHASES];
+  uint64_t max[SPARKEY_NUM_PHASES];
+  uint64_t buckets[SPARKEY_NUM_PHASES][NUM_BUCKETS];
+} latency_shard;
+
+/* Shards are padded to whole cache lines */
+#define SHARD_SIZE ((sizeof(latency_shard) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+
+struct sparkey_latency {
+  uint8_t *shards;
+};
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double cycles_per_ns = 1.0;
+
+static uint64_t now_ns() {
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t start_ns = now_ns();
+  uint64_t start_cycles = sparkey_cycles();
+  struct timespec duration = {0, 10000000};
+  nanosleep(&duration, NULL);
+  uint64_t ns = now_ns() - start_ns;
+  uint64_t cycles = sparkey_cycles() - start_cycles;
+  if (ns > 0 && cycles > 0) {
+    cycles_per_ns = (double) cycles / ns;
+  }
+#endif
+}
+
+void sparkey_calibrate_cycles(void) {
+  pthread_once(&calibrate_once, calibrate);
+}
+
+uint64_t sparkey_cycles_to_ns(uint64_t cycles) {
+  return (uint64_t) (cycles / cycles_per_ns);
+}
+
+static inline int bucket_index(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent > MAX_EXPONENT) {
+    return NUM_BUCKETS - 1;
+  }
+  return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + ((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/**
+ * @returns the largest value that maps to bucket i.
+ */
+static uint64_t bucket_max(int i) {
+  if (i < SUB_BUCKETS) {
+    return i;
+  }
+  int exponent = i / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  uint64_t width = 1ULL << (exponent - SUB_BUCKET_BITS);
+  return (uint64_t) (SUB_BUCKETS + i % SUB_BUCKETS) * width + width - 1;
+}
+
+static latency_shard * get_shard(sparkey_latency *latency, int i) {
+  return (latency_shard *) (latency->shards + i * SHARD_SIZE);
+}
+
+sparkey_returncode sparkey_hash_latency_enable(sparkey_hashreader *reader) {
+#ifdef SPARKEY_NO_LATENCY
+  (void) reader;
+  return SPARKEY_LATENCY_DISABLED;
+#else
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (reader->latency != NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  sparkey_latency *latency = malloc(sizeof(sparkey_latency));
+  if (latency == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  void *shards;
+  if (posix_memalign(&shards, CACHE_LINE_SIZE, LATENCY_SHARDS * SHARD_SIZE) != 0) {
+    free(latency);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(shards, 0, LATENCY_SHARDS * SHARD_SIZE);
+  latency->shards = shards;
+  sparkey_calibrate_cycles();
+  reader->latency = latency;
+  return SPARKEY_SUCCESS;
+#endif
+}
+
+void sparkey_hash_latency_disable(sparkey_hashreader *reader) {
+  sparkey_latency_free(reader->latency);
+  reader->latency = NULL;
+}
+
+void sparkey_latency_free(sparkey_latency *latency) {
+  if (latency != NULL) {
+    free(latency->shards);
+    free(latency);
+  }
+}
+
+static inline void record(latency_shard *shard, sparkey_lookup_phase phase, uint64_t cycles) {
+  sparkey_counter_add(&shard->count[phase], 1);
+  sparkey_counter_add(&shard->sum[phase], cycles);
+  if (cycles > __atomic_load_n(&shard->max[phase], __ATOMIC_RELAXED)) {
+    __atomic_store_n(&shard->max[phase], cycles, __ATOMIC_RELAXED);
+  }
+  sparkey_counter_add(&shard->buckets[phase][bucket_index(cycles)], 1);
+}
+
+void sparkey_latency_lookup(sparkey_latency *latency, const sparkey_lookup_info *info) {
+  latency_shard *shard = get_shard(latency, sparkey_thread_number() % LATENCY_SHARDS);
+  record(shard, SPARKEY_PHASE_TOTAL, info->total_cycles);
+  record(shard, SPARKEY_PHASE_HASH, info->hash_cycles);
+  uint64_t other = info->hash_cycles;
+  if (info->block_position != 0) {
+    record(shard, SPARKEY_PHASE_SEEK, info->seek_cycles - info->decompress_cycles);
+    record(shard, SPARKEY_PHASE_COMPARE, info->compare_cycles);
+    other += info->seek_cycles + info->compare_cycles;
+  }
+  if (info->decompressions > 0) {
+    record(shard, SPARKEY_PHASE_DECOMPRESS, info->decompress_cycles);
+  }
+  // whatever is left is spent reading hash slots
+  record(shard, SPARKEY_PHASE_PROBE, info->total_cycles > other ? info->total_cycles - other : 0);
+}
+
+sparkey_returncode sparkey_hash_latency_snapshot(sparkey_hashreader *reader, sparkey_lookup_phase phase, sparkey_latency_summary *summary) {
+  memset(summary, 0, sizeof(sparkey_latency_summary));
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if ((int) phase < 0 || phase >= SPARKEY_NUM_PHASES) {
+    return SPARKEY_INVALID_LOOKUP_PHASE;
+  }
+  if (reader->latency == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+
+  uint64_t buckets[NUM_BUCKETS];
+  memset(buckets, 0, sizeof(buckets));
+  uint64_t sum = 0;
+  uint64_t max = 0;
+  for (int i = 0; i < LATENCY_SHARDS; i++) {
+    latency_shard *shard = get_shard(reader->latency, i);
+    sum += __atomic_load_n(&shard->sum[phase], __ATOMIC_RELAXED);
+    uint64_t shard_max = __atomic_load_n(&shard->max[phase], __ATOMIC_RELAXED);
+    if (shard_max > max) {
+      max = shard_max;
+    }
+    for (int j = 0; j < NUM_BUCKETS; j++) {
+      buckets[j] += __atomic_load_n(&shard->buckets[phase][j], __ATOMIC_RELAXED);
+    }
+  }
+  // Count the buckets rather than reading the count, so that the percentiles are consistent
+  uint64_t count = 0;
+  for (int j = 0; j < NUM_BUCKETS; j++) {
+    count += buckets[j];
+  }
+  if (count == 0) {
+    return SPARKEY_SUCCESS;
+  }
+  summary->count = count;
+  summary->mean_ns = sparkey_cycles_to_ns(sum / count);
+  summary->max_ns = sparkey_cycles_to_ns(max);
+
+  const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t *results[] = {&summary->p50_ns, &summary->p90_ns, &summary->p99_ns, &summary->p999_ns};
+  uint64_t seen = 0;
+  int j = 0;
+  for (int p = 0; p < 4; p++) {
+    uint64_t rank = (uint64_t) (percentiles[p] * count);
+    while (j < NUM_BUCKETS - 1 && seen + buckets[j] <= rank) {
+      seen += buckets[j++];
+    }
+    uint64_t value = bucket_max(j);
+    *results[p] = sparkey_cycles_to_ns(value < max ? value : max);
+  }
+  return SPARKEY_SUCCESS;
+}
@@ -0,0 +1,185 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "endiantools.h"
+#include "util.h"
+#include "buf.h"
+#include "vlq.h"
+
+/*
+ * File layout:
+ * - A fixed size header.
+ * - One bit per log entry, puts and deletes alike, in log order. The bit for entry i is
+ *   bit i % 8 of byte i / 8, and it is set if the entry is live, i.e. the final put of its key.
+ */
+#define LIVENESS_MAGIC_NUMBER (0x11feb175)
+#define LIVENESS_MAJOR_VERSION (1)
+#define LIVENESS_MINOR_VERSION (0)
+#define LIVENESS_HEADER_SIZE (48)
+
+void sparkey_addresses_init(sparkey_address_list *list) {
+  list->data = NULL;
+  list->size = 0;
+  list->capacity = 0;
+  list->count = 0;
+  list->last = 0;
+}
+
+void sparkey_addresses_free(sparkey_address_list *list) {
+  free(list->data);
+  sparkey_addresses_init(list);
+}
+
+sparkey_returncode sparkey_addresses_add(sparkey_address_list *list, uint64_t address) {
+  if (list->size + 10 > list->capacity) {
+    uint64_t capacity = list->capacity == 0 ? 4096 : list->capacity * 2;
+    uint8_t *grown = realloc(list->data, capacity);
+    if (grown == NULL) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    list->data = grown;
+    list->capacity = capacity;
+  }
+  list->size += write_vlq(&list->data[list->size], address - list->last);
+  list->last = address;
+  list->count++;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_liveness_write(const char *filename, uint32_t file_identifier, uint64_t data_end, uint64_t num_entries, const sparkey_address_list *all, const uint64_t *live, uint64_t num_live) {
+  // Try removing it first, to avoid overwriting existing files that readers may be using.
+  if (remove(filename) < 0 && errno != ENOENT) {
+    return sparkey_remove_returncode(errno);
+  }
+  int fd = creat(filename, 00644);
+  if (fd < 0) {
+    return sparkey_create_returncode(errno);
+  }
+
+  sparkey_returncode returncode;
+  sparkey_buf buf;
+  buf.start = NULL;
+  TRY(buf_init(&buf, 1 << 16), cleanup);
+
+  uint8_t header[LIVENESS_HEADER_SIZE];
+  memset(header, 0, sizeof(header));
+  write_little_endian32(&header[0], LIVENESS_MAGIC_NUMBER);
+  write_little_endian32(&header[4], LIVENESS_MAJOR_VERSION);
+  write_little_endian32(&header[8], LIVENESS_MINOR_VERSION);
+  write_little_endian32(&header[12], file_identifier);
+  write_little_endian64(&header[16], data_end);
+  write_little_endian64(&header[24], num_entries);
+  write_little_endian64(&header[32], num_live);
+  TRY(buf_add(&buf, fd, header, sizeof(header)), cleanup);
+
+  // Both the log addresses and the live addresses are in log order, so one merge finds the live entries
+  uint64_t pos = 0;
+  uint64_t address = 0;
+  uint64_t j = 0;
+  uint8_t byte = 0;
+  for (uint64_t i = 0; i < num_entries; i++) {
+    int is_live = 1;
+    if (all != NULL) {
+      address += read_vlq(all->data, &pos);
+      is_live = j < num_live && live[j] == address;
+      j += is_live;
+    }
+    byte |= is_live << (i % 8);
+    if (i % 8 == 7) {
+      TRY(buf_add(&buf, fd, &byte, 1), cleanup);
+      byte = 0;
+    }
+  }
+  if (num_entries % 8 != 0) {
+    TRY(buf_add(&buf, fd, &byte, 1), cleanup);
+  }
+  if (all != NULL && j != num_live) {
+    // The hash table refers to entries that are not in the log
+    TRY(SPARKEY_INTERNAL_ERROR, cleanup);
+  }
+  TRY(buf_flushfile(&buf, fd), cleanup);
+
+cleanup:
+  if (buf.start != NULL) {
+    buf_close(&buf);
+  }
+  close(fd);
+  if (returncode != SPARKEY_SUCCESS) {
+    remove(filename);
+  }
+  return returncode;
+}
+
+sparkey_returncode sparkey_liveness_open(sparkey_liveness *liveness, const char *filename, uint32_t file_identifier, uint64_t data_end) {
+  liveness->data = NULL;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode;
+  struct stat s;
+  if (fstat(fd, &s) < 0 || s.st_size < LIVENESS_HEADER_SIZE) {
+    TRY(SPARKEY_LIVENESS_CORRUPT, close_fd);
+  }
+  liveness->data_len = s.st_size;
+  liveness->data = mmap(NULL, liveness->data_len, PROT_READ, MAP_SHARED, fd, 0);
+  if (liveness->data == MAP_FAILED) {
+    liveness->data = NULL;
+    TRY(SPARKEY_MMAP_FAILED, close_fd);
+  }
+
+  uint8_t *data = liveness->data;
+  if (read_little_endian32(data, 0) != LIVENESS_MAGIC_NUMBER) {
+    TRY(SPARKEY_WRONG_LIVENESS_MAGIC_NUMBER, unmap);
+  }
+  if (read_little_endian32(data, 4) != LIVENESS_MAJOR_VERSION || read_little_endian32(data, 8) > LIVENESS_MINOR_VERSION) {
+    TRY(SPARKEY_UNSUPPORTED_LIVENESS_VERSION, unmap);
+  }
+  if (read_little_endian32(data, 12) != file_identifier || read_little_endian64(data, 16) != data_end) {
+    TRY(SPARKEY_FILE_IDENTIFIER_MISMATCH, unmap);
+  }
+  liveness->num_entries = read_little_endian64(data, 24);
+  liveness->num_live = read_little_endian64(data, 32);
+  if ((liveness->num_entries + 7) / 8 != liveness->data_len - LIVENESS_HEADER_SIZE || liveness->num_live > liveness->num_entries) {
+    TRY(SPARKEY_LIVENESS_CORRUPT, unmap);
+  }
+  liveness->bits = &data[LIVENESS_HEADER_SIZE];
+  close(fd);
+  return SPARKEY_SUCCESS;
+
+unmap:
+  munmap(liveness->data, liveness->data_len);
+  liveness->data = NULL;
+close_fd:
+  close(fd);
+  return returncode;
+}
+
+void sparkey_liveness_close(sparkey_liveness *liveness) {
+  if (liveness->data != NULL) {
+    munmap(liveness->data, liveness->data_len);
+    liveness->data = NULL;
+  }
+}
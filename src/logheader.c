@@ -33,6 +33,9 @@ void print_logheader(sparkey_logheader *header) {
   printf("Compression: %s, block size: %d\n",
       compression_types[header->compression_type],
       header->compression_block_size);
+  if (log_fixed_width(header)) {
+    printf("Fixed width: %"PRIu32" byte keys, %"PRIu32" byte values\n", header->fixed_key_len, header->fixed_value_len);
+  }
 }
 
 static sparkey_returncode logheader_version0(sparkey_logheader *header, FILE *fp) {
@@ -48,6 +51,8 @@ static sparkey_returncode logheader_version0(sparkey_logheader *header, FILE *fp
   RETHROW(fread_little_endian64(fp, &header->put_size));
   RETHROW(fread_little_endian32(fp, &header->max_entries_per_block));
   header->header_size = LOG_HEADER_SIZE;
+  header->fixed_key_len = 0;
+  header->fixed_value_len = 0;
 
   // Some basic consistency checks
   if (header->data_end < header->header_size) {
@@ -65,10 +70,27 @@ static sparkey_returncode logheader_version0(sparkey_logheader *header, FILE *fp
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode logheader_version1(sparkey_logheader *header, FILE *fp) {
+  RETHROW(logheader_version0(header, fp));
+  RETHROW(fread_little_endian32(fp, &header->fixed_key_len));
+  RETHROW(fread_little_endian32(fp, &header->fixed_value_len));
+  header->header_size = LOG_FIXED_WIDTH_HEADER_SIZE;
+
+  if (header->data_end < header->header_size) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
+  }
+  if (log_fixed_entry_size(header) == 0) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
+  }
+  if (header->num_deletes > 0) {
+    return SPARKEY_LOG_HEADER_CORRUPT;
+  }
+  return SPARKEY_SUCCESS;
+}
 
 typedef sparkey_returncode (*loader)(sparkey_logheader *header, FILE *fp);
 
-static loader loaders[1] = { logheader_version0 };
+static loader loaders[2] = { logheader_version0, logheader_version1 };
 
 sparkey_returncode sparkey_load_logheader(sparkey_logheader *header, const char *filename) {
   FILE *fp = fopen(filename, "r");
@@ -106,7 +128,7 @@ sparkey_returncode sparkey_load_logheader(sparkey_logheader *header, const char
 sparkey_returncode write_logheader(int fd, sparkey_logheader *header) {
   RETHROW(fwrite_little_endian32(fd, LOG_MAGIC_NUMBER));
   RETHROW(fwrite_little_endian32(fd, LOG_MAJOR_VERSION));
-  RETHROW(fwrite_little_endian32(fd, LOG_MINOR_VERSION));
+  RETHROW(fwrite_little_endian32(fd, header->minor_version));
   RETHROW(fwrite_little_endian32(fd, header->file_identifier));
   RETHROW(fwrite_little_endian64(fd, header->num_puts));
   RETHROW(fwrite_little_endian64(fd, header->num_deletes));
@@ -118,6 +140,10 @@ sparkey_returncode write_logheader(int fd, sparkey_logheader *header) {
   RETHROW(fwrite_little_endian32(fd, header->compression_block_size));
   RETHROW(fwrite_little_endian64(fd, header->put_size));
   RETHROW(fwrite_little_endian32(fd, header->max_entries_per_block));
+  if (log_fixed_width(header)) {
+    RETHROW(fwrite_little_endian32(fd, header->fixed_key_len));
+    RETHROW(fwrite_little_endian32(fd, header->fixed_value_len));
+  }
   return SPARKEY_SUCCESS;
 }
 
@@ -22,8 +22,11 @@
 
 #define LOG_MAGIC_NUMBER (0x49b39c95)
 #define LOG_MAJOR_VERSION (1)
-#define LOG_MINOR_VERSION (0)
+#define LOG_MINOR_VERSION (1)
 #define LOG_HEADER_SIZE (84)
+/* Fixed width logs have minor version 1 and a larger header. Other logs keep minor version 0. */
+#define LOG_FIXED_WIDTH_MINOR_VERSION (1)
+#define LOG_FIXED_WIDTH_HEADER_SIZE (92)
 
 typedef struct {
   uint32_t major_version;
@@ -40,8 +43,26 @@ typedef struct {
   uint64_t put_size;
   uint32_t header_size;
   uint32_t max_entries_per_block;
+  // only set for fixed width logs
+  uint32_t fixed_key_len;
+  uint32_t fixed_value_len;
 } sparkey_logheader;
 
+/**
+ * @returns 1 if every entry in the log is a put with fixed_key_len byte keys and fixed_value_len byte values,
+ * stored without length headers.
+ */
+static inline int log_fixed_width(const sparkey_logheader *header) {
+  return header->minor_version >= LOG_FIXED_WIDTH_MINOR_VERSION;
+}
+
+/**
+ * @returns the size of every entry in a fixed width log.
+ */
+static inline uint64_t log_fixed_entry_size(const sparkey_logheader *header) {
+  return (uint64_t) header->fixed_key_len + header->fixed_value_len;
+}
+
 /**
  * fills up a logheader struct based on the contents at the beginning of the file.
  * @param header header struct to fill
@@ -13,6 +13,7 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#define _GNU_SOURCE
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -20,16 +21,23 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include "sparkey.h"
 #include "sparkey-internal.h"
 #include "logheader.h"
 #include "endiantools.h"
 #include "util.h"
+#include "vlq.h"
 
 #define MAGIC_VALUE_LOGITER (0xd765c8cc)
 #define MAGIC_VALUE_LOGREADER (0xe93356c4)
 
+/* Size of the read window used for uncompressed logs when not mmapped */
+#define PREAD_WINDOW_SIZE (1 << 14)
+/* An entry header is two VLQs of at most 10 bytes each */
+#define MAX_ENTRY_HEADER_SIZE (20)
+
 static inline uint64_t min64(uint64_t a, uint64_t b) {
   if (a < b) {
     return a;
@@ -37,31 +45,17 @@ static inline uint64_t min64(uint64_t a, uint64_t b) {
   return b;
 }
 
-static inline uint64_t read_vlq(uint8_t * array, uint64_t *position) {
-  uint64_t res = 0;
-  uint64_t shift = 0;
-  uint64_t tmp, tmp2;
-  while (1) {
-    tmp = array[(*position)++];
-    tmp2 = tmp & 0x7f;
-    if (tmp == tmp2) {
-      return res | tmp << shift;
-    }
-    res |= tmp2 << shift;
-    shift += 7;
-  }
-  return res;
-}
-
-sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, const char *filename) {
+static sparkey_returncode open_segment(sparkey_log_segment *seg, const char *filename, sparkey_read_mode mode) {
   int fd = 0;
   sparkey_returncode returncode;
-  TRY(sparkey_load_logheader(&log->header, filename), cleanup);
-  log->data_len = log->header.data_end;
+  seg->data = NULL;
+  seg->fd = -1;
+  seg->read_fd = -1;
+  TRY(sparkey_load_logheader(&seg->header, filename), cleanup);
 
   struct stat s;
   stat(filename, &s);
-  if (log->data_len > (uint64_t) s.st_size) {
+  if (seg->header.data_end > (uint64_t) s.st_size) {
     returncode = SPARKEY_LOG_TOO_SMALL;
     goto cleanup;
   }
@@ -71,23 +65,147 @@ sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, const
     returncode = sparkey_open_returncode(errno);
     goto cleanup;
   }
-  log->fd = fd;
+  seg->fd = fd;
+  seg->read_fd = fd;
 
-  log->data = mmap(NULL, log->data_len, PROT_READ, MAP_SHARED, fd, 0);
-  if (log->data == MAP_FAILED) {
-    returncode = SPARKEY_MMAP_FAILED;
+  switch (mode) {
+  case SPARKEY_READ_MMAP:
+    seg->data = mmap(NULL, seg->header.data_end, PROT_READ, MAP_SHARED, fd, 0);
+    if (seg->data == MAP_FAILED) {
+      seg->data = NULL;
+      returncode = SPARKEY_MMAP_FAILED;
+      goto cleanup;
+    }
+    break;
+  case SPARKEY_READ_PREAD:
+    break;
+  case SPARKEY_READ_PREAD_DIRECT:
+    seg->read_fd = sparkey_open_direct(filename, O_RDONLY);
+    if (seg->read_fd < 0) {
+      returncode = sparkey_open_returncode(errno);
+      goto cleanup;
+    }
+    break;
+  default:
+    returncode = SPARKEY_INVALID_READ_MODE;
     goto cleanup;
   }
+  return SPARKEY_SUCCESS;
+
+cleanup:
+  if (fd > 0) close(fd);
+  seg->fd = -1;
+  seg->read_fd = -1;
+  return returncode;
+}
+
+static void close_segment(sparkey_log_segment *seg) {
+  if (seg->data != NULL) {
+    munmap(seg->data, seg->header.data_end);
+    seg->data = NULL;
+  }
+  if (seg->read_fd != seg->fd) {
+    close(seg->read_fd);
+  }
+  seg->read_fd = -1;
+  if (seg->fd >= 0) {
+    close(seg->fd);
+  }
+  seg->fd = -1;
+}
+
+/**
+ * Combines the segment headers into one header describing the whole virtual log.
+ */
+static sparkey_returncode combine_headers(sparkey_logreader *log) {
+  sparkey_logheader *header = &log->header;
+  *header = log->segments[0].header;
+  for (int i = 1; i < log->num_segments; i++) {
+    sparkey_logheader *h = &log->segments[i].header;
+    if (h->compression_type != header->compression_type ||
+        h->compression_block_size != header->compression_block_size ||
+        log_fixed_width(h) != log_fixed_width(header) ||
+        h->fixed_key_len != header->fixed_key_len ||
+        h->fixed_value_len != header->fixed_value_len) {
+      return SPARKEY_SEGMENT_MISMATCH;
+    }
+    header->file_identifier = ((header->file_identifier << 7) | (header->file_identifier >> 25)) ^ h->file_identifier;
+    header->num_puts += h->num_puts;
+    header->num_deletes += h->num_deletes;
+    header->put_size += h->put_size;
+    header->delete_size += h->delete_size;
+    if (h->max_key_len > header->max_key_len) {
+      header->max_key_len = h->max_key_len;
+    }
+    if (h->max_value_len > header->max_value_len) {
+      header->max_value_len = h->max_value_len;
+    }
+    if (h->max_entries_per_block > header->max_entries_per_block) {
+      header->max_entries_per_block = h->max_entries_per_block;
+    }
+  }
+  sparkey_log_segment *last = &log->segments[log->num_segments - 1];
+  header->data_end = last->base + last->header.data_end;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, int num_segments, const char * const *filenames, sparkey_read_mode mode) {
+  if (num_segments < 1) {
+    return SPARKEY_INVALID_SHARD_COUNT;
+  }
+  log->segments = calloc(num_segments, sizeof(sparkey_log_segment));
+  if (log->segments == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  log->num_segments = 0;
+  log->mode = mode;
+
+  sparkey_returncode returncode;
+  uint64_t base = 0;
+  for (int i = 0; i < num_segments; i++) {
+    sparkey_log_segment *seg = &log->segments[i];
+    TRY(open_segment(seg, filenames[i], mode), cleanup);
+    log->num_segments++;
+    seg->base = base;
+    base += seg->header.data_end;
+  }
+  TRY(combine_headers(log), cleanup);
 
   log->open_status = MAGIC_VALUE_LOGREADER;
   return SPARKEY_SUCCESS;
 
 cleanup:
-  if (fd > 0) close(fd);
+  for (int i = 0; i < log->num_segments; i++) {
+    close_segment(&log->segments[i]);
+  }
+  free(log->segments);
+  log->segments = NULL;
   return returncode;
 }
 
+sparkey_log_segment * sparkey_logreader_segment(sparkey_logreader *log, uint64_t position) {
+  int lo = 0;
+  int hi = log->num_segments - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (log->segments[mid].base <= position) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return &log->segments[lo];
+}
+
 sparkey_returncode sparkey_logreader_open(sparkey_logreader **log_ref, const char *filename) {
+  return sparkey_logreader_open_mode(log_ref, filename, SPARKEY_READ_MMAP);
+}
+
+sparkey_returncode sparkey_logreader_open_mode(sparkey_logreader **log_ref, const char *filename, sparkey_read_mode mode) {
+  return sparkey_logreader_open_segments(log_ref, 1, &filename, mode);
+}
+
+sparkey_returncode sparkey_logreader_open_segments(sparkey_logreader **log_ref, int num_segments, const char * const *filenames, sparkey_read_mode mode) {
   RETHROW(correct_endian_platform());
 
   sparkey_logreader *log = malloc(sizeof(sparkey_logreader));
@@ -96,7 +214,7 @@ sparkey_returncode sparkey_logreader_open(sparkey_logreader **log_ref, const cha
   }
 
   sparkey_returncode returncode;
-  TRY(sparkey_logreader_open_noalloc(log, filename), cleanup);
+  TRY(sparkey_logreader_open_noalloc(log, num_segments, filenames, mode), cleanup);
 
   *log_ref = log;
   return SPARKEY_SUCCESS;
@@ -114,12 +232,12 @@ void sparkey_logreader_close_nodealloc(sparkey_logreader *log) {
     return;
   }
   log->open_status = 0;
-  if (log->data != NULL) {
-    munmap(log->data, log->data_len);
-    log->data = NULL;
+  for (int i = 0; i < log->num_segments; i++) {
+    close_segment(&log->segments[i]);
   }
-  close(log->fd);
-  log->fd = -1;
+  free(log->segments);
+  log->segments = NULL;
+  log->num_segments = 0;
 }
 
 void sparkey_logreader_close(sparkey_logreader **log_ref) {
@@ -165,6 +283,13 @@ sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter_ref, sparkey_lo
   iter->block_offset = 0;
   iter->block_len = 0;
   iter->state = SPARKEY_ITER_NEW;
+  iter->range_end = UINT64_MAX;
+  iter->decompressions = 0;
+  iter->decompressed_bytes = 0;
+  iter->block_reuses = 0;
+  iter->time_decompression = 0;
+  iter->decompress_cycles = 0;
+  iter->detached = 0;
 
   if (sparkey_uses_compressor(log->header.compression_type)) {
     iter->compression_buf_allocated = 1;
@@ -177,6 +302,29 @@ sparkey_returncode sparkey_logiter_create(sparkey_logiter **iter_ref, sparkey_lo
     iter->compression_buf_allocated = 0;
   }
 
+  iter->read_buf = NULL;
+  iter->read_buf_size = 0;
+  if (log->mode != SPARKEY_READ_MMAP) {
+    uint64_t alignment = log->mode == SPARKEY_READ_PREAD_DIRECT ? SPARKEY_DIRECT_IO_ALIGNMENT : 1;
+    uint64_t size = PREAD_WINDOW_SIZE;
+    if (sparkey_uses_compressor(log->header.compression_type)) {
+      // Block size prefix plus the largest possible compressed block
+      size = 10 + sparkey_compressors[log->header.compression_type].max_compressed_size(log->header.compression_block_size);
+    }
+    // Leave room for the unaligned start of a window
+    size = (size + 2 * alignment - 1) / alignment * alignment;
+    void *buf;
+    if (posix_memalign(&buf, SPARKEY_DIRECT_IO_ALIGNMENT, size) != 0) {
+      if (iter->compression_buf_allocated) {
+        free(iter->compression_buf);
+      }
+      free(iter);
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    iter->read_buf = buf;
+    iter->read_buf_size = size;
+  }
+
   *iter_ref = iter;
   return SPARKEY_SUCCESS;
 }
@@ -195,45 +343,130 @@ void sparkey_logiter_close(sparkey_logiter **iter_ref) {
   iter->open_status = 0;
 
   if (iter->compression_buf_allocated) {
-    free(iter->compression_buf);
+    free(iter->detached ? iter->detached_buf : iter->compression_buf);
   }
+  free(iter->read_buf);
   free(iter);
   *iter_ref = NULL;
 }
 
+static inline uint64_t segment_end(sparkey_log_segment *seg) {
+  return seg->base + seg->header.data_end;
+}
+
+/**
+ * Skips over the headers of segments, which are part of the position space but contain no entries.
+ * @returns the first position at or after position that holds entry data, or log->header.data_end.
+ */
+static uint64_t skip_segment_headers(sparkey_logreader *log, uint64_t position) {
+  while (position < log->header.data_end) {
+    sparkey_log_segment *seg = sparkey_logreader_segment(log, position);
+    uint64_t start = seg->base + seg->header.header_size;
+    if (position < start) {
+      position = start;
+    }
+    if (position < segment_end(seg)) {
+      return position;
+    }
+  }
+  return log->header.data_end;
+}
+
+/**
+ * Reads as much log data as fits in the read buffer, starting at position, without crossing the segment end.
+ * @param res (output parameter) points to the data at position.
+ * @param len (output parameter) the number of bytes available at res.
+ */
+static sparkey_returncode read_window(sparkey_logiter *iter, sparkey_logreader *log, sparkey_log_segment *seg, uint64_t position, uint8_t **res, uint64_t *len) {
+  uint64_t alignment = log->mode == SPARKEY_READ_PREAD_DIRECT ? SPARKEY_DIRECT_IO_ALIGNMENT : 1;
+  uint64_t local = position - seg->base;
+  uint64_t start = local - local % alignment;
+  uint64_t end = min64(start + iter->read_buf_size, seg->header.data_end);
+  uint64_t wanted = (end - start + alignment - 1) / alignment * alignment;
+  uint64_t actual = 0;
+  while (actual < end - start) {
+    ssize_t r = pread(seg->read_fd, &iter->read_buf[actual], wanted - actual, start + actual);
+    if (r < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    if (r == 0) {
+      return SPARKEY_UNEXPECTED_EOF;
+    }
+    actual += r;
+  }
+  *res = &iter->read_buf[local - start];
+  *len = end - local;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode fill_window(sparkey_logiter *iter, sparkey_logreader *log, sparkey_log_segment *seg, uint64_t position) {
+  uint64_t len;
+  RETHROW(read_window(iter, log, seg, position, &iter->compression_buf, &len));
+  iter->block_position = position;
+  iter->next_block_position = position + len;
+  iter->block_len = len;
+  return SPARKEY_SUCCESS;
+}
+
 static sparkey_returncode seekblock(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position) {
   iter->block_offset = 0;
   if (iter->block_position == position) {
+    iter->block_reuses++;
     return SPARKEY_SUCCESS;
   }
+  if (iter->detached) {
+    iter->compression_buf = iter->detached_buf;
+    iter->detached = 0;
+  }
+  sparkey_log_segment *seg = sparkey_logreader_segment(log, position);
   if (sparkey_uses_compressor(log->header.compression_type)) {
-    uint64_t pos = position;
+    uint8_t *data = seg->data;
+    uint64_t base = seg->base;
+    if (data == NULL) {
+      uint64_t len;
+      RETHROW(read_window(iter, log, seg, position, &data, &len));
+      base = position;
+    }
+    uint64_t pos = position - base;
     // TODO: assert that we're not reading > uint32_t
-    uint32_t compressed_size = read_vlq(log->data, &pos);
-    uint64_t next_pos = pos + compressed_size;
+    uint32_t compressed_size = read_vlq(data, &pos);
+    uint64_t next_pos = base + pos + compressed_size;
     uint32_t uncompressed_size = log->header.compression_block_size;
 
+    uint64_t start = iter->time_decompression ? sparkey_cycles() : 0;
     sparkey_returncode ret = sparkey_compressors[log->header.compression_type].decompress(
-      &log->data[pos], compressed_size, iter->compression_buf, &uncompressed_size);
+      &data[pos], compressed_size, iter->compression_buf, &uncompressed_size);
     if (ret != SPARKEY_SUCCESS) {
       return ret;
     }
+    if (iter->time_decompression) {
+      iter->decompress_cycles += sparkey_cycles() - start;
+    }
+    iter->decompressions++;
+    iter->decompressed_bytes += uncompressed_size;
 
     iter->block_position = position;
     iter->next_block_position = next_pos;
     iter->block_len = uncompressed_size;
+  } else if (seg->data == NULL) {
+    RETHROW(fill_window(iter, log, seg, position));
   } else {
-    iter->compression_buf = &log->data[position];
+    iter->compression_buf = &seg->data[position - seg->base];
     iter->block_position = position;
-    iter->next_block_position = log->header.data_end;
-    iter->block_len = log->data_len - position;
+    iter->next_block_position = segment_end(seg);
+    iter->block_len = segment_end(seg) - position;
   }
   return SPARKEY_SUCCESS;
 }
 
 sparkey_returncode sparkey_logiter_seek(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position) {
   RETHROW(assert_iter_open(iter, log));
-  if (position == log->header.data_end) {
+  iter->range_end = UINT64_MAX;
+  position = skip_segment_headers(log, position);
+  if (position >= log->header.data_end) {
     iter->state = SPARKEY_ITER_CLOSED;
     return SPARKEY_SUCCESS;
   }
@@ -248,19 +481,30 @@ static sparkey_returncode ensure_available(sparkey_logiter *iter, sparkey_logrea
     return SPARKEY_SUCCESS;
   }
 
-  if (iter->next_block_position >= log->header.data_end) {
+  uint64_t next = skip_segment_headers(log, iter->next_block_position);
+  if (next >= log->header.data_end) {
     iter->block_position = 0;
     iter->block_offset = 0;
     iter->block_len = 0;
     return SPARKEY_SUCCESS;
   }
-  RETHROW(seekblock(iter, log, iter->next_block_position));
+  RETHROW(seekblock(iter, log, next));
   iter->entry_count = -1;
 
   return SPARKEY_SUCCESS;
 }
 
 static sparkey_returncode skip(sparkey_logiter *iter, sparkey_logreader *log, uint64_t len) {
+  if (log->header.compression_type == SPARKEY_COMPRESSION_NONE && iter->block_offset + len > iter->block_len &&
+      iter->block_position != 0 && iter->next_block_position < log->header.data_end) {
+    sparkey_log_segment *seg = sparkey_logreader_segment(log, iter->block_position);
+    // Entries never cross segments, so jump over the rest of the entry instead of reading through it.
+    // An entry that ends its segment is followed by the header of the next one, which is skipped like in ensure_available.
+    uint64_t target = skip_segment_headers(log, iter->block_position + iter->block_offset + len);
+    if (seg->data == NULL && target < log->header.data_end) {
+      return seekblock(iter, log, target);
+    }
+  }
   while (len > 0) {
     RETHROW(ensure_available(iter, log));
     uint64_t m = min64(len, iter->block_len - iter->block_offset);
@@ -299,17 +543,41 @@ sparkey_returncode sparkey_logiter_next(sparkey_logiter *iter, sparkey_logreader
   }
 
   if (log->header.compression_type == SPARKEY_COMPRESSION_NONE) {
-  	iter->block_position += iter->block_offset;
-  	iter->block_len -= iter->block_offset;
-  	iter->block_offset = 0;
-    iter->compression_buf = &log->data[iter->block_position];
+    iter->block_position += iter->block_offset;
+    iter->block_len -= iter->block_offset;
+    iter->compression_buf += iter->block_offset;
+    iter->block_offset = 0;
     iter->entry_count = -1;
+    if (log->mode != SPARKEY_READ_MMAP && iter->block_len < MAX_ENTRY_HEADER_SIZE && !log_fixed_width(&log->header)) {
+      sparkey_log_segment *seg = sparkey_logreader_segment(log, iter->block_position);
+      if (iter->next_block_position < segment_end(seg)) {
+        // Don't let the entry header straddle two read windows
+        RETHROW(fill_window(iter, log, seg, iter->block_position));
+      }
+    }
+  }
+
+  if (iter->block_position >= iter->range_end) {
+    // Reached end of range
+    iter->state = SPARKEY_ITER_CLOSED;
+    return SPARKEY_SUCCESS;
   }
 
   iter->entry_count++;
 
-  uint64_t a = read_vlq(iter->compression_buf, &iter->block_offset);
-  uint64_t b = read_vlq(iter->compression_buf, &iter->block_offset);
+  if (log_fixed_width(&log->header)) {
+    // Fixed width entries have no header
+    iter->keylen = iter->key_remaining = log->header.fixed_key_len;
+    iter->valuelen = iter->value_remaining = log->header.fixed_value_len;
+    iter->type = SPARKEY_ENTRY_PUT;
+    iter->entry_block_position = iter->block_position;
+    iter->entry_block_offset = iter->block_offset;
+    iter->state = SPARKEY_ITER_ACTIVE;
+    return SPARKEY_SUCCESS;
+  }
+
+  uint64_t a = read_vlq_bounded(iter->compression_buf, &iter->block_offset, iter->block_len);
+  uint64_t b = read_vlq_bounded(iter->compression_buf, &iter->block_offset, iter->block_len);
   if (a == 0) {
     iter->keylen = iter->key_remaining = b;
     iter->valuelen = iter->value_remaining = 0;
@@ -340,7 +608,192 @@ sparkey_returncode sparkey_logiter_reset(sparkey_logiter *iter, sparkey_logreade
   return SPARKEY_SUCCESS;
 }
 
+sparkey_returncode sparkey_logiter_set_entry(sparkey_logiter *iter, sparkey_logreader *log, uint8_t *data, uint64_t keylen, uint64_t valuelen, int key_consumed) {
+  RETHROW(assert_iter_open(iter, log));
+  if (!iter->detached) {
+    iter->detached_buf = iter->compression_buf;
+    iter->detached = 1;
+  }
+  // Block position 0 is never a log block, so reset stays on the entry and seeking leaves it
+  iter->compression_buf = data;
+  iter->block_position = 0;
+  iter->next_block_position = log->header.data_end;
+  iter->block_offset = 0;
+  iter->block_len = keylen + valuelen;
+  iter->entry_count = 0;
+  iter->entry_block_position = 0;
+  iter->entry_block_offset = 0;
+  iter->type = SPARKEY_ENTRY_PUT;
+  iter->keylen = iter->key_remaining = keylen;
+  iter->valuelen = iter->value_remaining = valuelen;
+  if (key_consumed) {
+    iter->block_offset = keylen;
+    iter->key_remaining = 0;
+  }
+  iter->state = SPARKEY_ITER_ACTIVE;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logiter_range(sparkey_logiter *iter, sparkey_logreader *log, uint64_t start, uint64_t end) {
+  RETHROW(sparkey_logiter_seek(iter, log, start));
+  iter->range_end = end;
+  if (skip_segment_headers(log, start) >= end) {
+    iter->state = SPARKEY_ITER_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * Finds the start of the compressed block following the one at position,
+ * by reading only its size prefix.
+ */
+static sparkey_returncode next_block(sparkey_logreader *log, uint64_t position, uint64_t *next) {
+  sparkey_log_segment *seg = sparkey_logreader_segment(log, position);
+  uint64_t local = position - seg->base;
+  uint8_t buf[10];
+  uint8_t *data;
+  uint64_t pos = 0;
+  if (seg->data != NULL) {
+    data = &seg->data[local];
+  } else {
+    uint64_t len = min64(sizeof(buf), seg->header.data_end - local);
+    if (pread(seg->fd, buf, len, local) != (ssize_t) len) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    data = buf;
+  }
+  uint32_t compressed_size = read_vlq(data, &pos);
+  *next = skip_segment_headers(log, position + pos + compressed_size);
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * A block starts with a new entry unless the previous block was filled to the
+ * brim, in which case its last entry may continue into this one.
+ */
+static sparkey_returncode starts_entry(sparkey_logiter *iter, sparkey_logreader *log, uint64_t previous, uint64_t position, int *res) {
+  sparkey_log_segment *seg = sparkey_logreader_segment(log, position);
+  if (position == seg->base + seg->header.header_size || log_fixed_width(&log->header)) {
+    // Fixed width entries never cross block boundaries
+    *res = 1;
+    return SPARKEY_SUCCESS;
+  }
+  RETHROW(seekblock(iter, log, previous));
+  *res = iter->block_len < (uint64_t) log->header.compression_block_size;
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode partition_blocks(sparkey_logiter *iter, sparkey_logreader *log, int num_partitions, uint64_t *boundaries) {
+  uint64_t start = boundaries[0];
+  uint64_t step = (boundaries[num_partitions] - start) / num_partitions;
+  uint64_t previous = start;
+  uint64_t position = start;
+  int k = 1;
+  while (k < num_partitions && position < log->header.data_end) {
+    if (position >= start + step * k) {
+      int res;
+      RETHROW(starts_entry(iter, log, previous, position, &res));
+      while (res && k < num_partitions && position >= start + step * k) {
+        boundaries[k++] = position;
+      }
+    }
+    previous = position;
+    RETHROW(next_block(log, position, &position));
+  }
+  while (k < num_partitions) {
+    boundaries[k++] = log->header.data_end;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+/**
+ * In an uncompressed fixed width log, the entry at or after a position can be computed
+ * from the start of its segment.
+ */
+static void partition_fixed_width(sparkey_logreader *log, int num_partitions, uint64_t *boundaries) {
+  uint64_t start = boundaries[0];
+  uint64_t step = (boundaries[num_partitions] - start) / num_partitions;
+  uint64_t size = log_fixed_entry_size(&log->header);
+  for (int k = 1; k < num_partitions; k++) {
+    uint64_t position = skip_segment_headers(log, start + step * k);
+    if (position < log->header.data_end) {
+      sparkey_log_segment *seg = sparkey_logreader_segment(log, position);
+      uint64_t first = seg->base + seg->header.header_size;
+      position = first + (position - first + size - 1) / size * size;
+      if (position >= segment_end(seg)) {
+        position = skip_segment_headers(log, segment_end(seg));
+      }
+    }
+    boundaries[k] = position;
+  }
+}
+
+static sparkey_returncode partition_entries(sparkey_logiter *iter, sparkey_logreader *log, int num_partitions, uint64_t *boundaries) {
+  uint64_t start = boundaries[0];
+  uint64_t step = (boundaries[num_partitions] - start) / num_partitions;
+  int k = 1;
+  while (k < num_partitions) {
+    RETHROW(sparkey_logiter_next(iter, log));
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    while (k < num_partitions && iter->entry_block_position >= start + step * k) {
+      boundaries[k++] = iter->entry_block_position;
+    }
+  }
+  while (k < num_partitions) {
+    boundaries[k++] = log->header.data_end;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_logreader_partition(sparkey_logreader *log, int num_partitions, uint64_t *boundaries) {
+  RETHROW(assert_log_open(log));
+  if (num_partitions < 1) {
+    return SPARKEY_INVALID_PARTITION_COUNT;
+  }
+  boundaries[0] = skip_segment_headers(log, 0);
+  boundaries[num_partitions] = log->header.data_end;
+  if (num_partitions == 1 || boundaries[0] >= log->header.data_end) {
+    for (int i = 1; i < num_partitions; i++) {
+      boundaries[i] = log->header.data_end;
+    }
+    return SPARKEY_SUCCESS;
+  }
+
+  if (!sparkey_uses_compressor(log->header.compression_type) && log_fixed_width(&log->header)) {
+    partition_fixed_width(log, num_partitions, boundaries);
+    return SPARKEY_SUCCESS;
+  }
+
+  sparkey_logiter *iter;
+  RETHROW(sparkey_logiter_create(&iter, log));
+  sparkey_returncode returncode;
+  if (sparkey_uses_compressor(log->header.compression_type)) {
+    returncode = partition_blocks(iter, log, num_partitions, boundaries);
+  } else {
+    returncode = partition_entries(iter, log, num_partitions, boundaries);
+  }
+  sparkey_logiter_close(&iter);
+  return returncode;
+}
+
 sparkey_returncode sparkey_logiter_skip(sparkey_logiter *iter, sparkey_logreader *log, int count) {
+  if (count > 1 && log_fixed_width(&log->header) && iter->state != SPARKEY_ITER_CLOSED) {
+    // Jump over all but the last entry directly if they are in the current block
+    RETHROW(assert_iter_open(iter, log));
+    uint64_t len = (count - 1) * log_fixed_entry_size(&log->header);
+    if (iter->state == SPARKEY_ITER_ACTIVE) {
+      len += iter->key_remaining + iter->value_remaining;
+    }
+    if (iter->block_offset + len <= iter->block_len) {
+      iter->block_offset += len;
+      iter->entry_count += count - 1;
+      iter->key_remaining = 0;
+      iter->value_remaining = 0;
+      return sparkey_logiter_next(iter, log);
+    }
+  }
   while (count > 0) {
     count--;
     RETHROW(sparkey_logiter_next(iter, log));
@@ -13,12 +13,14 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "sparkey.h"
@@ -26,20 +28,17 @@
 #include "endiantools.h"
 #include "buf.h"
 #include "sparkey-internal.h"
+#include "vlq.h"
 
 #define MAGIC_VALUE_LOGWRITER (0x2866211b)
 
+#define DEFAULT_FILE_BUFFER_SIZE (1024*1024)
 
-static inline int write_vlq(uint8_t *buf, uint64_t value) {
-  int count = 1;
-  while (value >= 1 << 7) {
-    *buf = (value & 0x7f) | 0x80;
-    value >>= 7;
-    count++;
-    buf++;
+static inline uint64_t min64(uint64_t a, uint64_t b) {
+  if (a < b) {
+    return a;
   }
-  *buf = value;
-  return count;
+  return b;
 }
 
 static sparkey_returncode assert_writer_open(sparkey_logwriter *log) {
@@ -49,17 +48,284 @@ static sparkey_returncode assert_writer_open(sparkey_logwriter *log) {
   return SPARKEY_SUCCESS;
 }
 
+static sparkey_returncode assert_valid_options(const sparkey_logwriter_options *options) {
+  if (options == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  switch (options->write_mode) {
+  case SPARKEY_WRITE_CACHED:
+  case SPARKEY_WRITE_DONTNEED:
+  case SPARKEY_WRITE_DIRECT:
+    return SPARKEY_SUCCESS;
+  default:
+    return SPARKEY_INVALID_WRITE_MODE;
+  }
+}
+
+/**
+ * Checks the format of a new log, before anything is written to disk.
+ */
+static sparkey_returncode assert_valid_format(sparkey_compression_type compression_type, int compression_block_size, const sparkey_logwriter_options *options) {
+  if (!sparkey_uses_compressor(compression_type)) {
+    compression_block_size = 0;
+  } else if (compression_block_size < 10) {
+    return SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE;
+  }
+  if (options != NULL && options->fixed_width) {
+    uint64_t size = (uint64_t) options->fixed_key_len + options->fixed_value_len;
+    // Entries must fit in a block so that they can be located without parsing
+    if (size == 0 || (compression_block_size > 0 && size > (uint64_t) compression_block_size)) {
+      return SPARKEY_INVALID_FIXED_WIDTH;
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static void reset_file_buf(sparkey_logwriter *log) {
+  // With O_DIRECT, place the start so that aligned file offsets end up in aligned memory
+  uint64_t gap = log->direct_fd >= 0 ? log->file_offset % SPARKEY_DIRECT_IO_ALIGNMENT : 0;
+  log->file_buf.start = log->file_buf_mem + gap;
+  log->file_buf.cur = log->file_buf.start;
+  log->file_buf.end = log->file_buf.start + log->file_buf_size;
+}
+
+static sparkey_returncode write_file_data(sparkey_logwriter *log, uint8_t *data, uint64_t len, uint64_t offset);
+
+static void * flush_thread_main(void *arg) {
+  sparkey_logwriter *log = arg;
+  pthread_mutex_lock(&log->flush_lock);
+  while (1) {
+    if (log->flush_pending) {
+      pthread_mutex_unlock(&log->flush_lock);
+      sparkey_returncode returncode = write_file_data(log, log->flush_data, log->flush_len, log->flush_offset);
+      pthread_mutex_lock(&log->flush_lock);
+      if (log->flush_result == SPARKEY_SUCCESS) {
+        log->flush_result = returncode;
+      }
+      log->flush_pending = 0;
+      pthread_cond_broadcast(&log->flush_cond);
+    } else if (log->flush_stop) {
+      break;
+    } else {
+      pthread_cond_wait(&log->flush_cond, &log->flush_lock);
+    }
+  }
+  pthread_mutex_unlock(&log->flush_lock);
+  return NULL;
+}
+
+/**
+ * Waits until the background thread has written the previous buffer.
+ * @returns the first error the background thread ran into, if any.
+ */
+static sparkey_returncode wait_for_flush(sparkey_logwriter *log) {
+  if (!log->async) {
+    return SPARKEY_SUCCESS;
+  }
+  pthread_mutex_lock(&log->flush_lock);
+  while (log->flush_pending) {
+    pthread_cond_wait(&log->flush_cond, &log->flush_lock);
+  }
+  sparkey_returncode returncode = log->flush_result;
+  pthread_mutex_unlock(&log->flush_lock);
+  return returncode;
+}
+
+static sparkey_returncode start_flush_thread(sparkey_logwriter *log, uint64_t mem_size) {
+  void *mem;
+  if (posix_memalign(&mem, SPARKEY_DIRECT_IO_ALIGNMENT, mem_size) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  log->spare_buf_mem = mem;
+  log->flush_pending = 0;
+  log->flush_stop = 0;
+  log->flush_result = SPARKEY_SUCCESS;
+  if (pthread_mutex_init(&log->flush_lock, NULL) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (pthread_cond_init(&log->flush_cond, NULL) != 0) {
+    pthread_mutex_destroy(&log->flush_lock);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  if (pthread_create(&log->flush_thread, NULL, flush_thread_main, log) != 0) {
+    pthread_cond_destroy(&log->flush_cond);
+    pthread_mutex_destroy(&log->flush_lock);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  log->async = 1;
+  return SPARKEY_SUCCESS;
+}
+
+static void stop_flush_thread(sparkey_logwriter *log) {
+  pthread_mutex_lock(&log->flush_lock);
+  log->flush_stop = 1;
+  pthread_cond_broadcast(&log->flush_cond);
+  pthread_mutex_unlock(&log->flush_lock);
+  pthread_join(log->flush_thread, NULL);
+  pthread_cond_destroy(&log->flush_cond);
+  pthread_mutex_destroy(&log->flush_lock);
+  log->async = 0;
+}
+
+/**
+ * Sets up the file buffer and page cache handling. log->file_offset must be initialized.
+ */
+static sparkey_returncode init_file_io(sparkey_logwriter *log, const char *filename, const sparkey_logwriter_options *options) {
+  uint64_t size = DEFAULT_FILE_BUFFER_SIZE;
+  int async = 0;
+  log->write_mode = SPARKEY_WRITE_CACHED;
+  if (options != NULL) {
+    log->write_mode = options->write_mode;
+    if (options->file_buffer_size > 0) {
+      size = options->file_buffer_size;
+    }
+    async = options->async_flush;
+  }
+
+  if (log->write_mode == SPARKEY_WRITE_DIRECT) {
+    size = (size + SPARKEY_DIRECT_IO_ALIGNMENT - 1) / SPARKEY_DIRECT_IO_ALIGNMENT * SPARKEY_DIRECT_IO_ALIGNMENT;
+    log->direct_fd = sparkey_open_direct(filename, O_WRONLY);
+    if (log->direct_fd < 0) {
+      return sparkey_open_returncode(errno);
+    }
+  }
+
+  void *mem;
+  if (posix_memalign(&mem, SPARKEY_DIRECT_IO_ALIGNMENT, size + SPARKEY_DIRECT_IO_ALIGNMENT) != 0) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  log->file_buf_mem = mem;
+  log->file_buf_size = size;
+  log->dropped_offset = log->file_offset;
+  log->synced_offset = log->file_offset;
+  reset_file_buf(log);
+  if (async) {
+    RETHROW(start_flush_thread(log, size + SPARKEY_DIRECT_IO_ALIGNMENT));
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static void close_file_io(sparkey_logwriter *log) {
+  if (log->async) {
+    stop_flush_thread(log);
+  }
+  if (log->direct_fd >= 0) {
+    close(log->direct_fd);
+    log->direct_fd = -1;
+  }
+  free(log->file_buf_mem);
+  log->file_buf_mem = NULL;
+  free(log->spare_buf_mem);
+  log->spare_buf_mem = NULL;
+}
+
+/**
+ * Evicts written data from the page cache.
+ * Writeback of the most recently written data is only started, and it is evicted
+ * on the next call, so that the writer does not have to wait for the disk.
+ * @param all if set, wait for and evict everything that has been written.
+ */
+static void drop_written(sparkey_logwriter *log, uint64_t end, int all) {
+  uint64_t drop_end = all ? end : log->synced_offset;
+#ifdef HAVE_SYNC_FILE_RANGE
+  if (end > log->synced_offset) {
+    sync_file_range(log->fd, log->synced_offset, end - log->synced_offset, SYNC_FILE_RANGE_WRITE);
+  }
+  if (drop_end > log->dropped_offset) {
+    sync_file_range(log->fd, log->dropped_offset, drop_end - log->dropped_offset,
+      SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  }
+#endif
+#ifdef HAVE_POSIX_FADVISE
+  if (drop_end > log->dropped_offset) {
+    posix_fadvise(log->fd, log->dropped_offset, drop_end - log->dropped_offset, POSIX_FADV_DONTNEED);
+  }
+#endif
+  log->dropped_offset = drop_end;
+  log->synced_offset = end;
+}
+
+static sparkey_returncode write_file_data(sparkey_logwriter *log, uint8_t *data, uint64_t len, uint64_t offset) {
+  if (log->direct_fd >= 0) {
+    // Only whole aligned pages can bypass the page cache, the unaligned edges are written normally
+    uint64_t head = min64(len, (SPARKEY_DIRECT_IO_ALIGNMENT - offset % SPARKEY_DIRECT_IO_ALIGNMENT) % SPARKEY_DIRECT_IO_ALIGNMENT);
+    uint64_t body = (len - head) / SPARKEY_DIRECT_IO_ALIGNMENT * SPARKEY_DIRECT_IO_ALIGNMENT;
+    RETHROW(pwrite_full(log->fd, data, head, offset));
+    RETHROW(pwrite_full(log->direct_fd, data + head, body, offset + head));
+    RETHROW(pwrite_full(log->fd, data + head + body, len - head - body, offset + head + body));
+  } else {
+    RETHROW(pwrite_full(log->fd, data, len, offset));
+  }
+  if (log->write_mode != SPARKEY_WRITE_CACHED) {
+    drop_written(log, offset + len, 0);
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode flush_file_buf(sparkey_logwriter *log) {
+  uint8_t *data = log->file_buf.start;
+  uint64_t len = buf_used(&log->file_buf);
+  uint64_t offset = log->file_offset;
+  if (log->async) {
+    // Hand the full buffer to the background thread and continue in the other one
+    RETHROW(wait_for_flush(log));
+    pthread_mutex_lock(&log->flush_lock);
+    log->flush_data = data;
+    log->flush_len = len;
+    log->flush_offset = offset;
+    log->flush_pending = 1;
+    pthread_cond_broadcast(&log->flush_cond);
+    pthread_mutex_unlock(&log->flush_lock);
+
+    uint8_t *tmp = log->file_buf_mem;
+    log->file_buf_mem = log->spare_buf_mem;
+    log->spare_buf_mem = tmp;
+  } else {
+    RETHROW(write_file_data(log, data, len, offset));
+  }
+  log->file_offset += len;
+  reset_file_buf(log);
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode file_add(sparkey_logwriter *log, const uint8_t *data, ptrdiff_t len) {
+  sparkey_buf *file_buf = &log->file_buf;
+
+  while (1) {
+    ptrdiff_t remaining = buf_remaining(file_buf);
+    if (remaining >= len) {
+      memcpy(file_buf->cur, data, len);
+      file_buf->cur += len;
+      return SPARKEY_SUCCESS;
+    } else {
+      memcpy(file_buf->cur, data, remaining);
+      file_buf->cur += remaining;
+      data += remaining;
+      len -= remaining;
+      RETHROW(flush_file_buf(log));
+    }
+  }
+  return SPARKEY_SUCCESS;
+}
+
 sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log_ref, const char *filename, sparkey_compression_type compression_type, int compression_block_size) {
+  return sparkey_logwriter_create_opts(log_ref, filename, compression_type, compression_block_size, NULL);
+}
+
+sparkey_returncode sparkey_logwriter_create_opts(sparkey_logwriter **log_ref, const char *filename, sparkey_compression_type compression_type, int compression_block_size, const sparkey_logwriter_options *options) {
+  RETHROW(assert_valid_options(options));
+  RETHROW(assert_valid_format(compression_type, compression_block_size, options));
   sparkey_returncode returncode;
   int fd = 0;
   sparkey_logwriter *l = malloc(sizeof(sparkey_logwriter));
   if (l == NULL) {
     TRY(SPARKEY_INTERNAL_ERROR, error);
   }
+  l->direct_fd = -1;
+  l->file_buf_mem = NULL;
+  l->spare_buf_mem = NULL;
+  l->async = 0;
   if (sparkey_uses_compressor(compression_type)) {
-    if (compression_block_size < 10) {
-      TRY(SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE, error);
-    }
     l->max_compressed_size = sparkey_compressors[compression_type].max_compressed_size(compression_block_size);
     l->compressed = malloc(l->max_compressed_size);
     if (l->compressed == NULL) {
@@ -86,11 +352,20 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log_ref, const c
 
   l->header.compression_block_size = compression_block_size;
   l->header.compression_type = compression_type;
+  l->header.minor_version = 0;
+  l->header.header_size = LOG_HEADER_SIZE;
+  l->header.fixed_key_len = 0;
+  l->header.fixed_value_len = 0;
+  if (options != NULL && options->fixed_width) {
+    l->header.minor_version = LOG_FIXED_WIDTH_MINOR_VERSION;
+    l->header.header_size = LOG_FIXED_WIDTH_HEADER_SIZE;
+    l->header.fixed_key_len = options->fixed_key_len;
+    l->header.fixed_value_len = options->fixed_value_len;
+  }
 
   TRY(rand32(&(l->header.file_identifier)), error);
-  l->header.data_end = LOG_HEADER_SIZE;
+  l->header.data_end = l->header.header_size;
   l->header.major_version = LOG_MAJOR_VERSION;
-  l->header.minor_version = LOG_MINOR_VERSION;
   l->header.put_size = 0;
   l->header.delete_size = 0;
   l->header.num_puts = 0;
@@ -101,37 +376,51 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log_ref, const c
 
   TRY(write_logheader(fd, &l->header), error);
   off_t pos = lseek(fd, 0, SEEK_CUR);
-  if (pos != LOG_HEADER_SIZE) {
+  if (pos != l->header.header_size) {
     TRY(SPARKEY_INTERNAL_ERROR, error);
   }
 
-  TRY(buf_init(&l->file_buf, 1024*1024), error);
+  l->file_offset = l->header.header_size;
+  TRY(init_file_io(l, filename, options), error);
   TRY(buf_init(&l->block_buf, compression_block_size), error);
 
   l->entry_count = 0;
+  l->compress_cycles = 0;
 
   l->open_status = MAGIC_VALUE_LOGWRITER;
   *log_ref = l;
   return SPARKEY_SUCCESS;
 error:
+  if (l != NULL) {
+    close_file_io(l);
+  }
   free(l);
   if (fd > 0) close(fd);
   return returncode;
 }
 
 sparkey_returncode sparkey_logwriter_append(sparkey_logwriter **log_ref, const char *filename) {
+  return sparkey_logwriter_append_opts(log_ref, filename, NULL);
+}
+
+sparkey_returncode sparkey_logwriter_append_opts(sparkey_logwriter **log_ref, const char *filename, const sparkey_logwriter_options *options) {
+  RETHROW(assert_valid_options(options));
   sparkey_returncode returncode;
   int fd = 0;
   sparkey_logwriter *log = malloc(sizeof(sparkey_logwriter));
   if (log == NULL) {
     TRY(SPARKEY_INTERNAL_ERROR, error);
   }
+  log->direct_fd = -1;
+  log->file_buf_mem = NULL;
+  log->spare_buf_mem = NULL;
+  log->async = 0;
   TRY(sparkey_load_logheader(&log->header, filename), error);
 
   if (log->header.major_version != LOG_MAJOR_VERSION) {
     TRY(SPARKEY_WRONG_LOG_MAJOR_VERSION, error);
   }
-  if (log->header.minor_version != LOG_MINOR_VERSION) {
+  if (log->header.minor_version > LOG_MINOR_VERSION) {
     TRY(SPARKEY_UNSUPPORTED_LOG_MINOR_VERSION, error);
   }
 
@@ -154,17 +443,20 @@ sparkey_returncode sparkey_logwriter_append(sparkey_logwriter **log_ref, const c
   }
   log->fd = fd;
 
-  lseek(fd, log->header.data_end, SEEK_SET);
-
-  TRY(buf_init(&log->file_buf, 1024*1024), error);
+  log->file_offset = log->header.data_end;
+  TRY(init_file_io(log, filename, options), error);
   TRY(buf_init(&log->block_buf, log->header.compression_block_size), error);
 
   log->entry_count = 0;
+  log->compress_cycles = 0;
 
   log->open_status = MAGIC_VALUE_LOGWRITER;
   *log_ref = log;
   return SPARKEY_SUCCESS;
 error:
+  if (log != NULL) {
+    close_file_io(log);
+  }
   free(log);
   if (fd > 0) close(fd);
   return returncode;
@@ -179,19 +471,19 @@ static sparkey_returncode flush_compressed(sparkey_logwriter *log) {
   sparkey_buf *block_buf = &log->block_buf;
   uint8_t *compressed = log->compressed;
   uint32_t compressed_size = log->max_compressed_size;
-  sparkey_buf *file_buf = &log->file_buf;
-  int fd = log->fd;
 
+  uint64_t start = sparkey_cycles();
   sparkey_returncode ret = sparkey_compressors[log->header.compression_type].compress(
     block_buf->start, buf_used(block_buf), compressed, &compressed_size);
+  log->compress_cycles += sparkey_cycles() - start;
   if (ret != SPARKEY_SUCCESS) {
     return ret;
   }
 
   uint8_t buf1[10];
   ptrdiff_t written1 = write_vlq(buf1, compressed_size);
-  RETHROW(buf_add(file_buf, fd, buf1, written1));
-  RETHROW(buf_add(file_buf, fd, compressed, compressed_size));
+  RETHROW(file_add(log, buf1, written1));
+  RETHROW(file_add(log, compressed, compressed_size));
   block_buf->cur = block_buf->start;
   return SPARKEY_SUCCESS;
 }
@@ -203,19 +495,26 @@ sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log) {
     RETHROW(flush_compressed(log));
   }
   if (buf_used(&log->file_buf) > 0) {
-    RETHROW(buf_flushfile(&log->file_buf, log->fd));
+    RETHROW(flush_file_buf(log));
   }
-  off_t pos = lseek(log->fd, 0, SEEK_CUR);
-  log->header.data_end = pos;
+  RETHROW(wait_for_flush(log));
+  log->header.data_end = log->file_offset;
   lseek(log->fd, 0, SEEK_SET);
   RETHROW(write_logheader(log->fd, &log->header));
-  lseek(log->fd, pos, SEEK_SET);
 
   /* Can't build fsync support on lenny */
   /* fsync(log->fd); */
   return SPARKEY_SUCCESS;
 }
 
+uint64_t sparkey_logwriter_compression_ns(sparkey_logwriter *log) {
+  if (log->open_status != MAGIC_VALUE_LOGWRITER) {
+    return 0;
+  }
+  sparkey_calibrate_cycles();
+  return sparkey_cycles_to_ns(log->compress_cycles);
+}
+
 sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log) {
   sparkey_logwriter *l = *log;
   if (l->open_status != MAGIC_VALUE_LOGWRITER) {
@@ -223,8 +522,11 @@ sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log) {
   }
 
   RETHROW(sparkey_logwriter_flush(l));
+  if (l->write_mode != SPARKEY_WRITE_CACHED) {
+    drop_written(l, l->file_offset, 1);
+  }
+  close_file_io(l);
   close(l->fd);
-  buf_close(&l->file_buf);
   buf_close(&l->block_buf);
   if (l->compressed != NULL) {
     free(l->compressed);
@@ -261,8 +563,12 @@ static sparkey_returncode log_add(sparkey_logwriter *log, uint64_t num1, uint64_
   uint8_t buf1[10];
   uint8_t buf2[10];
 
-  uint64_t written1 = write_vlq(buf1, num1);
-  uint64_t written2 = write_vlq(buf2, num2);
+  uint64_t written1 = 0;
+  uint64_t written2 = 0;
+  if (!log_fixed_width(&log->header)) {
+    written1 = write_vlq(buf1, num1);
+    written2 = write_vlq(buf2, num2);
+  }
 
   *datasize = written1 + written2 + len1 + len2;
   uint64_t remaining;
@@ -284,16 +590,25 @@ static sparkey_returncode log_add(sparkey_logwriter *log, uint64_t num1, uint64_
       RETHROW(flush_compressed(log));
     }
   } else {
-    RETHROW(buf_add(&log->file_buf, log->fd, buf1, written1));
-    RETHROW(buf_add(&log->file_buf, log->fd, buf2, written2));
-    RETHROW(buf_add(&log->file_buf, log->fd, data1, len1));
-    RETHROW(buf_add(&log->file_buf, log->fd, data2, len2));
+    RETHROW(file_add(log, buf1, written1));
+    RETHROW(file_add(log, buf2, written2));
+    RETHROW(file_add(log, data1, len1));
+    RETHROW(file_add(log, data2, len2));
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static inline sparkey_returncode assert_entry_size(sparkey_logwriter *log, uint64_t keylen, uint64_t valuelen) {
+  if (log_fixed_width(&log->header) &&
+      (keylen != log->header.fixed_key_len || valuelen != log->header.fixed_value_len)) {
+    return SPARKEY_ENTRY_SIZE_MISMATCH;
   }
   return SPARKEY_SUCCESS;
 }
 
 sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value) {
   RETHROW(assert_writer_open(log));
+  RETHROW(assert_entry_size(log, keylen, valuelen));
   ptrdiff_t datasize;
   RETHROW(log_add(log, keylen + 1, valuelen, keylen, key, valuelen, value, &datasize));
 
@@ -308,8 +623,66 @@ sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen
   return SPARKEY_SUCCESS;
 }
 
+sparkey_returncode sparkey_logwriter_put_batch(sparkey_logwriter *log, uint64_t num_entries, const sparkey_logwriter_entry *entries) {
+  RETHROW(assert_writer_open(log));
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  int compressed = sparkey_uses_compressor(log->header.compression_type);
+  int fixed = log_fixed_width(&log->header);
+  sparkey_buf *buf = compressed ? &log->block_buf : &log->file_buf;
+  // Fixed width entries have no header
+  uint64_t max_header_size = fixed ? 0 : 20;
+
+  uint64_t put_size = 0;
+  uint64_t max_key_len = log->header.max_key_len;
+  uint64_t max_value_len = log->header.max_value_len;
+  uint64_t i;
+  for (i = 0; i < num_entries; i++) {
+    const sparkey_logwriter_entry *entry = &entries[i];
+    TRY(assert_entry_size(log, entry->keylen, entry->valuelen), done);
+    // Two VLQs take at most 20 bytes. If the entry is guaranteed to fit, no flushing is needed
+    // and it can be encoded in place.
+    if (buf_remaining(buf) >= max_header_size + entry->keylen + entry->valuelen) {
+      uint8_t *cur = buf->cur;
+      if (!fixed) {
+        cur += write_vlq(cur, entry->keylen + 1);
+        cur += write_vlq(cur, entry->valuelen);
+      }
+      memcpy(cur, entry->key, entry->keylen);
+      cur += entry->keylen;
+      memcpy(cur, entry->value, entry->valuelen);
+      cur += entry->valuelen;
+      put_size += cur - buf->cur;
+      buf->cur = cur;
+      if (compressed) {
+        log->entry_count++;
+        log->flushed = 0;
+      }
+    } else {
+      ptrdiff_t datasize;
+      TRY(log_add(log, entry->keylen + 1, entry->valuelen, entry->keylen, entry->key, entry->valuelen, entry->value, &datasize), done);
+      put_size += datasize;
+    }
+    if (entry->keylen > max_key_len) {
+      max_key_len = entry->keylen;
+    }
+    if (entry->valuelen > max_value_len) {
+      max_value_len = entry->valuelen;
+    }
+  }
+
+done:
+  log->header.num_puts += i;
+  log->header.put_size += put_size;
+  log->header.max_key_len = max_key_len;
+  log->header.max_value_len = max_value_len;
+  return returncode;
+}
+
 sparkey_returncode sparkey_logwriter_delete(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key) {
   RETHROW(assert_writer_open(log));
+  if (log_fixed_width(&log->header)) {
+    return SPARKEY_FIXED_WIDTH_DELETE;
+  }
   ptrdiff_t datasize;
   RETHROW(log_add(log, 0, keylen, 0, NULL, keylen, key, &datasize));
 
@@ -318,3 +691,27 @@ sparkey_returncode sparkey_logwriter_delete(sparkey_logwriter *log, uint64_t key
   return SPARKEY_SUCCESS;
 }
 
+
+sparkey_returncode sparkey_logwriter_append_raw(sparkey_logwriter *log, const uint8_t *data, uint64_t len, const sparkey_logheader *stats) {
+  RETHROW(assert_writer_open(log));
+  // Raw data always starts at a block boundary
+  if (buf_used(&log->block_buf) > 0) {
+    RETHROW(flush_compressed(log));
+  }
+  RETHROW(file_add(log, data, len));
+
+  log->header.num_puts += stats->num_puts;
+  log->header.put_size += stats->put_size;
+  log->header.num_deletes += stats->num_deletes;
+  log->header.delete_size += stats->delete_size;
+  if (stats->max_key_len > log->header.max_key_len) {
+    log->header.max_key_len = stats->max_key_len;
+  }
+  if (stats->max_value_len > log->header.max_value_len) {
+    log->header.max_value_len = stats->max_value_len;
+  }
+  if (stats->max_entries_per_block > log->header.max_entries_per_block) {
+    log->header.max_entries_per_block = stats->max_entries_per_block;
+  }
+  return SPARKEY_SUCCESS;
+}
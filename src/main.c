@@ -14,6 +14,7 @@
 * the License.
 */
 #include <stdio.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -43,6 +44,7 @@ static void usage() {
   fprintf(stderr, "  rewrite   - Rewrite an existing log/index file pair, "
                                 "trimming away all replaced entries and "
                                 "possibly changing the compression format.\n");
+  fprintf(stderr, "  heatmap   - Summarize a lookup trace.\n");
   fprintf(stderr, "  help      - Show this help text.\n");
 }
 
@@ -60,13 +62,17 @@ static void usage_get() {
 }
 
 static void usage_writehash() {
-  fprintf(stderr, "Usage: sparkey writehash <file.spl>\n");
+  fprintf(stderr, "Usage: sparkey writehash [-i <n> | -p <n>] <file.spl>\n");
   fprintf(stderr, "  Write a new index file for a log file.\n");
   fprintf(stderr, "  Creates and possibly overwrites a new file with file ending .spi\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -i <n>  Store entries of at most <n> bytes in the index [max: 254]\n");
+  fprintf(stderr, "  -p <n>  Store <n> bytes of key fingerprint per slot [max: 4]\n");
+  fprintf(stderr, "  Without options, the settings of the existing index are kept.\n");
 }
 
 static void usage_createlog() {
-  fprintf(stderr, "Usage: sparkey createlog [-c <none|snappy|zstd> | -b <n>] <file.spl>\n");
+  fprintf(stderr, "Usage: sparkey createlog [-c <none|snappy|zstd> | -b <n> | -f <k>:<v>] <file.spl>\n");
   fprintf(stderr, "  Create a new empty log file.\n");
   fprintf(stderr, "Options:\n");
   fprintf(stderr, "  -c <none|snappy|zstd>  Compression algorithm [default: none]\n");
@@ -74,6 +80,8 @@ static void usage_createlog() {
     COMP_DEFAULT_BLOCKSIZE);
   fprintf(stderr, "                    [min: %d, max: %d]\n",
     COMP_MIN_BLOCKSIZE, COMP_MAX_BLOCKSIZE);
+  fprintf(stderr, "  -f <k>:<v>             Only allow <k> byte keys and <v> byte values,\n");
+  fprintf(stderr, "                         and store them without length headers\n");
 }
 
 static void usage_appendlog() {
@@ -86,15 +94,25 @@ static void usage_appendlog() {
 }
 
 static void usage_rewrite() {
-  fprintf(stderr, "Usage: sparkey rewrite [-c <none|snappy|zstd> | -b <n>] <input.spi> <output.spi>\n");
-  fprintf(stderr, "  Iterate over all entries in <file.spi> and create a new index and log pair\n");
+  fprintf(stderr, "Usage: sparkey rewrite [-c <none|snappy|zstd> | -b <n> | -k <file>] <input.spi> <output.spi>\n");
+  fprintf(stderr, "  Copy all live entries in <input.spi> to a new index and log pair\n");
   fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -k <file>              Place these keys first, to pack hot entries together.\n");
+  fprintf(stderr, "                         One key per line, hottest first, or <key> TAB <count>\n");
   fprintf(stderr, "  -c <none|snappy|zstd>  Compression algorithm [default: same as before]\n");
   fprintf(stderr, "  -b <n>                 Compression blocksize [default: same as before]\n");
   fprintf(stderr, "                    [min: %d, max: %d]\n",
     COMP_MIN_BLOCKSIZE, COMP_MAX_BLOCKSIZE);
 }
 
+static void usage_heatmap() {
+  fprintf(stderr, "Usage: sparkey heatmap [-n <n>] <trace file>\n");
+  fprintf(stderr, "  Show which index pages and log blocks the traced lookups touched.\n");
+  fprintf(stderr, "  Trace files are written by sparkey_hash_trace_save.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -n <n>  Number of hottest pages and blocks to list [default: 10]\n");
+}
+
 static void assert(sparkey_returncode rc) {
   if (rc != SPARKEY_SUCCESS) {
     fprintf(stderr, "%s\n", sparkey_errstring(rc));
@@ -170,8 +188,12 @@ int get(const char *hashfile, const char *logfile, const char *key) {
   return exitcode;
 }
 
-int writehash(const char *indexfile, const char *logfile) {
-  assert(sparkey_hash_write(indexfile, logfile, 0));
+int writehash(const char *indexfile, const char *logfile, const sparkey_hash_options *options) {
+  if (options == NULL) {
+    assert(sparkey_hash_write(indexfile, logfile, 0));
+  } else {
+    assert(sparkey_hash_write_opts(indexfile, 1, &logfile, options));
+  }
   return 0;
 }
 
@@ -243,6 +265,214 @@ put_fail:
   return 1;
 }
 
+typedef struct {
+  char *key;
+  uint64_t count;
+  uint64_t line;
+} hot_key;
+
+static int cmp_hot_key(const void *a, const void *b) {
+  const hot_key *x = a;
+  const hot_key *y = b;
+  if (x->count != y->count) {
+    return x->count > y->count ? -1 : 1;
+  }
+  return x->line < y->line ? -1 : x->line > y->line;
+}
+
+/**
+ * Reads a file with one key per line, hottest first, or with lines of <key> TAB <count>
+ * in any order. Keys with a count are ordered by descending count.
+ * @returns the number of keys, or -1 on error.
+ */
+static int64_t read_hot_keys(const char *filename, hot_key **keys_ref) {
+  FILE *input = fopen(filename, "r");
+  if (input == NULL) {
+    fprintf(stderr, "Cannot open hot key file '%s'\n", filename);
+    return -1;
+  }
+  char *line = NULL;
+  size_t size = 0;
+  uint64_t n = 0;
+  uint64_t capacity = 1024;
+  hot_key *keys = malloc(capacity * sizeof(hot_key));
+  int failed = keys == NULL;
+  for (size_t end = read_line(&line, &size, input); !failed && line[end] == '\n'; end = read_line(&line, &size, input)) {
+    line[end] = '\0';
+    char *tab = strchr(line, '\t');
+    uint64_t count = 0;
+    if (tab != NULL) {
+      *tab = '\0';
+      count = strtoull(tab + 1, NULL, 10);
+    }
+    if (n == capacity) {
+      capacity *= 2;
+      hot_key *grown = realloc(keys, capacity * sizeof(hot_key));
+      if (grown == NULL) {
+        failed = 1;
+        break;
+      }
+      keys = grown;
+    }
+    keys[n].key = strdup(line);
+    if (keys[n].key == NULL) {
+      failed = 1;
+      break;
+    }
+    keys[n].count = count;
+    keys[n].line = n;
+    n++;
+  }
+  free(line);
+  fclose(input);
+  if (failed) {
+    // A partial hot set would silently change the layout of the compacted log
+    fprintf(stderr, "Cannot read hot key file '%s'\n", filename);
+    for (uint64_t i = 0; i < n; i++) {
+      free(keys[i].key);
+    }
+    free(keys);
+    return -1;
+  }
+  qsort(keys, n, sizeof(hot_key), cmp_hot_key);
+  *keys_ref = keys;
+  return n;
+}
+
+typedef struct {
+  uint64_t value;
+  uint64_t count;
+} heat;
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return x < y ? -1 : x > y;
+}
+
+static int cmp_heat(const void *a, const void *b) {
+  const heat *x = a;
+  const heat *y = b;
+  if (x->count != y->count) {
+    return x->count < y->count ? 1 : -1;
+  }
+  return x->value < y->value ? -1 : x->value > y->value;
+}
+
+/**
+ * Counts the distinct values, hottest first.
+ * Sorts values in place.
+ * @returns the number of distinct values.
+ */
+static uint64_t count_heat(uint64_t *values, uint64_t n, heat *heats) {
+  qsort(values, n, sizeof(uint64_t), cmp_u64);
+  uint64_t distinct = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    if (i == 0 || values[i] != values[i - 1]) {
+      heats[distinct].value = values[i];
+      heats[distinct].count = 0;
+      distinct++;
+    }
+    heats[distinct - 1].count++;
+  }
+  qsort(heats, distinct, sizeof(heat), cmp_heat);
+  return distinct;
+}
+
+static void print_heat(const char *name, const char *unit_name, uint64_t unit, heat *heats, uint64_t distinct, uint64_t total, int top) {
+  printf("%s touched: %"PRIu64"\n", name, distinct);
+  const int percentiles[] = {50, 90, 99};
+  uint64_t covered = 0;
+  uint64_t i = 0;
+  for (int p = 0; p < 3; p++) {
+    while (covered * 100 < total * percentiles[p] && i < distinct) {
+      covered += heats[i++].count;
+    }
+    printf("  %s covering %d%% of lookups: %"PRIu64"\n", name, percentiles[p], i);
+  }
+  if (top > 0 && distinct > 0) {
+    printf("  hottest (%s, lookups, share):\n", unit_name);
+  }
+  for (uint64_t j = 0; j < distinct && j < (uint64_t) top; j++) {
+    printf("  %12"PRIu64" %10"PRIu64" %6.2f%%\n", heats[j].value * unit, heats[j].count, 100.0 * heats[j].count / total);
+  }
+}
+
+static int heatmap(const char *filename, int top) {
+  sparkey_trace_file trace;
+  assert(sparkey_trace_load(filename, &trace));
+  uint64_t n = trace.num_records;
+  if (n == 0) {
+    printf("No lookups traced\n");
+    free(trace.records);
+    return 0;
+  }
+  uint64_t *values = malloc(n * sizeof(uint64_t));
+  heat *heats = malloc(n * sizeof(heat));
+  if (values == NULL || heats == NULL) {
+    fprintf(stderr, "Cannot allocate memory for %"PRIu64" records\n", n);
+    return 1;
+  }
+
+  uint64_t found = 0;
+  uint64_t decompressed = 0;
+  uint64_t probes = 0;
+  uint32_t max_probe = 0;
+  uint64_t probe_histogram[9];
+  memset(probe_histogram, 0, sizeof(probe_histogram));
+  for (uint64_t i = 0; i < n; i++) {
+    sparkey_trace_record *r = &trace.records[i];
+    found += (r->flags & SPARKEY_TRACE_FOUND) != 0;
+    decompressed += (r->flags & SPARKEY_TRACE_DECOMPRESSED) != 0;
+    probes += r->probe_length;
+    if (r->probe_length > max_probe) {
+      max_probe = r->probe_length;
+    }
+    probe_histogram[r->probe_length < 8 ? r->probe_length : 8]++;
+  }
+  printf("Lookups traced: %"PRIu64"\n", n);
+  printf("  found: %"PRIu64" (%.2f%%)\n", found, 100.0 * found / n);
+  printf("  decompressed a block: %"PRIu64" (%.2f%%)\n", decompressed, 100.0 * decompressed / n);
+  printf("Probe length: average %.3f, max %u\n", (double) probes / n, max_probe);
+  for (int i = 1; i <= 8; i++) {
+    if (probe_histogram[i] > 0) {
+      printf("  %s%d: %"PRIu64"\n", i == 8 ? ">=" : "", i, probe_histogram[i]);
+    }
+  }
+
+  // Index pages, as the hash table is mmapped and read a page at a time
+  uint64_t page_slots = trace.slot_size == 0 ? 1 : 4096 / trace.slot_size;
+  if (page_slots == 0) {
+    page_slots = 1;
+  }
+  for (uint64_t i = 0; i < n; i++) {
+    values[i] = trace.records[i].slot / page_slots;
+  }
+  uint64_t distinct = count_heat(values, n, heats);
+  printf("Hash capacity: %"PRIu64" slots, %"PRIu64" per 4 KiB page\n", trace.hash_capacity, page_slots);
+  print_heat("Index pages", "first slot", page_slots, heats, distinct, n, top);
+
+  // Log blocks, for compressed logs, or 4 KiB pages of the log for uncompressed logs
+  uint64_t m = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    if (trace.records[i].block_position != 0) {
+      values[m++] = trace.entry_block_bits > 0 ? trace.records[i].block_position : trace.records[i].block_position / 4096;
+    }
+  }
+  distinct = count_heat(values, m, heats);
+  printf("Lookups reading the log: %"PRIu64"\n", m);
+  if (trace.entry_block_bits > 0) {
+    print_heat("Log blocks", "log offset", 1, heats, distinct, m, top);
+  } else {
+    print_heat("Log pages", "log offset", 4096, heats, distinct, m, top);
+  }
+
+  free(heats);
+  free(values);
+  free(trace.records);
+  return 0;
+}
+
 int main(int argc, char * const *argv) {
   if (argc < 2) {
     usage();
@@ -270,17 +500,54 @@ int main(int argc, char * const *argv) {
     free(log_filename);
     return retval;
   } else if (strcmp(command, "writehash") == 0) {
-    if (argc < 3) {
+    opterr = 0;
+    optind = 2;
+    int opt_char;
+    int has_options = 0;
+    sparkey_hash_options options;
+    memset(&options, 0, sizeof(options));
+    while ((opt_char = getopt (argc, argv, "i:p:")) != -1) {
+      switch (opt_char) {
+      case 'i':
+        if (sscanf(optarg, "%"SCNu32, &options.inline_size) != 1) {
+          fprintf(stderr, "Inline size must be an integer, but was '%s'\n", optarg);
+          return 1;
+        }
+        has_options = 1;
+        break;
+      case 'p':
+        if (sscanf(optarg, "%"SCNu32, &options.fingerprint_size) != 1) {
+          fprintf(stderr, "Fingerprint size must be an integer, but was '%s'\n", optarg);
+          return 1;
+        }
+        has_options = 1;
+        break;
+      case '?':
+        if (optopt == 'i' || optopt == 'p') {
+          fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+        } else if (isprint(optopt)) {
+          fprintf(stderr, "Unknown option '-%c'.\n", optopt);
+        } else {
+          fprintf(stderr, "Unknown option character '\\x%x'.\n", optopt);
+        }
+        return 1;
+      default:
+        fprintf(stderr, "Unknown option parsing failure\n");
+        return 1;
+      }
+    }
+
+    if (optind >= argc) {
       usage_writehash();
       return 1;
     }
-    const char *log_filename = argv[2];
+    const char *log_filename = argv[optind];
     char *index_filename = sparkey_create_index_filename(log_filename);
     if (index_filename == NULL) {
       fprintf(stderr, "log filename must end with .spl\n");
       return 1;
     }
-    int retval = writehash(index_filename, log_filename);
+    int retval = writehash(index_filename, log_filename, has_options ? &options : NULL);
     free(index_filename);
     return retval;
   } else if (strcmp(command, "createlog") == 0) {
@@ -289,8 +556,17 @@ int main(int argc, char * const *argv) {
     int opt_char;
     int block_size = COMP_DEFAULT_BLOCKSIZE;
     sparkey_compression_type compression_type = SPARKEY_COMPRESSION_NONE;
-    while ((opt_char = getopt (argc, argv, "b:c:")) != -1) {
+    sparkey_logwriter_options options;
+    memset(&options, 0, sizeof(options));
+    while ((opt_char = getopt (argc, argv, "b:c:f:")) != -1) {
       switch (opt_char) {
+      case 'f':
+        if (sscanf(optarg, "%"SCNu32":%"SCNu32, &options.fixed_key_len, &options.fixed_value_len) != 2) {
+          fprintf(stderr, "Fixed width must be <keylen>:<valuelen>, but was '%s'\n", optarg);
+          return 1;
+        }
+        options.fixed_width = 1;
+        break;
       case 'b':
         if (sscanf(optarg, "%d", &block_size) != 1) {
           fprintf(stderr, "Block size must be an integer, but was '%s'\n", optarg);
@@ -315,7 +591,7 @@ int main(int argc, char * const *argv) {
         }
         break;
       case '?':
-        if (optopt == 'b' || optopt == 'c') {
+        if (optopt == 'b' || optopt == 'c' || optopt == 'f') {
           fprintf(stderr, "Option -%c requires an argument.\n", optopt);
         } else if (isprint(optopt)) {
           fprintf(stderr, "Unknown option '-%c'.\n", optopt);
@@ -336,8 +612,8 @@ int main(int argc, char * const *argv) {
 
     const char *log_filename = argv[optind];
     sparkey_logwriter *writer;
-    assert(sparkey_logwriter_create(&writer, log_filename,
-      compression_type, block_size));
+    assert(sparkey_logwriter_create_opts(&writer, log_filename,
+      compression_type, block_size, &options));
     assert(sparkey_logwriter_close(&writer));
     return 0;
   } else if (strcmp(command, "appendlog") == 0) {
@@ -387,8 +663,12 @@ int main(int argc, char * const *argv) {
     int block_size = -1;
     sparkey_compression_type compression_type = SPARKEY_COMPRESSION_NONE;
     int compression_set = 0;
-    while ((opt_char = getopt (argc, argv, "b:c:")) != -1) {
+    const char *hot_key_filename = NULL;
+    while ((opt_char = getopt (argc, argv, "b:c:k:")) != -1) {
       switch (opt_char) {
+      case 'k':
+        hot_key_filename = optarg;
+        break;
       case 'b':
         if (sscanf(optarg, "%d", &block_size) != 1) {
           fprintf(stderr, "Block size must be an integer, but was '%s'\n", optarg);
@@ -463,40 +743,69 @@ int main(int argc, char * const *argv) {
       block_size = sparkey_logreader_get_compression_blocksize(logreader);
     }
 
-    // TODO: skip rewrite if compression type and block size are unchanged, and there is no garbage in the log
-
-    sparkey_logwriter *writer;
-    assert(sparkey_logwriter_create(&writer, output_log_filename, compression_type, block_size));
-
-    sparkey_logiter *iter;
-    assert(sparkey_logiter_create(&iter, logreader));
-
-    uint8_t *keybuf = malloc(sparkey_logreader_maxkeylen(logreader));
-    uint8_t *valuebuf = malloc(sparkey_logreader_maxvaluelen(logreader));
-
-    while (1) {
-      assert(sparkey_logiter_next(iter, logreader));
-      if (sparkey_logiter_state(iter) != SPARKEY_ITER_ACTIVE) {
-        break;
-      }
-      uint64_t wanted_keylen = sparkey_logiter_keylen(iter);
-      uint64_t actual_keylen;
-      assert(sparkey_logiter_fill_key(iter, logreader, wanted_keylen, keybuf, &actual_keylen));
-      uint64_t wanted_valuelen = sparkey_logiter_valuelen(iter);
-      uint64_t actual_valuelen;
-      assert(sparkey_logiter_fill_value(iter, logreader, wanted_valuelen, valuebuf, &actual_valuelen));
-
-      assert(sparkey_logwriter_put(writer, wanted_keylen, keybuf, wanted_valuelen, valuebuf));
-    }
-    free(keybuf);
-    free(valuebuf);
-    sparkey_logiter_close(&iter);
-    assert(sparkey_logwriter_close(&writer));
     sparkey_hash_close(&reader);
 
-    writehash(output_index_filename, output_log_filename);
+    // Blocks without garbage are copied as they are if the compression settings are unchanged
+    sparkey_compaction_options options;
+    memset(&options, 0, sizeof(options));
+    options.set_compression = 1;
+    options.compression_type = compression_type;
+    options.compression_block_size = block_size;
+    if (hot_key_filename != NULL) {
+      hot_key *keys;
+      int64_t num_keys = read_hot_keys(hot_key_filename, &keys);
+      if (num_keys < 0) {
+        return 1;
+      }
+      const uint8_t **hot_keys = malloc((num_keys + 1) * sizeof(uint8_t *));
+      uint64_t *hot_keylens = malloc((num_keys + 1) * sizeof(uint64_t));
+      if (hot_keys == NULL || hot_keylens == NULL) {
+        fprintf(stderr, "Cannot allocate the hot keys\n");
+        return 1;
+      }
+      for (int64_t i = 0; i < num_keys; i++) {
+        hot_keys[i] = (const uint8_t *) keys[i].key;
+        hot_keylens[i] = strlen(keys[i].key);
+      }
+      options.num_hot_keys = num_keys;
+      options.hot_keys = hot_keys;
+      options.hot_keylens = hot_keylens;
+    }
+    assert(sparkey_compact(input_index_filename, input_log_filename, output_index_filename, output_log_filename, &options));
 
     return 0;
+  } else if (strcmp(command, "heatmap") == 0) {
+    opterr = 0;
+    optind = 2;
+    int opt_char;
+    int top = 10;
+    while ((opt_char = getopt (argc, argv, "n:")) != -1) {
+      switch (opt_char) {
+      case 'n':
+        if (sscanf(optarg, "%d", &top) != 1 || top < 0) {
+          fprintf(stderr, "Number of entries must be a non-negative integer, but was '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case '?':
+        if (optopt == 'n') {
+          fprintf(stderr, "Option -%c requires an argument.\n", optopt);
+        } else if (isprint(optopt)) {
+          fprintf(stderr, "Unknown option '-%c'.\n", optopt);
+        } else {
+          fprintf(stderr, "Unknown option character '\\x%x'.\n", optopt);
+        }
+        return 1;
+      default:
+        fprintf(stderr, "Unknown option parsing failure\n");
+        return 1;
+      }
+    }
+    if (optind >= argc) {
+      usage_heatmap();
+      return 1;
+    }
+    return heatmap(argv[optind], top);
   } else if (strcmp(command, "help") == 0 || strcmp(command, "--help") == 0 || strcmp(command, "-h") == 0) {
     usage();
     return 0;
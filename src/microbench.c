@@ -0,0 +1,502 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <time.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "MurmurHash3.h"
+#include "hashheader.h"
+#include "vlq.h"
+
+/*
+ * Micro-benchmarks of the inner kernels: VLQ coding, key hashing, reading hash table
+ * addresses and block compression. Each kernel works on a small, cache resident data set
+ * so that only the kernel itself is measured.
+ */
+
+// large enough that the branch predictor cannot learn the sequence of VLQ sizes
+#define VLQ_COUNT (16384)
+#define HASH_KEYS (64)
+#define ADDR_SLOTS (1 << 16)
+#define ADDR_LOOKUPS (1024)
+
+/**
+ * Runs a kernel iterations times.
+ * @returns a value that depends on the work, so that the compiler cannot skip it.
+ */
+typedef uint64_t (*kernel_fn)(void *arg, uint64_t iterations);
+
+typedef struct {
+  char name[64];
+  kernel_fn fn;
+  void *arg;
+  // calls of the measured function per iteration
+  uint64_t ops;
+  // bytes processed per iteration, or 0
+  uint64_t bytes;
+  // compression ratio, or 0
+  double ratio;
+} kernel;
+
+typedef struct {
+  int cpu;
+  int runs;
+  double run_time;
+  double warmup_time;
+  const char *filter;
+} microbench_config;
+
+static volatile uint64_t sink;
+
+static double now() {
+  struct timespec tp;
+#ifdef CLOCK_MONOTONIC_RAW
+  clock_gettime(CLOCK_MONOTONIC_RAW, &tp);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+#endif
+  return tp.tv_sec + 1e-9 * tp.tv_nsec;
+}
+
+static uint64_t splitmix64(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void * xmalloc(size_t size) {
+  void *p = malloc(size);
+  if (p == NULL) {
+    fprintf(stderr, "Could not allocate %zu bytes\n", size);
+    exit(1);
+  }
+  return p;
+}
+
+/* VLQ */
+
+typedef struct {
+  uint64_t values[VLQ_COUNT];
+  uint8_t encoded[VLQ_COUNT * 10];
+  uint64_t encoded_size;
+} vlq_data;
+
+/**
+ * @param max_bits values are uniformly distributed in size from 1 to max_bits bits.
+ */
+static vlq_data * make_vlq_data(int max_bits) {
+  vlq_data *d = xmalloc(sizeof(vlq_data));
+  uint64_t state = max_bits;
+  d->encoded_size = 0;
+  for (int i = 0; i < VLQ_COUNT; i++) {
+    int bits = 1 + splitmix64(&state) % max_bits;
+    d->values[i] = splitmix64(&state) >> (64 - bits);
+    d->encoded_size += write_vlq(&d->encoded[d->encoded_size], d->values[i]);
+  }
+  return d;
+}
+
+static uint64_t bench_write_vlq(void *arg, uint64_t iterations) {
+  vlq_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint8_t *p = d->encoded;
+    for (int i = 0; i < VLQ_COUNT; i++) {
+      p += write_vlq(p, d->values[i]);
+    }
+    sum += p[-1];
+  }
+  return sum;
+}
+
+static uint64_t bench_read_vlq(void *arg, uint64_t iterations) {
+  vlq_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint64_t pos = 0;
+    for (int i = 0; i < VLQ_COUNT; i++) {
+      sum += read_vlq(d->encoded, &pos);
+    }
+  }
+  return sum;
+}
+
+static uint64_t bench_read_vlq_bounded(void *arg, uint64_t iterations) {
+  vlq_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint64_t pos = 0;
+    for (int i = 0; i < VLQ_COUNT; i++) {
+      sum += read_vlq_bounded(d->encoded, &pos, d->encoded_size);
+    }
+  }
+  return sum;
+}
+
+/* Hashing */
+
+typedef struct {
+  uint64_t len;
+  uint8_t *keys;
+} hash_data;
+
+static hash_data * make_hash_data(uint64_t len) {
+  hash_data *d = xmalloc(sizeof(hash_data));
+  d->len = len;
+  d->keys = xmalloc(HASH_KEYS * len);
+  uint64_t state = len;
+  for (uint64_t i = 0; i < HASH_KEYS * len; i++) {
+    d->keys[i] = splitmix64(&state);
+  }
+  return d;
+}
+
+static uint64_t bench_murmurhash32(void *arg, uint64_t iterations) {
+  hash_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    for (int i = 0; i < HASH_KEYS; i++) {
+      sum += murmurhash32_hash(&d->keys[i * d->len], d->len, 0);
+    }
+  }
+  return sum;
+}
+
+static uint64_t bench_murmurhash64(void *arg, uint64_t iterations) {
+  hash_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    for (int i = 0; i < HASH_KEYS; i++) {
+      sum += murmurhash64_hash(&d->keys[i * d->len], d->len, 0);
+    }
+  }
+  return sum;
+}
+
+/* Hash table addresses */
+
+typedef struct {
+  int address_size;
+  uint8_t *table;
+  uint64_t positions[ADDR_LOOKUPS];
+} addr_data;
+
+static addr_data * make_addr_data(int address_size) {
+  addr_data *d = xmalloc(sizeof(addr_data));
+  d->address_size = address_size;
+  d->table = xmalloc((uint64_t) ADDR_SLOTS * address_size);
+  uint64_t state = address_size;
+  for (uint64_t i = 0; i < ADDR_SLOTS; i++) {
+    write_addr(&d->table[i * address_size], splitmix64(&state), address_size);
+  }
+  for (int i = 0; i < ADDR_LOOKUPS; i++) {
+    d->positions[i] = (splitmix64(&state) % ADDR_SLOTS) * address_size;
+  }
+  return d;
+}
+
+static uint64_t bench_read_addr(void *arg, uint64_t iterations) {
+  addr_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    for (int i = 0; i < ADDR_LOOKUPS; i++) {
+      sum += read_addr(d->table, d->positions[i], d->address_size);
+    }
+  }
+  return sum;
+}
+
+/* Compression */
+
+typedef struct {
+  struct sparkey_compressor *compressor;
+  uint32_t block_size;
+  uint8_t *input;
+  uint8_t *compressed;
+  uint32_t compressed_size;
+  uint32_t max_compressed_size;
+  uint8_t *output;
+} compress_data;
+
+/**
+ * Fills a block with log-like entries: VLQ lengths, short keys and values made of a few words.
+ */
+static void fill_block(uint8_t *buf, uint32_t size) {
+  static const char *words[] = {"track", "album", "artist", "playlist", "user", "country", "plays", "skips"};
+  uint64_t state = size;
+  uint32_t pos = 0;
+  while (pos < size) {
+    char entry[128];
+    int len = snprintf(entry, sizeof(entry), "%c%ckey_%08"PRIu64"%s:%"PRIu64",%s:%"PRIu64";", 13, 40,
+      splitmix64(&state) % 100000000, words[splitmix64(&state) % 8], splitmix64(&state) % 1000,
+      words[splitmix64(&state) % 8], splitmix64(&state) % 100000);
+    for (int i = 0; i < len && pos < size; i++) {
+      buf[pos++] = entry[i];
+    }
+  }
+}
+
+static compress_data * make_compress_data(sparkey_compression_type type, uint32_t block_size) {
+  compress_data *d = xmalloc(sizeof(compress_data));
+  d->compressor = &sparkey_compressors[type];
+  d->block_size = block_size;
+  d->max_compressed_size = d->compressor->max_compressed_size(block_size);
+  d->input = xmalloc(block_size);
+  d->compressed = xmalloc(d->max_compressed_size);
+  d->output = xmalloc(block_size);
+  fill_block(d->input, block_size);
+  d->compressed_size = d->max_compressed_size;
+  if (d->compressor->compress(d->input, block_size, d->compressed, &d->compressed_size) != SPARKEY_SUCCESS) {
+    fprintf(stderr, "Could not compress a block of %"PRIu32" bytes\n", block_size);
+    exit(1);
+  }
+  return d;
+}
+
+static uint64_t bench_compress(void *arg, uint64_t iterations) {
+  compress_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint32_t compressed_size = d->max_compressed_size;
+    d->compressor->compress(d->input, d->block_size, d->compressed, &compressed_size);
+    sum += compressed_size;
+  }
+  return sum;
+}
+
+static uint64_t bench_decompress(void *arg, uint64_t iterations) {
+  compress_data *d = arg;
+  uint64_t sum = 0;
+  for (uint64_t n = 0; n < iterations; n++) {
+    uint32_t uncompressed_size = d->block_size;
+    d->compressor->decompress(d->compressed, d->compressed_size, d->output, &uncompressed_size);
+    sum += uncompressed_size + d->output[n % d->block_size];
+  }
+  return sum;
+}
+
+/* Measuring */
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double time_iterations(const kernel *k, uint64_t iterations) {
+  double start = now();
+  sink += k->fn(k->arg, iterations);
+  return now() - start;
+}
+
+/**
+ * Warms up the kernel and finds the number of iterations that takes about c->run_time,
+ * then times c->runs runs of that many iterations.
+ */
+static void run_kernel(const microbench_config *c, const kernel *k) {
+  uint64_t iterations = 1;
+  double start = now();
+  double t;
+  while ((t = time_iterations(k, iterations)) < c->run_time / 8) {
+    iterations *= 2;
+  }
+  iterations = iterations * (c->run_time / t);
+  if (iterations == 0) {
+    iterations = 1;
+  }
+  while (now() - start < c->warmup_time) {
+    time_iterations(k, iterations);
+  }
+
+  double *ns = xmalloc(c->runs * sizeof(double));
+  for (int i = 0; i < c->runs; i++) {
+    ns[i] = time_iterations(k, iterations) * 1e9 / (iterations * k->ops);
+  }
+  qsort(ns, c->runs, sizeof(double), cmp_double);
+  double median = ns[c->runs / 2];
+  printf("%-28s %10.2f %10.2f %10.2f %7.1f%%", k->name, median, ns[0], ns[c->runs - 1],
+    100 * (ns[c->runs - 1] - ns[0]) / median);
+  if (k->bytes > 0) {
+    printf(" %10.1f", k->bytes / (median * k->ops) * 1e9 / (1 << 20));
+  } else {
+    printf(" %10s", "");
+  }
+  if (k->ratio > 0) {
+    printf(" %7.2f", k->ratio);
+  }
+  printf("\n");
+  free(ns);
+}
+
+static int pin_cpu(int cpu) {
+#ifdef HAVE_SCHED_SETAFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void) cpu;
+  return 0;
+#endif
+}
+
+/* main */
+
+static int add_kernel(kernel *kernels, int n, const char *filter, const char *name, kernel_fn fn, void *arg, uint64_t ops, uint64_t bytes) {
+  if (filter != NULL && strstr(name, filter) == NULL) {
+    return n;
+  }
+  kernel *k = &kernels[n];
+  snprintf(k->name, sizeof(k->name), "%s", name);
+  k->fn = fn;
+  k->arg = arg;
+  k->ops = ops;
+  k->bytes = bytes;
+  k->ratio = 0;
+  return n + 1;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: microbench [options]\n");
+  fprintf(stderr, "  Times the VLQ, hashing, address and compression kernels in isolation.\n");
+  fprintf(stderr, "  Times are per call, as the median, minimum and maximum over the runs.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -p <cpu>                  Pin to this CPU, -1 to not pin [default: the current CPU]\n");
+  fprintf(stderr, "  -r <n>                    Number of timed runs per kernel [default: 11]\n");
+  fprintf(stderr, "  -t <ms>                   Duration of each run [default: 50]\n");
+  fprintf(stderr, "  -w <ms>                   Warmup time per kernel [default: 200]\n");
+  fprintf(stderr, "  -f <text>                 Only run kernels whose name contains text\n");
+  fprintf(stderr, "  -h                        Show this help\n");
+}
+
+int main(int argc, char * const *argv) {
+  microbench_config c;
+  c.cpu = -2;
+  c.runs = 11;
+  c.run_time = 0.05;
+  c.warmup_time = 0.2;
+  c.filter = NULL;
+
+  int opt_char;
+  while ((opt_char = getopt(argc, argv, "p:r:t:w:f:h")) != -1) {
+    int ok = 1;
+    int ms;
+    switch (opt_char) {
+    case 'p':
+      ok = sscanf(optarg, "%d", &c.cpu) == 1 && c.cpu >= -1;
+      break;
+    case 'r':
+      ok = sscanf(optarg, "%d", &c.runs) == 1 && c.runs > 0;
+      break;
+    case 't':
+      ok = sscanf(optarg, "%d", &ms) == 1 && ms > 0;
+      c.run_time = ms / 1000.0;
+      break;
+    case 'w':
+      ok = sscanf(optarg, "%d", &ms) == 1 && ms >= 0;
+      c.warmup_time = ms / 1000.0;
+      break;
+    case 'f':
+      c.filter = optarg;
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      ok = 0;
+      break;
+    }
+    if (!ok) {
+      usage();
+      return 1;
+    }
+  }
+  if (optind < argc) {
+    usage();
+    return 1;
+  }
+
+  if (c.cpu == -2) {
+    c.cpu = sched_getcpu();
+  }
+  if (c.cpu < 0) {
+    printf("Not pinned to a CPU\n");
+  } else if (pin_cpu(c.cpu)) {
+    printf("Pinned to CPU %d\n", c.cpu);
+  } else {
+    printf("Could not pin to CPU %d\n", c.cpu);
+  }
+
+  kernel kernels[64];
+  int n = 0;
+  char name[64];
+  int vlq_bits[] = {7, 14, 64};
+  const char *vlq_names[] = {"1byte", "2byte", "mixed"};
+  for (int i = 0; i < 3; i++) {
+    vlq_data *d = make_vlq_data(vlq_bits[i]);
+    snprintf(name, sizeof(name), "write_vlq/%s", vlq_names[i]);
+    n = add_kernel(kernels, n, c.filter, name, bench_write_vlq, d, VLQ_COUNT, d->encoded_size);
+    snprintf(name, sizeof(name), "read_vlq/%s", vlq_names[i]);
+    n = add_kernel(kernels, n, c.filter, name, bench_read_vlq, d, VLQ_COUNT, d->encoded_size);
+    snprintf(name, sizeof(name), "read_vlq_bounded/%s", vlq_names[i]);
+    n = add_kernel(kernels, n, c.filter, name, bench_read_vlq_bounded, d, VLQ_COUNT, d->encoded_size);
+  }
+  uint64_t key_sizes[] = {8, 16, 32, 64, 256};
+  for (int i = 0; i < 5; i++) {
+    hash_data *d = make_hash_data(key_sizes[i]);
+    snprintf(name, sizeof(name), "murmurhash32/%"PRIu64, key_sizes[i]);
+    n = add_kernel(kernels, n, c.filter, name, bench_murmurhash32, d, HASH_KEYS, HASH_KEYS * key_sizes[i]);
+    snprintf(name, sizeof(name), "murmurhash64/%"PRIu64, key_sizes[i]);
+    n = add_kernel(kernels, n, c.filter, name, bench_murmurhash64, d, HASH_KEYS, HASH_KEYS * key_sizes[i]);
+  }
+  for (int address_size = 4; address_size <= 8; address_size += 4) {
+    snprintf(name, sizeof(name), "read_addr/%d", address_size);
+    n = add_kernel(kernels, n, c.filter, name, bench_read_addr, make_addr_data(address_size), ADDR_LOOKUPS, 0);
+  }
+  const char *compression_names[] = {"none", "snappy", "zstd"};
+  uint32_t block_sizes[] = {1 << 10, 1 << 12, 1 << 14, 1 << 16};
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
+    if (!sparkey_uses_compressor(t)) {
+      continue;
+    }
+    for (int i = 0; i < 4; i++) {
+      compress_data *d = make_compress_data(t, block_sizes[i]);
+      double ratio = (double) d->block_size / d->compressed_size;
+      snprintf(name, sizeof(name), "compress/%s/%"PRIu32, compression_names[t], block_sizes[i]);
+      int added = add_kernel(kernels, n, c.filter, name, bench_compress, d, 1, d->block_size);
+      if (added > n) {
+        kernels[n].ratio = ratio;
+      }
+      n = added;
+      snprintf(name, sizeof(name), "decompress/%s/%"PRIu32, compression_names[t], block_sizes[i]);
+      n = add_kernel(kernels, n, c.filter, name, bench_decompress, d, 1, d->block_size);
+    }
+  }
+
+  printf("%-28s %10s %10s %10s %8s %10s %7s\n", "kernel", "ns/call", "min", "max", "spread", "MB/s", "ratio");
+  for (int i = 0; i < n; i++) {
+    run_kernel(&c, &kernels[i]);
+  }
+  return 0;
+}
@@ -44,6 +44,15 @@ const char * sparkey_errstring(sparkey_returncode code) {
 
   case SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE: return "Invalid compression block size";
   case SPARKEY_INVALID_COMPRESSION_TYPE: return "Invalid compression type";
+  case SPARKEY_INVALID_READ_MODE: return "Invalid read mode";
+  case SPARKEY_INVALID_WRITE_MODE: return "Invalid write mode";
+  case SPARKEY_INVALID_SHARD_COUNT: return "Invalid number of shards or segments";
+  case SPARKEY_SEGMENT_MISMATCH: return "Log segments have different compression settings or entry formats";
+  case SPARKEY_CANCELLED: return "Operation was cancelled";
+  case SPARKEY_INVALID_PARTITION_COUNT: return "Invalid number of partitions";
+  case SPARKEY_INVALID_FIXED_WIDTH: return "Invalid fixed key and value sizes";
+  case SPARKEY_ENTRY_SIZE_MISMATCH: return "Entry does not match the fixed key and value sizes of the log";
+  case SPARKEY_FIXED_WIDTH_DELETE: return "Fixed width logs can not contain deletes";
 
   case SPARKEY_WRONG_HASH_MAGIC_NUMBER: return "Wrong magic number of hash file";
   case SPARKEY_WRONG_HASH_MAJOR_VERSION: return "Wrong major version of hash file";
@@ -53,6 +62,25 @@ const char * sparkey_errstring(sparkey_returncode code) {
   case SPARKEY_FILE_IDENTIFIER_MISMATCH: return "File identifier differs between hash file and log file";
   case SPARKEY_HASH_HEADER_CORRUPT: return "Hash header is corrupt";
   case SPARKEY_HASH_SIZE_INVALID: return "Hash size is invalid";
+  case SPARKEY_INLINE_SIZE_INVALID: return "Inline size is invalid";
+  case SPARKEY_FINGERPRINT_SIZE_INVALID: return "Fingerprint size is invalid";
+
+  case SPARKEY_ASYNC_QUEUE_FULL: return "Too many asynchronous lookups in progress";
+  case SPARKEY_INVALID_QUEUE_DEPTH: return "Invalid queue depth";
+
+  case SPARKEY_WRONG_SORTED_MAGIC_NUMBER: return "Wrong magic number of sorted index file";
+  case SPARKEY_UNSUPPORTED_SORTED_VERSION: return "Unsupported version of sorted index file";
+  case SPARKEY_SORTED_INDEX_CORRUPT: return "Sorted index file is corrupt";
+  case SPARKEY_SORTED_CLOSED: return "Sorted index is closed";
+
+  case SPARKEY_WRONG_LIVENESS_MAGIC_NUMBER: return "Wrong magic number of liveness file";
+  case SPARKEY_UNSUPPORTED_LIVENESS_VERSION: return "Unsupported version of liveness file";
+  case SPARKEY_LIVENESS_CORRUPT: return "Liveness file is corrupt";
+
+  case SPARKEY_INVALID_TRACE_SETTINGS: return "Invalid trace settings";
+  case SPARKEY_TRACE_CORRUPT: return "Trace file is corrupt";
+  case SPARKEY_LATENCY_DISABLED: return "Latency histograms were disabled at build time";
+  case SPARKEY_INVALID_LOOKUP_PHASE: return "Invalid lookup phase";
 
   default: return "Unknown error";
   }
@@ -0,0 +1,206 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "logheader.h"
+#include "endiantools.h"
+#include "util.h"
+
+#define MAGIC_VALUE_SHARDWRITER (0x5b0e7d21)
+
+struct sparkey_sharded_writer {
+  uint32_t open_status;
+  char *filename;
+  int num_shards;
+  char **shard_filenames;
+  sparkey_logwriter **shards;
+};
+
+sparkey_returncode sparkey_logwriter_merge(const char *filename, int num_segments, const char * const *segment_filenames) {
+  RETHROW(correct_endian_platform());
+  if (num_segments < 1) {
+    return SPARKEY_INVALID_SHARD_COUNT;
+  }
+
+  sparkey_logheader *headers = malloc(num_segments * sizeof(sparkey_logheader));
+  if (headers == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+
+  sparkey_returncode returncode;
+  int fd = -1;
+  sparkey_logheader header;
+  memset(&header, 0, sizeof(header));
+  for (int i = 0; i < num_segments; i++) {
+    sparkey_logheader *h = &headers[i];
+    TRY(sparkey_load_logheader(h, segment_filenames[i]), free_headers);
+    if (h->compression_type != headers[0].compression_type ||
+        h->compression_block_size != headers[0].compression_block_size ||
+        log_fixed_width(h) != log_fixed_width(&headers[0]) ||
+        h->fixed_key_len != headers[0].fixed_key_len ||
+        h->fixed_value_len != headers[0].fixed_value_len) {
+      TRY(SPARKEY_SEGMENT_MISMATCH, free_headers);
+    }
+    // The entry format is the same in all segments
+    header.minor_version = h->minor_version;
+    header.header_size = h->header_size;
+    header.fixed_key_len = h->fixed_key_len;
+    header.fixed_value_len = h->fixed_value_len;
+    header.num_puts += h->num_puts;
+    header.num_deletes += h->num_deletes;
+    header.put_size += h->put_size;
+    header.delete_size += h->delete_size;
+    if (h->max_key_len > header.max_key_len) {
+      header.max_key_len = h->max_key_len;
+    }
+    if (h->max_value_len > header.max_value_len) {
+      header.max_value_len = h->max_value_len;
+    }
+    if (h->max_entries_per_block > header.max_entries_per_block) {
+      header.max_entries_per_block = h->max_entries_per_block;
+    }
+  }
+  header.compression_type = headers[0].compression_type;
+  header.compression_block_size = headers[0].compression_block_size;
+  TRY(rand32(&header.file_identifier), free_headers);
+
+  if (remove(filename) < 0 && errno != ENOENT) {
+    TRY(sparkey_remove_returncode(errno), free_headers);
+  }
+  fd = open(filename, O_WRONLY | O_TRUNC | O_CREAT, 00644);
+  if (fd == -1) {
+    TRY(sparkey_create_returncode(errno), free_headers);
+  }
+
+  // Blocks and entries never refer to anything outside themselves, so the data
+  // sections can be concatenated as is. Only the header needs to be recomputed.
+  header.data_end = header.header_size;
+  TRY(write_logheader(fd, &header), close_file);
+  for (int i = 0; i < num_segments; i++) {
+    int in_fd = open(segment_filenames[i], O_RDONLY);
+    if (in_fd < 0) {
+      TRY(sparkey_open_returncode(errno), close_file);
+    }
+    uint64_t len = headers[i].data_end - headers[i].header_size;
+    returncode = sparkey_copy_range(in_fd, fd, headers[i].header_size, len);
+    close(in_fd);
+    TRY(returncode, close_file);
+    header.data_end += len;
+  }
+
+  lseek(fd, 0, SEEK_SET);
+  TRY(write_logheader(fd, &header), close_file);
+
+close_file:
+  close(fd);
+free_headers:
+  free(headers);
+  return returncode;
+}
+
+static void free_sharded_writer(sparkey_sharded_writer *writer) {
+  for (int i = 0; i < writer->num_shards; i++) {
+    if (writer->shards[i] != NULL) {
+      sparkey_logwriter_close(&writer->shards[i]);
+    }
+    if (writer->shard_filenames[i] != NULL) {
+      remove(writer->shard_filenames[i]);
+      free(writer->shard_filenames[i]);
+    }
+  }
+  free(writer->shards);
+  free(writer->shard_filenames);
+  free(writer->filename);
+  free(writer);
+}
+
+sparkey_returncode sparkey_sharded_writer_create(sparkey_sharded_writer **writer_ref, const char *filename, int num_shards, sparkey_compression_type compression_type, int compression_block_size, const sparkey_logwriter_options *options) {
+  if (num_shards < 1) {
+    return SPARKEY_INVALID_SHARD_COUNT;
+  }
+  sparkey_sharded_writer *writer = malloc(sizeof(sparkey_sharded_writer));
+  if (writer == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  writer->open_status = 0;
+  writer->num_shards = num_shards;
+  writer->filename = strdup(filename);
+  writer->shards = calloc(num_shards, sizeof(sparkey_logwriter *));
+  writer->shard_filenames = calloc(num_shards, sizeof(char *));
+
+  sparkey_returncode returncode;
+  if (writer->filename == NULL || writer->shards == NULL || writer->shard_filenames == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, error);
+  }
+
+  size_t len = strlen(filename) + 32;
+  for (int i = 0; i < num_shards; i++) {
+    writer->shard_filenames[i] = malloc(len);
+    if (writer->shard_filenames[i] == NULL) {
+      TRY(SPARKEY_INTERNAL_ERROR, error);
+    }
+    snprintf(writer->shard_filenames[i], len, "%s.shard%d", filename, i);
+    TRY(sparkey_logwriter_create_opts(&writer->shards[i], writer->shard_filenames[i], compression_type, compression_block_size, options), error);
+  }
+
+  writer->open_status = MAGIC_VALUE_SHARDWRITER;
+  *writer_ref = writer;
+  return SPARKEY_SUCCESS;
+
+error:
+  free_sharded_writer(writer);
+  return returncode;
+}
+
+sparkey_logwriter * sparkey_sharded_writer_get(sparkey_sharded_writer *writer, int shard) {
+  if (writer->open_status != MAGIC_VALUE_SHARDWRITER) {
+    return NULL;
+  }
+  if (shard < 0 || shard >= writer->num_shards) {
+    return NULL;
+  }
+  return writer->shards[shard];
+}
+
+sparkey_returncode sparkey_sharded_writer_close(sparkey_sharded_writer **writer_ref, const char *hash_filename, int hash_size) {
+  sparkey_sharded_writer *writer = *writer_ref;
+  if (writer == NULL || writer->open_status != MAGIC_VALUE_SHARDWRITER) {
+    return SPARKEY_LOG_CLOSED;
+  }
+  writer->open_status = 0;
+  *writer_ref = NULL;
+
+  sparkey_returncode returncode;
+  for (int i = 0; i < writer->num_shards; i++) {
+    TRY(sparkey_logwriter_close(&writer->shards[i]), done);
+  }
+  TRY(sparkey_logwriter_merge(writer->filename, writer->num_shards, (const char * const *) writer->shard_filenames), done);
+  if (hash_filename != NULL) {
+    TRY(sparkey_hash_write(hash_filename, writer->filename, hash_size), done);
+  }
+
+done:
+  free_sharded_writer(writer);
+  return returncode;
+}
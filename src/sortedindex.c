@@ -0,0 +1,551 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "endiantools.h"
+#include "util.h"
+#include "buf.h"
+#include "vlq.h"
+
+/*
+ * File layout:
+ * - A fixed size header.
+ * - All live keys in sorted order, each as VLQ key length, key, VLQ address.
+ *   The address is the same as in the hash table.
+ * - A block index with one entry per SORTED_BLOCK_ENTRIES keys: the first SORTED_PREFIX_SIZE
+ *   bytes of the first key in the block, zero padded, followed by the 64 bit offset of the block.
+ */
+#define SORTED_MAGIC_NUMBER (0x50b7ed1c)
+#define SORTED_MAJOR_VERSION (1)
+#define SORTED_MINOR_VERSION (0)
+#define SORTED_HEADER_SIZE (64)
+#define SORTED_BLOCK_ENTRIES (64)
+#define SORTED_PREFIX_SIZE (16)
+#define SORTED_INDEX_ENTRY_SIZE (SORTED_PREFIX_SIZE + 8)
+
+#define MAGIC_VALUE_SORTEDREADER (0x2c7e94a1)
+#define MAGIC_VALUE_SORTEDITER (0x6f03b85d)
+
+typedef struct {
+  uint32_t major_version;
+  uint32_t minor_version;
+  uint32_t file_identifier;
+  uint32_t entry_block_bits;
+  uint64_t data_end;
+  uint64_t num_entries;
+  uint64_t num_blocks;
+  uint64_t index_offset;
+} sorted_header;
+
+struct sparkey_sortedreader {
+  uint32_t open_status;
+  sorted_header header;
+  sparkey_logreader log;
+  int fd;
+  uint64_t data_len;
+  uint8_t *data;
+};
+
+struct sparkey_sortediter {
+  uint32_t open_status;
+  // offset of the next key in the sorted file
+  uint64_t offset;
+  // exclusive upper bound of the range, if has_end is set
+  int has_end;
+  uint8_t *end_key;
+  uint64_t end_len;
+  uint64_t end_capacity;
+};
+
+typedef struct {
+  uint64_t key_offset;
+  uint64_t keylen;
+  uint64_t address;
+  const uint8_t *key;
+} sorted_entry;
+
+static int compare_keys(const uint8_t *key1, uint64_t len1, const uint8_t *key2, uint64_t len2) {
+  int cmp = memcmp(key1, key2, len1 < len2 ? len1 : len2);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return len1 < len2 ? -1 : len1 > len2;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+  const sorted_entry *x = a;
+  const sorted_entry *y = b;
+  return compare_keys(x->key, x->keylen, y->key, y->keylen);
+}
+
+static void write_prefix(uint8_t *buf, const uint8_t *key, uint64_t keylen) {
+  uint64_t len = keylen < SORTED_PREFIX_SIZE ? keylen : SORTED_PREFIX_SIZE;
+  memset(buf, 0, SORTED_PREFIX_SIZE);
+  memcpy(buf, key, len);
+}
+
+/**
+ * Reads the keys of all live entries into memory, in log order.
+ */
+static sparkey_returncode load_keys(sparkey_hashreader *hash, sorted_entry **entries_ref, uint8_t **keys_ref, uint64_t *count) {
+  sparkey_logreader *log = sparkey_hash_getreader(hash);
+  sparkey_live_entry *live;
+  uint64_t num_live;
+  RETHROW(sparkey_hash_live_entries(hash, &live, &num_live));
+
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  sparkey_logiter *iter = NULL;
+  uint64_t keys_size = 0;
+  uint64_t keys_capacity = 4096;
+  uint8_t *keys = malloc(keys_capacity);
+  sorted_entry *entries = malloc(num_live * sizeof(sorted_entry) + 1);
+  if (keys == NULL || entries == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, error);
+  }
+  TRY(sparkey_logiter_create(&iter, log), error);
+
+  int entry_block_bits = hash->header.entry_block_bits;
+  uint64_t i = 0;
+  while (i < num_live) {
+    TRY(sparkey_logiter_next(iter, log), error);
+    if (iter->state != SPARKEY_ITER_ACTIVE) {
+      TRY(SPARKEY_HASH_HEADER_CORRUPT, error);
+    }
+    uint64_t address = (iter->block_position << entry_block_bits) | iter->entry_count;
+    if (iter->type != SPARKEY_ENTRY_PUT || address != live[i].address) {
+      continue;
+    }
+    if (keys_size + iter->keylen > keys_capacity) {
+      while (keys_size + iter->keylen > keys_capacity) {
+        keys_capacity *= 2;
+      }
+      uint8_t *grown = realloc(keys, keys_capacity);
+      if (grown == NULL) {
+        TRY(SPARKEY_INTERNAL_ERROR, error);
+      }
+      keys = grown;
+    }
+    uint64_t actual;
+    TRY(sparkey_logiter_fill_key(iter, log, iter->keylen, &keys[keys_size], &actual), error);
+    entries[i].key_offset = keys_size;
+    entries[i].keylen = actual;
+    entries[i].address = address;
+    keys_size += actual;
+    i++;
+  }
+  // The key buffer may have moved while growing, so only resolve the pointers now
+  for (i = 0; i < num_live; i++) {
+    entries[i].key = &keys[entries[i].key_offset];
+  }
+
+  sparkey_logiter_close(&iter);
+  free(live);
+  *entries_ref = entries;
+  *keys_ref = keys;
+  *count = num_live;
+  return SPARKEY_SUCCESS;
+
+error:
+  sparkey_logiter_close(&iter);
+  free(live);
+  free(keys);
+  free(entries);
+  return returncode;
+}
+
+static sparkey_returncode write_header(int fd, sorted_header *header) {
+  uint8_t buf[SORTED_HEADER_SIZE];
+  memset(buf, 0, sizeof(buf));
+  write_little_endian32(&buf[0], SORTED_MAGIC_NUMBER);
+  write_little_endian32(&buf[4], header->major_version);
+  write_little_endian32(&buf[8], header->minor_version);
+  write_little_endian32(&buf[12], header->file_identifier);
+  write_little_endian32(&buf[16], header->entry_block_bits);
+  write_little_endian64(&buf[24], header->data_end);
+  write_little_endian64(&buf[32], header->num_entries);
+  write_little_endian64(&buf[40], header->num_blocks);
+  write_little_endian64(&buf[48], header->index_offset);
+  return pwrite_full(fd, buf, sizeof(buf), 0);
+}
+
+static sparkey_returncode read_header(sorted_header *header, const uint8_t *data, uint64_t len) {
+  if (len < SORTED_HEADER_SIZE) {
+    return SPARKEY_SORTED_INDEX_CORRUPT;
+  }
+  if (read_little_endian32(data, 0) != SORTED_MAGIC_NUMBER) {
+    return SPARKEY_WRONG_SORTED_MAGIC_NUMBER;
+  }
+  header->major_version = read_little_endian32(data, 4);
+  header->minor_version = read_little_endian32(data, 8);
+  if (header->major_version != SORTED_MAJOR_VERSION || header->minor_version > SORTED_MINOR_VERSION) {
+    return SPARKEY_UNSUPPORTED_SORTED_VERSION;
+  }
+  header->file_identifier = read_little_endian32(data, 12);
+  header->entry_block_bits = read_little_endian32(data, 16);
+  header->data_end = read_little_endian64(data, 24);
+  header->num_entries = read_little_endian64(data, 32);
+  header->num_blocks = read_little_endian64(data, 40);
+  header->index_offset = read_little_endian64(data, 48);
+  if (header->index_offset < SORTED_HEADER_SIZE ||
+      header->index_offset > len ||
+      header->num_blocks > (len - header->index_offset) / SORTED_INDEX_ENTRY_SIZE ||
+      header->num_blocks != (header->num_entries + SORTED_BLOCK_ENTRIES - 1) / SORTED_BLOCK_ENTRIES) {
+    return SPARKEY_SORTED_INDEX_CORRUPT;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sorted_write(const char *sorted_filename, const char *hash_filename, const char *log_filename) {
+  sparkey_hashreader *hash;
+  RETHROW(sparkey_hash_open(&hash, hash_filename, log_filename));
+
+  sparkey_returncode returncode;
+  sorted_entry *entries = NULL;
+  uint8_t *keys = NULL;
+  uint8_t *index = NULL;
+  uint64_t count;
+  sparkey_buf buf;
+  buf.start = NULL;
+  int fd = -1;
+  TRY(load_keys(hash, &entries, &keys, &count), cleanup);
+  qsort(entries, count, sizeof(sorted_entry), cmp_entry);
+
+  sorted_header header;
+  header.major_version = SORTED_MAJOR_VERSION;
+  header.minor_version = SORTED_MINOR_VERSION;
+  header.file_identifier = hash->header.file_identifier;
+  header.entry_block_bits = hash->header.entry_block_bits;
+  header.data_end = hash->header.data_end;
+  header.num_entries = count;
+  header.num_blocks = (count + SORTED_BLOCK_ENTRIES - 1) / SORTED_BLOCK_ENTRIES;
+  index = malloc(header.num_blocks * SORTED_INDEX_ENTRY_SIZE + 1);
+  if (index == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, cleanup);
+  }
+
+  // Try removing it first, to avoid overwriting existing files that readers may be using.
+  if (remove(sorted_filename) < 0 && errno != ENOENT) {
+    TRY(sparkey_remove_returncode(errno), cleanup);
+  }
+  fd = creat(sorted_filename, 00644);
+  if (fd < 0) {
+    TRY(sparkey_create_returncode(errno), cleanup);
+  }
+  TRY(buf_init(&buf, 1 << 16), cleanup);
+  uint8_t empty[SORTED_HEADER_SIZE];
+  memset(empty, 0, sizeof(empty));
+  TRY(buf_add(&buf, fd, empty, sizeof(empty)), cleanup);
+
+  uint64_t offset = SORTED_HEADER_SIZE;
+  for (uint64_t i = 0; i < count; i++) {
+    sorted_entry *e = &entries[i];
+    if (i % SORTED_BLOCK_ENTRIES == 0) {
+      uint8_t *index_entry = &index[(i / SORTED_BLOCK_ENTRIES) * SORTED_INDEX_ENTRY_SIZE];
+      write_prefix(index_entry, e->key, e->keylen);
+      write_little_endian64(&index_entry[SORTED_PREFIX_SIZE], offset);
+    }
+    uint8_t vlq[10];
+    int len = write_vlq(vlq, e->keylen);
+    TRY(buf_add(&buf, fd, vlq, len), cleanup);
+    TRY(buf_add(&buf, fd, e->key, e->keylen), cleanup);
+    offset += len + e->keylen;
+    len = write_vlq(vlq, e->address);
+    TRY(buf_add(&buf, fd, vlq, len), cleanup);
+    offset += len;
+  }
+  header.index_offset = offset;
+  TRY(buf_add(&buf, fd, index, header.num_blocks * SORTED_INDEX_ENTRY_SIZE), cleanup);
+  TRY(buf_flushfile(&buf, fd), cleanup);
+  TRY(write_header(fd, &header), cleanup);
+
+cleanup:
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (buf.start != NULL) {
+    buf_close(&buf);
+  }
+  free(index);
+  free(entries);
+  free(keys);
+  sparkey_hash_close(&hash);
+  return returncode;
+}
+
+sparkey_returncode sparkey_sorted_open(sparkey_sortedreader **reader_ref, const char *sorted_filename, const char *log_filename) {
+  RETHROW(correct_endian_platform());
+
+  sparkey_sortedreader *reader = malloc(sizeof(sparkey_sortedreader));
+  if (reader == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  reader->open_status = 0;
+  reader->data = NULL;
+
+  sparkey_returncode returncode;
+  reader->fd = open(sorted_filename, O_RDONLY);
+  if (reader->fd < 0) {
+    returncode = sparkey_open_returncode(errno);
+    free(reader);
+    return returncode;
+  }
+  struct stat s;
+  if (fstat(reader->fd, &s) < 0 || s.st_size == 0) {
+    returncode = SPARKEY_SORTED_INDEX_CORRUPT;
+    goto close_fd;
+  }
+  reader->data_len = s.st_size;
+  reader->data = mmap(NULL, reader->data_len, PROT_READ, MAP_SHARED, reader->fd, 0);
+  if (reader->data == MAP_FAILED) {
+    reader->data = NULL;
+    returncode = SPARKEY_MMAP_FAILED;
+    goto close_fd;
+  }
+  TRY(read_header(&reader->header, reader->data, reader->data_len), close_fd);
+
+  const char *log_filenames[] = {log_filename};
+  TRY(sparkey_logreader_open_noalloc(&reader->log, 1, log_filenames, SPARKEY_READ_MMAP), close_fd);
+  if (reader->header.file_identifier != reader->log.header.file_identifier) {
+    returncode = SPARKEY_FILE_IDENTIFIER_MISMATCH;
+    goto close_log;
+  }
+  if (reader->header.data_end > reader->log.header.data_end) {
+    returncode = SPARKEY_SORTED_INDEX_CORRUPT;
+    goto close_log;
+  }
+
+  reader->open_status = MAGIC_VALUE_SORTEDREADER;
+  *reader_ref = reader;
+  return SPARKEY_SUCCESS;
+
+close_log:
+  sparkey_logreader_close_nodealloc(&reader->log);
+close_fd:
+  if (reader->data != NULL) {
+    munmap(reader->data, reader->data_len);
+  }
+  close(reader->fd);
+  free(reader);
+  return returncode;
+}
+
+void sparkey_sorted_close(sparkey_sortedreader **reader_ref) {
+  if (reader_ref == NULL) {
+    return;
+  }
+  sparkey_sortedreader *reader = *reader_ref;
+  if (reader == NULL) {
+    return;
+  }
+  if (reader->open_status == MAGIC_VALUE_SORTEDREADER) {
+    reader->open_status = 0;
+    sparkey_logreader_close_nodealloc(&reader->log);
+    munmap(reader->data, reader->data_len);
+    close(reader->fd);
+  }
+  free(reader);
+  *reader_ref = NULL;
+}
+
+sparkey_logreader * sparkey_sorted_getreader(sparkey_sortedreader *reader) {
+  return &reader->log;
+}
+
+uint64_t sparkey_sorted_numentries(sparkey_sortedreader *reader) {
+  return reader->header.num_entries;
+}
+
+static sparkey_returncode assert_reader_open(sparkey_sortedreader *reader) {
+  if (reader->open_status != MAGIC_VALUE_SORTEDREADER) {
+    return SPARKEY_SORTED_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+static sparkey_returncode assert_iter_open(sparkey_sortediter *iter) {
+  if (iter->open_status != MAGIC_VALUE_SORTEDITER) {
+    return SPARKEY_LOG_ITERATOR_CLOSED;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sortediter_create(sparkey_sortediter **iter_ref, sparkey_sortedreader *reader) {
+  RETHROW(assert_reader_open(reader));
+  sparkey_sortediter *iter = malloc(sizeof(sparkey_sortediter));
+  if (iter == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  iter->open_status = MAGIC_VALUE_SORTEDITER;
+  iter->offset = SORTED_HEADER_SIZE;
+  iter->has_end = 0;
+  iter->end_key = NULL;
+  iter->end_len = 0;
+  iter->end_capacity = 0;
+  *iter_ref = iter;
+  return SPARKEY_SUCCESS;
+}
+
+void sparkey_sortediter_close(sparkey_sortediter **iter_ref) {
+  if (iter_ref == NULL || *iter_ref == NULL) {
+    return;
+  }
+  sparkey_sortediter *iter = *iter_ref;
+  iter->open_status = 0;
+  free(iter->end_key);
+  free(iter);
+  *iter_ref = NULL;
+}
+
+/**
+ * Decodes the entry at offset. Sets key, keylen and address, and returns the offset of the next entry.
+ */
+static uint64_t read_entry(sparkey_sortedreader *reader, uint64_t offset, const uint8_t **key, uint64_t *keylen, uint64_t *address) {
+  uint8_t *data = reader->data;
+  *keylen = read_vlq(data, &offset);
+  *key = &data[offset];
+  offset += *keylen;
+  *address = read_vlq(data, &offset);
+  return offset;
+}
+
+/**
+ * Compares the first key of a block with a key, using the prefix in the block index when it's enough.
+ */
+static int compare_block(sparkey_sortedreader *reader, uint64_t block, const uint8_t *key, uint64_t keylen, const uint8_t *key_prefix) {
+  const uint8_t *index_entry = &reader->data[reader->header.index_offset + block * SORTED_INDEX_ENTRY_SIZE];
+  int cmp = memcmp(index_entry, key_prefix, SORTED_PREFIX_SIZE);
+  if (cmp != 0) {
+    // Zero padding keeps the order, so a difference in the prefixes is final
+    return cmp;
+  }
+  const uint8_t *first_key;
+  uint64_t first_keylen;
+  uint64_t address;
+  read_entry(reader, read_little_endian64(index_entry, SORTED_PREFIX_SIZE), &first_key, &first_keylen, &address);
+  return compare_keys(first_key, first_keylen, key, keylen);
+}
+
+/**
+ * @returns the offset of the first entry with a key greater than or equal to key.
+ */
+static uint64_t lower_bound(sparkey_sortedreader *reader, const uint8_t *key, uint64_t keylen) {
+  uint8_t key_prefix[SORTED_PREFIX_SIZE];
+  write_prefix(key_prefix, key, keylen);
+
+  // Find the last block that starts with a key less than the wanted key
+  uint64_t lo = 0;
+  uint64_t hi = reader->header.num_blocks;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (compare_block(reader, mid, key, keylen, key_prefix) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return SORTED_HEADER_SIZE;
+  }
+  const uint8_t *index_entry = &reader->data[reader->header.index_offset + (lo - 1) * SORTED_INDEX_ENTRY_SIZE];
+  uint64_t offset = read_little_endian64(index_entry, SORTED_PREFIX_SIZE);
+  while (offset < reader->header.index_offset) {
+    const uint8_t *key2;
+    uint64_t keylen2;
+    uint64_t address;
+    uint64_t next = read_entry(reader, offset, &key2, &keylen2, &address);
+    if (compare_keys(key2, keylen2, key, keylen) >= 0) {
+      break;
+    }
+    offset = next;
+  }
+  return offset;
+}
+
+static sparkey_returncode set_end(sparkey_sortediter *iter, const uint8_t *end, uint64_t endlen) {
+  if (endlen > iter->end_capacity || iter->end_key == NULL) {
+    uint8_t *buf = realloc(iter->end_key, endlen + 1);
+    if (buf == NULL) {
+      return SPARKEY_INTERNAL_ERROR;
+    }
+    iter->end_key = buf;
+    iter->end_capacity = endlen;
+  }
+  memcpy(iter->end_key, end, endlen);
+  iter->end_len = endlen;
+  iter->has_end = 1;
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sortediter_range(sparkey_sortediter *iter, sparkey_sortedreader *reader, const uint8_t *start, uint64_t startlen, const uint8_t *end, uint64_t endlen) {
+  RETHROW(assert_reader_open(reader));
+  RETHROW(assert_iter_open(iter));
+  iter->offset = start == NULL ? SORTED_HEADER_SIZE : lower_bound(reader, start, startlen);
+  iter->has_end = 0;
+  if (end != NULL) {
+    RETHROW(set_end(iter, end, endlen));
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sortediter_prefix(sparkey_sortediter *iter, sparkey_sortedreader *reader, const uint8_t *prefix, uint64_t prefixlen) {
+  RETHROW(sparkey_sortediter_range(iter, reader, prefix, prefixlen, NULL, 0));
+  // The range ends at the smallest key that is greater than all keys with the prefix.
+  // A prefix of only 0xff bytes has no such key, so the range is then unbounded.
+  uint64_t len = prefixlen;
+  while (len > 0 && prefix[len - 1] == 0xff) {
+    len--;
+  }
+  if (len > 0) {
+    RETHROW(set_end(iter, prefix, len));
+    iter->end_key[len - 1]++;
+  }
+  return SPARKEY_SUCCESS;
+}
+
+sparkey_returncode sparkey_sortediter_next(sparkey_sortediter *iter, sparkey_sortedreader *reader, sparkey_logiter *logiter) {
+  RETHROW(assert_reader_open(reader));
+  RETHROW(assert_iter_open(iter));
+  if (iter->offset >= reader->header.index_offset) {
+    logiter->state = SPARKEY_ITER_INVALID;
+    return SPARKEY_SUCCESS;
+  }
+  const uint8_t *key;
+  uint64_t keylen;
+  uint64_t address;
+  uint64_t next = read_entry(reader, iter->offset, &key, &keylen, &address);
+  if (iter->has_end && compare_keys(key, keylen, iter->end_key, iter->end_len) >= 0) {
+    iter->offset = reader->header.index_offset;
+    logiter->state = SPARKEY_ITER_INVALID;
+    return SPARKEY_SUCCESS;
+  }
+  iter->offset = next;
+
+  uint64_t entry_block_bitmask = (1ULL << reader->header.entry_block_bits) - 1;
+  RETHROW(sparkey_logiter_seek(logiter, &reader->log, address >> reader->header.entry_block_bits));
+  RETHROW(sparkey_logiter_skip(logiter, &reader->log, (int) (address & entry_block_bitmask)));
+  RETHROW(sparkey_logiter_next(logiter, &reader->log));
+  if (logiter->type != SPARKEY_ENTRY_PUT) {
+    logiter->state = SPARKEY_ITER_INVALID;
+    return SPARKEY_SORTED_INDEX_CORRUPT;
+  }
+  return SPARKEY_SUCCESS;
+}
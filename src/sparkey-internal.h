@@ -16,6 +16,11 @@
 #ifndef SPARKEY_INTERNAL_H
 #define SPARKEY_INTERNAL_H
 #include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "sparkey.h"
 
@@ -23,13 +28,30 @@
 #include "hashheader.h"
 #include "buf.h"
 
+typedef struct {
+  sparkey_logheader header;
+  int fd;
+  // fd used for pread, may differ from fd when opened with O_DIRECT
+  int read_fd;
+  // NULL unless the log is mmapped
+  uint8_t *data;
+  // position of the first byte of this segment within the reader
+  uint64_t base;
+} sparkey_log_segment;
+
+/**
+ * A logreader is a concatenation of one or more log segments. Segment i is placed right
+ * after segment i - 1 in the position space, so positions (and hash addresses) into a
+ * single log file are plain file offsets.
+ */
 struct sparkey_logreader {
   uint32_t open_status;
+  // combined header of all segments
   sparkey_logheader header;
-  int fd;
+  sparkey_read_mode mode;
 
-  uint64_t data_len;
-  uint8_t *data;
+  int num_segments;
+  sparkey_log_segment *segments;
 };
 
 struct sparkey_logiter {
@@ -47,6 +69,14 @@ struct sparkey_logiter {
   int compression_buf_allocated;
   uint8_t *compression_buf;
 
+  // set while the current entry lives outside the log, see sparkey_logiter_set_entry
+  int detached;
+  uint8_t *detached_buf;
+
+  // read window, only used when the log is not mmapped
+  uint8_t *read_buf;
+  uint64_t read_buf_size;
+
   // current entry
   uint64_t entry_block_position;
   uint64_t entry_block_offset;
@@ -56,6 +86,17 @@ struct sparkey_logiter {
   uint64_t valuelen;
   uint64_t key_remaining;
   uint64_t value_remaining;
+
+  // entries starting at or after this position are not visited
+  uint64_t range_end;
+
+  // decompression counters, read by the hashreader statistics
+  uint64_t decompressions;
+  uint64_t decompressed_bytes;
+  uint64_t block_reuses;
+  // cycles spent decompressing, only measured while time_decompression is set
+  int time_decompression;
+  uint64_t decompress_cycles;
 };
 
 struct sparkey_logwriter {
@@ -63,15 +104,48 @@ struct sparkey_logwriter {
   sparkey_logheader header;
   int fd;
 
+  sparkey_write_mode write_mode;
+  // O_DIRECT descriptor for aligned writes, or -1
+  int direct_fd;
+  // file offset of file_buf.start
+  uint64_t file_offset;
+  // everything before this offset has been written and evicted from the page cache
+  uint64_t dropped_offset;
+  // everything before this offset has been scheduled for writeback
+  uint64_t synced_offset;
+
   sparkey_buf block_buf;
   uint32_t max_compressed_size;
   uint8_t *compressed;
   sparkey_buf file_buf;
+  // aligned allocation backing file_buf
+  uint8_t *file_buf_mem;
+  uint64_t file_buf_size;
+
+  // background flushing, file_buf is swapped with spare_buf_mem when full
+  int async;
+  uint8_t *spare_buf_mem;
+  pthread_t flush_thread;
+  pthread_mutex_t flush_lock;
+  pthread_cond_t flush_cond;
+  // the fields below are protected by flush_lock
+  int flush_pending;
+  int flush_stop;
+  uint8_t *flush_data;
+  uint64_t flush_len;
+  uint64_t flush_offset;
+  sparkey_returncode flush_result;
   int flushed;
 
   int entry_count;
+  // cycles spent compressing blocks
+  uint64_t compress_cycles;
 };
 
+typedef struct sparkey_trace sparkey_trace;
+typedef struct sparkey_stats sparkey_stats;
+typedef struct sparkey_latency sparkey_latency;
+
 struct sparkey_hashreader {
   uint32_t open_status;
   sparkey_hashheader header;
@@ -82,11 +156,187 @@ struct sparkey_hashreader {
   uint64_t data_len;
   uint8_t *data;
 
+  // access tracing, NULL unless enabled
+  sparkey_trace *trace;
+  // runtime statistics, NULL unless enabled
+  sparkey_stats *stats;
+  // latency histograms, NULL unless enabled
+  sparkey_latency *latency;
 };
 
-sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, const char *filename);
+/**
+ * What a single hash lookup did, filled in by sparkey_hash_get.
+ */
+typedef struct {
+  // the slot the key hashes to
+  uint64_t slot;
+  // log block of the last entry that was compared, or 0 if no entry was read
+  uint64_t block_position;
+  // the number of hash slots inspected
+  uint32_t probe_length;
+  // the number of log blocks that were decompressed
+  uint32_t decompressions;
+  uint64_t decompressed_bytes;
+  // the number of times the block that was needed was already decompressed in the iterator
+  uint32_t block_reuses;
+  int found;
+  // address of the entry that was found, as stored in the hash table
+  uint64_t address;
+
+  // time spent per phase, only measured if timed is set
+  int timed;
+  uint64_t total_cycles;
+  uint64_t hash_cycles;
+  // seeking to entries and reading their headers, including decompression
+  uint64_t seek_cycles;
+  uint64_t decompress_cycles;
+  uint64_t compare_cycles;
+} sparkey_lookup_info;
+
+/**
+ * Samples a lookup into the trace ring buffer.
+ * Safe to call from multiple threads sharing the same reader.
+ */
+void sparkey_trace_lookup(sparkey_trace *trace, const sparkey_lookup_info *info);
+void sparkey_trace_free(sparkey_trace *trace);
+
+/**
+ * Adds a lookup to the statistics of the calling thread's shard.
+ */
+void sparkey_stats_lookup(sparkey_stats *stats, const sparkey_lookup_info *info);
+void sparkey_stats_free(sparkey_stats *stats);
+
+/**
+ * Adds the phase timings of a lookup to the histograms of the calling thread's shard.
+ */
+void sparkey_latency_lookup(sparkey_latency *latency, const sparkey_lookup_info *info);
+void sparkey_latency_free(sparkey_latency *latency);
+
+/**
+ * @returns a small number identifying the calling thread, the same on every call.
+ *          Threads are numbered in the order they first call it.
+ */
+uint32_t sparkey_thread_number(void);
+
+/**
+ * Increments a counter that other threads may read concurrently.
+ * Not an atomic read-modify-write, so only one thread may update the counter at a time
+ * for the result to be exact.
+ */
+static inline void sparkey_counter_add(uint64_t *counter, uint64_t n) {
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * A cheap, monotonic timestamp: the time stamp counter on x86, nanoseconds elsewhere.
+ * Use sparkey_cycles_to_ns to convert differences to nanoseconds.
+ */
+static inline uint64_t sparkey_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+#endif
+}
+
+/**
+ * Measures the rate of sparkey_cycles, once per process. Takes about 10 ms on the first call.
+ */
+void sparkey_calibrate_cycles(void);
+uint64_t sparkey_cycles_to_ns(uint64_t cycles);
+
+sparkey_returncode sparkey_logreader_open_noalloc(sparkey_logreader *log, int num_segments, const char * const *filenames, sparkey_read_mode mode);
+/**
+ * @returns the segment that contains position.
+ */
+sparkey_log_segment * sparkey_logreader_segment(sparkey_logreader *log, uint64_t position);
 void sparkey_logreader_close_nodealloc(sparkey_logreader *log);
 
+/**
+ * Makes a put entry stored outside the log, such as an entry inlined in a hash file, the current entry of iter.
+ * The key and value are read directly from data, which must stay valid while the entry is current.
+ * Moving past the entry closes the iterator, seeking returns it to the log.
+ * If key_consumed is set, the iterator is positioned at the value, as after a lookup that compared the key.
+ */
+sparkey_returncode sparkey_logiter_set_entry(sparkey_logiter *iter, sparkey_logreader *log, uint8_t *data, uint64_t keylen, uint64_t valuelen, int key_consumed);
+
+typedef struct {
+  // address of the entry, as stored in the hash table
+  uint64_t address;
+  uint64_t hash;
+} sparkey_live_entry;
+
+/**
+ * Collects the address and key hash of every live entry from the hash table, ordered by log position.
+ * This is a single pass over the hash table, without touching the log.
+ * @param entries will be set to a malloc'ed array that the caller must free.
+ * @param count will be set to the number of entries.
+ */
+sparkey_returncode sparkey_hash_live_entries(sparkey_hashreader *reader, sparkey_live_entry **entries, uint64_t *count);
+
+/**
+ * Like sparkey_hash_get, but also sets address to the hash table address of the entry that was found.
+ * The iterator can not be used for this once the key has been read, since the key may continue into the next block,
+ * and an entry stored inline in the hash file is not positioned in the log at all.
+ */
+sparkey_returncode sparkey_hash_get_address(sparkey_hashreader *reader, const uint8_t *key, uint64_t keylen, sparkey_logiter *iter, uint64_t *address);
+
+/**
+ * Appends already encoded log data, such as whole compressed blocks copied from another log
+ * with the same compression settings. Any partially filled block is flushed first.
+ * stats holds the entry counts, sizes and maximums of the appended data, which are added to the header.
+ */
+sparkey_returncode sparkey_logwriter_append_raw(sparkey_logwriter *log, const uint8_t *data, uint64_t len, const sparkey_logheader *stats);
+
+/**
+ * Writes a hash file for a log that only contains puts of distinct keys, such as a compacted log.
+ * No keys are compared, hashes[i] must be the hash of the key of the i:th entry in the log
+ * for the given hash_seed and options->hash_size. Keys are only read for the fingerprints and inline records.
+ */
+sparkey_returncode sparkey_hash_write_known(const char *hash_filename, const char *log_filename, uint32_t hash_seed, const sparkey_hash_options *options, uint64_t num_hashes, const uint64_t *hashes);
+
+/* liveness.c */
+
+/**
+ * The addresses of a sequence of log entries, in log order, delta encoded as VLQs.
+ */
+typedef struct {
+  uint8_t *data;
+  uint64_t size;
+  uint64_t capacity;
+  uint64_t count;
+  // the most recently added address
+  uint64_t last;
+} sparkey_address_list;
+
+void sparkey_addresses_init(sparkey_address_list *list);
+void sparkey_addresses_free(sparkey_address_list *list);
+sparkey_returncode sparkey_addresses_add(sparkey_address_list *list, uint64_t address);
+
+/**
+ * Writes a liveness bitmap with one bit for each of the num_entries log entries.
+ * @param all the addresses of all entries in the log, or NULL if every entry is live.
+ * @param live the addresses of the live entries, sorted.
+ */
+sparkey_returncode sparkey_liveness_write(const char *filename, uint32_t file_identifier, uint64_t data_end, uint64_t num_entries, const sparkey_address_list *all, const uint64_t *live, uint64_t num_live);
+
+typedef struct {
+  uint8_t *data;
+  uint64_t data_len;
+  uint64_t num_entries;
+  uint64_t num_live;
+  // bit i % 8 of bits[i / 8] is set if entry i is live
+  const uint8_t *bits;
+} sparkey_liveness;
+
+/**
+ * Maps a liveness bitmap, verifying that it belongs to the log with the given identifier and size.
+ */
+sparkey_returncode sparkey_liveness_open(sparkey_liveness *liveness, const char *filename, uint32_t file_identifier, uint64_t data_end);
+void sparkey_liveness_close(sparkey_liveness *liveness);
+
 struct sparkey_compressor {
   uint32_t (*max_compressed_size)(uint32_t block_size);
   sparkey_returncode (*decompress)(uint8_t *input, uint32_t compressed_size, uint8_t *output, uint32_t *uncompressed_size);
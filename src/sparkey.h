@@ -237,6 +237,15 @@ typedef enum {
   SPARKEY_LOG_HEADER_CORRUPT = -208,
   SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE = -209,
   SPARKEY_INVALID_COMPRESSION_TYPE = -210,
+  SPARKEY_INVALID_READ_MODE = -211,
+  SPARKEY_INVALID_WRITE_MODE = -212,
+  SPARKEY_INVALID_SHARD_COUNT = -213,
+  SPARKEY_SEGMENT_MISMATCH = -214,
+  SPARKEY_CANCELLED = -215,
+  SPARKEY_INVALID_PARTITION_COUNT = -216,
+  SPARKEY_INVALID_FIXED_WIDTH = -217,
+  SPARKEY_ENTRY_SIZE_MISMATCH = -218,
+  SPARKEY_FIXED_WIDTH_DELETE = -219,
 
   SPARKEY_WRONG_HASH_MAGIC_NUMBER = -300,
   SPARKEY_WRONG_HASH_MAJOR_VERSION = -301,
@@ -246,6 +255,25 @@ typedef enum {
   SPARKEY_FILE_IDENTIFIER_MISMATCH = -305,
   SPARKEY_HASH_HEADER_CORRUPT = -306,
   SPARKEY_HASH_SIZE_INVALID = -307,
+  SPARKEY_INLINE_SIZE_INVALID = -308,
+  SPARKEY_FINGERPRINT_SIZE_INVALID = -309,
+
+  SPARKEY_ASYNC_QUEUE_FULL = -400,
+  SPARKEY_INVALID_QUEUE_DEPTH = -401,
+
+  SPARKEY_WRONG_SORTED_MAGIC_NUMBER = -500,
+  SPARKEY_UNSUPPORTED_SORTED_VERSION = -501,
+  SPARKEY_SORTED_INDEX_CORRUPT = -502,
+  SPARKEY_SORTED_CLOSED = -503,
+
+  SPARKEY_WRONG_LIVENESS_MAGIC_NUMBER = -600,
+  SPARKEY_UNSUPPORTED_LIVENESS_VERSION = -601,
+  SPARKEY_LIVENESS_CORRUPT = -602,
+
+  SPARKEY_INVALID_TRACE_SETTINGS = -700,
+  SPARKEY_TRACE_CORRUPT = -701,
+  SPARKEY_LATENCY_DISABLED = -702,
+  SPARKEY_INVALID_LOOKUP_PHASE = -703,
 
 } sparkey_returncode;
 
@@ -282,6 +310,18 @@ typedef enum {
   SPARKEY_ITER_INVALID
 } sparkey_iter_state;
 
+/**
+ * How the log data is accessed by a reader. The hash index is always mmapped.
+ */
+typedef enum {
+  /** mmap the entire log, this is the default */
+  SPARKEY_READ_MMAP,
+  /** Read the log with pread into per iterator buffers */
+  SPARKEY_READ_PREAD,
+  /** Like SPARKEY_READ_PREAD, but bypass the page cache with O_DIRECT where supported */
+  SPARKEY_READ_PREAD_DIRECT
+} sparkey_read_mode;
+
 struct sparkey_logreader;
 typedef struct sparkey_logreader sparkey_logreader;
 
@@ -291,6 +331,61 @@ typedef struct sparkey_logiter sparkey_logiter;
 struct sparkey_hashreader;
 typedef struct sparkey_hashreader sparkey_hashreader;
 
+struct sparkey_liveiter;
+typedef struct sparkey_liveiter sparkey_liveiter;
+
+struct sparkey_hash_async;
+typedef struct sparkey_hash_async sparkey_hash_async;
+
+struct sparkey_sharded_writer;
+typedef struct sparkey_sharded_writer sparkey_sharded_writer;
+
+/**
+ * How a logwriter interacts with the page cache.
+ */
+typedef enum {
+  /** Write through the page cache, this is the default */
+  SPARKEY_WRITE_CACHED,
+  /** Write through the page cache, but evict written pages shortly behind the write cursor */
+  SPARKEY_WRITE_DONTNEED,
+  /** Bypass the page cache with O_DIRECT where supported, evicting the few unaligned pages at buffer edges */
+  SPARKEY_WRITE_DIRECT
+} sparkey_write_mode;
+
+/**
+ * Tuning options for a logwriter. A zero initialized struct gives the default behaviour.
+ */
+typedef struct {
+  /** How written data interacts with the page cache. */
+  sparkey_write_mode write_mode;
+  /** Number of bytes buffered before writing to the file. 0 means 1 MB.
+      Rounded up to a multiple of 4096 for SPARKEY_WRITE_DIRECT. */
+  uint64_t file_buffer_size;
+  /** If non-zero, full file buffers are written by a background thread while the next one is filled.
+      This uses twice the buffer memory. Write errors are reported by a later put, flush or close. */
+  int async_flush;
+  /** If non-zero, create a fixed width log where every key is fixed_key_len bytes and every value
+      is fixed_value_len bytes. Entries are stored without length headers, so the log is smaller and
+      entries within a block are found by arithmetic instead of by parsing. Such a log can not contain
+      deletes, and it can only be read by versions of this library that support it.
+      Ignored when appending, where the format of the existing log is kept. */
+  int fixed_width;
+  /** The key size of a fixed width log. */
+  uint32_t fixed_key_len;
+  /** The value size of a fixed width log. Together with the key size it must be at least one byte,
+      and no more than the compression block size. */
+  uint32_t fixed_value_len;
+} sparkey_logwriter_options;
+
+/**
+ * A key value pair for \ref sparkey_logwriter_put_batch.
+ */
+typedef struct {
+  const uint8_t *key;
+  uint64_t keylen;
+  const uint8_t *value;
+  uint64_t valuelen;
+} sparkey_logwriter_entry;
 
 /**
  * Creates a new Sparkey log file, possibly overwriting an already existing.
@@ -303,6 +398,19 @@ typedef struct sparkey_hashreader sparkey_hashreader;
  */
 sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char *filename, sparkey_compression_type compression_type, int compression_block_size);
 
+/**
+ * Creates a new Sparkey log file, like \ref sparkey_logwriter_create, with custom writer options.
+ * Use SPARKEY_WRITE_DONTNEED or SPARKEY_WRITE_DIRECT to avoid evicting the page cache of other
+ * processes on the same host when writing large logs.
+ * @param log a double reference to a sparkey_logwriter structure that gets allocated and initialized by this call.
+ * @param filename the file to create.
+ * @param compression_type NONE or SNAPPY, specifies if block compression should be used or not.
+ * @param compression_block_size is only relevant if compression type is not NONE.
+ * @param options writer options, may be NULL for the defaults.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logwriter_create_opts(sparkey_logwriter **log, const char *filename, sparkey_compression_type compression_type, int compression_block_size, const sparkey_logwriter_options *options);
+
 /**
  * Append to an existing Sparkey log file.
  * @param log a double reference to a sparkey_logwriter structure that gets allocated and initialized by this call.
@@ -312,6 +420,15 @@ sparkey_returncode sparkey_logwriter_create(sparkey_logwriter **log, const char
  */
 sparkey_returncode sparkey_logwriter_append(sparkey_logwriter **log, const char *filename);
 
+/**
+ * Append to an existing Sparkey log file, like \ref sparkey_logwriter_append, with custom writer options.
+ * @param log a double reference to a sparkey_logwriter structure that gets allocated and initialized by this call.
+ * @param filename the file to open for appending.
+ * @param options writer options, may be NULL for the defaults.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logwriter_append_opts(sparkey_logwriter **log, const char *filename, const sparkey_logwriter_options *options);
+
 /**
  * Append a key/value pair to the log file
  * @param log a reference to an open log writer.
@@ -325,6 +442,17 @@ sparkey_returncode sparkey_logwriter_append(sparkey_logwriter **log, const char
  */
 sparkey_returncode sparkey_logwriter_put(sparkey_logwriter *log, uint64_t keylen, const uint8_t *key, uint64_t valuelen, const uint8_t *value);
 
+/**
+ * Append several key value pairs to the log file.
+ * This is equivalent to calling \ref sparkey_logwriter_put for each entry in order, but entries
+ * are encoded directly into the write buffer, which is considerably cheaper for small entries.
+ * @param log a reference to an open log writer.
+ * @param num_entries the number of entries in entries.
+ * @param entries the entries to append.
+ * @return SPARKEY_SUCCESS if all goes well. If an error is returned, a prefix of the entries may have been appended.
+ */
+sparkey_returncode sparkey_logwriter_put_batch(sparkey_logwriter *log, uint64_t num_entries, const sparkey_logwriter_entry *entries);
+
 /**
  * Append a delete operation for a key to the log file
  * @param log a reference to an open log writer.
@@ -345,6 +473,13 @@ sparkey_returncode sparkey_logwriter_delete(sparkey_logwriter *log, uint64_t key
  */
 sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log);
 
+/**
+ * Returns the time the log writer has spent compressing blocks since it was opened.
+ * @param log a reference to an open log writer.
+ * @returns the time in nanoseconds, or 0 if the log writer is closed.
+ */
+uint64_t sparkey_logwriter_compression_ns(sparkey_logwriter *log);
+
 /**
  * Flushes the log, then closes the file and marks the log as closed.
  * The log will be closed after this, the sparkey_logwriter struct
@@ -354,6 +489,55 @@ sparkey_returncode sparkey_logwriter_flush(sparkey_logwriter *log);
  */
 sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log);
 
+/* shardwriter */
+
+/**
+ * Concatenates several log files into a single new log file.
+ * The segments must all use the same compression type and block size.
+ * Entries keep their relative order, so for keys that occur in several segments,
+ * the entry in the last such segment wins. The segment files are left untouched.
+ * @param filename the log file to create.
+ * @param num_segments the number of segment files, at least 1.
+ * @param segment_filenames the log files to concatenate, in order.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_logwriter_merge(const char *filename, int num_segments, const char * const *segment_filenames);
+
+/**
+ * Creates a writer for a log file that is written by several threads in parallel.
+ * Each shard is a regular logwriter backed by a temporary segment file next to filename,
+ * which may be used from a different thread than the other shards.
+ * Keys should be partitioned between the shards, for instance by hashing them,
+ * since the merge order between shards is by shard index and not by time.
+ * @param writer a double reference to a sharded writer that gets allocated and initialized by this call.
+ * @param filename the log file that is created when the writer is closed.
+ * @param num_shards the number of shards, at least 1.
+ * @param compression_type compression type of all shards.
+ * @param compression_block_size compression block size of all shards.
+ * @param options writer options for the shards, may be NULL for the defaults.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sharded_writer_create(sparkey_sharded_writer **writer, const char *filename, int num_shards, sparkey_compression_type compression_type, int compression_block_size, const sparkey_logwriter_options *options);
+
+/**
+ * Gets the logwriter of one shard. It must not be closed by the caller.
+ * @param writer an open sharded writer.
+ * @param shard the shard index, from 0 to num_shards - 1.
+ * @returns the logwriter, or NULL if writer is closed or shard is out of range.
+ */
+sparkey_logwriter * sparkey_sharded_writer_get(sparkey_sharded_writer *writer, int shard);
+
+/**
+ * Closes all shards, merges them into the final log file, and optionally writes a hash index for it.
+ * The segment files are removed and the writer is freed, also on failure. *writer is set to NULL.
+ * No other thread may use any of the shards during this call.
+ * @param writer a double reference to an open sharded writer.
+ * @param hash_filename the hash file to write, or NULL to skip writing the index.
+ * @param hash_size the hash size, see \ref sparkey_hash_write.
+ * @return SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sharded_writer_close(sparkey_sharded_writer **writer, const char *hash_filename, int hash_size);
+
 /* logreader */
 
 /**
@@ -364,6 +548,32 @@ sparkey_returncode sparkey_logwriter_close(sparkey_logwriter **log);
  */
 sparkey_returncode sparkey_logreader_open(sparkey_logreader **log, const char *filename);
 
+/**
+ * Opens a log file for reading, like \ref sparkey_logreader_open, but with a specific read mode.
+ * With the pread modes, the log is not mapped into memory, which keeps the resident size of very
+ * large logs down at the cost of one or more system calls per block or entry read.
+ * Pointers returned by the logiter chunk functions are then only valid until the next call on the same iterator.
+ * @param log a double reference to a logreader.
+ * @param filename a filename of a file containing a sparkey log.
+ * @param mode how to read the log data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_logreader_open_mode(sparkey_logreader **log, const char *filename, sparkey_read_mode mode);
+
+/**
+ * Opens several log files as one logical log, without copying any data.
+ * The segments are read as if they were concatenated in order, so for keys that occur in several
+ * segments, the entry in the last such segment wins. Only the last segment should still be appended to.
+ * All segments must use the same compression type and block size.
+ * Opening a single segment is equivalent to \ref sparkey_logreader_open_mode.
+ * @param log a double reference to a logreader.
+ * @param num_segments the number of segment files, at least 1.
+ * @param filenames the log files, oldest first.
+ * @param mode how to read the log data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_logreader_open_segments(sparkey_logreader **log, int num_segments, const char * const *filenames, sparkey_read_mode mode);
+
 /**
  * Closes a logreader.
  * It's allowed to close a logreader while there are open logiterators.
@@ -431,6 +641,39 @@ void sparkey_logiter_close(sparkey_logiter **iter);
  */
 sparkey_returncode sparkey_logiter_seek(sparkey_logiter *iter, sparkey_logreader *log, uint64_t position);
 
+/**
+ * Splits a log into disjoint ranges that can be iterated independently, for
+ * scanning a large log from several threads.
+ * For compressed logs the split only reads block size prefixes and decompresses
+ * one block per boundary, and uncompressed fixed width logs are split without reading anything.
+ * Other uncompressed logs have no blocks and no way to find an entry start from an arbitrary
+ * offset, so the split is a single threaded walk over the entry headers of nearly the whole log.
+ * That walk touches every page holding a header when the log is mmapped, and reads through all
+ * entries smaller than the read buffer otherwise. Compute the boundaries once and reuse them,
+ * or write logs meant for parallel scans compressed or with fixed width entries.
+ * Ranges are roughly equal in bytes; some may be empty if the log is small.
+ * @param log an open logreader.
+ * @param num_partitions the number of ranges to produce. Must be at least 1.
+ * @param boundaries an array of num_partitions + 1 positions that will be filled in.
+ *                   Range i covers the entries starting in [boundaries[i], boundaries[i + 1]).
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_logreader_partition(sparkey_logreader *log, int num_partitions, uint64_t *boundaries);
+
+/**
+ * Positions a logiter at start and limits it to the entries starting before end.
+ * Once the range is exhausted, sparkey_logiter_next sets the state to SPARKEY_ITER_CLOSED.
+ * start must be a boundary returned by sparkey_logreader_partition. Each thread
+ * needs its own logiter, but they may share the logreader.
+ * A later sparkey_logiter_seek removes the limit.
+ * @param iter an open log iterator.
+ * @param log an open logreader associated with iter.
+ * @param start the position of the first entry in the range.
+ * @param end the position where the range ends.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_logiter_range(sparkey_logiter *iter, sparkey_logreader *log, uint64_t start, uint64_t end);
+
 /**
  * Skip a number of entries.
  * This is equivalent to calling sparkey_logiter_next count number of times.
@@ -583,6 +826,8 @@ uint64_t sparkey_logiter_valuelen(sparkey_logiter *iter);
  * Note that the hash file is never overwritten, instead the old file is unlinked from
  * the filesystem and the new one is created. Thus, it's safe to rewrite the hash table while
  * other processes are reading from it.
+ * A liveness bitmap left next to the hash file by an earlier build is removed, see
+ * \ref sparkey_hash_options.
  * @param hash_filename the file to create and put the sparkey hash table in.
  * @param log_filename a file that must exist and be a sparkey log file.
  * @param hash_size size of the hashes for keys.
@@ -593,6 +838,272 @@ uint64_t sparkey_logiter_valuelen(sparkey_logiter *iter);
  */
 sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log_filename, int hash_size);
 
+/**
+ * Creates a hash table for a list of log segments, see \ref sparkey_logreader_open_segments.
+ * If the existing hash file was built from a prefix of the segments, it will be reused
+ * and only the entries in the new segments (and the new tail of its last segment) are added.
+ * This makes it cheap to add a new delta segment on top of a large base segment.
+ * @param hash_filename the file to create and put the sparkey hash table in.
+ * @param num_segments the number of segment files, at least 1.
+ * @param log_filenames the log files, oldest first.
+ * @param hash_size size of the hashes for keys, see \ref sparkey_hash_write.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_hash_write_segments(const char *hash_filename, int num_segments, const char * const *log_filenames, int hash_size);
+
+/**
+ * The time spent in each phase of building a hash file, see \ref sparkey_hash_write_profiled.
+ * Reading, hashing and insertion are interleaved per entry, so they are measured with the cycle counter.
+ */
+typedef struct {
+  /** The number of log entries that were indexed. */
+  uint64_t entries;
+  /** The size of the in-memory hash table. */
+  uint64_t table_bytes;
+  /** The whole build, including opening the log. */
+  uint64_t total_ns;
+  /** Reading and reinserting the entries of an existing hash file that is reused. */
+  uint64_t copy_ns;
+  /** Iterating over the log entries, excluding decompression. */
+  uint64_t read_ns;
+  /** Decompressing log blocks. */
+  uint64_t decompress_ns;
+  /** Hashing the keys. */
+  uint64_t hash_ns;
+  /** Robin Hood insertion and deletion, including the key comparisons on collisions. */
+  uint64_t insert_ns;
+  /** Computing the displacement statistics for the header. */
+  uint64_t displacement_ns;
+  /** Filling the fingerprints and inline records, writing the hash file and the liveness bitmap. */
+  uint64_t write_ns;
+} sparkey_hash_build_profile;
+
+/**
+ * Same as \ref sparkey_hash_write_segments, but also measures the time spent in each phase of the build.
+ * Profiling adds a few cycle counter reads per log entry.
+ * @param hash_filename the file to create and put the sparkey hash table in.
+ * @param num_segments the number of segment files, at least 1.
+ * @param log_filenames the log files, oldest first.
+ * @param hash_size size of the hashes for keys, see \ref sparkey_hash_write.
+ * @param profile is filled in with the phase times, or may be NULL.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_hash_write_profiled(const char *hash_filename, int num_segments, const char * const *log_filenames, int hash_size, sparkey_hash_build_profile *profile);
+
+/**
+ * Options for building a hash file, see \ref sparkey_hash_write_opts.
+ */
+typedef struct {
+  /** Size of the hashes for keys, see \ref sparkey_hash_write. */
+  int hash_size;
+  /**
+   * Puts whose key and value together are at most this many bytes are also stored in the hash file,
+   * next to the table, so looking them up never reads the log. Costs inline_size + 2 bytes per slot.
+   * Must be at most 254, and 0 disables it.
+   * After a lookup of an inlined entry, the iterator can not continue to the following log entries.
+   */
+  uint32_t inline_size;
+  /**
+   * Bytes of an extra key fingerprint per slot, at most 4, and 0 disables it.
+   * The fingerprint is independent of the hash, so a key whose hash matches a slot only reads the log
+   * if the fingerprint matches too. With 4 byte hashes, 2 fingerprint bytes make such false matches
+   * about 65000 times rarer.
+   */
+  uint32_t fingerprint_size;
+  /**
+   * If set and the hash file name ends with ".spi", a liveness bitmap with one bit per log entry is
+   * written next to it, with the extension ".spb". See \ref sparkey_liveiter_create_bitmap.
+   * It costs about two bytes of memory per log entry while building, and an incremental build
+   * also reads the part of the log that the old hash file covers. If not set, a bitmap left by an
+   * earlier build is removed.
+   */
+  int liveness;
+} sparkey_hash_options;
+
+/**
+ * Same as \ref sparkey_hash_write_segments, but with options.
+ * The other hash writing functions keep the inline and fingerprint sizes of the existing hash file, if any.
+ * Changing either size rebuilds the hash file from the whole log, instead of only adding the new entries.
+ * @param hash_filename the file to create and put the sparkey hash table in.
+ * @param num_segments the number of segment files, at least 1.
+ * @param log_filenames the log files, oldest first.
+ * @param options the options for the hash file.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_hash_write_opts(const char *hash_filename, int num_segments, const char * const *log_filenames, const sparkey_hash_options *options);
+
+/* compaction */
+
+typedef struct sparkey_compaction sparkey_compaction;
+
+/**
+ * Options for compaction. Zero-initialize it and set the fields you need.
+ */
+typedef struct {
+  /** Limits how fast the input log is read, in bytes per second. 0 means no limit. */
+  uint64_t max_bytes_per_second;
+  /** If set, the new log uses compression_type and compression_block_size instead of the settings of the input log. */
+  int set_compression;
+  sparkey_compression_type compression_type;
+  int compression_block_size;
+  /** Options for writing the new log, or NULL for the defaults. */
+  const sparkey_logwriter_options *writer_options;
+  /**
+   * Keys to place first in the new log, hottest first, so that the hot entries are packed into
+   * a few contiguous blocks. Keys that are not live are skipped. All other entries follow in their
+   * original order. The keys are copied, so they don't need to outlive the call.
+   */
+  uint64_t num_hot_keys;
+  const uint8_t * const *hot_keys;
+  const uint64_t *hot_keylens;
+  /** If set, a liveness bitmap is written next to the new hash file, see \ref sparkey_hash_options. */
+  int liveness;
+} sparkey_compaction_options;
+
+/**
+ * Writes a new log/hash file pair that only contains the live entries of an existing pair,
+ * dropping all overwritten and deleted entries. The entries keep their relative order,
+ * except for the hot keys in the options which come first.
+ *
+ * Only the hash table is used to find the live entries, and the new hash table is filled
+ * from the known hash values, so no keys are hashed or compared.
+ * When the compression settings are unchanged, blocks that only contain live entries are copied
+ * without compressing them again, and a pair without garbage is copied as is.
+ * The input files are only read, so readers can keep using them while this runs.
+ * @param hash_filename an existing hash file.
+ * @param log_filename the log file of the hash file.
+ * @param new_hash_filename the hash file to create.
+ * @param new_log_filename the log file to create, must not be the same as log_filename.
+ * @param options compaction options, may be NULL for the defaults.
+ * @returns SPARKEY_SUCCESS if all goes well. On failure, the new files are removed.
+ */
+sparkey_returncode sparkey_compact(const char *hash_filename, const char *log_filename, const char *new_hash_filename, const char *new_log_filename, const sparkey_compaction_options *options);
+
+/**
+ * Starts a compaction like \ref sparkey_compact on a background thread.
+ * The compaction must always be finished with \ref sparkey_compaction_wait.
+ * @param job a double reference to a compaction, will be set on success.
+ * @returns SPARKEY_SUCCESS if the thread was started.
+ */
+sparkey_returncode sparkey_compaction_start(sparkey_compaction **job, const char *hash_filename, const char *log_filename, const char *new_hash_filename, const char *new_log_filename, const sparkey_compaction_options *options);
+
+/**
+ * Gets the progress of a running compaction.
+ * @param job a started compaction.
+ * @param processed will be set to the number of bytes of the input log that have been processed.
+ *                  Hot entries copied to the front count with the size of their key and value.
+ * @param total will be set to the total number of bytes to process, or 0 if it's not known yet.
+ *              It grows by the size of the hot entries once they have been copied.
+ */
+void sparkey_compaction_progress(sparkey_compaction *job, uint64_t *processed, uint64_t *total);
+
+/**
+ * Asks a running compaction to stop. \ref sparkey_compaction_wait will then return SPARKEY_CANCELLED,
+ * unless the compaction had already finished.
+ * @param job a started compaction.
+ */
+void sparkey_compaction_cancel(sparkey_compaction *job);
+
+/**
+ * Waits for a compaction to finish and frees it. *job will be set to NULL.
+ * @param job a double reference to a started compaction.
+ * @returns the result of the compaction.
+ */
+sparkey_returncode sparkey_compaction_wait(sparkey_compaction **job);
+
+/* sorted index */
+
+typedef struct sparkey_sortedreader sparkey_sortedreader;
+typedef struct sparkey_sortediter sparkey_sortediter;
+
+/**
+ * Creates a sorted index for a log file, which supports range and prefix scans over the keys.
+ * It contains all live keys of the hash file in sorted order, compared byte by byte with shorter
+ * keys first, together with their log addresses. It should be rebuilt together with the hash file.
+ * All live keys are held in memory while building.
+ * @param sorted_filename the file to create.
+ * @param hash_filename an existing hash file for the log.
+ * @param log_filename the log file.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_sorted_write(const char *sorted_filename, const char *hash_filename, const char *log_filename);
+
+/**
+ * Opens a sorted index and its log file for reading. The sortedreader is threadsafe, except during opening or closing.
+ * @param reader a double reference to an uninitialized sortedreader. Will be set on success.
+ * @param sorted_filename a file created by \ref sparkey_sorted_write.
+ * @param log_filename the log file the index was built from.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_sorted_open(sparkey_sortedreader **reader, const char *sorted_filename, const char *log_filename);
+
+/**
+ * Closes a sortedreader and sets *reader to NULL.
+ * @param reader a double reference to a sortedreader.
+ */
+void sparkey_sorted_close(sparkey_sortedreader **reader);
+
+/**
+ * Gets the logreader of a sortedreader, to be used with log iterators. It must not be closed by the caller.
+ * @param reader an open sortedreader.
+ * @returns the logreader.
+ */
+sparkey_logreader * sparkey_sorted_getreader(sparkey_sortedreader *reader);
+
+/**
+ * @param reader an open sortedreader.
+ * @returns the number of keys in the index.
+ */
+uint64_t sparkey_sorted_numentries(sparkey_sortedreader *reader);
+
+/**
+ * Creates an iterator over a sorted index. It starts out covering all keys.
+ * Each iterator may only be used by one thread at a time.
+ * @param iter a double reference to an iterator. Will be set on success.
+ * @param reader an open sortedreader.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sortediter_create(sparkey_sortediter **iter, sparkey_sortedreader *reader);
+
+/**
+ * Closes an iterator and sets *iter to NULL.
+ * @param iter a double reference to an iterator.
+ */
+void sparkey_sortediter_close(sparkey_sortediter **iter);
+
+/**
+ * Restricts the iterator to the keys in [start, end). The start is found with a binary search
+ * over the block index, followed by a short scan within one block.
+ * @param iter an open iterator.
+ * @param reader the sortedreader of the iterator.
+ * @param start the first key to include, or NULL to start at the smallest key.
+ * @param startlen the length of start.
+ * @param end the first key to exclude, or NULL to continue until the largest key.
+ * @param endlen the length of end.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sortediter_range(sparkey_sortediter *iter, sparkey_sortedreader *reader, const uint8_t *start, uint64_t startlen, const uint8_t *end, uint64_t endlen);
+
+/**
+ * Restricts the iterator to the keys that start with prefix.
+ * @param iter an open iterator.
+ * @param reader the sortedreader of the iterator.
+ * @param prefix the key prefix, may be empty.
+ * @param prefixlen the length of prefix.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sortediter_prefix(sparkey_sortediter *iter, sparkey_sortedreader *reader, const uint8_t *prefix, uint64_t prefixlen);
+
+/**
+ * Moves to the next key in the range, in sorted order, and positions a log iterator on its entry.
+ * The log iterator will be in state SPARKEY_ITER_ACTIVE, or SPARKEY_ITER_INVALID when there are no more keys in the range.
+ * @param iter an open iterator.
+ * @param reader the sortedreader of the iterator.
+ * @param logiter a log iterator for the logreader of the sortedreader.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_sortediter_next(sparkey_sortediter *iter, sparkey_sortedreader *reader, sparkey_logiter *logiter);
+
 /* hashreader */
 /**
  * Opens a hash file and a log file for reading. The the hashreader is threadsafe, except during opening or closing.
@@ -603,6 +1114,29 @@ sparkey_returncode sparkey_hash_write(const char *hash_filename, const char *log
  */
 sparkey_returncode sparkey_hash_open(sparkey_hashreader **reader, const char *hash_filename, const char *log_filename);
 
+/**
+ * Opens a hash file and a log file for reading, like \ref sparkey_hash_open, but with a specific
+ * read mode for the log file. The hash file is always mmapped.
+ * @param reader a double reference to an uninitialized hashreader. Will be set on success.
+ * @param hash_filename a filename of a file containing a sparkey hash table.
+ * @param log_filename a filename of a file containing a sparkey log.
+ * @param mode how to read the log data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_open_mode(sparkey_hashreader **reader, const char *hash_filename, const char *log_filename, sparkey_read_mode mode);
+
+/**
+ * Opens a hash file together with the log segments it was built from.
+ * The segments must be the same, in the same order, as when the hash file was written.
+ * @param reader a double reference to an uninitialized hashreader. Will be set on success.
+ * @param hash_filename a filename of a file containing a sparkey hash table.
+ * @param num_segments the number of segment files, at least 1.
+ * @param log_filenames the log files, oldest first.
+ * @param mode how to read the log data.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a return code indicating the error.
+ */
+sparkey_returncode sparkey_hash_open_segments(sparkey_hashreader **reader, const char *hash_filename, int num_segments, const char * const *log_filenames, sparkey_read_mode mode);
+
 /**
  * Gets the logreader that is referenced by the hashreader
  * @param reader an open reader.
@@ -644,10 +1178,342 @@ sparkey_returncode sparkey_hash_get(sparkey_hashreader *reader, const uint8_t *k
  */
 sparkey_returncode sparkey_logiter_hashnext(sparkey_logiter *iter, sparkey_hashreader *reader);
 
+/**
+ * Creates an iterator over the live entries of a hash file, as an alternative to
+ * \ref sparkey_logiter_hashnext for scanning all live data.
+ * The addresses in the hash table are collected and sorted once, which takes
+ * 16 bytes of memory per live entry. Iteration then reads the log in order, seeks
+ * past dead blocks and never hashes a key or probes the hash table.
+ * @param live a double reference to an uninitialized liveiter. Will be set on success.
+ * @param reader an open hashreader.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_liveiter_create(sparkey_liveiter **live, sparkey_hashreader *reader);
+
+/**
+ * Creates an iterator over the live entries of a hash file from the liveness bitmap that
+ * \ref sparkey_hash_write_opts creates next to it when asked to, see \ref sparkey_hash_options.
+ * Nothing needs to be sorted or held in memory. Iteration reads every log entry in order and
+ * stops at the ones marked as live, without hashing keys or probing the hash table.
+ * The logiter passed to \ref sparkey_liveiter_next must not be used for anything else in between.
+ * @param live a double reference to an uninitialized liveiter. Will be set on success.
+ * @param reader an open hashreader.
+ * @param liveness_filename the liveness bitmap written together with the hash file.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_FILE_IDENTIFIER_MISMATCH if the bitmap
+ *          was built for another version of the hash file.
+ */
+sparkey_returncode sparkey_liveiter_create_bitmap(sparkey_liveiter **live, sparkey_hashreader *reader, const char *liveness_filename);
+
+/**
+ * Closes a liveiter.
+ * This is a failsafe operation.
+ * @param live a double reference to a liveiter. This will be set to NULL after close.
+ */
+void sparkey_liveiter_close(sparkey_liveiter **live);
+
+/**
+ * Moves iter to the next live entry, with the same results as \ref sparkey_logiter_hashnext.
+ * iter->state will be SPARKEY_ITER_CLOSED if the last live entry has been passed.
+ * @param live an open liveiter.
+ * @param reader the hashreader the liveiter was created for.
+ * @param iter an open logiter associated with reader. It is repositioned as needed.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_liveiter_next(sparkey_liveiter *live, sparkey_hashreader *reader, sparkey_logiter *iter);
+
 uint64_t sparkey_hash_numentries(sparkey_hashreader *reader);
 
 uint64_t sparkey_hash_numcollisions(sparkey_hashreader *reader);
 
+/* statistics */
+
+/**
+ * Counters for the lookups made through \ref sparkey_hash_get and \ref sparkey_hash_async_submit
+ * since statistics were enabled.
+ */
+typedef struct {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t misses;
+  /** The number of hash slots inspected in total. The average probe length is probes / lookups. */
+  uint64_t probes;
+  /** The longest probe sequence of a single lookup. */
+  uint64_t max_probe;
+  /** The number of compressed log blocks that were decompressed. */
+  uint64_t decompressions;
+  /** The size of the decompressed blocks, in bytes. */
+  uint64_t decompressed_bytes;
+  /** Time spent decompressing, in nanoseconds. */
+  uint64_t decompress_ns;
+  /** The number of times the needed block was still decompressed in the logiter from an earlier lookup. */
+  uint64_t block_cache_hits;
+} sparkey_hash_stats;
+
+/**
+ * Starts counting lookups.
+ * Each thread updates its own cache line of counters without atomic read-modify-write operations,
+ * so the counters can be left on in production. Counts may be slightly low when many more threads
+ * than CPU cores use the same reader concurrently.
+ * Enabling and disabling must not race with lookups.
+ * @param reader an open hashreader.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_hash_stats_enable(sparkey_hashreader *reader);
+
+/**
+ * Stops counting lookups and discards the counters.
+ * This is a failsafe operation.
+ * @param reader a hashreader.
+ */
+void sparkey_hash_stats_disable(sparkey_hashreader *reader);
+
+/**
+ * Sums the counters of all threads. May be called while other threads are doing lookups.
+ * @param reader an open hashreader.
+ * @param stats is filled in with the current counters, or zeros if statistics are not enabled.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_hash_stats_snapshot(sparkey_hashreader *reader, sparkey_hash_stats *stats);
+
+/* latency */
+
+/**
+ * The phases of a lookup in \ref sparkey_hash_get that are timed separately.
+ */
+typedef enum {
+  /** The whole lookup. */
+  SPARKEY_PHASE_TOTAL,
+  /** Hashing the key. */
+  SPARKEY_PHASE_HASH,
+  /** Reading hash slots, which includes page faults on the hash file. */
+  SPARKEY_PHASE_PROBE,
+  /** Seeking to entries in the log and reading their headers, excluding decompression. */
+  SPARKEY_PHASE_SEEK,
+  /** Decompressing log blocks, for the lookups that had to. */
+  SPARKEY_PHASE_DECOMPRESS,
+  /** Comparing the key with the keys of the entries that were read. */
+  SPARKEY_PHASE_COMPARE,
+  SPARKEY_NUM_PHASES
+} sparkey_lookup_phase;
+
+/**
+ * Latency distribution of one lookup phase.
+ * Percentiles are accurate to within 12.5%.
+ */
+typedef struct {
+  /** The number of lookups that went through the phase. */
+  uint64_t count;
+  uint64_t mean_ns;
+  uint64_t max_ns;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t p999_ns;
+} sparkey_latency_summary;
+
+/**
+ * Starts recording a latency histogram per lookup phase.
+ * Timing uses the CPU time stamp counter where available, so the overhead is a few
+ * nanoseconds per lookup, and each thread records into its own histograms.
+ * The first call in a process takes about 10 ms to calibrate the time stamp counter.
+ * Enabling and disabling must not race with lookups.
+ * @param reader an open hashreader.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_LATENCY_DISABLED if sparkey
+ *          was configured with --disable-latency.
+ */
+sparkey_returncode sparkey_hash_latency_enable(sparkey_hashreader *reader);
+
+/**
+ * Stops recording and discards the histograms.
+ * This is a failsafe operation.
+ * @param reader a hashreader.
+ */
+void sparkey_hash_latency_disable(sparkey_hashreader *reader);
+
+/**
+ * Summarizes the histograms of all threads for one phase.
+ * May be called while other threads are doing lookups.
+ * @param reader an open hashreader.
+ * @param phase the phase to summarize.
+ * @param summary is filled in, or set to zeros if latency recording is not enabled.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_hash_latency_snapshot(sparkey_hashreader *reader, sparkey_lookup_phase phase, sparkey_latency_summary *summary);
+
+/* tracing */
+
+typedef enum {
+  /** The key was found. */
+  SPARKEY_TRACE_FOUND = 1,
+  /** At least one log block had to be decompressed. */
+  SPARKEY_TRACE_DECOMPRESSED = 2
+} sparkey_trace_flag;
+
+/**
+ * One sampled lookup.
+ */
+typedef struct {
+  /** The hash slot the key hashes to. */
+  uint64_t slot;
+  /** The log block of the last entry that was read, or 0 if no entry was read. */
+  uint64_t block_position;
+  /** The number of hash slots inspected, including the first one. */
+  uint32_t probe_length;
+  /** A combination of SPARKEY_TRACE_FOUND and SPARKEY_TRACE_DECOMPRESSED. */
+  uint32_t flags;
+} sparkey_trace_record;
+
+/**
+ * Starts sampling lookups made through \ref sparkey_hash_get into a ring buffer.
+ * Sampling is cheap and safe with concurrent lookups: each thread records every
+ * sample_interval:th lookup it makes on this reader, and records claim ring slots with a single
+ * atomic add. The countdowns are kept per reader, so lookups on other readers do not shift them.
+ * Threads beyond the first 64 share countdowns, which may skip a few samples.
+ * When the ring buffer is full, the oldest records are overwritten.
+ * Enabling and disabling must not race with lookups or with each other.
+ * Reading with \ref sparkey_hash_trace_read or \ref sparkey_hash_trace_save may run concurrently
+ * with lookups, but only from one thread at a time.
+ * @param reader an open hashreader.
+ * @param sample_interval record one lookup out of this many, per thread. Must be at least 1.
+ * @param capacity the size of the ring buffer in records. Must be a power of two.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_INVALID_TRACE_SETTINGS if the settings are invalid.
+ */
+sparkey_returncode sparkey_hash_trace_enable(sparkey_hashreader *reader, uint32_t sample_interval, uint32_t capacity);
+
+/**
+ * Stops tracing and discards any records that have not been read.
+ * This is a failsafe operation.
+ * @param reader a hashreader.
+ */
+void sparkey_hash_trace_disable(sparkey_hashreader *reader);
+
+/**
+ * Removes the oldest records from the ring buffer.
+ * @param reader a hashreader with tracing enabled.
+ * @param records an array with room for max_records records.
+ * @param max_records the maximum number of records to read.
+ * @returns the number of records read, 0 if there are none or if tracing is not enabled.
+ */
+uint64_t sparkey_hash_trace_read(sparkey_hashreader *reader, sparkey_trace_record *records, uint64_t max_records);
+
+/**
+ * @returns the number of records that were overwritten before they could be read.
+ */
+uint64_t sparkey_hash_trace_dropped(sparkey_hashreader *reader);
+
+/**
+ * Drains the ring buffer into a trace file, creating it if it does not exist.
+ * Records are appended to an existing file, so a trace can be saved periodically.
+ * @param reader a hashreader with tracing enabled.
+ * @param filename the trace file.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_hash_trace_save(sparkey_hashreader *reader, const char *filename);
+
+/**
+ * A trace file loaded into memory.
+ */
+typedef struct {
+  /** Size in bytes of a hash slot. */
+  uint32_t slot_size;
+  uint32_t entry_block_bits;
+  uint64_t hash_capacity;
+  /** Size of the log file at the time of the trace. */
+  uint64_t data_end;
+  uint64_t num_records;
+  sparkey_trace_record *records;
+} sparkey_trace_file;
+
+/**
+ * Loads a trace file written by \ref sparkey_hash_trace_save.
+ * @param filename the trace file.
+ * @param file will be filled in on success. The caller must free file->records.
+ * @returns SPARKEY_SUCCESS if all goes well. SPARKEY_TRACE_CORRUPT if the file is not a trace file.
+ */
+sparkey_returncode sparkey_trace_load(const char *filename, sparkey_trace_file *file);
+
+/* hashasync */
+
+/**
+ * The outcome of an asynchronous lookup, as returned by \ref sparkey_hash_async_poll.
+ */
+typedef struct {
+  /** The userdata pointer passed to \ref sparkey_hash_async_submit. */
+  void *userdata;
+  /** SPARKEY_SUCCESS if the lookup completed, otherwise a returncode indicating the error. */
+  sparkey_returncode returncode;
+  /** SPARKEY_ITER_ACTIVE if the key was found, otherwise SPARKEY_ITER_INVALID. */
+  sparkey_iter_state state;
+  /** The value of the entry. Only valid until the next call to \ref sparkey_hash_async_poll. */
+  const uint8_t *value;
+  /** The length of the value. */
+  uint64_t valuelen;
+} sparkey_hash_async_result;
+
+/**
+ * Creates a context for asynchronous lookups against a hashreader.
+ * Lookups resolve slots from the (mmapped) index directly, and then read the needed log data
+ * with explicit reads instead of page faulting on the mmapped log. On Linux the reads are issued
+ * through io_uring, so a single thread can keep many reads in flight. If io_uring is not available,
+ * the reads are done with pread when the lookup is submitted.
+ *
+ * Entries larger than a compressed block are assembled from reads of the following blocks,
+ * so no lookup blocks on the mmapped log.
+ *
+ * Async lookups are counted in the statistics and traces of the hashreader like \ref sparkey_hash_get,
+ * but not in its latency histograms, since their time is mostly spent waiting on the queue.
+ *
+ * The context is not threadsafe, use one per thread. The hashreader may be shared between contexts,
+ * and must remain open until the context is closed.
+ * @param async a double reference to an uninitialized async context. Will be set on success.
+ * @param reader an open hashreader.
+ * @param queue_depth the maximum number of lookups in progress at the same time.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_hash_async_create(sparkey_hash_async **async, sparkey_hashreader *reader, int queue_depth);
+
+/**
+ * Closes an async context, waiting for any reads still in flight.
+ * If the kernel stops accepting the wait, the context is leaked rather than freed under those reads.
+ * This is a failsafe operation.
+ * @param async a double reference to an async context.
+ *              This will be set to NULL after close.
+ */
+void sparkey_hash_async_close(sparkey_hash_async **async);
+
+/**
+ * Starts an asynchronous lookup of a key.
+ * The key is copied, so the buffer may be reused as soon as the function returns.
+ * @param async an open async context.
+ * @param key a buffer containing the key. It does not have be NUL terminated.
+ * @param keylen the length of the key.
+ * @param userdata an opaque pointer, returned as is in the result.
+ * @returns SPARKEY_SUCCESS if the lookup was started, SPARKEY_ASYNC_QUEUE_FULL if
+ * queue_depth lookups are already in progress. Poll for results to make room.
+ */
+sparkey_returncode sparkey_hash_async_submit(sparkey_hash_async *async, const uint8_t *key, uint64_t keylen, void *userdata);
+
+/**
+ * Collects results of finished lookups, in completion order.
+ * Calling this releases the results returned by the previous call, so any value pointers
+ * from that call become invalid.
+ * @param async an open async context.
+ * @param min_results wait until at least this many results are available, or until all
+ *                    pending lookups are done. Use 0 to never block.
+ * @param max_results the capacity of results.
+ * @param results an array where the results are stored.
+ * @param num_results (output parameter) the number of results stored.
+ * @returns SPARKEY_SUCCESS if all goes well. Otherwise a returncode indicating the error.
+ */
+sparkey_returncode sparkey_hash_async_poll(sparkey_hash_async *async, int min_results, int max_results, sparkey_hash_async_result *results, int *num_results);
+
+/**
+ * Get the number of submitted lookups that have not yet been returned by \ref sparkey_hash_async_poll.
+ * @param async an open async context.
+ * @returns the number of pending lookups.
+ */
+int sparkey_hash_async_pending(sparkey_hash_async *async);
+
 /* util */
 
 /**
@@ -666,6 +1532,14 @@ char * sparkey_create_log_filename(const char *index_filename);
  */
 char * sparkey_create_index_filename(const char *log_filename);
 
+/**
+ * Allocates and creates a string denoting a liveness bitmap file from an index file.
+ * This is simply a string replacement of .spi$ to .spb$
+ * @param index_filename the filename representing the index file
+ * @returns NULL if the index_filename does not end with ".spi"
+ */
+char * sparkey_create_liveness_filename(const char *index_filename);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,140 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdlib.h>
+#include <string.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+
+/*
+ * Counters are spread over shards, one cache line each, so that threads doing lookups
+ * on the same reader do not write to shared cache lines. A thread always uses the same shard.
+ * Counters are updated with relaxed loads and stores rather than atomic additions,
+ * which compile to plain moves. Updates are only lost if two threads that map to
+ * the same shard update it at the same time.
+ */
+#define STATS_SHARDS (64)
+#define CACHE_LINE_SIZE (64)
+
+typedef struct {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t probes;
+  uint64_t max_probe;
+  uint64_t decompressions;
+  uint64_t decompressed_bytes;
+  uint64_t decompress_cycles;
+  uint64_t block_cache_hits;
+} stats_shard;
+
+struct sparkey_stats {
+  stats_shard *shards;
+};
+
+/* The number of the calling thread, or 0 before it has been assigned */
+static __thread uint32_t thread_number;
+static uint32_t num_threads;
+
+uint32_t sparkey_thread_number(void) {
+  if (thread_number == 0) {
+    thread_number = __atomic_add_fetch(&num_threads, 1, __ATOMIC_RELAXED);
+  }
+  return thread_number - 1;
+}
+
+sparkey_returncode sparkey_hash_stats_enable(sparkey_hashreader *reader) {
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (reader->stats != NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  sparkey_stats *stats = malloc(sizeof(sparkey_stats));
+  if (stats == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  void *shards;
+  if (posix_memalign(&shards, CACHE_LINE_SIZE, STATS_SHARDS * CACHE_LINE_SIZE) != 0) {
+    free(stats);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(shards, 0, STATS_SHARDS * CACHE_LINE_SIZE);
+  sparkey_calibrate_cycles();
+  stats->shards = shards;
+  reader->stats = stats;
+  return SPARKEY_SUCCESS;
+}
+
+void sparkey_hash_stats_disable(sparkey_hashreader *reader) {
+  sparkey_stats_free(reader->stats);
+  reader->stats = NULL;
+}
+
+void sparkey_stats_free(sparkey_stats *stats) {
+  if (stats != NULL) {
+    free(stats->shards);
+    free(stats);
+  }
+}
+
+static stats_shard * get_shard(sparkey_stats *stats, int i) {
+  return (stats_shard *) ((uint8_t *) stats->shards + i * CACHE_LINE_SIZE);
+}
+
+void sparkey_stats_lookup(sparkey_stats *stats, const sparkey_lookup_info *info) {
+  stats_shard *shard = get_shard(stats, sparkey_thread_number() % STATS_SHARDS);
+  sparkey_counter_add(&shard->lookups, 1);
+  sparkey_counter_add(&shard->hits, info->found != 0);
+  sparkey_counter_add(&shard->probes, info->probe_length);
+  if (info->probe_length > __atomic_load_n(&shard->max_probe, __ATOMIC_RELAXED)) {
+    __atomic_store_n(&shard->max_probe, info->probe_length, __ATOMIC_RELAXED);
+  }
+  if (info->decompressions > 0) {
+    sparkey_counter_add(&shard->decompressions, info->decompressions);
+    sparkey_counter_add(&shard->decompressed_bytes, info->decompressed_bytes);
+    sparkey_counter_add(&shard->decompress_cycles, info->decompress_cycles);
+  }
+  sparkey_counter_add(&shard->block_cache_hits, info->block_reuses);
+}
+
+sparkey_returncode sparkey_hash_stats_snapshot(sparkey_hashreader *reader, sparkey_hash_stats *snapshot) {
+  memset(snapshot, 0, sizeof(sparkey_hash_stats));
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (reader->stats == NULL) {
+    return SPARKEY_SUCCESS;
+  }
+  uint64_t decompress_cycles = 0;
+  for (int i = 0; i < STATS_SHARDS; i++) {
+    stats_shard *shard = get_shard(reader->stats, i);
+    snapshot->lookups += __atomic_load_n(&shard->lookups, __ATOMIC_RELAXED);
+    snapshot->hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+    snapshot->probes += __atomic_load_n(&shard->probes, __ATOMIC_RELAXED);
+    uint64_t max_probe = __atomic_load_n(&shard->max_probe, __ATOMIC_RELAXED);
+    if (max_probe > snapshot->max_probe) {
+      snapshot->max_probe = max_probe;
+    }
+    snapshot->decompressions += __atomic_load_n(&shard->decompressions, __ATOMIC_RELAXED);
+    snapshot->decompressed_bytes += __atomic_load_n(&shard->decompressed_bytes, __ATOMIC_RELAXED);
+    decompress_cycles += __atomic_load_n(&shard->decompress_cycles, __ATOMIC_RELAXED);
+    snapshot->block_cache_hits += __atomic_load_n(&shard->block_cache_hits, __ATOMIC_RELAXED);
+  }
+  snapshot->decompress_ns = sparkey_cycles_to_ns(decompress_cycles);
+  // hits may be summed from a later point in time than lookups
+  snapshot->misses = snapshot->lookups > snapshot->hits ? snapshot->lookups - snapshot->hits : 0;
+  return SPARKEY_SUCCESS;
+}
@@ -17,8 +17,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "sparkey.h"
+#include "logheader.h"
+#include "hashheader.h"
 
 static int max(int a, int b) {
   return a > b ? a : b;
@@ -50,7 +55,65 @@ static void _assert_str_equals(const char *file, int line, const char *expected,
 
 #define assert_str_equals(expected, actual) _assert_str_equals(__FILE__, __LINE__, expected, actual)
 
-void verify(sparkey_compression_type compression, int blocksize, int hashsize, int num_puts, int num_deletes, int num_puts2) {
+static void assert_same_entry(sparkey_logiter *expected_iter, sparkey_logiter *actual_iter, sparkey_logreader *myreader) {
+  uint64_t keylen = sparkey_logiter_keylen(expected_iter);
+  uint64_t valuelen = sparkey_logiter_valuelen(expected_iter);
+  assert_equals(keylen, sparkey_logiter_keylen(actual_iter));
+  assert_equals(valuelen, sparkey_logiter_valuelen(actual_iter));
+  uint8_t *expected = malloc(keylen + valuelen + 1);
+  uint8_t *actual = malloc(keylen + valuelen + 1);
+  uint64_t len;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(expected_iter, myreader, keylen, expected, &len));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(expected_iter, myreader, valuelen, &expected[keylen], &len));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(actual_iter, myreader, keylen, actual, &len));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(actual_iter, myreader, valuelen, &actual[keylen], &len));
+  assert_equals(0, memcmp(expected, actual, keylen + valuelen));
+  free(expected);
+  free(actual);
+}
+
+/**
+ * Checks that liveiters, both from the hash table and from the liveness bitmap,
+ * visit the same entries as sparkey_logiter_hashnext.
+ * @returns the number of live entries.
+ */
+static int verify_live_iteration(sparkey_hashreader *myhashreader, const char *liveness_filename) {
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+  sparkey_logiter *expected_iter;
+  sparkey_logiter *actual_iter;
+  sparkey_logiter *bitmap_iter;
+  sparkey_liveiter *live;
+  sparkey_liveiter *bitmap_live;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&expected_iter, myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&actual_iter, myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&bitmap_iter, myreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_liveiter_create(&live, myhashreader));
+  assert_equals(SPARKEY_SUCCESS, sparkey_liveiter_create_bitmap(&bitmap_live, myhashreader, liveness_filename));
+  int count = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_hashnext(expected_iter, myhashreader));
+    assert_equals(SPARKEY_SUCCESS, sparkey_liveiter_next(live, myhashreader, actual_iter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_liveiter_next(bitmap_live, myhashreader, bitmap_iter));
+    assert_equals(sparkey_logiter_state(expected_iter), sparkey_logiter_state(actual_iter));
+    assert_equals(sparkey_logiter_state(expected_iter), sparkey_logiter_state(bitmap_iter));
+    if (sparkey_logiter_state(expected_iter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    count++;
+    assert_same_entry(expected_iter, actual_iter, myreader);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_reset(expected_iter, myreader));
+    assert_same_entry(expected_iter, bitmap_iter, myreader);
+  }
+  sparkey_liveiter_close(&live);
+  assert_equals(1, live == NULL);
+  sparkey_liveiter_close(&bitmap_live);
+  sparkey_logiter_close(&expected_iter);
+  sparkey_logiter_close(&actual_iter);
+  sparkey_logiter_close(&bitmap_iter);
+  return count;
+}
+
+void verify(sparkey_read_mode mode, sparkey_compression_type compression, int blocksize, int hashsize, int num_puts, int num_deletes, int num_puts2) {
   int expected_puts = max(0, num_puts - max(num_deletes, num_puts2));
   int expected_total = expected_puts + num_puts2;
 
@@ -84,7 +147,7 @@ void verify(sparkey_compression_type compression, int blocksize, int hashsize, i
 
   // verify correct log iteration
   sparkey_logreader *myreader;
-  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open_mode(&myreader, "test.spl", mode));
   sparkey_logiter *myiter;
   assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
 
@@ -150,7 +213,7 @@ void verify(sparkey_compression_type compression, int blocksize, int hashsize, i
 
   // verify hash iteration
   sparkey_hashreader *myhashreader;
-  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_mode(&myhashreader, "test.spi", "test.spl", mode));
   myreader = sparkey_hash_getreader(myhashreader);
   assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
 
@@ -198,6 +261,16 @@ void verify(sparkey_compression_type compression, int blocksize, int hashsize, i
   }
   assert_equals(expected_total, visited);
 
+  // add a liveness bitmap in a separate build, it matches the open hash file since the log is the same
+  sparkey_hash_options hash_options;
+  memset(&hash_options, 0, sizeof(hash_options));
+  hash_options.hash_size = hashsize;
+  hash_options.liveness = 1;
+  const char *log_filename = "test.spl";
+  assert_equals(-1, access("test.spb", F_OK));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 1, &log_filename, &hash_options));
+  assert_equals(expected_total, verify_live_iteration(myhashreader, "test.spb"));
+
   // verify random access
   for (int i = 0; i < max(num_puts, num_puts2) + 100; i++) {
     char key[100];
@@ -225,10 +298,1369 @@ void verify(sparkey_compression_type compression, int blocksize, int hashsize, i
       free(valuebuf);
     }
   }
+
+  // verify asynchronous random access
+  sparkey_hash_async *async;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_create(&async, myhashreader, 8));
+  int num_keys = max(num_puts, num_puts2) + 100;
+  int submitted = 0;
+  int completed = 0;
+  while (completed < num_keys) {
+    while (submitted < num_keys) {
+      char key[100];
+      sprintf(key, "key_%d", submitted);
+      sparkey_returncode rc = sparkey_hash_async_submit(async, (uint8_t*) key, strlen(key), (void *) (intptr_t) submitted);
+      if (rc == SPARKEY_ASYNC_QUEUE_FULL) {
+        break;
+      }
+      assert_equals(SPARKEY_SUCCESS, rc);
+      submitted++;
+    }
+    sparkey_hash_async_result results[8];
+    int num_results;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_poll(async, 1, 8, results, &num_results));
+    for (int j = 0; j < num_results; j++) {
+      int i = (int) (intptr_t) results[j].userdata;
+      char expected_value[100];
+      assert_equals(SPARKEY_SUCCESS, results[j].returncode);
+      if (i < num_puts2) {
+        assert_equals(SPARKEY_ITER_ACTIVE, results[j].state);
+        sprintf(expected_value, "newvalue_%d", i);
+      } else if (i >= num_deletes && i < num_puts) {
+        assert_equals(SPARKEY_ITER_ACTIVE, results[j].state);
+        sprintf(expected_value, "value_%d", i);
+      } else {
+        assert_equals(SPARKEY_ITER_INVALID, results[j].state);
+        continue;
+      }
+      assert_equals(strlen(expected_value), results[j].valuelen);
+      assert_equals(0, memcmp(expected_value, results[j].value, results[j].valuelen));
+    }
+    completed += num_results;
+  }
+  assert_equals(0, sparkey_hash_async_pending(async));
+  sparkey_hash_async_close(&async);
+  assert_equals(1, async == NULL);
+
   sparkey_hash_close(&myhashreader);
   sparkey_logiter_close(&myiter);
 }
 
+void verify_write_modes() {
+  for (sparkey_write_mode mode = SPARKEY_WRITE_CACHED; mode <= SPARKEY_WRITE_DIRECT; mode++) {
+    for (int variant = 0; variant < 4; variant++) {
+      sparkey_compression_type t = variant % 2 ? SPARKEY_COMPRESSION_SNAPPY : SPARKEY_COMPRESSION_NONE;
+      sparkey_logwriter_options options;
+      options.write_mode = mode;
+      // deliberately not a multiple of the page size
+      options.file_buffer_size = 5000;
+      options.async_flush = variant / 2;
+      options.fixed_width = 0;
+
+      sparkey_logwriter *mywriter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create_opts(&mywriter, "test.spl", t, 100, &options));
+      for (int i = 0; i < 3000; i++) {
+        char key[100];
+        char value[100];
+        sprintf(key, "key_%d", i);
+        sprintf(value, "value_%d", i);
+        assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+        if (i == 1000) {
+          assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+        }
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_append_opts(&mywriter, "test.spl", &options));
+      for (int i = 3000; i < 4000; i++) {
+        char key[100];
+        char value[100];
+        sprintf(key, "key_%d", i);
+        sprintf(value, "value_%d", i);
+        assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+      sparkey_hashreader *myhashreader;
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+      sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+      sparkey_logiter *myiter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      for (int i = 0; i < 4000; i++) {
+        char key[100];
+        char expected_value[100];
+        uint8_t valuebuf[100];
+        sprintf(key, "key_%d", i);
+        sprintf(expected_value, "value_%d", i);
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+        assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+        uint64_t actual_valuelen;
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(valuebuf), valuebuf, &actual_valuelen));
+        assert_equals(strlen(expected_value), actual_valuelen);
+        assert_equals(0, memcmp(expected_value, valuebuf, actual_valuelen));
+      }
+      sparkey_logiter_close(&myiter);
+      sparkey_hash_close(&myhashreader);
+    }
+  }
+
+  sparkey_logwriter_options options;
+  options.write_mode = (sparkey_write_mode) 17;
+  options.file_buffer_size = 0;
+  options.async_flush = 0;
+  options.fixed_width = 0;
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_INVALID_WRITE_MODE, sparkey_logwriter_create_opts(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0, &options));
+}
+
+void verify_put_batch() {
+  static char values[3000];
+  memset(values, 'x', sizeof(values));
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
+    sparkey_logwriter *mywriter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", t, 100));
+
+    // every 100th entry is larger than a compression block
+    char keys[1000][16];
+    sparkey_logwriter_entry entries[1000];
+    for (int i = 0; i < 1000; i++) {
+      sprintf(keys[i], "key_%d", i);
+      entries[i].key = (uint8_t*) keys[i];
+      entries[i].keylen = strlen(keys[i]);
+      entries[i].value = (uint8_t*) values;
+      entries[i].valuelen = i % 100 == 99 ? sizeof(values) : (uint64_t) (i % 20);
+    }
+    for (int i = 0; i < 1000; i += 250) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put_batch(mywriter, 250, &entries[i]));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+    sparkey_logreader *myreader;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test.spl"));
+    assert_equals(sizeof(values), sparkey_logreader_maxvaluelen(myreader));
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+    for (int i = 0; i < 1000; i++) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+      assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+      assert_equals(SPARKEY_ENTRY_PUT, sparkey_logiter_type(myiter));
+      uint8_t keybuf[16];
+      uint64_t actual_keylen;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(keybuf), keybuf, &actual_keylen));
+      assert_equals(entries[i].keylen, actual_keylen);
+      assert_equals(0, memcmp(keys[i], keybuf, actual_keylen));
+      assert_equals(entries[i].valuelen, sparkey_logiter_valuelen(myiter));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    assert_equals(SPARKEY_ITER_CLOSED, sparkey_logiter_state(myiter));
+    sparkey_logiter_close(&myiter);
+    sparkey_logreader_close(&myreader);
+  }
+}
+
+void verify_sharded_writer() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_sharded_writer *writer;
+    assert_equals(SPARKEY_SUCCESS, sparkey_sharded_writer_create(&writer, "test.spl", 4, t, 100, NULL));
+    assert_equals(1, sparkey_sharded_writer_get(writer, 4) == NULL);
+    for (int i = 0; i < 4000; i++) {
+      char key[100];
+      char value[100];
+      sprintf(key, "key_%d", i);
+      sprintf(value, "value_%d", i);
+      sparkey_logwriter *shard = sparkey_sharded_writer_get(writer, i % 4);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(shard, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    }
+    // the last shard gets deletes for keys owned by the others, which must win
+    for (int i = 0; i < 100; i++) {
+      char key[100];
+      sprintf(key, "key_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(sparkey_sharded_writer_get(writer, 3), strlen(key), (uint8_t*) key));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_sharded_writer_close(&writer, "test.spi", 0));
+    assert_equals(1, writer == NULL);
+
+    sparkey_hashreader *myhashreader;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+    assert_equals(3900, sparkey_hash_numentries(myhashreader));
+    sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+    for (int i = 0; i < 4000; i++) {
+      char key[100];
+      char expected_value[100];
+      uint8_t valuebuf[100];
+      sprintf(key, "key_%d", i);
+      sprintf(expected_value, "value_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+      if (i < 100) {
+        assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(myiter));
+        continue;
+      }
+      assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+      uint64_t actual_valuelen;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(valuebuf), valuebuf, &actual_valuelen));
+      assert_equals(strlen(expected_value), actual_valuelen);
+      assert_equals(0, memcmp(expected_value, valuebuf, actual_valuelen));
+    }
+    sparkey_logiter_close(&myiter);
+    sparkey_hash_close(&myhashreader);
+  }
+  assert_equals(-1, access("test.spl.shard0", F_OK));
+}
+
+static void write_segment(const char *filename, sparkey_compression_type t, int first_put, int num_puts, int num_deletes) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, filename, t, 100));
+  for (int i = first_put; i < first_put + num_puts; i++) {
+    char key[100];
+    char value[100];
+    sprintf(key, "key_%d", i);
+    sprintf(value, "value_%d_%s", i, filename);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  for (int i = 0; i < num_deletes; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+}
+
+void verify_segments() {
+  const char *segments[] = {"test0.spl", "test1.spl", "test2.spl"};
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    // the second segment overrides half of the first, the third deletes some keys from the first
+    write_segment(segments[0], t, 0, 1000, 0);
+    write_segment(segments[1], t, 500, 1000, 0);
+    remove("test.spi");
+    sparkey_hash_options hash_options;
+    memset(&hash_options, 0, sizeof(hash_options));
+    hash_options.liveness = 1;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 2, segments, &hash_options));
+
+    sparkey_hashreader *myhashreader;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_segments(&myhashreader, "test.spi", 2, segments, SPARKEY_READ_MMAP));
+    assert_equals(1500, sparkey_hash_numentries(myhashreader));
+    sparkey_hash_close(&myhashreader);
+
+    // adding a delta segment only indexes the new entries
+    write_segment(segments[2], t, 1500, 100, 100);
+    assert_equals(SPARKEY_FILE_IDENTIFIER_MISMATCH, sparkey_hash_open_segments(&myhashreader, "test.spi", 3, segments, SPARKEY_READ_MMAP));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 3, segments, &hash_options));
+    assert_equals(SPARKEY_FILE_IDENTIFIER_MISMATCH, sparkey_hash_open_segments(&myhashreader, "test.spi", 2, segments, SPARKEY_READ_MMAP));
+
+    for (sparkey_read_mode mode = SPARKEY_READ_MMAP; mode <= SPARKEY_READ_PREAD; mode++) {
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_segments(&myhashreader, "test.spi", 3, segments, mode));
+      assert_equals(1500, sparkey_hash_numentries(myhashreader));
+      sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+      sparkey_logiter *myiter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      for (int i = 0; i < 1700; i++) {
+        char key[100];
+        char expected_value[100];
+        uint8_t valuebuf[100];
+        sprintf(key, "key_%d", i);
+        sprintf(expected_value, "value_%d_%s", i, segments[i < 500 ? 0 : i < 1500 ? 1 : 2]);
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+        if (i < 100 || i >= 1600) {
+          assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(myiter));
+          continue;
+        }
+        assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+        uint64_t actual_valuelen;
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(valuebuf), valuebuf, &actual_valuelen));
+        assert_equals(strlen(expected_value), actual_valuelen);
+        assert_equals(0, memcmp(expected_value, valuebuf, actual_valuelen));
+      }
+
+      // the iterators cross segment boundaries transparently
+      sparkey_logiter_close(&myiter);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      int entries = 0;
+      while (1) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+        if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+          break;
+        }
+        entries++;
+      }
+      assert_equals(2200, entries);
+
+      sparkey_logiter_close(&myiter);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      int live = 0;
+      while (1) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_hashnext(myiter, myhashreader));
+        if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+          break;
+        }
+        live++;
+      }
+      assert_equals(1500, live);
+      assert_equals(1500, verify_live_iteration(myhashreader, "test.spb"));
+      sparkey_logiter_close(&myiter);
+      sparkey_hash_close(&myhashreader);
+    }
+  }
+
+  sparkey_logreader *myreader;
+  write_segment(segments[1], SPARKEY_COMPRESSION_NONE, 0, 10, 0);
+  assert_equals(SPARKEY_SEGMENT_MISMATCH, sparkey_logreader_open_segments(&myreader, 3, segments, SPARKEY_READ_MMAP));
+}
+
+/**
+ * Every 100th value is large_len bytes, to make it larger than a compression block or an inline record.
+ */
+static void compaction_value(char *buf, int i, int large_len) {
+  sprintf(buf, "v%d", i);
+  if (i % 100 == 7) {
+    size_t len = strlen(buf);
+    memset(&buf[len], 'x', large_len - len);
+    buf[large_len] = 0;
+  }
+}
+
+/**
+ * Writes num_puts puts to test.spl, cycling through key_0 to key_999 with the value compaction_value(i),
+ * and then deletes the last num_deletes keys.
+ */
+static void write_compaction_log(sparkey_compression_type t, int num_puts, int num_deletes, int large_len) {
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", t, 100));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    char value[400];
+    sprintf(key, "key_%d", i % 1000);
+    compaction_value(value, i, large_len);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+  }
+  for (int i = 1000 - num_deletes; i < 1000; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+}
+
+/**
+ * Looks up key_0 to key_{num_keys - 1}, both directly and asynchronously, where the first num_overwritten keys
+ * have the value compaction_value(i + num_keys), the others compaction_value(i), and keys from num_live on
+ * do not exist. Returns the number of decompressions.
+ */
+static uint64_t verify_lookups(const char *hash_filename, const char *log_filename, int num_keys, int num_overwritten, int num_live, int large_len) {
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, hash_filename, log_filename));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_enable(myhashreader));
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  sparkey_hash_async *async;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_create(&async, myhashreader, 2));
+  for (int i = 0; i < num_keys; i++) {
+    char key[100];
+    char expected_value[400];
+    uint8_t valuebuf[400];
+    sprintf(key, "key_%d", i);
+    compaction_value(expected_value, i < num_overwritten ? i + num_keys : i, large_len);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_submit(async, (uint8_t*) key, strlen(key), NULL));
+    sparkey_hash_async_result result;
+    int num_results;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_poll(async, 1, 1, &result, &num_results));
+    if (i >= num_live) {
+      assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(myiter));
+      assert_equals(SPARKEY_ITER_INVALID, result.state);
+      continue;
+    }
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+    assert_equals(strlen(key), sparkey_logiter_keylen(myiter));
+    uint64_t actual_valuelen;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(valuebuf), valuebuf, &actual_valuelen));
+    assert_equals(strlen(expected_value), actual_valuelen);
+    assert_equals(0, memcmp(expected_value, valuebuf, actual_valuelen));
+    assert_equals(SPARKEY_ITER_ACTIVE, result.state);
+    assert_equals(strlen(expected_value), result.valuelen);
+    assert_equals(0, memcmp(expected_value, result.value, result.valuelen));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) "nokey", 5, myiter));
+  assert_equals(SPARKEY_ITER_INVALID, sparkey_logiter_state(myiter));
+
+  sparkey_hash_stats stats;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_snapshot(myhashreader, &stats));
+
+  // the iterator can go back to the log after an inlined entry
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_seek(myiter, myreader, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+  assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+  uint8_t keybuf[100];
+  uint64_t actual_keylen;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(keybuf), keybuf, &actual_keylen));
+  assert_equals(1, actual_keylen > 4);
+  assert_equals(0, memcmp("key_", keybuf, 4));
+
+  sparkey_hash_async_close(&async);
+  sparkey_logiter_close(&myiter);
+  sparkey_hash_close(&myhashreader);
+  return stats.decompressions;
+}
+
+static void verify_compacted(const char *hash_filename, const char *log_filename, sparkey_compression_type t, int num_keys, int num_overwritten, int num_live) {
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, hash_filename, log_filename));
+  assert_equals(num_live, sparkey_hash_numentries(myhashreader));
+  sparkey_logreader *myreader = sparkey_hash_getreader(myhashreader);
+  assert_equals(t, sparkey_logreader_get_compression_type(myreader));
+  sparkey_logiter *myiter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+  int entries = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    assert_equals(SPARKEY_ENTRY_PUT, sparkey_logiter_type(myiter));
+    entries++;
+  }
+  assert_equals(num_live, entries);
+  sparkey_logiter_close(&myiter);
+
+  char *liveness_filename = sparkey_create_liveness_filename(hash_filename);
+  if (access(liveness_filename, F_OK) == 0) {
+    assert_equals(num_live, verify_live_iteration(myhashreader, liveness_filename));
+  }
+  free(liveness_filename);
+  sparkey_hash_close(&myhashreader);
+
+  verify_lookups(hash_filename, log_filename, num_keys, num_overwritten, num_live, 300);
+}
+
+void verify_compaction() {
+  for (int variant = 0; variant < 7; variant++) {
+    // variant 2 changes the compression, variant 3 runs in the background, variant 4 has no garbage,
+    // variants 5 and 6 move hot keys to the front
+    sparkey_compression_type t = variant % 2 ? SPARKEY_COMPRESSION_SNAPPY : SPARKEY_COMPRESSION_NONE;
+    int num_puts = variant == 4 ? 1000 : 1500;
+    int num_deletes = variant == 4 ? 0 : 100;
+    write_compaction_log(t, num_puts, num_deletes, 300);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+
+    sparkey_compaction_options options;
+    memset(&options, 0, sizeof(options));
+    if (variant == 2) {
+      options.set_compression = 1;
+      options.compression_type = SPARKEY_COMPRESSION_SNAPPY;
+      options.compression_block_size = 200;
+      t = SPARKEY_COMPRESSION_SNAPPY;
+    }
+    // deleted, missing and repeated keys are skipped
+    const char *hot_keys[] = {"key_7", "key_950", "key_3", "nokey", "key_3", "key_600"};
+    uint64_t hot_keylens[6];
+    for (int i = 0; i < 6; i++) {
+      hot_keylens[i] = strlen(hot_keys[i]);
+    }
+    // the bitmap of the previous variant is removed when compacting without one
+    options.liveness = variant != 5;
+    if (variant >= 5) {
+      options.num_hot_keys = 6;
+      options.hot_keys = (const uint8_t * const *) hot_keys;
+      options.hot_keylens = hot_keylens;
+    }
+    if (variant == 3) {
+      options.max_bytes_per_second = 1 << 30;
+      sparkey_compaction *job;
+      assert_equals(SPARKEY_SUCCESS, sparkey_compaction_start(&job, "test.spi", "test.spl", "test2.spi", "test2.spl", &options));
+      assert_equals(SPARKEY_SUCCESS, sparkey_compaction_wait(&job));
+      assert_equals(1, job == NULL);
+    } else {
+      assert_equals(SPARKEY_SUCCESS, sparkey_compact("test.spi", "test.spl", "test2.spi", "test2.spl", &options));
+    }
+    verify_compacted("test2.spi", "test2.spl", t, 1000, num_puts - 1000, 1000 - num_deletes);
+    assert_equals(options.liveness ? 0 : -1, access("test2.spb", F_OK));
+    if (variant >= 5) {
+      sparkey_logreader *myreader;
+      sparkey_logiter *myiter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open(&myreader, "test2.spl"));
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      const char *expected_keys[] = {"key_7", "key_3", "key_600", "key_500"};
+      for (int i = 0; i < 4; i++) {
+        char keybuf[100];
+        uint64_t keylen;
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(keybuf) - 1, (uint8_t*) keybuf, &keylen));
+        keybuf[keylen] = 0;
+        assert_str_equals(expected_keys[i], keybuf);
+      }
+      sparkey_logiter_close(&myiter);
+      sparkey_logreader_close(&myreader);
+    }
+  }
+
+  // A heavily throttled compaction can still be cancelled right away
+  static char value[1000];
+  memset(value, 'x', sizeof(value));
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  for (int i = 0; i < 1000; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, sizeof(value), (uint8_t*) value));
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+
+  sparkey_compaction_options options;
+  memset(&options, 0, sizeof(options));
+  options.max_bytes_per_second = 1;
+  sparkey_compaction *job;
+  remove("test2.spl");
+  assert_equals(SPARKEY_SUCCESS, sparkey_compaction_start(&job, "test.spi", "test.spl", "test2.spi", "test2.spl", &options));
+  sparkey_compaction_cancel(job);
+  assert_equals(SPARKEY_CANCELLED, sparkey_compaction_wait(&job));
+  assert_equals(-1, access("test2.spl", F_OK));
+
+  // Copying hot entries counts as progress, so it is throttled too
+  char hot_key_data[100][16];
+  const char *hot_keys[100];
+  uint64_t hot_keylens[100];
+  for (int i = 0; i < 100; i++) {
+    sprintf(hot_key_data[i], "key_%d", i);
+    hot_keys[i] = hot_key_data[i];
+    hot_keylens[i] = strlen(hot_keys[i]);
+  }
+  options.num_hot_keys = 100;
+  options.hot_keys = (const uint8_t * const *) hot_keys;
+  options.hot_keylens = hot_keylens;
+  assert_equals(SPARKEY_SUCCESS, sparkey_compaction_start(&job, "test.spi", "test.spl", "test2.spi", "test2.spl", &options));
+  uint64_t processed = 0;
+  uint64_t total = 0;
+  while (processed == 0) {
+    usleep(1000);
+    sparkey_compaction_progress(job, &processed, &total);
+  }
+  assert_equals(1, processed >= 64 * 1024 && processed < total);
+  sparkey_compaction_cancel(job);
+  assert_equals(SPARKEY_CANCELLED, sparkey_compaction_wait(&job));
+
+  // A liveness bitmap is only written when asked for, and only fits the hash file it was written with
+  write_segment("test1.spl", SPARKEY_COMPRESSION_NONE, 0, 10, 0);
+  remove("test1.spb");
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test1.spi", "test1.spl", 0));
+  assert_equals(-1, access("test1.spb", F_OK));
+  sparkey_hash_options hash_options;
+  memset(&hash_options, 0, sizeof(hash_options));
+  hash_options.liveness = 1;
+  const char *log_filename = "test1.spl";
+  // an up to date hash file still gets the bitmap it lacks
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test1.spi", 1, &log_filename, &hash_options));
+  assert_equals(0, access("test1.spb", F_OK));
+  log_filename = "test.spl";
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 1, &log_filename, &hash_options));
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  sparkey_liveiter *live;
+  assert_equals(SPARKEY_FILE_IDENTIFIER_MISMATCH, sparkey_liveiter_create_bitmap(&live, myhashreader, "test1.spb"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_liveiter_create_bitmap(&live, myhashreader, "test.spb"));
+  sparkey_liveiter_close(&live);
+  sparkey_hash_close(&myhashreader);
+}
+
+static int count_sorted(sparkey_sortediter *sortediter, sparkey_sortedreader *sorted, sparkey_logiter *myiter, const char *expected_prefix) {
+  sparkey_logreader *myreader = sparkey_sorted_getreader(sorted);
+  uint8_t prev[100];
+  uint64_t prevlen = 0;
+  int count = 0;
+  while (1) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_next(sortediter, sorted, myiter));
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      return count;
+    }
+    uint8_t keybuf[100];
+    uint64_t keylen;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(keybuf), keybuf, &keylen));
+    if (count > 0) {
+      uint64_t minlen = keylen < prevlen ? keylen : prevlen;
+      int cmp = memcmp(prev, keybuf, minlen);
+      assert_equals(1, cmp < 0 || (cmp == 0 && prevlen < keylen));
+    }
+    assert_equals(0, memcmp(expected_prefix, keybuf, strlen(expected_prefix)));
+    memcpy(prev, keybuf, keylen);
+    prevlen = keylen;
+    count++;
+  }
+}
+
+void verify_sorted_index() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_logwriter *mywriter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", t, 100));
+    // written in reverse order, with some keys overwritten and some deleted
+    for (int i = 499; i >= 0; i--) {
+      char key[100];
+      sprintf(key, "user_%03d_item_%d", i / 10, i % 10);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, 1, (uint8_t*) "a"));
+      if (i % 7 == 0) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, 1, (uint8_t*) "b"));
+      }
+    }
+    for (int i = 0; i < 10; i++) {
+      char key[100];
+      sprintf(key, "user_020_item_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_delete(mywriter, strlen(key), (uint8_t*) key));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sorted_write("test.sps", "test.spi", "test.spl"));
+
+    sparkey_sortedreader *sorted;
+    assert_equals(SPARKEY_SUCCESS, sparkey_sorted_open(&sorted, "test.sps", "test.spl"));
+    assert_equals(490, sparkey_sorted_numentries(sorted));
+    sparkey_logreader *myreader = sparkey_sorted_getreader(sorted);
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+    sparkey_sortediter *sortediter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_create(&sortediter, sorted));
+
+    assert_equals(490, count_sorted(sortediter, sorted, myiter, ""));
+
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_prefix(sortediter, sorted, (uint8_t*) "user_007_", 9));
+    assert_equals(10, count_sorted(sortediter, sorted, myiter, "user_007_"));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_prefix(sortediter, sorted, (uint8_t*) "user_020", 8));
+    assert_equals(0, count_sorted(sortediter, sorted, myiter, "user_020"));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_prefix(sortediter, sorted, (uint8_t*) "user_04", 7));
+    assert_equals(100, count_sorted(sortediter, sorted, myiter, "user_04"));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_prefix(sortediter, sorted, (uint8_t*) "\xff", 1));
+    assert_equals(0, count_sorted(sortediter, sorted, myiter, ""));
+
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_range(sortediter, sorted, (uint8_t*) "user_010", 8, (uint8_t*) "user_012_item_5", 15));
+    assert_equals(25, count_sorted(sortediter, sorted, myiter, "user_01"));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_range(sortediter, sorted, (uint8_t*) "user_049_item_9", 15, NULL, 0));
+    assert_equals(1, count_sorted(sortediter, sorted, myiter, "user_049_item_9"));
+
+    // values come from the latest put
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_prefix(sortediter, sorted, (uint8_t*) "user_000_item_7", 15));
+    assert_equals(SPARKEY_SUCCESS, sparkey_sortediter_next(sortediter, sorted, myiter));
+    assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+    uint8_t valuebuf[10];
+    uint64_t valuelen;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(valuebuf), valuebuf, &valuelen));
+    assert_equals(1, valuelen);
+    assert_equals('b', valuebuf[0]);
+
+    sparkey_sortediter_close(&sortediter);
+    sparkey_logiter_close(&myiter);
+    sparkey_sorted_close(&sorted);
+    assert_equals(1, sorted == NULL);
+  }
+}
+
+struct partition_scan {
+  sparkey_logreader *reader;
+  uint64_t start;
+  uint64_t end;
+  char *seen;
+  sparkey_returncode returncode;
+};
+
+static void * scan_partition(void *arg) {
+  struct partition_scan *scan = arg;
+  sparkey_logiter *myiter;
+  scan->returncode = sparkey_logiter_create(&myiter, scan->reader);
+  if (scan->returncode != SPARKEY_SUCCESS) {
+    return NULL;
+  }
+  scan->returncode = sparkey_logiter_range(myiter, scan->reader, scan->start, scan->end);
+  while (scan->returncode == SPARKEY_SUCCESS) {
+    scan->returncode = sparkey_logiter_next(myiter, scan->reader);
+    if (sparkey_logiter_state(myiter) != SPARKEY_ITER_ACTIVE) {
+      break;
+    }
+    char keybuf[100];
+    uint64_t keylen;
+    scan->returncode = sparkey_logiter_fill_key(myiter, scan->reader, sizeof(keybuf) - 1, (uint8_t*) keybuf, &keylen);
+    keybuf[keylen] = 0;
+    scan->seen[atoi(&keybuf[4])]++;
+  }
+  sparkey_logiter_close(&myiter);
+  return NULL;
+}
+
+void verify_partitions() {
+  static char value[350];
+  memset(value, 'x', sizeof(value));
+  for (sparkey_read_mode mode = SPARKEY_READ_MMAP; mode <= SPARKEY_READ_PREAD_DIRECT; mode++) {
+    for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
+      sparkey_logwriter *mywriter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", t, 100));
+      for (int i = 0; i < 1000; i++) {
+        char key[100];
+        sprintf(key, "key_%d", i);
+        // every 37th value spans several blocks
+        uint64_t valuelen = i % 37 == 0 ? sizeof(value) : (uint64_t) (i % 13);
+        assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, valuelen, (uint8_t*) value));
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+      sparkey_logreader *myreader;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open_mode(&myreader, "test.spl", mode));
+      uint64_t boundaries[9];
+      assert_equals(SPARKEY_INVALID_PARTITION_COUNT, sparkey_logreader_partition(myreader, 0, boundaries));
+      for (int n = 1; n <= 8; n++) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, n, boundaries));
+        struct partition_scan scans[8];
+        pthread_t threads[8];
+        static char seen[1000];
+        memset(seen, 0, sizeof(seen));
+        for (int i = 0; i < n; i++) {
+          assert_equals(1, boundaries[i] < boundaries[i + 1]);
+          scans[i].reader = myreader;
+          scans[i].start = boundaries[i];
+          scans[i].end = boundaries[i + 1];
+          scans[i].seen = seen;
+          scans[i].returncode = SPARKEY_SUCCESS;
+        }
+        if (n == 1) {
+          scan_partition(&scans[0]);
+        } else {
+          // each thread only touches the keys in its own range
+          for (int i = 0; i < n; i++) {
+            assert_equals(0, pthread_create(&threads[i], NULL, scan_partition, &scans[i]));
+          }
+          for (int i = 0; i < n; i++) {
+            assert_equals(0, pthread_join(threads[i], NULL));
+          }
+        }
+        for (int i = 0; i < n; i++) {
+          assert_equals(SPARKEY_SUCCESS, scans[i].returncode);
+        }
+        for (int i = 0; i < 1000; i++) {
+          assert_equals(1, seen[i]);
+        }
+      }
+      sparkey_logreader_close(&myreader);
+    }
+  }
+
+  // entries larger than a read window are jumped over when their value is not read,
+  // also when such an entry ends a segment and the next segment's header follows it
+  static char large[40000];
+  memset(large, 'y', sizeof(large));
+  const char *segments[] = {"test0.spl", "test1.spl"};
+  for (int k = 0; k < 2; k++) {
+    sparkey_logwriter *mywriter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, segments[k], SPARKEY_COMPRESSION_NONE, 0));
+    for (int i = 10 * k; i < 10 * k + 10; i++) {
+      char key[100];
+      sprintf(key, "key_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, i % 2 ? sizeof(large) : 5, (uint8_t*) large));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  }
+  for (sparkey_read_mode mode = SPARKEY_READ_MMAP; mode <= SPARKEY_READ_PREAD_DIRECT; mode++) {
+    sparkey_logreader *myreader;
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open_segments(&myreader, 2, segments, mode));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+    for (int i = 0; i < 20; i++) {
+      char key[100];
+      char actual[100];
+      uint64_t len;
+      sprintf(key, "key_%d", i);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+      assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, sizeof(actual), (uint8_t*) actual, &len));
+      assert_equals(strlen(key), len);
+      assert_equals(0, memcmp(key, actual, len));
+      if (i % 4 == 0) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, myreader, sizeof(actual), (uint8_t*) actual, &len));
+        assert_equals(5, len);
+        assert_equals(0, memcmp(large, actual, len));
+      }
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+    assert_equals(SPARKEY_ITER_CLOSED, sparkey_logiter_state(myiter));
+    sparkey_logiter_close(&myiter);
+
+    uint64_t boundaries[2];
+    struct partition_scan scan;
+    static char seen[1000];
+    memset(seen, 0, sizeof(seen));
+    assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, 1, boundaries));
+    scan.reader = myreader;
+    scan.start = boundaries[0];
+    scan.end = boundaries[1];
+    scan.seen = seen;
+    scan_partition(&scan);
+    assert_equals(SPARKEY_SUCCESS, scan.returncode);
+    for (int i = 0; i < 20; i++) {
+      assert_equals(1, seen[i]);
+    }
+    sparkey_logreader_close(&myreader);
+  }
+}
+
+/* Fills buf with the value of put i, at most 10000 bytes. */
+typedef void (*store_value)(char *buf, int i);
+
+/**
+ * Writes test.spl with num_puts puts of key_(i % num_keys), then builds and opens test.spi.
+ * value fills the value of each put, or is NULL for "value".
+ * If profile is set, it checks the compression time of the log writer and profiles the hash build.
+ */
+static sparkey_hashreader * open_store(sparkey_compression_type t, int num_puts, int num_keys, store_value value, sparkey_hash_build_profile *profile) {
+  static char buf[10001];
+  sparkey_logwriter *mywriter;
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", t, 100));
+  for (int i = 0; i < num_puts; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i % num_keys);
+    if (value != NULL) {
+      value(buf, i);
+    } else {
+      strcpy(buf, "value");
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(buf), (uint8_t*) buf));
+  }
+  if (profile != NULL) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_flush(mywriter));
+    assert_equals(t != SPARKEY_COMPRESSION_NONE, sparkey_logwriter_compression_ns(mywriter) > 0);
+  }
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+  const char *log_filename = "test.spl";
+  if (profile != NULL) {
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_profiled("test.spi", 1, &log_filename, 0, profile));
+  } else {
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+  }
+  sparkey_hashreader *myhashreader;
+  assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&myhashreader, "test.spi", "test.spl"));
+  return myhashreader;
+}
+
+static void trace_lookups(sparkey_hashreader *myhashreader, sparkey_logiter *myiter, int first, int count) {
+  for (int i = first; i < first + count; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, strlen(key), myiter));
+  }
+}
+
+void verify_tracing() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_hashreader *myhashreader = open_store(t, 200, 200, NULL, NULL);
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+    sparkey_trace_record records[512];
+    assert_equals(0, sparkey_hash_trace_read(myhashreader, records, 512));
+    assert_equals(SPARKEY_INVALID_TRACE_SETTINGS, sparkey_hash_trace_enable(myhashreader, 0, 256));
+    assert_equals(SPARKEY_INVALID_TRACE_SETTINGS, sparkey_hash_trace_enable(myhashreader, 1, 100));
+
+    // keys 200 and up are missing
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_enable(myhashreader, 1, 256));
+    trace_lookups(myhashreader, myiter, 150, 100);
+    assert_equals(100, sparkey_hash_trace_read(myhashreader, records, 512));
+    for (int i = 0; i < 100; i++) {
+      assert_equals(i < 50, (records[i].flags & SPARKEY_TRACE_FOUND) != 0);
+      assert_equals(1, records[i].probe_length >= 1);
+      assert_equals(1, records[i].slot < sparkey_hash_numentries(myhashreader) * 2);
+      if (i < 50) {
+        assert_equals(1, records[i].block_position > 0);
+      }
+    }
+    assert_equals(t != SPARKEY_COMPRESSION_NONE, (records[0].flags & SPARKEY_TRACE_DECOMPRESSED) != 0);
+    assert_equals(0, sparkey_hash_trace_read(myhashreader, records, 512));
+
+    // the oldest records are overwritten when the ring buffer is full
+    trace_lookups(myhashreader, myiter, 0, 300);
+    assert_equals(256, sparkey_hash_trace_read(myhashreader, records, 512));
+    assert_equals(44, sparkey_hash_trace_dropped(myhashreader));
+
+    // saving appends to the same file
+    remove("test.spt");
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_enable(myhashreader, 2, 256));
+    trace_lookups(myhashreader, myiter, 0, 100);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_save(myhashreader, "test.spt"));
+    trace_lookups(myhashreader, myiter, 0, 10);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_save(myhashreader, "test.spt"));
+    sparkey_trace_file trace;
+    assert_equals(SPARKEY_SUCCESS, sparkey_trace_load("test.spt", &trace));
+    assert_equals(55, trace.num_records);
+    assert_equals(1, trace.hash_capacity > 0 && trace.slot_size > 0);
+    for (uint64_t i = 0; i < trace.num_records; i++) {
+      assert_equals(SPARKEY_TRACE_FOUND, trace.records[i].flags & SPARKEY_TRACE_FOUND);
+    }
+    free(trace.records);
+    assert_equals(SPARKEY_TRACE_CORRUPT, sparkey_trace_load("test.spl", &trace));
+
+    // each reader counts its own lookups towards the sample interval
+    sparkey_hashreader *otherhashreader;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_open(&otherhashreader, "test.spi", "test.spl"));
+    sparkey_logiter *otheriter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&otheriter, sparkey_hash_getreader(otherhashreader)));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_enable(myhashreader, 2, 256));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_trace_enable(otherhashreader, 2, 256));
+    for (int i = 0; i < 10; i++) {
+      trace_lookups(myhashreader, myiter, i, 1);
+      trace_lookups(otherhashreader, otheriter, i, 1);
+    }
+    assert_equals(5, sparkey_hash_trace_read(myhashreader, records, 512));
+    assert_equals(5, sparkey_hash_trace_read(otherhashreader, records, 512));
+    sparkey_logiter_close(&otheriter);
+    sparkey_hash_close(&otherhashreader);
+
+    sparkey_hash_trace_disable(myhashreader);
+    trace_lookups(myhashreader, myiter, 0, 10);
+    assert_equals(0, sparkey_hash_trace_read(myhashreader, records, 512));
+    sparkey_logiter_close(&myiter);
+    sparkey_hash_close(&myhashreader);
+  }
+}
+
+struct stats_lookups {
+  sparkey_hashreader *reader;
+  sparkey_returncode returncode;
+};
+
+static void * stats_lookup_thread(void *arg) {
+  struct stats_lookups *lookups = arg;
+  sparkey_logiter *myiter;
+  lookups->returncode = sparkey_logiter_create(&myiter, sparkey_hash_getreader(lookups->reader));
+  for (int i = 0; i < 300 && lookups->returncode == SPARKEY_SUCCESS; i++) {
+    char key[100];
+    sprintf(key, "key_%d", i);
+    lookups->returncode = sparkey_hash_get(lookups->reader, (uint8_t*) key, strlen(key), myiter);
+  }
+  sparkey_logiter_close(&myiter);
+  return NULL;
+}
+
+void verify_stats() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_hashreader *myhashreader = open_store(t, 200, 200, NULL, NULL);
+    sparkey_hash_stats stats;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_snapshot(myhashreader, &stats));
+    assert_equals(0, stats.lookups);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_enable(myhashreader));
+
+    // 300 lookups per thread, of which the last 100 are misses
+    struct stats_lookups lookups[4];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+      lookups[i].reader = myhashreader;
+      assert_equals(0, pthread_create(&threads[i], NULL, stats_lookup_thread, &lookups[i]));
+    }
+    for (int i = 0; i < 4; i++) {
+      assert_equals(0, pthread_join(threads[i], NULL));
+      assert_equals(SPARKEY_SUCCESS, lookups[i].returncode);
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_snapshot(myhashreader, &stats));
+    assert_equals(1200, stats.lookups);
+    assert_equals(800, stats.hits);
+    assert_equals(400, stats.misses);
+    assert_equals(1, stats.probes >= stats.lookups);
+    assert_equals(1, stats.max_probe >= 1);
+    if (t == SPARKEY_COMPRESSION_NONE) {
+      assert_equals(0, stats.decompressions);
+      assert_equals(0, stats.block_cache_hits);
+    } else {
+      assert_equals(1, stats.decompressions > 0);
+      assert_equals(1, stats.decompressed_bytes >= stats.decompressions);
+      // with only a few dozen blocks, some lookups need the block read by the previous one
+      assert_equals(1, stats.block_cache_hits > 0);
+    }
+
+    sparkey_hash_stats_disable(myhashreader);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_snapshot(myhashreader, &stats));
+    assert_equals(0, stats.lookups);
+    sparkey_hash_close(&myhashreader);
+  }
+}
+
+void verify_latency() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_hashreader *myhashreader = open_store(t, 200, 200, NULL, NULL);
+    sparkey_logiter *myiter;
+    assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+    sparkey_latency_summary summary;
+    sparkey_returncode rc = sparkey_hash_latency_enable(myhashreader);
+    if (rc == SPARKEY_LATENCY_DISABLED) {
+      // configured with --disable-latency
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_latency_snapshot(myhashreader, SPARKEY_PHASE_TOTAL, &summary));
+      assert_equals(0, summary.count);
+    } else {
+      assert_equals(SPARKEY_SUCCESS, rc);
+      // keys 200 and up are missing, and most misses do not read the log
+      trace_lookups(myhashreader, myiter, 0, 300);
+      for (sparkey_lookup_phase phase = SPARKEY_PHASE_TOTAL; phase < SPARKEY_NUM_PHASES; phase++) {
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_latency_snapshot(myhashreader, phase, &summary));
+        assert_equals(1, summary.p50_ns <= summary.p90_ns);
+        assert_equals(1, summary.p90_ns <= summary.p99_ns);
+        assert_equals(1, summary.p99_ns <= summary.p999_ns);
+        assert_equals(1, summary.p999_ns <= summary.max_ns);
+        assert_equals(1, summary.mean_ns <= summary.max_ns);
+        if (phase == SPARKEY_PHASE_DECOMPRESS) {
+          assert_equals(t != SPARKEY_COMPRESSION_NONE, summary.count > 0);
+        } else if (phase == SPARKEY_PHASE_SEEK || phase == SPARKEY_PHASE_COMPARE) {
+          assert_equals(1, summary.count >= 200 && summary.count < 300);
+        } else {
+          assert_equals(300, summary.count);
+        }
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_latency_snapshot(myhashreader, SPARKEY_PHASE_TOTAL, &summary));
+      assert_equals(1, summary.max_ns > 0);
+      assert_equals(SPARKEY_INVALID_LOOKUP_PHASE, sparkey_hash_latency_snapshot(myhashreader, SPARKEY_NUM_PHASES, &summary));
+    }
+
+    sparkey_hash_latency_disable(myhashreader);
+    trace_lookups(myhashreader, myiter, 0, 10);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_latency_snapshot(myhashreader, SPARKEY_PHASE_TOTAL, &summary));
+    assert_equals(0, summary.count);
+    sparkey_logiter_close(&myiter);
+    sparkey_hash_close(&myhashreader);
+  }
+}
+
+static void async_value(char *buf, int i) {
+  if (i % 3 == 0) {
+    // larger than both the first read of an uncompressed entry and a compression block
+    for (int j = 0; j < 10000; j++) {
+      buf[j] = 'a' + (i + j) % 26;
+    }
+    buf[10000] = 0;
+  } else {
+    sprintf(buf, "value_%d", i);
+  }
+}
+
+void verify_async_large_values() {
+  static char value[10001];
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_hashreader *myhashreader = open_store(t, 60, 60, async_value, NULL);
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_enable(myhashreader));
+    sparkey_hash_async *async;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_create(&async, myhashreader, 2));
+
+    // two rounds, so that small entries are also read by slots that grew for a large one
+    int num_keys = 140;
+    int submitted = 0;
+    int completed = 0;
+    while (completed < num_keys) {
+      while (submitted < num_keys) {
+        char key[100];
+        sprintf(key, "key_%d", submitted % 70);
+        sparkey_returncode rc = sparkey_hash_async_submit(async, (uint8_t*) key, strlen(key), (void *) (intptr_t) (submitted % 70));
+        if (rc == SPARKEY_ASYNC_QUEUE_FULL) {
+          break;
+        }
+        assert_equals(SPARKEY_SUCCESS, rc);
+        submitted++;
+      }
+      sparkey_hash_async_result results[2];
+      int num_results;
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_poll(async, 1, 2, results, &num_results));
+      for (int j = 0; j < num_results; j++) {
+        int i = (int) (intptr_t) results[j].userdata;
+        assert_equals(SPARKEY_SUCCESS, results[j].returncode);
+        if (i >= 60) {
+          assert_equals(SPARKEY_ITER_INVALID, results[j].state);
+          continue;
+        }
+        assert_equals(SPARKEY_ITER_ACTIVE, results[j].state);
+        async_value(value, i);
+        assert_equals(strlen(value), results[j].valuelen);
+        assert_equals(0, memcmp(value, results[j].value, results[j].valuelen));
+      }
+      completed += num_results;
+    }
+    sparkey_hash_async_close(&async);
+
+    sparkey_hash_stats stats;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_stats_snapshot(myhashreader, &stats));
+    assert_equals(140, stats.lookups);
+    assert_equals(120, stats.hits);
+    assert_equals(20, stats.misses);
+    if (t == SPARKEY_COMPRESSION_NONE) {
+      assert_equals(0, stats.decompressions);
+    } else {
+      // each large value continues over many blocks
+      assert_equals(1, stats.decompressions > 40 * 10000 / 100);
+    }
+    sparkey_hash_close(&myhashreader);
+  }
+}
+
+void verify_build_profile() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    sparkey_hash_build_profile profile;
+    sparkey_hashreader *myhashreader = open_store(t, 300, 200, NULL, &profile);
+    assert_equals(300, profile.entries);
+    assert_equals(1, profile.table_bytes > 0);
+    assert_equals(0, profile.copy_ns);
+    assert_equals(t != SPARKEY_COMPRESSION_NONE, profile.decompress_ns > 0);
+    assert_equals(1, profile.hash_ns > 0 && profile.insert_ns > 0 && profile.write_ns > 0);
+    assert_equals(1, profile.read_ns + profile.decompress_ns + profile.hash_ns + profile.insert_ns +
+      profile.displacement_ns + profile.write_ns <= profile.total_ns);
+    assert_equals(200, sparkey_hash_numentries(myhashreader));
+    sparkey_hash_close(&myhashreader);
+  }
+}
+
+static void fixed_width_entry(char *key, char *value, int i) {
+  sprintf(key, "key_%04d", i);
+  sprintf(value, "value_%06d", i * 7);
+}
+
+void verify_fixed_width() {
+  sparkey_logwriter_options options;
+  memset(&options, 0, sizeof(options));
+  options.fixed_width = 1;
+  sparkey_logwriter *mywriter;
+  // invalid settings leave an existing file alone
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 3, (uint8_t*) "key", 5, (uint8_t*) "value"));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  assert_equals(SPARKEY_INVALID_FIXED_WIDTH, sparkey_logwriter_create_opts(&mywriter, "test.spl", SPARKEY_COMPRESSION_NONE, 0, &options));
+  options.fixed_key_len = 60;
+  options.fixed_value_len = 60;
+  assert_equals(SPARKEY_INVALID_FIXED_WIDTH, sparkey_logwriter_create_opts(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 100, &options));
+  assert_equals(SPARKEY_INVALID_COMPRESSION_BLOCK_SIZE, sparkey_logwriter_create_opts(&mywriter, "test.spl", SPARKEY_COMPRESSION_SNAPPY, 5, &options));
+  sparkey_logheader old_header;
+  assert_equals(SPARKEY_SUCCESS, sparkey_load_logheader(&old_header, "test.spl"));
+  assert_equals(1, old_header.num_puts);
+
+  options.fixed_key_len = 8;
+  options.fixed_value_len = 12;
+  for (sparkey_read_mode mode = SPARKEY_READ_MMAP; mode <= SPARKEY_READ_PREAD_DIRECT; mode++) {
+    for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
+      char key[16];
+      char value[16];
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create_opts(&mywriter, "test.spl", t, 110, &options));
+      assert_equals(SPARKEY_ENTRY_SIZE_MISMATCH, sparkey_logwriter_put(mywriter, 3, (uint8_t*) "key", 12, (uint8_t*) "value_000000"));
+      assert_equals(SPARKEY_FIXED_WIDTH_DELETE, sparkey_logwriter_delete(mywriter, 8, (uint8_t*) "key_0000"));
+      for (int i = 0; i < 400; i++) {
+        fixed_width_entry(key, value, i);
+        assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, 8, (uint8_t*) key, 12, (uint8_t*) value));
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+      // appending keeps the fixed width format
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_append(&mywriter, "test.spl"));
+      char keys[200][16];
+      char values[200][16];
+      sparkey_logwriter_entry entries[200];
+      for (int i = 0; i < 200; i++) {
+        fixed_width_entry(keys[i], values[i], 400 + i);
+        entries[i].key = (uint8_t*) keys[i];
+        entries[i].keylen = 8;
+        entries[i].value = (uint8_t*) values[i];
+        entries[i].valuelen = 12;
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put_batch(mywriter, 200, entries));
+      entries[0].keylen = 7;
+      assert_equals(SPARKEY_ENTRY_SIZE_MISMATCH, sparkey_logwriter_put_batch(mywriter, 1, entries));
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+
+      sparkey_logheader header;
+      assert_equals(SPARKEY_SUCCESS, sparkey_load_logheader(&header, "test.spl"));
+      assert_equals(600, header.num_puts);
+      assert_equals(600 * 20, header.put_size);
+      if (t == SPARKEY_COMPRESSION_NONE) {
+        assert_equals(92 + 600 * 20, header.data_end);
+      }
+
+      sparkey_logreader *myreader;
+      sparkey_logiter *myiter;
+      assert_equals(SPARKEY_SUCCESS, sparkey_logreader_open_mode(&myreader, "test.spl", mode));
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, myreader));
+      for (int i = 0; i < 600; i++) {
+        // skip over a few entries at a time, partly without reading them
+        if (i % 5 == 0 && i + 3 < 600) {
+          assert_equals(SPARKEY_SUCCESS, sparkey_logiter_skip(myiter, myreader, 3));
+          i += 2;
+        } else {
+          assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+        }
+        assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+        assert_equals(SPARKEY_ENTRY_PUT, sparkey_logiter_type(myiter));
+        char keybuf[16];
+        uint64_t keylen;
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_key(myiter, myreader, 4, (uint8_t*) keybuf, &keylen));
+        assert_equals(4, keylen);
+        fixed_width_entry(key, value, i);
+        assert_equals(0, memcmp(key, keybuf, 4));
+      }
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_next(myiter, myreader));
+      assert_equals(SPARKEY_ITER_CLOSED, sparkey_logiter_state(myiter));
+
+      uint64_t boundaries[6];
+      assert_equals(SPARKEY_SUCCESS, sparkey_logreader_partition(myreader, 5, boundaries));
+      static char seen[1000];
+      memset(seen, 0, sizeof(seen));
+      for (int i = 0; i < 5; i++) {
+        struct partition_scan scan;
+        scan.reader = myreader;
+        scan.start = boundaries[i];
+        scan.end = boundaries[i + 1];
+        scan.seen = seen;
+        scan.returncode = SPARKEY_SUCCESS;
+        scan_partition(&scan);
+        assert_equals(SPARKEY_SUCCESS, scan.returncode);
+      }
+      for (int i = 0; i < 600; i++) {
+        assert_equals(1, seen[i]);
+      }
+      sparkey_logiter_close(&myiter);
+      sparkey_logreader_close(&myreader);
+
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+      sparkey_hashreader *myhashreader;
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_open_mode(&myhashreader, "test.spi", "test.spl", mode));
+      assert_equals(SPARKEY_SUCCESS, sparkey_logiter_create(&myiter, sparkey_hash_getreader(myhashreader)));
+      sparkey_hash_async *async;
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_create(&async, myhashreader, 2));
+      for (int i = 0; i < 600; i++) {
+        fixed_width_entry(key, value, i);
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_get(myhashreader, (uint8_t*) key, 8, myiter));
+        assert_equals(SPARKEY_ITER_ACTIVE, sparkey_logiter_state(myiter));
+        char valuebuf[16];
+        uint64_t valuelen;
+        assert_equals(SPARKEY_SUCCESS, sparkey_logiter_fill_value(myiter, sparkey_hash_getreader(myhashreader), sizeof(valuebuf), (uint8_t*) valuebuf, &valuelen));
+        assert_equals(12, valuelen);
+        assert_equals(0, memcmp(value, valuebuf, 12));
+
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_submit(async, (uint8_t*) key, 8, NULL));
+        sparkey_hash_async_result result;
+        int num_results;
+        assert_equals(SPARKEY_SUCCESS, sparkey_hash_async_poll(async, 1, 1, &result, &num_results));
+        assert_equals(SPARKEY_ITER_ACTIVE, result.state);
+        assert_equals(12, result.valuelen);
+        assert_equals(0, memcmp(value, result.value, 12));
+      }
+      sparkey_hash_async_close(&async);
+      sparkey_logiter_close(&myiter);
+      sparkey_hash_close(&myhashreader);
+
+      // compaction keeps the fixed width format
+      assert_equals(SPARKEY_SUCCESS, sparkey_compact("test.spi", "test.spl", "test2.spi", "test2.spl", NULL));
+      assert_equals(SPARKEY_SUCCESS, sparkey_load_logheader(&header, "test2.spl"));
+      assert_equals(8, header.fixed_key_len);
+      assert_equals(12, header.fixed_value_len);
+      assert_equals(600 * 20, header.put_size);
+    }
+  }
+
+  // fixed width and variable width segments can not be combined
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_create(&mywriter, "test1.spl", SPARKEY_COMPRESSION_ZSTD, 110));
+  assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+  const char *segments[] = {"test.spl", "test1.spl"};
+  assert_equals(SPARKEY_SEGMENT_MISMATCH, sparkey_logwriter_merge("test3.spl", 2, segments));
+}
+
+void verify_inline_values() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    // inline records hold 16 bytes, so the large values are read from the log
+    write_compaction_log(t, 1200, 100, 40);
+    sparkey_logwriter *mywriter;
+    const char *log_filename = "test.spl";
+    sparkey_hash_options options;
+    memset(&options, 0, sizeof(options));
+    options.inline_size = 255;
+    assert_equals(SPARKEY_INLINE_SIZE_INVALID, sparkey_hash_write_opts("test.spi", 1, &log_filename, &options));
+    options.inline_size = 16;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 1, &log_filename, &options));
+    sparkey_hashheader header;
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test.spi"));
+    assert_equals(HASH_INLINE_MINOR_VERSION, header.minor_version);
+    assert_equals(16, header.inline_size);
+    // only the large values are read from the log, and the first 200 keys were overwritten
+    uint64_t decompressions = verify_lookups("test.spi", "test.spl", 1000, 200, 900, 40);
+    if (t == SPARKEY_COMPRESSION_SNAPPY) {
+      assert_equals(1, decompressions > 0 && decompressions < 400);
+    }
+
+    // extending the hash file keeps the inline size
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_append(&mywriter, "test.spl"));
+    for (int i = 900; i < 1000; i++) {
+      char key[100];
+      char value[100];
+      sprintf(key, "key_%d", i);
+      compaction_value(value, i, 40);
+      assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_put(mywriter, strlen(key), (uint8_t*) key, strlen(value), (uint8_t*) value));
+    }
+    assert_equals(SPARKEY_SUCCESS, sparkey_logwriter_close(&mywriter));
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 0));
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test.spi"));
+    assert_equals(16, header.inline_size);
+    // the inline records of the old hash file are copied along with their slots
+    decompressions = verify_lookups("test.spi", "test.spl", 1000, 200, 1000, 40);
+    if (t == SPARKEY_COMPRESSION_SNAPPY) {
+      assert_equals(1, decompressions > 0 && decompressions < 400);
+    }
+
+    // and so does compaction
+    assert_equals(SPARKEY_SUCCESS, sparkey_compact("test.spi", "test.spl", "test2.spi", "test2.spl", NULL));
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test2.spi"));
+    assert_equals(16, header.inline_size);
+    verify_lookups("test2.spi", "test2.spl", 1000, 200, 1000, 40);
+
+    options.inline_size = 0;
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 1, &log_filename, &options));
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test.spi"));
+    assert_equals(1, header.minor_version);
+    assert_equals(0, header.inline_size);
+    verify_lookups("test.spi", "test.spl", 1000, 200, 1000, 40);
+  }
+}
+
+void verify_fingerprints() {
+  for (sparkey_compression_type t = SPARKEY_COMPRESSION_NONE; t <= SPARKEY_COMPRESSION_SNAPPY; t++) {
+    // inline records hold 16 bytes, so the large values are read from the log
+    write_compaction_log(t, 1200, 100, 40);
+    const char *log_filename = "test.spl";
+    sparkey_hash_options options;
+    memset(&options, 0, sizeof(options));
+    options.fingerprint_size = 5;
+    assert_equals(SPARKEY_FINGERPRINT_SIZE_INVALID, sparkey_hash_write_opts("test.spi", 1, &log_filename, &options));
+    sparkey_hashheader header;
+    for (uint32_t size = 1; size <= 4; size++) {
+      options.fingerprint_size = size;
+      options.inline_size = size == 2 ? 16 : 0;
+      assert_equals(SPARKEY_SUCCESS, sparkey_hash_write_opts("test.spi", 1, &log_filename, &options));
+      assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test.spi"));
+      assert_equals(HASH_FINGERPRINT_MINOR_VERSION, header.minor_version);
+      assert_equals(size, header.fingerprint_size);
+      assert_equals(options.inline_size, header.inline_size);
+      verify_lookups("test.spi", "test.spl", 1000, 200, 900, 40);
+    }
+
+    // rebuilding and compaction keep the fingerprints
+    assert_equals(SPARKEY_SUCCESS, sparkey_hash_write("test.spi", "test.spl", 4));
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test.spi"));
+    assert_equals(4, header.fingerprint_size);
+    assert_equals(SPARKEY_SUCCESS, sparkey_compact("test.spi", "test.spl", "test2.spi", "test2.spl", NULL));
+    assert_equals(SPARKEY_SUCCESS, sparkey_load_hashheader(&header, "test2.spi"));
+    assert_equals(4, header.fingerprint_size);
+    verify_lookups("test2.spi", "test2.spl", 1000, 200, 900, 40);
+
+    // with every fingerprint wrong, no key is found and the log is never read
+    uint64_t size = header.hash_capacity * header.fingerprint_size;
+    uint8_t *fingerprints = malloc(size);
+    FILE *fp = fopen("test2.spi", "r+");
+    assert_equals(0, fseek(fp, header.header_size + header.hash_capacity * (header.hash_size + header.address_size), SEEK_SET));
+    assert_equals(size, fread(fingerprints, 1, size, fp));
+    for (uint64_t i = 0; i < size; i++) {
+      fingerprints[i] ^= 0xff;
+    }
+    assert_equals(0, fseek(fp, header.header_size + header.hash_capacity * (header.hash_size + header.address_size), SEEK_SET));
+    assert_equals(size, fwrite(fingerprints, 1, size, fp));
+    fclose(fp);
+    free(fingerprints);
+    assert_equals(0, verify_lookups("test2.spi", "test2.spl", 1000, 0, 0, 40));
+  }
+}
+
 void verify_files_closed() {
   // Verify that SPARKEY_FILE_IDENTIFIER_MISMATCH is returned appropriately.
   sparkey_logwriter *writer;
@@ -257,27 +1689,45 @@ void verify_files_closed() {
 }
 
 int main() {
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 0, 0, 0);
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 1, 0, 0);
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 100, 0, 0);
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 0, 100, 0);
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 0, 0, 100);
-  verify(SPARKEY_COMPRESSION_NONE, 0, 0, 100, 10, 5);
+  for (sparkey_read_mode mode = SPARKEY_READ_MMAP; mode <= SPARKEY_READ_PREAD_DIRECT; mode++) {
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 0, 0, 0);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 1, 0, 0);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 100, 0, 0);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 0, 100, 0);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 0, 0, 100);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 100, 10, 5);
+    verify(mode, SPARKEY_COMPRESSION_NONE, 0, 0, 2000, 100, 50);
 
-  for (sparkey_compression_type t = SPARKEY_COMPRESSION_SNAPPY; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
-    verify(t, 10, 0, 100, 0, 0);
-    verify(t, 20, 0, 100, 0, 0);
-    verify(t, 100, 0, 100, 0, 0);
-    verify(t, 100, 0, 1000, 0, 0);
-    verify(t, 1000, 0, 1000, 0, 0);
+    for (sparkey_compression_type t = SPARKEY_COMPRESSION_SNAPPY; t <= SPARKEY_COMPRESSION_ZSTD; t++) {
+      verify(mode, t, 10, 0, 100, 0, 0);
+      verify(mode, t, 20, 0, 100, 0, 0);
+      verify(mode, t, 100, 0, 100, 0, 0);
+      verify(mode, t, 100, 0, 1000, 0, 0);
+      verify(mode, t, 1000, 0, 1000, 0, 0);
 
-    verify(t, 100, 0, 1000, 100, 0);
-    verify(t, 100, 0, 1000, 100, 50);
+      verify(mode, t, 100, 0, 1000, 100, 0);
+      verify(mode, t, 100, 0, 1000, 100, 50);
 
-    verify(t, 100, 4, 1000, 0, 0);
-    verify(t, 100, 8, 1000, 0, 0);
+      verify(mode, t, 100, 4, 1000, 0, 0);
+      verify(mode, t, 100, 8, 1000, 0, 0);
+    }
   }
 
+  verify_write_modes();
+  verify_put_batch();
+  verify_sharded_writer();
+  verify_segments();
+  verify_compaction();
+  verify_sorted_index();
+  verify_partitions();
+  verify_tracing();
+  verify_stats();
+  verify_latency();
+  verify_async_large_values();
+  verify_build_profile();
+  verify_fixed_width();
+  verify_inline_values();
+  verify_fingerprints();
   verify_files_closed();
 
   printf("Success!\n");
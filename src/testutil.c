@@ -13,6 +13,7 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <inttypes.h>
 
@@ -41,6 +42,9 @@ int main() {
   assert_equals(NULL, sparkey_create_log_filename(".spx"));
   assert_equals("foo.spl", sparkey_create_log_filename("foo.spi"));
 
+  assert_equals(NULL, sparkey_create_liveness_filename("foo.spl"));
+  assert_equals("foo.spb", sparkey_create_liveness_filename("foo.spi"));
+
   printf("Success!\n");
 }
 
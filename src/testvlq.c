@@ -13,11 +13,12 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
 
-#include "logreader.c"
-#include "logwriter.c"
+#include "vlq.h"
 
 void assert_equals(int64_t expected, int64_t actual) {
   if (expected != actual) {
@@ -41,6 +42,24 @@ int main() {
     }
   }
 
+  // The bounded decoder must ignore whatever follows the value, and not read past the end
+  for (int i = 0; i < 64; i++) {
+    for (int64_t j = -1; j <= 1; j++) {
+      uint64_t val = (1ULL << i) + j;
+      for (int offset = 0; offset < 3; offset++) {
+        memset(buf, 0xff, sizeof(buf));
+        uint64_t written = write_vlq(&buf[offset], val);
+        uint64_t ends[] = {offset + written, sizeof(buf)};
+        for (int e = 0; e < 2; e++) {
+          uint64_t pos = offset;
+          uint64_t val2 = read_vlq_bounded(buf, &pos, ends[e]);
+          assert_equals(offset + written, pos);
+          assert_equals(val, val2);
+        }
+      }
+    }
+  }
+
   assert_equals(1, write_vlq(buf, 0));
   assert_equals(1, write_vlq(buf, 127));
   assert_equals(2, write_vlq(buf, 128));
@@ -0,0 +1,260 @@
+/*
+* Copyright (c) 2026 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "sparkey.h"
+#include "sparkey-internal.h"
+#include "endiantools.h"
+#include "util.h"
+
+/*
+ * Trace file layout:
+ * - A header with the magic number, the version, the slot size, the hash capacity and the log size.
+ * - Records of TRACE_RECORD_SIZE bytes: slot, block position, probe length and flags.
+ * Saving to an existing file appends more records.
+ */
+#define TRACE_MAGIC_NUMBER (0x7ace0b17)
+#define TRACE_VERSION (1)
+#define TRACE_HEADER_SIZE (32)
+#define TRACE_RECORD_SIZE (24)
+
+/* Records are drained from the ring buffer in batches of this size */
+#define TRACE_BATCH_SIZE (1024)
+
+/*
+ * The sampling countdowns are spread over shards like the statistics counters, one cache line each,
+ * so that each reader samples every sample_interval:th lookup of each thread without a shared counter.
+ */
+#define TRACE_SHARDS (64)
+#define CACHE_LINE_SIZE (64)
+
+typedef struct {
+  // index + 1 of the record in the slot, 0 while it is being written
+  uint64_t seq;
+  sparkey_trace_record record;
+} trace_slot;
+
+struct sparkey_trace {
+  uint32_t sample_interval;
+  uint64_t mask;
+  trace_slot *slots;
+  // lookups left until the next sample, per shard of threads
+  uint32_t *countdowns;
+  // the number of records ever added, only updated atomically
+  uint64_t head;
+  // the next record to read
+  uint64_t tail;
+  uint64_t dropped;
+};
+
+sparkey_returncode sparkey_hash_trace_enable(sparkey_hashreader *reader, uint32_t sample_interval, uint32_t capacity) {
+  if (reader->open_status == 0) {
+    return SPARKEY_HASH_CLOSED;
+  }
+  if (sample_interval == 0 || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return SPARKEY_INVALID_TRACE_SETTINGS;
+  }
+  sparkey_trace *trace = malloc(sizeof(sparkey_trace));
+  if (trace == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  trace->slots = calloc(capacity, sizeof(trace_slot));
+  void *countdowns;
+  if (trace->slots == NULL || posix_memalign(&countdowns, CACHE_LINE_SIZE, TRACE_SHARDS * CACHE_LINE_SIZE) != 0) {
+    free(trace->slots);
+    free(trace);
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  memset(countdowns, 0, TRACE_SHARDS * CACHE_LINE_SIZE);
+  trace->countdowns = countdowns;
+  trace->sample_interval = sample_interval;
+  trace->mask = capacity - 1;
+  trace->head = 0;
+  trace->tail = 0;
+  trace->dropped = 0;
+  sparkey_trace_free(reader->trace);
+  reader->trace = trace;
+  return SPARKEY_SUCCESS;
+}
+
+void sparkey_hash_trace_disable(sparkey_hashreader *reader) {
+  sparkey_trace_free(reader->trace);
+  reader->trace = NULL;
+}
+
+void sparkey_trace_free(sparkey_trace *trace) {
+  if (trace != NULL) {
+    free(trace->slots);
+    free(trace->countdowns);
+    free(trace);
+  }
+}
+
+void sparkey_trace_lookup(sparkey_trace *trace, const sparkey_lookup_info *info) {
+  uint32_t *countdown = (uint32_t *) ((uint8_t *) trace->countdowns + (sparkey_thread_number() % TRACE_SHARDS) * CACHE_LINE_SIZE);
+  uint32_t left = __atomic_load_n(countdown, __ATOMIC_RELAXED);
+  if (left > 1) {
+    __atomic_store_n(countdown, left - 1, __ATOMIC_RELAXED);
+    return;
+  }
+  __atomic_store_n(countdown, trace->sample_interval, __ATOMIC_RELAXED);
+
+  uint64_t index = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+  trace_slot *slot = &trace->slots[index & trace->mask];
+  __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  slot->record.slot = info->slot;
+  slot->record.block_position = info->block_position;
+  slot->record.probe_length = info->probe_length;
+  slot->record.flags = (info->found ? SPARKEY_TRACE_FOUND : 0) | (info->decompressions > 0 ? SPARKEY_TRACE_DECOMPRESSED : 0);
+  __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t sparkey_hash_trace_read(sparkey_hashreader *reader, sparkey_trace_record *records, uint64_t max_records) {
+  sparkey_trace *trace = reader->trace;
+  if (trace == NULL) {
+    return 0;
+  }
+  uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+  uint64_t capacity = trace->mask + 1;
+  if (head - trace->tail > capacity) {
+    // The oldest records have already been overwritten
+    trace->dropped += head - trace->tail - capacity;
+    trace->tail = head - capacity;
+  }
+  uint64_t n = 0;
+  while (n < max_records && trace->tail < head) {
+    uint64_t index = trace->tail;
+    trace_slot *slot = &trace->slots[index & trace->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1) {
+      // Still being written, or overwritten by a newer record
+      break;
+    }
+    records[n] = slot->record;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    trace->tail++;
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != index + 1) {
+      trace->dropped++;
+      continue;
+    }
+    n++;
+  }
+  return n;
+}
+
+uint64_t sparkey_hash_trace_dropped(sparkey_hashreader *reader) {
+  return reader->trace == NULL ? 0 : reader->trace->dropped;
+}
+
+sparkey_returncode sparkey_hash_trace_save(sparkey_hashreader *reader, const char *filename) {
+  if (reader->trace == NULL) {
+    return SPARKEY_INVALID_TRACE_SETTINGS;
+  }
+  int fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 00644);
+  if (fd < 0) {
+    return sparkey_create_returncode(errno);
+  }
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  struct stat s;
+  if (fstat(fd, &s) < 0) {
+    TRY(SPARKEY_INTERNAL_ERROR, close_fd);
+  }
+  if (s.st_size == 0) {
+    uint8_t header[TRACE_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    write_little_endian32(&header[0], TRACE_MAGIC_NUMBER);
+    write_little_endian32(&header[4], TRACE_VERSION);
+    write_little_endian32(&header[8], reader->header.address_size + reader->header.hash_size);
+    write_little_endian32(&header[12], reader->header.entry_block_bits);
+    write_little_endian64(&header[16], reader->header.hash_capacity);
+    write_little_endian64(&header[24], reader->header.data_end);
+    TRY(write_full(fd, header, sizeof(header)), close_fd);
+  }
+
+  sparkey_trace_record records[TRACE_BATCH_SIZE];
+  uint8_t buf[TRACE_BATCH_SIZE * TRACE_RECORD_SIZE];
+  uint64_t n;
+  while ((n = sparkey_hash_trace_read(reader, records, TRACE_BATCH_SIZE)) > 0) {
+    for (uint64_t i = 0; i < n; i++) {
+      uint8_t *p = &buf[i * TRACE_RECORD_SIZE];
+      write_little_endian64(&p[0], records[i].slot);
+      write_little_endian64(&p[8], records[i].block_position);
+      write_little_endian32(&p[16], records[i].probe_length);
+      write_little_endian32(&p[20], records[i].flags);
+    }
+    TRY(write_full(fd, buf, n * TRACE_RECORD_SIZE), close_fd);
+  }
+
+close_fd:
+  close(fd);
+  return returncode;
+}
+
+sparkey_returncode sparkey_trace_load(const char *filename, sparkey_trace_file *file) {
+  FILE *fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    return sparkey_open_returncode(errno);
+  }
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  file->records = NULL;
+  uint8_t header[TRACE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header)) {
+    TRY(SPARKEY_TRACE_CORRUPT, close_fp);
+  }
+  if (read_little_endian32(header, 0) != TRACE_MAGIC_NUMBER || read_little_endian32(header, 4) != TRACE_VERSION) {
+    TRY(SPARKEY_TRACE_CORRUPT, close_fp);
+  }
+  file->slot_size = read_little_endian32(header, 8);
+  file->entry_block_bits = read_little_endian32(header, 12);
+  file->hash_capacity = read_little_endian64(header, 16);
+  file->data_end = read_little_endian64(header, 24);
+
+  uint64_t capacity = 1024;
+  file->num_records = 0;
+  file->records = malloc(capacity * sizeof(sparkey_trace_record));
+  uint8_t p[TRACE_RECORD_SIZE];
+  while (file->records != NULL && fread(p, 1, sizeof(p), fp) == sizeof(p)) {
+    if (file->num_records == capacity) {
+      capacity *= 2;
+      sparkey_trace_record *grown = realloc(file->records, capacity * sizeof(sparkey_trace_record));
+      if (grown == NULL) {
+        TRY(SPARKEY_INTERNAL_ERROR, close_fp);
+      }
+      file->records = grown;
+    }
+    sparkey_trace_record *r = &file->records[file->num_records++];
+    r->slot = read_little_endian64(p, 0);
+    r->block_position = read_little_endian64(p, 8);
+    r->probe_length = read_little_endian32(p, 16);
+    r->flags = read_little_endian32(p, 20);
+  }
+  if (file->records == NULL) {
+    TRY(SPARKEY_INTERNAL_ERROR, close_fp);
+  }
+
+close_fp:
+  fclose(fp);
+  if (returncode != SPARKEY_SUCCESS) {
+    free(file->records);
+    file->records = NULL;
+  }
+  return returncode;
+}
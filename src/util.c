@@ -13,15 +13,38 @@
 * License for the specific language governing permissions and limitations under
 * the License.
 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 
 #include "util.h"
 #include "sparkey.h"
+#include "endiantools.h"
 
 #include <stdlib.h>
 #include <errno.h>
 
+#define COPY_BUFFER_SIZE (1024*1024)
+
+int sparkey_open_direct(const char *filename, int flags) {
+#ifdef O_DIRECT
+  int fd = open(filename, flags | O_DIRECT);
+  if (fd >= 0 || errno != EINVAL) {
+    return fd;
+  }
+  // The filesystem does not support O_DIRECT (e.g. tmpfs), use the page cache instead.
+  return open(filename, flags);
+#else
+  int fd = open(filename, flags);
+#ifdef F_NOCACHE
+  if (fd >= 0) {
+    fcntl(fd, F_NOCACHE, 1);
+  }
+#endif
+  return fd;
+#endif
+}
+
 sparkey_returncode sparkey_open_returncode(int e) {
   switch (e) {
   case EPERM:
@@ -93,3 +116,54 @@ char * sparkey_create_log_filename(const char *index_filename) {
 char * sparkey_create_index_filename(const char *log_filename) {
   return _create_filename(log_filename, ".spl", 'i');
 }
+
+char * sparkey_create_liveness_filename(const char *index_filename) {
+  return _create_filename(index_filename, ".spi", 'b');
+}
+
+sparkey_returncode sparkey_copy_range(int in_fd, int out_fd, uint64_t offset, uint64_t len) {
+#ifdef HAVE_COPY_FILE_RANGE
+  // Lets the filesystem clone or copy the data without a round trip through user space
+  loff_t in_offset = offset;
+  while (len > 0) {
+    ssize_t actual = copy_file_range(in_fd, &in_offset, out_fd, NULL, len, 0);
+    if (actual <= 0) {
+      if (actual < 0 && errno == EINTR) {
+        continue;
+      }
+      // Not supported here, e.g. across filesystems on older kernels. Copy the rest by hand.
+      break;
+    }
+    len -= actual;
+  }
+  offset = in_offset;
+#endif
+  if (len == 0) {
+    return SPARKEY_SUCCESS;
+  }
+
+  uint8_t *buf = malloc(COPY_BUFFER_SIZE);
+  if (buf == NULL) {
+    return SPARKEY_INTERNAL_ERROR;
+  }
+  sparkey_returncode returncode = SPARKEY_SUCCESS;
+  while (len > 0) {
+    size_t wanted = len < COPY_BUFFER_SIZE ? len : COPY_BUFFER_SIZE;
+    ssize_t actual = pread(in_fd, buf, wanted, offset);
+    if (actual < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      TRY(SPARKEY_INTERNAL_ERROR, done);
+    }
+    if (actual == 0) {
+      TRY(SPARKEY_UNEXPECTED_EOF, done);
+    }
+    TRY(write_full(out_fd, buf, actual), done);
+    offset += actual;
+    len -= actual;
+  }
+done:
+  free(buf);
+  return returncode;
+}
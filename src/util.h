@@ -23,6 +23,11 @@
 
 #include "sparkey.h"
 
+/**
+ * Offset, length and memory alignment used for O_DIRECT I/O.
+ */
+#define SPARKEY_DIRECT_IO_ALIGNMENT (4096)
+
 /**
  * This macro sort of behaves like a new keyword.
  * Input must be an expression that returns sparkey_returncode.
@@ -40,6 +45,24 @@
  */
 #define TRY(f, label) do { returncode = (f); if (returncode != SPARKEY_SUCCESS) goto label; } while (0);
 
+/**
+ * Opens an existing file, bypassing the page cache where the platform and filesystem support it.
+ * Falls back to a regular open when O_DIRECT is rejected.
+ * Reads and writes through O_DIRECT descriptors must use aligned offsets, lengths and buffers,
+ * see SPARKEY_DIRECT_IO_ALIGNMENT.
+ * @param filename the file to open.
+ * @param flags flags passed to open, such as O_RDONLY or O_WRONLY.
+ * @returns a file descriptor, or -1 with errno set.
+ */
+int sparkey_open_direct(const char *filename, int flags);
+
+/**
+ * Appends len bytes starting at offset in in_fd to the current position of out_fd.
+ * Uses copy_file_range where available, which lets the filesystem share or copy the data in the kernel.
+ * @returns SPARKEY_SUCCESS if all goes well.
+ */
+sparkey_returncode sparkey_copy_range(int in_fd, int out_fd, uint64_t offset, uint64_t len);
+
 /**
  * Convert error codes generated by open and fopen into sparkey return codes.
  * @param e an error code
@@ -0,0 +1,115 @@
+/*
+* Copyright (c) 2012-2013 Spotify AB
+*
+* Licensed under the Apache License, Version 2.0 (the "License"); you may not
+* use this file except in compliance with the License. You may obtain a copy of
+* the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+* WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+* License for the specific language governing permissions and limitations under
+* the License.
+*/
+#ifndef SPARKEY_VLQ_H_INCLUDED
+#define SPARKEY_VLQ_H_INCLUDED
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Encodes value as an unsigned VLQ into buf.
+ * @param buf a buffer with room for at least 10 bytes.
+ * @param value the value to encode.
+ * @returns the number of bytes written.
+ */
+static inline int write_vlq(uint8_t *buf, uint64_t value) {
+  int count = 1;
+  while (value >= 1 << 7) {
+    *buf = (value & 0x7f) | 0x80;
+    value >>= 7;
+    count++;
+    buf++;
+  }
+  *buf = value;
+  return count;
+}
+
+/**
+ * Decodes an unsigned VLQ from array, starting at *position.
+ * @param array the data to decode from.
+ * @param position offset into array. Is advanced past the decoded value.
+ * @returns the decoded value.
+ */
+static inline uint64_t read_vlq(uint8_t * array, uint64_t *position) {
+  const uint8_t *p = &array[*position];
+  // Most lengths fit in one or two bytes
+  if (p[0] < 0x80) {
+    *position += 1;
+    return p[0];
+  }
+  if (p[1] < 0x80) {
+    *position += 2;
+    return (p[0] & 0x7f) | (uint64_t) p[1] << 7;
+  }
+  uint64_t res = 0;
+  uint64_t shift = 0;
+  uint64_t tmp, tmp2;
+  while (1) {
+    tmp = array[(*position)++];
+    tmp2 = tmp & 0x7f;
+    if (tmp == tmp2) {
+      return res | tmp << shift;
+    }
+    res |= tmp2 << shift;
+    shift += 7;
+  }
+  return res;
+}
+
+/**
+ * Decodes an unsigned VLQ like read_vlq, but decodes values of three to eight bytes
+ * from a single 64 bit load instead of one byte at a time, without data dependent branches.
+ * Near the end of the array it falls back to read_vlq.
+ * @param array the data to decode from.
+ * @param position offset into array. Is advanced past the decoded value.
+ * @param end the size of array. For valid data, bytes at end and beyond are never read.
+ * @returns the decoded value.
+ */
+static inline uint64_t read_vlq_bounded(uint8_t * array, uint64_t *position, uint64_t end) {
+  const uint8_t *p = &array[*position];
+  if (p[0] < 0x80) {
+    *position += 1;
+    return p[0];
+  }
+  if (p[1] < 0x80) {
+    *position += 2;
+    return (p[0] & 0x7f) | (uint64_t) p[1] << 7;
+  }
+  if (end - *position < 8) {
+    return read_vlq(array, position);
+  }
+  uint64_t x;
+  memcpy(&x, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  x = __builtin_bswap64(x);
+#endif
+  // The first byte without the continuation bit is the last byte of the value
+  uint64_t stops = ~x & 0x8080808080808080ULL;
+  if (stops == 0) {
+    return read_vlq(array, position);
+  }
+  int bits = __builtin_ctzll(stops) + 1;
+  *position += bits >> 3;
+  x &= ~0ULL >> (64 - bits);
+  x &= 0x7f7f7f7f7f7f7f7fULL;
+  // Pack the 7 bit groups together, pairwise
+  x = ((x & 0x7f007f007f007f00ULL) >> 1) | (x & 0x007f007f007f007fULL);
+  x = ((x & 0x3fff00003fff0000ULL) >> 2) | (x & 0x00003fff00003fffULL);
+  x = ((x & 0x0fffffff00000000ULL) >> 4) | (x & 0x000000000fffffffULL);
+  return x;
+}
+
+#endif